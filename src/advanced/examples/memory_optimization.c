@@ -13,35 +13,100 @@
 
 /* メモリプールのブロックサイズ */
 #define POOL_BLOCK_SIZE 1024
-#define MAX_POOL_BLOCKS 10
 #define SMALL_OBJECT_SIZE 64
 #define MEDIUM_OBJECT_SIZE 256
+#define POOL_ALIGNMENT 16           /* データ領域の配置境界 */
+#define POOL_CHUNK_SIZE (64 * 1024) /* 足りなくなったときに追加するチャンクの最小サイズ */
 
-/* メモリプール構造体 */
+#define POOL_ALIGN(n) (((n) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1))
+
+/* メモリプールのブロックヘッダー（境界タグ）
+ * 直前のブロックのサイズを持つので、解放時に前後どちらの隣とも O(1) で結合できる。
+ * size の最下位ビットは使用中フラグ（サイズは POOL_ALIGNMENT の倍数） */
 typedef struct MemoryBlock
 {
-    void *data;
-    size_t size;
-    int is_free;
-    struct MemoryBlock *next;
+    size_t prev_size;           /* 物理的に直前のブロックのサイズ（先頭なら0） */
+    size_t size;                /* ヘッダー込みのサイズ | BLOCK_USED */
 } MemoryBlock;
 
+#define BLOCK_USED ((size_t)1)
+#define BLOCK_HEADER_SIZE POOL_ALIGN(sizeof(MemoryBlock))
+
+/* 空きブロックの索引（データ領域に置く）
+ * 小さいブロックはサイズごとのビン（双方向リスト、left/right を前後に使う）、
+ * 大きいブロックは (サイズ, アドレス) 順の二分探索木に入れる。
+ * 木は優先度をアドレスから作るトリープにして深さを O(log n) に保つ */
+typedef struct FreeNode
+{
+    struct FreeNode *left;
+    struct FreeNode *right;
+    unsigned long priority;
+} FreeNode;
+
+#define BLOCK_MIN_SIZE POOL_ALIGN(BLOCK_HEADER_SIZE + sizeof(FreeNode))
+#define SMALL_BIN_COUNT 32          /* ビンの数（unsigned long の32ビットで空きを表す） */
+#define SMALL_BIN_LIMIT (SMALL_BIN_COUNT * POOL_ALIGNMENT) /* これ未満のブロックはビンへ */
+
+/* プールに追加したチャンク（末尾は大きさ0の使用中ブロックで止める）
+ * 全体が1つの空きブロックに戻ったチャンクは、予備の1個を残してOSへ返す */
+typedef struct MemoryChunk
+{
+    struct MemoryChunk *next;
+    struct MemoryChunk *prev;
+    size_t size;
+} MemoryChunk;
+
+#define CHUNK_HEADER_SIZE POOL_ALIGN(sizeof(MemoryChunk))
+
 typedef struct
 {
-    MemoryBlock *blocks;
-    size_t total_size;
-    size_t used_size;
-    int num_blocks;
+    MemoryChunk *chunks;        /* 確保したチャンクの一覧 */
+    FreeNode *small_bins[SMALL_BIN_COUNT]; /* サイズ i * POOL_ALIGNMENT の空きブロック */
+    unsigned long small_map;    /* ビット i は small_bins[i] が空でないこと */
+    FreeNode *free_tree;        /* 大きい空きブロックの木 */
+    size_t total_size;          /* 全チャンクのブロック領域の合計 */
+    size_t used_size;           /* 使用中ブロックのデータ領域の合計 */
+    int num_blocks;             /* ブロック数（使用中と空き） */
+    int num_free;               /* 空きブロック数 */
+    int num_chunks;             /* チャンク数 */
+    int empty_chunks;           /* 全体が空きのチャンク数（予備として残すのは1個まで） */
+    int verbose;                /* 解放ごとのログ（ベンチマークでは止める） */
 } MemoryPool;
 
-/* スタックアロケーター */
+/* スタックアロケーター（アリーナ）
+ * チャンクを連結して伸び、マーカーで入れ子のスコープを戻せる。
+ * reuse_chunks なら巻き戻し・リセット後もチャンクを残して次の割り当てに使う */
+#define STACK_DEFAULT_ALIGNMENT 8
+
+typedef struct StackChunk
+{
+    struct StackChunk *next;    /* 次のチャンク（割り当て順） */
+    size_t size;                /* データ領域のサイズ */
+} StackChunk;
+
+#define STACK_CHUNK_HEADER_SIZE POOL_ALIGN(sizeof(StackChunk))
+#define STACK_CHUNK_DATA(chunk) ((char *)(chunk) + STACK_CHUNK_HEADER_SIZE)
+
 typedef struct
 {
-    char *memory;
-    size_t size;
-    size_t offset;
+    StackChunk *first;          /* 最初のチャンク（リセットでここに戻る） */
+    StackChunk *current;        /* 割り当て中のチャンク */
+    char *memory;               /* current のデータ領域 */
+    size_t size;                /* current のデータ領域のサイズ */
+    size_t offset;              /* current 内の使用済みバイト数 */
+    size_t chunk_size;          /* 新しいチャンクの標準サイズ */
+    size_t total_size;          /* 全チャンクのデータ領域の合計 */
+    int num_chunks;
+    int reuse_chunks;           /* 巻き戻し・リセット後もチャンクを残す */
 } StackAllocator;
 
+/* スコープの開始位置（stack_save で取り、stack_restore で戻す） */
+typedef struct
+{
+    StackChunk *chunk;
+    size_t offset;
+} StackMarker;
+
 /* オブジェクトプール */
 typedef struct ObjectNode
 {
@@ -58,7 +123,7 @@ typedef struct
 } ObjectPool;
 
 /* グローバルメモリプール */
-static MemoryPool g_memory_pool = {NULL, 0, 0, 0};
+static MemoryPool g_memory_pool;
 
 /* メモリ使用統計 */
 typedef struct
@@ -73,198 +138,599 @@ typedef struct
 
 static MemoryStats g_memory_stats = {0, 0, 0, 0, 0, 0};
 
-/* メモリプールの初期化 */
-int init_memory_pool(MemoryPool *pool, size_t total_size)
+/* ブロック操作 */
+#define BLOCK_SIZE(block) ((block)->size & ~BLOCK_USED)
+#define BLOCK_IS_USED(block) ((block)->size & BLOCK_USED)
+#define BLOCK_NEXT(block) ((MemoryBlock *)((char *)(block) + BLOCK_SIZE(block)))
+#define BLOCK_PREV(block) ((MemoryBlock *)((char *)(block) - (block)->prev_size))
+#define BLOCK_DATA(block) ((void *)((char *)(block) + BLOCK_HEADER_SIZE))
+#define BLOCK_FROM_DATA(ptr) ((MemoryBlock *)((char *)(ptr) - BLOCK_HEADER_SIZE))
+#define BLOCK_NODE(block) ((FreeNode *)BLOCK_DATA(block))
+#define NODE_BLOCK(node) BLOCK_FROM_DATA(node)
+
+/* 木の順序：サイズが小さい順、同じサイズならアドレスの小さい順 */
+static int free_node_less(FreeNode *a, FreeNode *b)
+{
+    size_t sa = BLOCK_SIZE(NODE_BLOCK(a));
+    size_t sb = BLOCK_SIZE(NODE_BLOCK(b));
+
+    return sa < sb || (sa == sb && (char *)a < (char *)b);
+}
+
+/* key より小さいノードを *left に、それ以外を *right に分ける */
+static void free_tree_split(FreeNode *tree, FreeNode *key, FreeNode **left, FreeNode **right)
+{
+    while (tree)
+    {
+        if (free_node_less(tree, key))
+        {
+            *left = tree;
+            left = &tree->right;
+            tree = tree->right;
+        }
+        else
+        {
+            *right = tree;
+            right = &tree->left;
+            tree = tree->left;
+        }
+    }
+    *left = NULL;
+    *right = NULL;
+}
+
+/* 全ノードが a < b の2つの木をつなぐ */
+static FreeNode *free_tree_merge(FreeNode *a, FreeNode *b)
+{
+    FreeNode *root = NULL;
+    FreeNode **link = &root;
+
+    while (a && b)
+    {
+        if (a->priority > b->priority)
+        {
+            *link = a;
+            link = &a->right;
+            a = a->right;
+        }
+        else
+        {
+            *link = b;
+            link = &b->left;
+            b = b->left;
+        }
+    }
+    *link = a ? a : b;
+    return root;
+}
+
+/* 空きブロックを索引に入れる */
+static void free_index_insert(MemoryPool *pool, MemoryBlock *block)
+{
+    FreeNode *node = BLOCK_NODE(block);
+    FreeNode **link = &pool->free_tree;
+    size_t size = BLOCK_SIZE(block);
+    unsigned long h = (unsigned long)((size_t)block / POOL_ALIGNMENT);
+
+    pool->num_free++;
+    if (size < SMALL_BIN_LIMIT)
+    {
+        /* ビンの先頭に積む */
+        size_t bin = size / POOL_ALIGNMENT;
+
+        node->left = NULL;
+        node->right = pool->small_bins[bin];
+        if (node->right)
+        {
+            node->right->left = node;
+        }
+        pool->small_bins[bin] = node;
+        pool->small_map |= 1UL << bin;
+        return;
+    }
+
+    /* アドレスを混ぜた値を優先度にする（同じ並びなら同じ形の木になる） */
+    h ^= h >> 15;
+    h *= 2654435761UL;
+    h ^= h >> 13;
+    node->priority = h;
+
+    while (*link && (*link)->priority >= node->priority)
+    {
+        link = free_node_less(node, *link) ? &(*link)->left : &(*link)->right;
+    }
+    free_tree_split(*link, node, &node->left, &node->right);
+    *link = node;
+}
+
+/* 空きブロックを索引から外す */
+static void free_index_remove(MemoryPool *pool, MemoryBlock *block)
+{
+    FreeNode *node = BLOCK_NODE(block);
+    FreeNode **link = &pool->free_tree;
+    size_t size = BLOCK_SIZE(block);
+
+    pool->num_free--;
+    if (size < SMALL_BIN_LIMIT)
+    {
+        size_t bin = size / POOL_ALIGNMENT;
+
+        if (node->left)
+        {
+            node->left->right = node->right;
+        }
+        else
+        {
+            pool->small_bins[bin] = node->right;
+            if (!node->right)
+            {
+                pool->small_map &= ~(1UL << bin);
+            }
+        }
+        if (node->right)
+        {
+            node->right->left = node->left;
+        }
+        return;
+    }
+
+    while (*link != node)
+    {
+        link = free_node_less(node, *link) ? &(*link)->left : &(*link)->right;
+    }
+    *link = free_tree_merge(node->left, node->right);
+}
+
+/* size 以上で最小の空きブロック（最良適合）を探す
+ * 小さい要求は size 以上で空でない最初のビン、なければ木の中の下限 */
+static MemoryBlock *free_index_best_fit(MemoryPool *pool, size_t size)
+{
+    FreeNode *node = pool->free_tree;
+    FreeNode *best = NULL;
+
+    if (size < SMALL_BIN_LIMIT)
+    {
+        size_t bin = size / POOL_ALIGNMENT;
+        unsigned long map = (pool->small_map >> bin) & 0xFFFFFFFFUL;
+
+        if (map)
+        {
+            while (!(map & 1UL))
+            {
+                map >>= 1;
+                bin++;
+            }
+            return NODE_BLOCK(pool->small_bins[bin]);
+        }
+    }
+
+    while (node)
+    {
+        if (BLOCK_SIZE(NODE_BLOCK(node)) >= size)
+        {
+            best = node;
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+    return best ? NODE_BLOCK(best) : NULL;
+}
+
+/* チャンクを追加し、全体を1つの空きブロックとして索引に入れる */
+static int pool_add_chunk(MemoryPool *pool, size_t block_area)
 {
-    pool->blocks = malloc(sizeof(MemoryBlock) * MAX_POOL_BLOCKS);
-    if (!pool->blocks)
+    MemoryChunk *chunk;
+    MemoryBlock *block, *sentinel;
+
+    block_area = POOL_ALIGN(block_area);
+    if (block_area < BLOCK_MIN_SIZE)
+    {
+        block_area = BLOCK_MIN_SIZE;
+    }
+
+    chunk = malloc(CHUNK_HEADER_SIZE + block_area + BLOCK_HEADER_SIZE);
+    if (!chunk)
     {
-        printf("メモリプール初期化エラー: ブロック配列の確保に失敗\n");
         return 0;
     }
+    chunk->size = block_area;
+    chunk->prev = NULL;
+    chunk->next = pool->chunks;
+    if (pool->chunks)
+    {
+        pool->chunks->prev = chunk;
+    }
+    pool->chunks = chunk;
+    pool->num_chunks++;
+    pool->empty_chunks++;
+
+    block = (MemoryBlock *)((char *)chunk + CHUNK_HEADER_SIZE);
+    block->prev_size = 0;
+    block->size = block_area;
+
+    /* 末尾の番兵は使用中扱いなので、最後のブロックがその先と結合されることはない */
+    sentinel = BLOCK_NEXT(block);
+    sentinel->prev_size = block_area;
+    sentinel->size = BLOCK_USED;
+
+    pool->total_size += block_area;
+    pool->num_blocks++;
+    free_index_insert(pool, block);
+    return 1;
+}
+
+/* ブロックがチャンク全体を占めていればそのチャンク（先頭で、次が末尾の番兵） */
+static MemoryChunk *block_whole_chunk(MemoryBlock *block)
+{
+    if (block->prev_size != 0 || BLOCK_SIZE(BLOCK_NEXT(block)) != 0)
+    {
+        return NULL;
+    }
+    return (MemoryChunk *)((char *)block - CHUNK_HEADER_SIZE);
+}
+
+/* 全体が空いたチャンクを一覧から外して解放する */
+static void pool_release_chunk(MemoryPool *pool, MemoryChunk *chunk)
+{
+    if (chunk->prev)
+    {
+        chunk->prev->next = chunk->next;
+    }
+    else
+    {
+        pool->chunks = chunk->next;
+    }
+    if (chunk->next)
+    {
+        chunk->next->prev = chunk->prev;
+    }
+    pool->total_size -= chunk->size;
+    pool->num_blocks--;
+    pool->num_chunks--;
+    free(chunk);
+}
 
-    pool->total_size = total_size;
-    pool->used_size = 0;
-    pool->num_blocks = 1;
+/* メモリプールの初期化 */
+int init_memory_pool(MemoryPool *pool, size_t total_size)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->verbose = 1;
 
     /* 最初の大きなブロックを作成 */
-    pool->blocks[0].data = malloc(total_size);
-    if (!pool->blocks[0].data)
+    if (!pool_add_chunk(pool, total_size))
     {
-        free(pool->blocks);
         printf("メモリプール初期化エラー: メモリブロックの確保に失敗\n");
         return 0;
     }
 
-    pool->blocks[0].size = total_size;
-    pool->blocks[0].is_free = 1;
-    pool->blocks[0].next = NULL;
-
     printf("メモリプール初期化完了: %zu バイト\n", total_size);
     return 1;
 }
 
-/* メモリプールからの割り当て */
+/* メモリプールからの割り当て（最良適合、O(log n)） */
 void *pool_alloc(MemoryPool *pool, size_t size)
 {
-    int i;
+    MemoryBlock *block, *rest;
+    size_t need;
 
-    /* 適切なサイズの空きブロックを検索 */
-    for (i = 0; i < pool->num_blocks; i++)
+    if (size == 0)
+    {
+        return NULL;
+    }
+    need = POOL_ALIGN(size) + BLOCK_HEADER_SIZE;
+    if (need < BLOCK_MIN_SIZE)
     {
-        if (pool->blocks[i].is_free && pool->blocks[i].size >= size)
+        need = BLOCK_MIN_SIZE;
+    }
+
+    /* 適切なサイズの空きブロックを検索（なければチャンクを追加） */
+    block = free_index_best_fit(pool, need);
+    if (!block)
+    {
+        if (!pool_add_chunk(pool, need > POOL_CHUNK_SIZE ? need : POOL_CHUNK_SIZE))
         {
-            /* ブロックが大きすぎる場合は分割 */
-            if (pool->blocks[i].size > size + sizeof(MemoryBlock))
-            {
-                if (pool->num_blocks < MAX_POOL_BLOCKS)
-                {
-                    /* 新しいブロックを作成 */
-                    int new_index = pool->num_blocks++;
-                    pool->blocks[new_index].data = (char *)pool->blocks[i].data + size;
-                    pool->blocks[new_index].size = pool->blocks[i].size - size;
-                    pool->blocks[new_index].is_free = 1;
-                    pool->blocks[new_index].next = NULL;
-
-                    /* 元のブロックサイズを調整 */
-                    pool->blocks[i].size = size;
-                }
-            }
+            printf("メモリプール割り当てエラー: %zu バイトの空きブロックが見つかりません\n", size);
+            return NULL;
+        }
+        block = free_index_best_fit(pool, need);
+    }
+    free_index_remove(pool, block);
+    if (block_whole_chunk(block))
+    {
+        pool->empty_chunks--;
+    }
 
-            pool->blocks[i].is_free = 0;
-            pool->used_size += size;
+    /* ブロックが大きすぎる場合は分割し、残りを索引に戻す */
+    if (BLOCK_SIZE(block) - need >= BLOCK_MIN_SIZE)
+    {
+        rest = (MemoryBlock *)((char *)block + need);
+        rest->prev_size = need;
+        rest->size = BLOCK_SIZE(block) - need;
+        BLOCK_NEXT(rest)->prev_size = rest->size;
+        block->size = need;
+        pool->num_blocks++;
+        free_index_insert(pool, rest);
+    }
 
-            /* 統計更新 */
-            g_memory_stats.total_allocated += size;
-            g_memory_stats.current_usage += size;
-            g_memory_stats.allocation_count++;
+    block->size |= BLOCK_USED;
+    pool->used_size += BLOCK_SIZE(block) - BLOCK_HEADER_SIZE;
 
-            if (g_memory_stats.current_usage > g_memory_stats.peak_usage)
-            {
-                g_memory_stats.peak_usage = g_memory_stats.current_usage;
-            }
+    /* 統計更新（解放時と揃えてデータ領域のサイズで数える） */
+    g_memory_stats.total_allocated += BLOCK_SIZE(block) - BLOCK_HEADER_SIZE;
+    g_memory_stats.current_usage += BLOCK_SIZE(block) - BLOCK_HEADER_SIZE;
+    g_memory_stats.allocation_count++;
 
-            return pool->blocks[i].data;
-        }
+    if (g_memory_stats.current_usage > g_memory_stats.peak_usage)
+    {
+        g_memory_stats.peak_usage = g_memory_stats.current_usage;
     }
 
-    printf("メモリプール割り当てエラー: %zu バイトの空きブロックが見つかりません\n", size);
-    return NULL;
+    return BLOCK_DATA(block);
 }
 
-/* メモリプールへの解放 */
+/* メモリプールへの解放（前後の空きブロックと境界タグで結合） */
 void pool_free(MemoryPool *pool, void *ptr)
 {
-    int i;
+    MemoryBlock *block, *next, *prev;
+    MemoryChunk *chunk;
+    size_t data_size;
 
     if (!ptr)
         return;
 
-    for (i = 0; i < pool->num_blocks; i++)
+    block = BLOCK_FROM_DATA(ptr);
+    if (!BLOCK_IS_USED(block) || BLOCK_SIZE(block) < BLOCK_MIN_SIZE)
     {
-        if (pool->blocks[i].data == ptr && !pool->blocks[i].is_free)
-        {
-            pool->blocks[i].is_free = 1;
-            pool->used_size -= pool->blocks[i].size;
+        printf("メモリ解放エラー: 無効なポインタ\n");
+        return;
+    }
 
-            /* 統計更新 */
-            g_memory_stats.total_freed += pool->blocks[i].size;
-            g_memory_stats.current_usage -= pool->blocks[i].size;
-            g_memory_stats.free_count++;
+    block->size &= ~BLOCK_USED;
+    data_size = BLOCK_SIZE(block) - BLOCK_HEADER_SIZE;
+    pool->used_size -= data_size;
 
-            /* 隣接する空きブロックとマージ */
-            /* 簡単な実装のため、ここではマージを省略 */
+    /* 統計更新 */
+    g_memory_stats.total_freed += data_size;
+    g_memory_stats.current_usage -= data_size;
+    g_memory_stats.free_count++;
 
-            printf("メモリ解放: %zu バイト\n", pool->blocks[i].size);
-            return;
+    /* 隣接する空きブロックとマージ */
+    next = BLOCK_NEXT(block);
+    if (!BLOCK_IS_USED(next))
+    {
+        free_index_remove(pool, next);
+        block->size += next->size;
+        pool->num_blocks--;
+    }
+    if (block->prev_size != 0)
+    {
+        prev = BLOCK_PREV(block);
+        if (!BLOCK_IS_USED(prev))
+        {
+            free_index_remove(pool, prev);
+            prev->size += block->size;
+            block = prev;
+            pool->num_blocks--;
         }
     }
+    BLOCK_NEXT(block)->prev_size = block->size;
 
-    printf("メモリ解放エラー: 無効なポインタ\n");
+    /* チャンク全体が空いた：予備が既にあれば返却し、なければ予備として残す */
+    chunk = block_whole_chunk(block);
+    if (chunk && pool->empty_chunks > 0)
+    {
+        pool_release_chunk(pool, chunk);
+    }
+    else
+    {
+        if (chunk)
+        {
+            pool->empty_chunks++;
+        }
+        free_index_insert(pool, block);
+    }
+
+    if (pool->verbose)
+    {
+        printf("メモリ解放: %zu バイト\n", data_size);
+    }
 }
 
 /* メモリプールの状態表示 */
 void print_pool_status(MemoryPool *pool)
 {
+    MemoryChunk *chunk;
+    MemoryBlock *block;
+    int i = 0;
+
     printf("\n=== メモリプール状態 ===\n");
     printf("総サイズ: %zu バイト\n", pool->total_size);
     printf("使用中: %zu バイト\n", pool->used_size);
     printf("空き: %zu バイト\n", pool->total_size - pool->used_size);
-    printf("ブロック数: %d\n", pool->num_blocks);
+    printf("ブロック数: %d (空き %d)\n", pool->num_blocks, pool->num_free);
 
     printf("ブロック詳細:\n");
-    int i;
-    for (i = 0; i < pool->num_blocks; i++)
+    for (chunk = pool->chunks; chunk; chunk = chunk->next)
     {
-        printf("  ブロック%d: サイズ=%zu, 状態=%s\n",
-               i, pool->blocks[i].size,
-               pool->blocks[i].is_free ? "空き" : "使用中");
+        block = (MemoryBlock *)((char *)chunk + CHUNK_HEADER_SIZE);
+        for (; BLOCK_SIZE(block) > 0; block = BLOCK_NEXT(block))
+        {
+            printf("  ブロック%d: サイズ=%zu, 状態=%s\n",
+                   i++, BLOCK_SIZE(block) - BLOCK_HEADER_SIZE,
+                   BLOCK_IS_USED(block) ? "使用中" : "空き");
+        }
     }
 }
 
 /* メモリプールの終了処理 */
 void cleanup_memory_pool(MemoryPool *pool)
 {
-    if (pool->blocks)
+    while (pool->chunks)
     {
-        if (pool->blocks[0].data)
-        {
-            free(pool->blocks[0].data);
-        }
-        free(pool->blocks);
-        pool->blocks = NULL;
+        MemoryChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
     }
+    memset(pool->small_bins, 0, sizeof(pool->small_bins));
+    pool->small_map = 0;
+    pool->free_tree = NULL;
     printf("メモリプール終了処理完了\n");
 }
 
-/* スタックアロケーターの初期化 */
+/* スタックアロケーターにチャンクを1つ作る */
+static StackChunk *stack_new_chunk(StackAllocator *stack, size_t size)
+{
+    StackChunk *chunk = malloc(STACK_CHUNK_HEADER_SIZE + size);
+
+    if (chunk)
+    {
+        chunk->next = NULL;
+        chunk->size = size;
+        stack->total_size += size;
+        stack->num_chunks++;
+    }
+    return chunk;
+}
+
+/* chunk より後ろのチャンクを解放する */
+static void stack_free_after(StackAllocator *stack, StackChunk *chunk)
+{
+    while (chunk->next)
+    {
+        StackChunk *next = chunk->next->next;
+        stack->total_size -= chunk->next->size;
+        stack->num_chunks--;
+        free(chunk->next);
+        chunk->next = next;
+    }
+}
+
+/* 割り当て先のチャンクを切り替える */
+static void stack_use_chunk(StackAllocator *stack, StackChunk *chunk)
+{
+    stack->current = chunk;
+    stack->memory = STACK_CHUNK_DATA(chunk);
+    stack->size = chunk->size;
+    stack->offset = 0;
+}
+
+/* p を alignment の倍数に揃えるのに必要なバイト数 */
+static size_t stack_padding(const char *p, size_t alignment)
+{
+    return (alignment - ((size_t)p & (alignment - 1))) & (alignment - 1);
+}
+
+/* スタックアロケーターの初期化（size は1チャンクの標準サイズ） */
 int init_stack_allocator(StackAllocator *stack, size_t size)
 {
-    stack->memory = malloc(size);
-    if (!stack->memory)
+    memset(stack, 0, sizeof(*stack));
+    stack->chunk_size = size;
+    stack->reuse_chunks = 1;
+
+    stack->first = stack_new_chunk(stack, size);
+    if (!stack->first)
     {
         printf("スタックアロケーター初期化エラー\n");
         return 0;
     }
-
-    stack->size = size;
-    stack->offset = 0;
+    stack_use_chunk(stack, stack->first);
 
     printf("スタックアロケーター初期化: %zu バイト\n", size);
     return 1;
 }
 
+/* スタックアロケーターからの割り当て（alignment は2のべき乗） */
+void *stack_alloc_aligned(StackAllocator *stack, size_t size, size_t alignment)
+{
+    size_t pad = stack_padding(stack->memory + stack->offset, alignment);
+    StackChunk *chunk;
+    void *ptr;
+
+    /* 今のチャンクに収まらなければ次のチャンクへ（なければ作る） */
+    if (stack->offset + pad + size > stack->size)
+    {
+        size_t need = size + alignment - 1;
+
+        /* current より後ろは未使用なので、小さすぎる再利用チャンクは捨てる */
+        while ((chunk = stack->current->next) != NULL && chunk->size < need)
+        {
+            stack->current->next = chunk->next;
+            stack->total_size -= chunk->size;
+            stack->num_chunks--;
+            free(chunk);
+        }
+        if (!chunk)
+        {
+            chunk = stack_new_chunk(stack, need > stack->chunk_size ? need : stack->chunk_size);
+            if (!chunk)
+            {
+                printf("スタックアロケーターエラー: メモリ不足\n");
+                return NULL;
+            }
+            stack->current->next = chunk;
+        }
+        stack_use_chunk(stack, chunk);
+        pad = stack_padding(stack->memory, alignment);
+    }
+
+    ptr = stack->memory + stack->offset + pad;
+    stack->offset += pad + size;
+    return ptr;
+}
+
 /* スタックアロケーターからの割り当て */
 void *stack_alloc(StackAllocator *stack, size_t size)
 {
     /* アライメント調整 */
-    size_t aligned_size = (size + 7) & ~7; /* 8バイト境界に整列 */
+    return stack_alloc_aligned(stack, (size + 7) & ~(size_t)7, STACK_DEFAULT_ALIGNMENT);
+}
 
-    if (stack->offset + aligned_size > stack->size)
-    {
-        printf("スタックアロケーターエラー: メモリ不足\n");
-        return NULL;
-    }
+/* 現在位置をマーカーとして保存 */
+StackMarker stack_save(StackAllocator *stack)
+{
+    StackMarker marker;
 
-    void *ptr = stack->memory + stack->offset;
-    stack->offset += aligned_size;
+    marker.chunk = stack->current;
+    marker.offset = stack->offset;
+    return marker;
+}
 
-    return ptr;
+/* マーカーの位置まで巻き戻す（それ以降の割り当てはまとめて無効になる） */
+void stack_restore(StackAllocator *stack, StackMarker marker)
+{
+    if (stack->current != marker.chunk)
+    {
+        stack_use_chunk(stack, marker.chunk);
+        if (!stack->reuse_chunks)
+        {
+            stack_free_after(stack, marker.chunk);
+        }
+    }
+    stack->offset = marker.offset;
 }
 
 /* スタックアロケーターのリセット */
 void stack_reset(StackAllocator *stack)
 {
-    stack->offset = 0;
-    printf("スタックアロケーターをリセットしました\n");
+    stack_use_chunk(stack, stack->first);
+    if (!stack->reuse_chunks)
+    {
+        stack_free_after(stack, stack->first);
+    }
 }
 
 /* スタックアロケーターの終了処理 */
 void cleanup_stack_allocator(StackAllocator *stack)
 {
-    if (stack->memory)
+    if (stack->first)
     {
-        free(stack->memory);
+        stack_free_after(stack, stack->first);
+        free(stack->first);
+        stack->first = NULL;
+        stack->current = NULL;
         stack->memory = NULL;
     }
     printf("スタックアロケーター終了処理完了\n");
@@ -478,6 +944,7 @@ double benchmark_pool_alloc(int iterations)
 
     MemoryPool pool;
     init_memory_pool(&pool, sizeof(TestObject) * iterations * 2);
+    pool.verbose = 0;
 
     TestObject **objects = malloc(sizeof(TestObject *) * iterations);
     int i;
@@ -505,6 +972,158 @@ double benchmark_pool_alloc(int iterations)
     return ((double)(end - start)) / CLOCKS_PER_SEC;
 }
 
+/* 断片化が進む条件での可変サイズ混在ベンチマーク
+ * ラウンドごとに、小・大を交互にした一時ブロックの間へ長寿命の小さなブロックを挟んで確保し、
+ * 一時ブロックだけを解放する。長寿命ブロックが仕切りになって穴は結合できないので、
+ * 空きブロックはラウンドを追うごとに増える。その状態で生存数一定の解放と割り当てを繰り返し、
+ * 空きブロック数に対する1操作の時間を malloc/free と比べる。
+ * 大きい空きブロックの木は深さ O(log n) なので、空きブロックが増えると1操作の時間も
+ * （キャッシュミスとともに）ゆるやかに伸び、空きブロック数が頭打ちになると落ち着く */
+#define MIXED_SLOTS 16384           /* 解放と割り当てを繰り返す生存ブロック数 */
+#define MIXED_ROUNDS 5
+#define MIXED_OPS_PER_ROUND 200000
+#define MIXED_PINS_PER_ROUND 16384  /* ラウンドごとに増やす長寿命ブロック */
+
+static unsigned long mixed_random(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* 70%は16〜128バイト、25%は〜1KB、5%は〜8KB */
+static size_t mixed_size(unsigned long *state)
+{
+    unsigned long r = mixed_random(state);
+    unsigned long kind = r % 100;
+
+    r >>= 8;
+    if (kind < 70)
+        return 16 + r % 113;
+    if (kind < 95)
+        return 128 + r % 897;
+    return 1024 + r % 7169;
+}
+
+static void *mixed_alloc(MemoryPool *pool, size_t size)
+{
+    return pool ? pool_alloc(pool, size) : malloc(size);
+}
+
+static void mixed_free(MemoryPool *pool, void *ptr)
+{
+    if (pool)
+        pool_free(pool, ptr);
+    else
+        free(ptr);
+}
+
+/* 一時ブロックと長寿命ブロックを交互に確保し、一時ブロックだけを解放して穴を残す
+ * （pool が NULL なら malloc/free） */
+static void mixed_pin(MemoryPool *pool, void **pins, void **temps, unsigned long *state)
+{
+    int i;
+
+    for (i = 0; i < MIXED_PINS_PER_ROUND; i++)
+    {
+        unsigned long r = mixed_random(state) >> 8;
+
+        temps[i] = mixed_alloc(pool, (i & 1) ? 512 + r % 1537 : 32 + r % 97);
+        pins[i] = mixed_alloc(pool, 16 + (r >> 12) % 49);
+    }
+    for (i = 0; i < MIXED_PINS_PER_ROUND; i++)
+    {
+        mixed_free(pool, temps[i]);
+    }
+}
+
+/* 1ラウンド分の解放・割り当て（pool が NULL なら malloc/free）。経過秒を返す */
+static double mixed_round(MemoryPool *pool, void **slots, unsigned long *state)
+{
+    clock_t start = clock();
+    int i;
+
+    for (i = 0; i < MIXED_OPS_PER_ROUND; i++)
+    {
+        int slot = (int)(mixed_random(state) % MIXED_SLOTS);
+
+        mixed_free(pool, slots[slot]);
+        slots[slot] = mixed_alloc(pool, mixed_size(state));
+        if (slots[slot])
+        {
+            *(char *)slots[slot] = (char)i;
+        }
+    }
+    return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+void benchmark_pool_mixed(void)
+{
+    MemoryPool pool;
+    void **pool_slots = calloc(MIXED_SLOTS, sizeof(void *));
+    void **std_slots = calloc(MIXED_SLOTS, sizeof(void *));
+    void **pool_pins = calloc(MIXED_ROUNDS * MIXED_PINS_PER_ROUND, sizeof(void *));
+    void **std_pins = calloc(MIXED_ROUNDS * MIXED_PINS_PER_ROUND, sizeof(void *));
+    void **temps = calloc(MIXED_PINS_PER_ROUND, sizeof(void *));
+    unsigned long pool_state = 2463534242UL;
+    unsigned long std_state = pool_state;
+    int round, i;
+
+    printf("\n=== 断片化が進む条件での可変サイズ混在ベンチマーク ===\n");
+    printf("生存 %d ブロックで1ラウンド %d 回の解放+割り当て、ラウンドごとに長寿命ブロックを %d 個追加\n",
+           MIXED_SLOTS, MIXED_OPS_PER_ROUND, MIXED_PINS_PER_ROUND);
+    if (!pool_slots || !std_slots || !pool_pins || !std_pins || !temps ||
+        !init_memory_pool(&pool, POOL_CHUNK_SIZE))
+    {
+        free(pool_slots);
+        free(std_slots);
+        free(pool_pins);
+        free(std_pins);
+        free(temps);
+        return;
+    }
+    pool.verbose = 0;
+
+    printf("ラウンド  長寿命  空きブロック  空き率  プール(ns/回)  malloc(ns/回)\n");
+    for (round = 0; round < MIXED_ROUNDS; round++)
+    {
+        double pool_time, std_time;
+
+        mixed_pin(&pool, pool_pins + round * MIXED_PINS_PER_ROUND, temps, &pool_state);
+        mixed_pin(NULL, std_pins + round * MIXED_PINS_PER_ROUND, temps, &std_state);
+        pool_time = mixed_round(&pool, pool_slots, &pool_state);
+        std_time = mixed_round(NULL, std_slots, &std_state);
+
+        printf("%8d  %6d  %12d  %5.1f%%  %13.1f  %13.1f\n",
+               round + 1, (round + 1) * MIXED_PINS_PER_ROUND, pool.num_free,
+               100.0 * (double)(pool.total_size - pool.used_size) / (double)pool.total_size,
+               pool_time * 1e9 / MIXED_OPS_PER_ROUND,
+               std_time * 1e9 / MIXED_OPS_PER_ROUND);
+    }
+    printf("ピーク時: チャンク %d 個 (%zu バイト)\n", pool.num_chunks, pool.total_size);
+
+    for (i = 0; i < MIXED_SLOTS; i++)
+    {
+        pool_free(&pool, pool_slots[i]);
+        free(std_slots[i]);
+    }
+    for (i = 0; i < MIXED_ROUNDS * MIXED_PINS_PER_ROUND; i++)
+    {
+        pool_free(&pool, pool_pins[i]);
+        free(std_pins[i]);
+    }
+    printf("全解放後: チャンク %d 個 (%zu バイト), 空きブロック %d 個 (空いたチャンクは予備の1個を残して返却)\n",
+           pool.num_chunks, pool.total_size, pool.num_free);
+
+    free(pool_slots);
+    free(std_slots);
+    free(pool_pins);
+    free(std_pins);
+    free(temps);
+    cleanup_memory_pool(&pool);
+}
+
 /* オブジェクトプールのベンチマーク */
 double benchmark_object_pool(int iterations)
 {
@@ -539,6 +1158,208 @@ double benchmark_object_pool(int iterations)
     return ((double)(end - start)) / CLOCKS_PER_SEC;
 }
 
+/* スタックアロケーター（アリーナ）のベンチマーク
+ * 個別の解放はせず、最後にリセット1回でまとめて捨てる */
+double benchmark_arena_alloc(int iterations)
+{
+    clock_t start = clock();
+
+    StackAllocator stack;
+    init_stack_allocator(&stack, POOL_CHUNK_SIZE);
+
+    TestObject **objects = malloc(sizeof(TestObject *) * iterations);
+    int i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        objects[i] = (TestObject *)stack_alloc(&stack, sizeof(TestObject));
+        if (objects[i])
+        {
+            objects[i]->id = i;
+            sprintf(objects[i]->name, "Object_%d", i);
+            objects[i]->value = i * 3.14;
+        }
+    }
+
+    stack_reset(&stack);
+
+    free(objects);
+    cleanup_stack_allocator(&stack);
+
+    clock_t end = clock();
+    return ((double)(end - start)) / CLOCKS_PER_SEC;
+}
+
+/* 構文解析型の負荷のベンチマーク
+ * "key=value&key=value..." 形式の要求を1件ずつ解析し、フィールドごとにノードと
+ * キー・値の複製を確保する。値のデコードには一時バッファを使う入れ子のスコープを持つ。
+ * malloc/free では全ノードを個別に解放し、アリーナでは要求ごとにリセット1回で済ませる */
+#define PARSE_REQUESTS 20000
+#define PARSE_FIELDS 16
+/* 1フィールドの最大長: "&field" + int + "=value_" + int + "_" + int（intは符号込み11文字） */
+#define PARSE_FIELD_MAX (6 + 11 + 7 + 11 + 1 + 11)
+#define PARSE_TEXT_SIZE (PARSE_FIELDS * PARSE_FIELD_MAX + 1)
+
+typedef struct ParseField
+{
+    char *key;
+    char *value;
+    struct ParseField *next;
+} ParseField;
+
+/* i 番目の要求文字列を作る（buf は PARSE_TEXT_SIZE バイト以上） */
+static int parse_make_request(char *buf, int i)
+{
+    int len = 0;
+    int f;
+
+    for (f = 0; f < PARSE_FIELDS; f++)
+    {
+        len += sprintf(buf + len, "%sfield%d=value_%d_%d", f ? "&" : "", f, i, f * 7);
+    }
+    return len;
+}
+
+/* 1件の要求を解析してフィールドのリストを返す（arena が NULL なら malloc） */
+static ParseField *parse_request(StackAllocator *arena, const char *text, size_t *checksum)
+{
+    ParseField *head = NULL;
+    ParseField **tail = &head;
+    const char *p = text;
+
+    while (*p)
+    {
+        const char *eq = strchr(p, '=');
+        const char *end = strchr(p, '&');
+        size_t key_len, value_len;
+        ParseField *field;
+        char *scratch;
+
+        if (!eq)
+            break;
+        if (!end)
+            end = p + strlen(p);
+        key_len = (size_t)(eq - p);
+        value_len = (size_t)(end - eq - 1);
+
+        if (arena)
+        {
+            /* デコード用の一時バッファは内側のスコープで確保して巻き戻す */
+            StackMarker scope = stack_save(arena);
+            size_t k;
+
+            scratch = stack_alloc_aligned(arena, value_len + 1, 1);
+            for (k = 0; k < value_len; k++)
+                scratch[k] = (char)(eq[1 + k] == '_' ? ' ' : eq[1 + k]);
+            scratch[value_len] = '\0';
+            *checksum += (unsigned char)scratch[value_len / 2];
+            stack_restore(arena, scope);
+
+            field = stack_alloc(arena, sizeof(ParseField));
+            field->key = stack_alloc_aligned(arena, key_len + 1, 1);
+            field->value = stack_alloc_aligned(arena, value_len + 1, 1);
+        }
+        else
+        {
+            size_t k;
+
+            scratch = malloc(value_len + 1);
+            for (k = 0; k < value_len; k++)
+                scratch[k] = (char)(eq[1 + k] == '_' ? ' ' : eq[1 + k]);
+            scratch[value_len] = '\0';
+            *checksum += (unsigned char)scratch[value_len / 2];
+            free(scratch);
+
+            field = malloc(sizeof(ParseField));
+            field->key = malloc(key_len + 1);
+            field->value = malloc(value_len + 1);
+        }
+
+        memcpy(field->key, p, key_len);
+        field->key[key_len] = '\0';
+        memcpy(field->value, eq + 1, value_len);
+        field->value[value_len] = '\0';
+        field->next = NULL;
+        *tail = field;
+        tail = &field->next;
+
+        p = *end ? end + 1 : end;
+    }
+    return head;
+}
+
+/* 解析結果を使う（キーと値の長さを数える） */
+static size_t parse_consume(const ParseField *field)
+{
+    size_t total = 0;
+
+    for (; field; field = field->next)
+    {
+        total += strlen(field->key) + strlen(field->value);
+    }
+    return total;
+}
+
+/* 構文解析型の負荷を実行して経過秒を返す（arena が NULL なら malloc/free） */
+static double parse_workload(StackAllocator *arena, size_t *checksum)
+{
+    char text[PARSE_TEXT_SIZE];
+    clock_t start = clock();
+    int i;
+
+    for (i = 0; i < PARSE_REQUESTS; i++)
+    {
+        ParseField *fields;
+
+        parse_make_request(text, i);
+        fields = parse_request(arena, text, checksum);
+        *checksum += parse_consume(fields);
+
+        if (arena)
+        {
+            stack_reset(arena);
+        }
+        else
+        {
+            while (fields)
+            {
+                ParseField *next = fields->next;
+                free(fields->key);
+                free(fields->value);
+                free(fields);
+                fields = next;
+            }
+        }
+    }
+    return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+void benchmark_parse_workload(void)
+{
+    StackAllocator arena;
+    size_t std_sum = 0;
+    size_t arena_sum = 0;
+    double std_time, arena_time;
+
+    printf("\n=== 構文解析型ベンチマーク (%d 要求 x %d フィールド) ===\n",
+           PARSE_REQUESTS, PARSE_FIELDS);
+    if (!init_stack_allocator(&arena, 4096))
+    {
+        return;
+    }
+
+    std_time = parse_workload(NULL, &std_sum);
+    arena_time = parse_workload(&arena, &arena_sum);
+
+    printf("標準malloc/free: %.6f秒\n", std_time);
+    printf("アリーナ (要求ごとにリセット): %.6f秒 (%.1f%%)\n",
+           arena_time, std_time > 0 ? (arena_time / std_time) * 100 : 0.0);
+    printf("チェックサム: %s, アリーナのチャンク: %d 個 (%zu バイト)\n",
+           std_sum == arena_sum ? "一致" : "不一致", arena.num_chunks, arena.total_size);
+
+    cleanup_stack_allocator(&arena);
+}
+
 /* メモリリークのシミュレーション */
 void simulate_memory_leak(void)
 {
@@ -607,8 +1428,32 @@ int main(void)
 
         printf("割り当て後オフセット: %zu\n", stack.offset);
 
+        /* 入れ子のスコープ: 内側の割り当てはマーカーまで巻き戻すとまとめて消える */
+        StackMarker outer = stack_save(&stack);
+        void *s4 = stack_alloc(&stack, 64);
+        StackMarker inner = stack_save(&stack);
+        void *s5 = stack_alloc_aligned(&stack, 32, 64);
+        printf("64バイト境界の割り当て: %s\n", ((size_t)s5 & 63) == 0 ? "OK" : "NG");
+        stack_restore(&stack, inner);
+        printf("内側スコープ終了後オフセット: %zu\n", stack.offset);
+
+        /* チャンクに収まらない割り当ては次のチャンクへ */
+        void *s6 = stack_alloc(&stack, 2000);
+        printf("大きな割り当て後: チャンク %d 個, オフセット %zu\n", stack.num_chunks, stack.offset);
+        stack_restore(&stack, outer);
+        printf("外側スコープ終了後オフセット: %zu\n", stack.offset);
+
         stack_reset(&stack);
-        printf("リセット後オフセット: %zu\n", stack.offset);
+        printf("スタックアロケーターをリセットしました\n");
+        printf("リセット後オフセット: %zu (チャンク %d 個は再利用のため保持)\n",
+               stack.offset, stack.num_chunks);
+
+        /* 再利用を切るとリセットで最初のチャンク以外を解放する */
+        s6 = stack_alloc(&stack, 2000);
+        stack.reuse_chunks = 0;
+        stack_reset(&stack);
+        printf("再利用なしでリセット後: チャンク %d 個\n", stack.num_chunks);
+        (void)s1; (void)s2; (void)s3; (void)s4; (void)s6;
 
         cleanup_stack_allocator(&stack);
     }
@@ -664,9 +1509,19 @@ int main(void)
     double obj_pool_time = benchmark_object_pool(iterations);
     printf("オブジェクトプール: %.6f秒\n", obj_pool_time);
 
+    double arena_time = benchmark_arena_alloc(iterations);
+    printf("アリーナ: %.6f秒\n", arena_time);
+
     printf("\nパフォーマンス比較 (標準を100%%とした場合):\n");
     printf("メモリプール: %.1f%%\n", (pool_time / std_time) * 100);
     printf("オブジェクトプール: %.1f%%\n", (obj_pool_time / std_time) * 100);
+    printf("アリーナ: %.1f%%\n", (arena_time / std_time) * 100);
+
+    /* 可変サイズ混在・断片化が進む条件でのメモリプール */
+    benchmark_pool_mixed();
+
+    /* 要求ごとに短命な割り当てを大量に行う負荷でのアリーナ */
+    benchmark_parse_workload();
 
     /* メモリ使用統計 */
     print_memory_stats();
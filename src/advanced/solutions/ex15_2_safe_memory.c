@@ -2,12 +2,35 @@
  * 演習15-2の解答例: 安全なメモリ操作マクロ
  * ファイル名: ex15_2_safe_memory.c
  * 説明: NULLチェック、境界チェック、メモリリーク検出機能の実装
- * C90準拠
+ *       追跡中の割り当てはポインタをキーにしたオープンアドレス法のハッシュ表で引き、
+ *       追跡レコードはスラブからまとめて切り出す（追加・削除ともO(1)）
+ *       追跡表はポインタのハッシュで分けたシャードごとにロックし、統計はスレッドごとに
+ *       数えてレポート時にだけ合算する（複数スレッドからSAFE_MALLOCを使える）
+ *       割り当ては呼び出し元（ファイル, 行）ごとにも集計し、上位N件のレポートと
+ *       フレームグラフ用の折りたたみスタック形式で出力できる
+ * C90準拠（スレッドセーフな追跡はPOSIXスレッドを使用）
  */
 
+/* POSIXスレッドを使用するための機能テストマクロ */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* 呼び出し元ごとの集計（登録後はクリーンアップまで消さない） */
+typedef struct CallSite {
+    const char *file;
+    int line;
+    size_t live_bytes;              /* 使用中のバイト数 */
+    unsigned long live_count;       /* 使用中のブロック数 */
+    unsigned long total_allocs;     /* 総割り当て回数 */
+    size_t total_bytes;             /* 総割り当てバイト数 */
+    size_t peak_bytes;              /* 使用中バイト数の最大 */
+    struct CallSite *next;          /* 同じバケットの次 */
+} CallSite;
 
 /* メモリリーク追跡用の構造体 */
 typedef struct MemoryTracker {
@@ -15,15 +38,87 @@ typedef struct MemoryTracker {
     size_t size;
     const char *file;
     int line;
-    struct MemoryTracker *next;
+    CallSite *site;                 /* 割り当てた呼び出し元 */
+    struct MemoryTracker *next;     /* スラブの空きレコードの連結 */
 } MemoryTracker;
 
-/* グローバルなメモリ追跡リスト */
-static MemoryTracker *g_memory_list = NULL;
-static size_t g_total_allocated = 0;
-static size_t g_total_freed = 0;
-static int g_allocation_count = 0;
-static int g_free_count = 0;
+/* 追跡表の設定 */
+#define TRACKER_INITIAL_CAPACITY 64     /* ハッシュ表の初期スロット数（2のべき乗） */
+#define TRACKER_SLAB_RECORDS 256        /* スラブ1枚あたりの追跡レコード数 */
+#define TRACKER_SHARD_BITS 4
+#define TRACKER_SHARDS (1 << TRACKER_SHARD_BITS) /* 追跡表の分割数 */
+#define CALL_SITE_BUCKETS 256           /* 呼び出し元表のバケット数（2のべき乗） */
+#define LEAK_DUMP_LIMIT 16              /* リークがこの数以下ならブロックごとにも表示 */
+#define LEAK_REPORT_TOP_SITES 10        /* リークレポートに出す呼び出し元の数 */
+
+/* 追跡レコードのスラブ（まとめて確保し、解放はクリーンアップ時だけ） */
+typedef struct TrackerSlab {
+    struct TrackerSlab *next;
+    MemoryTracker records[TRACKER_SLAB_RECORDS];
+} TrackerSlab;
+
+/* 追跡表のシャード
+ * 線形探査のオープンアドレス法。削除は後続のレコードを詰め直すので墓標を残さない。
+ * ポインタのハッシュの下位ビットでシャードを、残りのビットでスロットを選ぶ */
+typedef struct TrackerShard {
+    pthread_mutex_t lock;
+    MemoryTracker **table;
+    size_t capacity;                    /* スロット数（2のべき乗） */
+    size_t count;                       /* 追跡中の割り当て数 */
+    TrackerSlab *slabs;
+    MemoryTracker *free_records;
+} TrackerShard;
+
+/* スレッドごとの統計（書くのは所有スレッドだけで、集計するときに読む） */
+typedef struct TrackerCounters {
+    size_t total_allocated;
+    size_t total_freed;
+    unsigned long allocation_count;
+    unsigned long free_count;
+    struct TrackerCounters *prev;
+    struct TrackerCounters *next;
+} TrackerCounters;
+
+/* グローバルなメモリ追跡表 */
+static TrackerShard g_tracker_shards[TRACKER_SHARDS];
+static pthread_once_t g_tracker_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_counters_key;
+static pthread_mutex_t g_counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static TrackerCounters *g_counters_list = NULL;   /* 動いているスレッドの統計 */
+static TrackerCounters g_retired_counters;        /* 終了したスレッドの統計の合計 */
+static int g_memory_verbose = 1;        /* 割り当て・解放ごとのログ（ベンチマーク中は止める） */
+
+/* 呼び出し元表（バケットの連結は挿入だけなので、探索はロックなしで行う） */
+static CallSite *g_call_sites[CALL_SITE_BUCKETS];
+static pthread_mutex_t g_call_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t g_call_site_count = 0;
+
+/* 他スレッドの統計の読み出し（書き込みは所有スレッドだけなので読み書きの原子性だけ保つ） */
+#if defined(__ATOMIC_RELAXED)
+#define TRACKER_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define TRACKER_ADD(ptr, value) __atomic_store_n(ptr, *(ptr) + (value), __ATOMIC_RELAXED)
+#define TRACKER_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+#else
+#define TRACKER_LOAD(ptr) (*(ptr))
+#define TRACKER_ADD(ptr, value) (*(ptr) += (value))
+#define TRACKER_STORE(ptr, value) (*(ptr) = (value))
+#endif
+
+/* 呼び出し元表の公開と、複数スレッドが同時に更新する集計値
+ * （GCC/Clangの原子操作がなければ呼び出し元表のロックで守る） */
+#if defined(__ATOMIC_ACQUIRE)
+#define CALL_SITE_ATOMIC 1
+#define CALL_SITE_ACQUIRE(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define CALL_SITE_PUBLISH(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define CALL_SITE_ADD(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED)
+#define CALL_SITE_SUB(ptr, value) __atomic_sub_fetch(ptr, value, __ATOMIC_RELAXED)
+#else
+#define CALL_SITE_ATOMIC 0
+#define CALL_SITE_ACQUIRE(ptr) (*(ptr))
+#define CALL_SITE_PUBLISH(ptr, value) (*(ptr) = (value))
+#define CALL_SITE_ADD(ptr, value) (*(ptr) += (value))
+#define CALL_SITE_SUB(ptr, value) (*(ptr) -= (value))
+#endif
 
 /* メモリ追跡の有効/無効 */
 #define MEMORY_TRACKING_ENABLED 1
@@ -133,54 +228,405 @@ static int g_free_count = 0;
 
 /* 実装関数群 */
 
-/* メモリ追跡の初期化 */
+/* 終了したスレッドの統計を合計に移す */
+static void tracker_counters_destructor(void *arg)
+{
+    TrackerCounters *counters = (TrackerCounters *)arg;
+    
+    pthread_mutex_lock(&g_counters_lock);
+    g_retired_counters.total_allocated += counters->total_allocated;
+    g_retired_counters.total_freed += counters->total_freed;
+    g_retired_counters.allocation_count += counters->allocation_count;
+    g_retired_counters.free_count += counters->free_count;
+    if (counters->prev) {
+        counters->prev->next = counters->next;
+    } else {
+        g_counters_list = counters->next;
+    }
+    if (counters->next) {
+        counters->next->prev = counters->prev;
+    }
+    pthread_mutex_unlock(&g_counters_lock);
+    
+    free(counters);
+}
+
+/* シャードのロックとスレッドごとの統計のキーを作る（最初の1回だけ） */
+static void tracker_init_once(void)
+{
+    int i;
+    
+    for (i = 0; i < TRACKER_SHARDS; i++) {
+        pthread_mutex_init(&g_tracker_shards[i].lock, NULL);
+    }
+    pthread_key_create(&g_counters_key, tracker_counters_destructor);
+}
+
+/* 呼び出したスレッドの統計（初回に登録する） */
+static TrackerCounters *tracker_counters(void)
+{
+    TrackerCounters *counters = (TrackerCounters *)pthread_getspecific(g_counters_key);
+    
+    if (!counters) {
+        counters = (TrackerCounters *)calloc(1, sizeof(TrackerCounters));
+        if (!counters) {
+            return NULL;
+        }
+        pthread_setspecific(g_counters_key, counters);
+        
+        pthread_mutex_lock(&g_counters_lock);
+        counters->next = g_counters_list;
+        if (g_counters_list) {
+            g_counters_list->prev = counters;
+        }
+        g_counters_list = counters;
+        pthread_mutex_unlock(&g_counters_lock);
+    }
+    return counters;
+}
+
+/* 全スレッドの統計を合算する */
+static void tracker_totals(TrackerCounters *sum)
+{
+    TrackerCounters *counters;
+    
+    pthread_mutex_lock(&g_counters_lock);
+    *sum = g_retired_counters;
+    for (counters = g_counters_list; counters; counters = counters->next) {
+        sum->total_allocated += TRACKER_LOAD(&counters->total_allocated);
+        sum->total_freed += TRACKER_LOAD(&counters->total_freed);
+        sum->allocation_count += TRACKER_LOAD(&counters->allocation_count);
+        sum->free_count += TRACKER_LOAD(&counters->free_count);
+    }
+    pthread_mutex_unlock(&g_counters_lock);
+}
+
+/* 追跡中の割り当て数（全シャードの合計） */
+static size_t tracker_live_count(void)
+{
+    size_t count = 0;
+    int i;
+    
+    for (i = 0; i < TRACKER_SHARDS; i++) {
+        pthread_mutex_lock(&g_tracker_shards[i].lock);
+        count += g_tracker_shards[i].count;
+        pthread_mutex_unlock(&g_tracker_shards[i].lock);
+    }
+    return count;
+}
+
+/* 全スレッドの統計を0に戻す
+ * 統計は所有スレッドのTSDなので解放はせず、スレッド終了時のデストラクタに任せる */
+static void tracker_reset_counters(void)
+{
+    TrackerCounters *counters;
+    
+    pthread_mutex_lock(&g_counters_lock);
+    memset(&g_retired_counters, 0, sizeof(g_retired_counters));
+    for (counters = g_counters_list; counters; counters = counters->next) {
+        TRACKER_STORE(&counters->total_allocated, (size_t)0);
+        TRACKER_STORE(&counters->total_freed, (size_t)0);
+        TRACKER_STORE(&counters->allocation_count, 0UL);
+        TRACKER_STORE(&counters->free_count, 0UL);
+    }
+    pthread_mutex_unlock(&g_counters_lock);
+}
+
+/* メモリ追跡の初期化（他のスレッドが追跡を使い始める前に呼ぶ） */
 void init_memory_tracker(void)
 {
-    g_memory_list = NULL;
-    g_total_allocated = 0;
-    g_total_freed = 0;
-    g_allocation_count = 0;
-    g_free_count = 0;
+    pthread_once(&g_tracker_once, tracker_init_once);
+    tracker_reset_counters();
     MEMORY_INFO("メモリ追跡システムを初期化しました");
 }
 
+/* ポインタのハッシュ（下位ビットは配置境界で揃っているので捨てて混ぜる） */
+static unsigned long tracker_hash(const void *ptr)
+{
+    unsigned long h = (unsigned long)ptr >> 4;
+    
+    h ^= h >> 16;
+    h *= 0x45d9f3bUL;
+    h ^= h >> 16;
+    return h;
+}
+
+/* ポインタの属するシャード */
+static TrackerShard *tracker_shard(const void *ptr)
+{
+    return &g_tracker_shards[tracker_hash(ptr) & (TRACKER_SHARDS - 1)];
+}
+
+/* シャード内のスロット */
+static size_t tracker_slot(const TrackerShard *shard, const void *ptr)
+{
+    return (size_t)(tracker_hash(ptr) >> TRACKER_SHARD_BITS) & (shard->capacity - 1);
+}
+
+/* スラブから追跡レコードを1つ取り出す（シャードのロックを持って呼ぶ） */
+static MemoryTracker *tracker_record_alloc(TrackerShard *shard)
+{
+    MemoryTracker *record;
+    
+    if (!shard->free_records) {
+        TrackerSlab *slab = (TrackerSlab *)malloc(sizeof(TrackerSlab));
+        int i;
+        
+        if (!slab) {
+            return NULL;
+        }
+        slab->next = shard->slabs;
+        shard->slabs = slab;
+        for (i = TRACKER_SLAB_RECORDS - 1; i >= 0; i--) {
+            slab->records[i].next = shard->free_records;
+            shard->free_records = &slab->records[i];
+        }
+    }
+    record = shard->free_records;
+    shard->free_records = record->next;
+    return record;
+}
+
+/* 追跡レコードをスラブに戻す（シャードのロックを持って呼ぶ） */
+static void tracker_record_free(TrackerShard *shard, MemoryTracker *record)
+{
+    record->next = shard->free_records;
+    shard->free_records = record;
+}
+
+/* シャードのハッシュ表を capacity スロットに作り直す（シャードのロックを持って呼ぶ） */
+static int tracker_table_resize(TrackerShard *shard, size_t capacity)
+{
+    MemoryTracker **old_table = shard->table;
+    size_t old_capacity = shard->capacity;
+    size_t i, slot;
+    
+    shard->table = (MemoryTracker **)calloc(capacity, sizeof(MemoryTracker *));
+    if (!shard->table) {
+        shard->table = old_table;
+        return -1;
+    }
+    shard->capacity = capacity;
+    
+    for (i = 0; i < old_capacity; i++) {
+        if (old_table[i]) {
+            slot = tracker_slot(shard, old_table[i]->ptr);
+            while (shard->table[slot]) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            shard->table[slot] = old_table[i];
+        }
+    }
+    free(old_table);
+    return 0;
+}
+
+/* 呼び出し元のバケット（__FILE__ は翻訳単位ごとに別の文字列になりうるので行番号だけで選ぶ） */
+static CallSite **call_site_bucket(int line)
+{
+    unsigned long h = (unsigned long)line * 0x9E3779B1UL;
+    return &g_call_sites[(h >> 8) & (CALL_SITE_BUCKETS - 1)];
+}
+
+/* バケットから (file, line) を探す */
+static CallSite *call_site_find(CallSite *site, const char *file, int line)
+{
+    for (; site; site = site->next) {
+        if (site->line == line && (site->file == file || strcmp(site->file, file) == 0)) {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+/* 呼び出し元の集計を引く（なければ登録する） */
+static CallSite *call_site_lookup(const char *file, int line)
+{
+    CallSite **bucket = call_site_bucket(line);
+    CallSite *site;
+    
+    site = call_site_find(CALL_SITE_ACQUIRE(bucket), file, line);
+    if (site) {
+        return site;
+    }
+    
+    pthread_mutex_lock(&g_call_sites_lock);
+    site = call_site_find(*bucket, file, line);
+    if (!site) {
+        site = (CallSite *)calloc(1, sizeof(CallSite));
+        if (site) {
+            site->file = file;
+            site->line = line;
+            site->next = *bucket;
+            CALL_SITE_PUBLISH(bucket, site);
+            g_call_site_count++;
+        }
+    }
+    pthread_mutex_unlock(&g_call_sites_lock);
+    return site;
+}
+
+/* 呼び出し元に割り当てを加える（ピークは使用中バイト数の最大値） */
+static void call_site_record_alloc(CallSite *site, size_t size)
+{
+    size_t live, peak;
+    
+#if !CALL_SITE_ATOMIC
+    pthread_mutex_lock(&g_call_sites_lock);
+#endif
+    live = CALL_SITE_ADD(&site->live_bytes, size);
+    CALL_SITE_ADD(&site->live_count, 1UL);
+    CALL_SITE_ADD(&site->total_allocs, 1UL);
+    CALL_SITE_ADD(&site->total_bytes, size);
+#if CALL_SITE_ATOMIC
+    peak = __atomic_load_n(&site->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&site->peak_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+#else
+    peak = site->peak_bytes;
+    if (live > peak) {
+        site->peak_bytes = live;
+    }
+    pthread_mutex_unlock(&g_call_sites_lock);
+#endif
+}
+
+/* 呼び出し元から解放した分を引く */
+static void call_site_record_free(CallSite *site, size_t size)
+{
+#if !CALL_SITE_ATOMIC
+    pthread_mutex_lock(&g_call_sites_lock);
+#endif
+    CALL_SITE_SUB(&site->live_bytes, size);
+    CALL_SITE_SUB(&site->live_count, 1UL);
+#if !CALL_SITE_ATOMIC
+    pthread_mutex_unlock(&g_call_sites_lock);
+#endif
+}
+
 /* メモリ追跡エントリの追加 */
 static void add_memory_tracker(void *ptr, size_t size, const char *file, int line)
 {
 #if MEMORY_TRACKING_ENABLED
-    MemoryTracker *tracker = (MemoryTracker *)malloc(sizeof(MemoryTracker));
+    TrackerShard *shard;
+    TrackerCounters *counters;
+    MemoryTracker *tracker;
+    CallSite *site;
+    size_t slot;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    site = call_site_lookup(file, line);
+    shard = tracker_shard(ptr);
+    
+    pthread_mutex_lock(&shard->lock);
+    
+    /* 使用率を1/2以下に保つ（探査列を短くする） */
+    if ((shard->count + 1) * 2 > shard->capacity &&
+        tracker_table_resize(shard, shard->capacity ? shard->capacity * 2
+                                                    : TRACKER_INITIAL_CAPACITY) < 0) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    
+    tracker = tracker_record_alloc(shard);
     if (tracker) {
         tracker->ptr = ptr;
         tracker->size = size;
         tracker->file = file;
         tracker->line = line;
-        tracker->next = g_memory_list;
-        g_memory_list = tracker;
+        tracker->site = site;
+        tracker->next = NULL;
         
-        g_total_allocated += size;
-        g_allocation_count++;
+        slot = tracker_slot(shard, ptr);
+        while (shard->table[slot]) {
+            slot = (slot + 1) & (shard->capacity - 1);
+        }
+        shard->table[slot] = tracker;
+        shard->count++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    
+    if (tracker && site) {
+        call_site_record_alloc(site, size);
+    }
+    counters = tracker_counters();
+    if (tracker && counters) {
+        TRACKER_ADD(&counters->total_allocated, size);
+        TRACKER_ADD(&counters->allocation_count, 1UL);
     }
 #endif
 }
 
-/* メモリ追跡エントリの削除 */
-static void remove_memory_tracker(void *ptr, const char *file, int line)
+/* メモリ追跡エントリの削除（removed が NULL でなければ消したレコードの内容を写す）
+ * 見つかれば1を返す */
+static int remove_memory_tracker(void *ptr, const char *file, int line, MemoryTracker *removed)
 {
 #if MEMORY_TRACKING_ENABLED
-    MemoryTracker **current = &g_memory_list;
-    while (*current) {
-        if ((*current)->ptr == ptr) {
-            MemoryTracker *to_remove = *current;
-            g_total_freed += to_remove->size;
-            g_free_count++;
-            *current = to_remove->next;
-            free(to_remove);
-            return;
+    TrackerShard *shard;
+    TrackerCounters *counters;
+    CallSite *site = NULL;
+    size_t mask, slot, next, home;
+    size_t size = 0;
+    int found = 0;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    shard = tracker_shard(ptr);
+    
+    pthread_mutex_lock(&shard->lock);
+    mask = shard->capacity - 1;
+    if (shard->table) {
+        for (slot = tracker_slot(shard, ptr); shard->table[slot]; slot = (slot + 1) & mask) {
+            MemoryTracker *to_remove = shard->table[slot];
+            
+            if (to_remove->ptr != ptr) {
+                continue;
+            }
+            size = to_remove->size;
+            site = to_remove->site;
+            found = 1;
+            if (removed) {
+                *removed = *to_remove;
+            }
+            shard->count--;
+            tracker_record_free(shard, to_remove);
+            
+            /* 後ろの探査列を詰め直す：本来の位置から空いた穴までの間にないレコードだけ動かす */
+            shard->table[slot] = NULL;
+            for (next = (slot + 1) & mask; shard->table[next]; next = (next + 1) & mask) {
+                home = tracker_slot(shard, shard->table[next]->ptr);
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                    shard->table[slot] = shard->table[next];
+                    shard->table[next] = NULL;
+                    slot = next;
+                }
+            }
+            break;
         }
-        current = &(*current)->next;
     }
-    fprintf(stderr, "[MEMORY WARNING:%s:%d] 解放されたポインタ %p が追跡リストに見つかりません\n",
-            file, line, ptr);
+    pthread_mutex_unlock(&shard->lock);
+    
+    if (!found) {
+        fprintf(stderr, "[MEMORY WARNING:%s:%d] 解放されたポインタ %p が追跡リストに見つかりません\n",
+                file, line, ptr);
+        return 0;
+    }
+    if (site) {
+        call_site_record_free(site, size);
+    }
+    counters = tracker_counters();
+    if (counters) {
+        TRACKER_ADD(&counters->total_freed, size);
+        TRACKER_ADD(&counters->free_count, 1UL);
+    }
+    return 1;
+#else
+    (void)ptr;
+    (void)file;
+    (void)line;
+    (void)removed;
+    return 0;
 #endif
 }
 
@@ -202,8 +648,10 @@ void *safe_malloc_impl(size_t size, const char *file, int line)
     }
     
     add_memory_tracker(ptr, size, file, line);
-    printf("[MEMORY INFO:%s:%d] malloc成功: %luバイト @ %p\n", 
-           file, line, (unsigned long)size, ptr);
+    if (g_memory_verbose) {
+        printf("[MEMORY INFO:%s:%d] malloc成功: %luバイト @ %p\n", 
+               file, line, (unsigned long)size, ptr);
+    }
     
     return ptr;
 }
@@ -235,8 +683,10 @@ void *safe_calloc_impl(size_t count, size_t size, const char *file, int line)
     }
     
     add_memory_tracker(ptr, total_size, file, line);
-    printf("[MEMORY INFO:%s:%d] calloc成功: %lu * %luバイト @ %p\n",
-           file, line, (unsigned long)count, (unsigned long)size, ptr);
+    if (g_memory_verbose) {
+        printf("[MEMORY INFO:%s:%d] calloc成功: %lu * %luバイト @ %p\n",
+               file, line, (unsigned long)count, (unsigned long)size, ptr);
+    }
     
     return ptr;
 }
@@ -245,6 +695,8 @@ void *safe_calloc_impl(size_t count, size_t size, const char *file, int line)
 void *safe_realloc_impl(void *ptr, size_t size, const char *file, int line)
 {
     void *new_ptr;
+    MemoryTracker old_record;
+    int tracked;
     
     if (!ptr) {
         return safe_malloc_impl(size, file, line);
@@ -255,19 +707,28 @@ void *safe_realloc_impl(void *ptr, size_t size, const char *file, int line)
         return NULL;
     }
     
+    /* realloc が古い領域を解放した直後に他のスレッドが同じアドレスを得て登録しうるので、
+     * 古いレコードは realloc の前に外しておく */
+    tracked = remove_memory_tracker(ptr, file, line, &old_record);
+    
     new_ptr = realloc(ptr, size);
     if (!new_ptr) {
         fprintf(stderr, "[MEMORY ERROR:%s:%d] realloc失敗: %luバイト\n", 
                 file, line, (unsigned long)size);
+        /* 元の領域は残っているので、元の割り当て元のまま登録し直す */
+        if (tracked) {
+            add_memory_tracker(ptr, old_record.size, old_record.file, old_record.line);
+        }
         return NULL;
     }
     
     /* 追跡情報の更新 */
-    remove_memory_tracker(ptr, file, line);
     add_memory_tracker(new_ptr, size, file, line);
     
-    printf("[MEMORY INFO:%s:%d] realloc成功: %p -> %p (%luバイト)\n",
-           file, line, ptr, new_ptr, (unsigned long)size);
+    if (g_memory_verbose) {
+        printf("[MEMORY INFO:%s:%d] realloc成功: %p -> %p (%luバイト)\n",
+               file, line, ptr, new_ptr, (unsigned long)size);
+    }
     
     return new_ptr;
 }
@@ -280,54 +741,239 @@ void safe_free_impl(void *ptr, const char *file, int line)
         return;
     }
     
-    remove_memory_tracker(ptr, file, line);
+    remove_memory_tracker(ptr, file, line, NULL);
     free(ptr);
     /* 注意: デバッグ目的でポインタ値を表示。実際のコードでは解放後のポインタアクセスは避ける */
-    printf("[MEMORY INFO:%s:%d] free成功: アドレス %p を解放しました\n", file, line, (void*)ptr);
+    if (g_memory_verbose) {
+        printf("[MEMORY INFO:%s:%d] free成功: アドレス %p を解放しました\n", file, line, (void*)ptr);
+    }
+}
+
+/* 呼び出し元の並べ替え（使用中バイト数、総割り当て回数の多い順） */
+static int compare_call_sites(const void *a, const void *b)
+{
+    const CallSite *sa = *(const CallSite *const *)a;
+    const CallSite *sb = *(const CallSite *const *)b;
+    
+    if (sa->live_bytes != sb->live_bytes) {
+        return sa->live_bytes < sb->live_bytes ? 1 : -1;
+    }
+    if (sa->total_allocs != sb->total_allocs) {
+        return sa->total_allocs < sb->total_allocs ? 1 : -1;
+    }
+    return sa->line - sb->line;
+}
+
+/* 呼び出し元の集計を取り出して並べる（値は複写するので並べ替え中に変わらない）
+ * leaks_only なら使用中のブロックがある呼び出し元だけ。呼び出し側で free する */
+static CallSite **collect_call_sites(int leaks_only, size_t *count)
+{
+    CallSite **sites;
+    CallSite *site, *copy;
+    size_t capacity, n = 0;
+    int i;
+    
+    pthread_mutex_lock(&g_call_sites_lock);
+    capacity = g_call_site_count;
+    sites = (CallSite **)malloc((capacity ? capacity : 1) * (sizeof(CallSite *) + sizeof(CallSite)));
+    if (sites) {
+        copy = (CallSite *)(sites + (capacity ? capacity : 1));
+        for (i = 0; i < CALL_SITE_BUCKETS; i++) {
+            for (site = g_call_sites[i]; site; site = site->next) {
+                copy->file = site->file;
+                copy->line = site->line;
+                copy->live_bytes = TRACKER_LOAD(&site->live_bytes);
+                copy->live_count = TRACKER_LOAD(&site->live_count);
+                copy->total_allocs = TRACKER_LOAD(&site->total_allocs);
+                copy->total_bytes = TRACKER_LOAD(&site->total_bytes);
+                copy->peak_bytes = TRACKER_LOAD(&site->peak_bytes);
+                copy->next = NULL;
+                if (!leaks_only || copy->live_count > 0) {
+                    sites[n++] = copy++;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_call_sites_lock);
+    
+    if (sites) {
+        qsort(sites, n, sizeof(CallSite *), compare_call_sites);
+    }
+    *count = n;
+    return sites;
+}
+
+/* 呼び出し元ごとの表を上位 top_n 件まで表示 */
+static void print_call_sites(CallSite **sites, size_t count, int top_n)
+{
+    size_t i;
+    
+    printf("  呼び出し元                   使用中バイト     使用中   割当回数 ピークバイト\n");
+    for (i = 0; i < count && (top_n <= 0 || i < (size_t)top_n); i++) {
+        char where[64];
+        
+        sprintf(where, "%.50s:%d", sites[i]->file, sites[i]->line);
+        printf("  %-28s %12lu %10lu %10lu %12lu\n", where,
+               (unsigned long)sites[i]->live_bytes, sites[i]->live_count,
+               sites[i]->total_allocs, (unsigned long)sites[i]->peak_bytes);
+    }
+    if (count > i) {
+        printf("  ... ほか %lu 箇所\n", (unsigned long)(count - i));
+    }
+}
+
+/* 呼び出し元ごとの割り当てプロファイル（top_n が0以下なら全件） */
+void report_call_sites(int top_n)
+{
+    CallSite **sites;
+    size_t count;
+    
+    sites = collect_call_sites(0, &count);
+    if (!sites) {
+        MEMORY_ERROR("呼び出し元集計の確保に失敗");
+        return;
+    }
+    printf("\n=== 呼び出し元ごとの割り当てプロファイル (%lu 箇所) ===\n", (unsigned long)count);
+    print_call_sites(sites, count, top_n);
+    printf("========================\n\n");
+    free(sites);
+}
+
+/* フレームグラフ用の折りたたみスタック形式で書き出す
+ * 1行が「ファイル;ファイル:行 値」で、値は使用中バイト数（by_allocations なら総割り当て回数）。
+ * 値が0の呼び出し元は出さない。flamegraph.pl などにそのまま渡せる */
+int export_folded_stacks(const char *path, int by_allocations)
+{
+    CallSite **sites;
+    size_t count, i;
+    FILE *fp;
+    
+    VALIDATE_POINTER_RETURN(path, -1);
+    
+    fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "[MEMORY ERROR:%s:%d] %s を開けません\n", __FILE__, __LINE__, path);
+        return -1;
+    }
+    sites = collect_call_sites(!by_allocations, &count);
+    if (!sites) {
+        fclose(fp);
+        MEMORY_ERROR("呼び出し元集計の確保に失敗");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        unsigned long value = by_allocations ? sites[i]->total_allocs
+                                             : (unsigned long)sites[i]->live_bytes;
+        if (value > 0) {
+            fprintf(fp, "%s;%s:%d %lu\n", sites[i]->file, sites[i]->file, sites[i]->line, value);
+        }
+    }
+    free(sites);
+    
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "[MEMORY ERROR:%s:%d] %s の書き込みに失敗\n", __FILE__, __LINE__, path);
+        return -1;
+    }
+    return 0;
 }
 
-/* メモリリークレポート */
+/* メモリリークレポート（スレッドごとの統計とシャードはここで初めて合算する）
+ * リークは呼び出し元ごとにまとめて表示し、ブロック数が少ないときだけ個別にも表示する */
 void report_memory_leaks(void)
 {
     MemoryTracker *current;
+    TrackerCounters totals;
+    CallSite **sites;
     size_t leak_total = 0;
-    int leak_count = 0;
+    size_t live, count, i;
+    int shard;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    tracker_totals(&totals);
+    live = tracker_live_count();
     
     printf("\n=== メモリリークレポート ===\n");
-    printf("総割り当て: %lu バイト (%d 回)\n",
-           (unsigned long)g_total_allocated, g_allocation_count);
-    printf("総解放: %lu バイト (%d 回)\n",
-           (unsigned long)g_total_freed, g_free_count);
+    printf("総割り当て: %lu バイト (%lu 回)\n",
+           (unsigned long)totals.total_allocated, totals.allocation_count);
+    printf("総解放: %lu バイト (%lu 回)\n",
+           (unsigned long)totals.total_freed, totals.free_count);
     
-    if (g_memory_list) {
+    if (live == 0) {
+        printf("メモリリークは検出されませんでした。\n");
+        printf("========================\n\n");
+        return;
+    }
+    
+    if (live <= LEAK_DUMP_LIMIT) {
         printf("\n検出されたリーク:\n");
-        current = g_memory_list;
-        
-        while (current) {
-            printf("  %p: %lu バイト (%s:%d)\n",
-                   current->ptr, (unsigned long)current->size,
-                   current->file, current->line);
-            leak_total += current->size;
-            leak_count++;
-            current = current->next;
+        for (shard = 0; shard < TRACKER_SHARDS; shard++) {
+            TrackerShard *ts = &g_tracker_shards[shard];
+            
+            pthread_mutex_lock(&ts->lock);
+            for (i = 0; i < ts->capacity; i++) {
+                current = ts->table[i];
+                if (current) {
+                    printf("  %p: %lu バイト (%s:%d)\n",
+                           current->ptr, (unsigned long)current->size,
+                           current->file, current->line);
+                }
+            }
+            pthread_mutex_unlock(&ts->lock);
         }
-        
-        printf("\nリーク合計: %lu バイト (%d ブロック)\n",
-               (unsigned long)leak_total, leak_count);
-    } else {
-        printf("メモリリークは検出されませんでした。\n");
     }
+    
+    sites = collect_call_sites(1, &count);
+    if (sites) {
+        printf("\nリークした呼び出し元 (%lu 箇所):\n", (unsigned long)count);
+        print_call_sites(sites, count, LEAK_REPORT_TOP_SITES);
+        for (i = 0; i < count; i++) {
+            leak_total += sites[i]->live_bytes;
+        }
+        free(sites);
+    }
+    
+    printf("\nリーク合計: %lu バイト (%lu ブロック)\n",
+           (unsigned long)leak_total, (unsigned long)live);
     printf("========================\n\n");
 }
 
-/* メモリ追跡システムのクリーンアップ */
+/* メモリ追跡システムのクリーンアップ（他のスレッドが追跡を使い終えてから呼ぶ） */
 void cleanup_memory_tracker(void)
 {
-    while (g_memory_list) {
-        MemoryTracker *to_remove = g_memory_list;
-        g_memory_list = g_memory_list->next;
-        free(to_remove);
+    int i;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    for (i = 0; i < TRACKER_SHARDS; i++) {
+        TrackerShard *shard = &g_tracker_shards[i];
+        
+        pthread_mutex_lock(&shard->lock);
+        while (shard->slabs) {
+            TrackerSlab *to_remove = shard->slabs;
+            shard->slabs = shard->slabs->next;
+            free(to_remove);
+        }
+        free(shard->table);
+        shard->table = NULL;
+        shard->capacity = 0;
+        shard->count = 0;
+        shard->free_records = NULL;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    
+    /* スレッドごとの統計は0に戻すだけ（動いているスレッドがまだ書き込む） */
+    tracker_reset_counters();
+    
+    /* 呼び出し元の集計 */
+    pthread_mutex_lock(&g_call_sites_lock);
+    for (i = 0; i < CALL_SITE_BUCKETS; i++) {
+        while (g_call_sites[i]) {
+            CallSite *to_remove = g_call_sites[i];
+            g_call_sites[i] = to_remove->next;
+            free(to_remove);
+        }
     }
+    g_call_site_count = 0;
+    pthread_mutex_unlock(&g_call_sites_lock);
     MEMORY_INFO("メモリ追跡システムをクリーンアップしました");
 }
 
@@ -477,6 +1123,299 @@ void test_memory_leak_detection(void)
     /* leak1とleak2は意図的に解放しない */
 }
 
+/* 呼び出し元ごとの集計テスト
+ * 小さなブロックを大量に残す呼び出し元と、割り当て・解放を繰り返すだけの呼び出し元を作り、
+ * 上位N件の表と折りたたみスタック形式の出力を確かめる */
+#define PROFILE_SMALL_BLOCKS 5000
+#define PROFILE_MEDIUM_BLOCKS 200
+#define PROFILE_FOLDED_PATH "safe_memory_profile.folded"
+
+static void *g_profile_small[PROFILE_SMALL_BLOCKS];
+static void *g_profile_medium[PROFILE_MEDIUM_BLOCKS];
+
+void test_call_site_profile(void)
+{
+    void *temp;
+    char line[256];
+    FILE *fp;
+    int i, lines = 0;
+    
+    printf("=== 呼び出し元ごとの集計テスト ===\n");
+    
+    g_memory_verbose = 0;
+    for (i = 0; i < PROFILE_SMALL_BLOCKS; i++) {
+        g_profile_small[i] = SAFE_MALLOC(24);
+    }
+    for (i = 0; i < PROFILE_MEDIUM_BLOCKS; i++) {
+        g_profile_medium[i] = SAFE_MALLOC(512);
+    }
+    /* 使用中の分は残らないがピークは1ブロック分 */
+    for (i = 0; i < 1000; i++) {
+        temp = SAFE_MALLOC(4096);
+        SAFE_FREE(temp);
+    }
+    g_memory_verbose = 1;
+    
+    report_call_sites(5);
+    
+    /* 使用中バイト数の折りたたみスタック */
+    if (export_folded_stacks(PROFILE_FOLDED_PATH, 0) == 0 &&
+        (fp = fopen(PROFILE_FOLDED_PATH, "r")) != NULL) {
+        printf("%s:\n", PROFILE_FOLDED_PATH);
+        while (fgets(line, sizeof(line), fp)) {
+            printf("  %s", line);
+            lines++;
+        }
+        fclose(fp);
+        remove(PROFILE_FOLDED_PATH);
+    }
+    /* 使用中のブロックがあるのは leak1, leak2 と上の2箇所 */
+    printf("折りたたみスタックの行数: %d %s\n", lines, lines == 4 ? "OK" : "NG");
+    
+    g_memory_verbose = 0;
+    for (i = 0; i < PROFILE_SMALL_BLOCKS; i++) {
+        SAFE_FREE(g_profile_small[i]);
+    }
+    for (i = 0; i < PROFILE_MEDIUM_BLOCKS; i++) {
+        SAFE_FREE(g_profile_medium[i]);
+    }
+    g_memory_verbose = 1;
+    printf("\n");
+}
+
+/* 複数スレッドからの追跡テスト
+ * 各スレッドが自分のリングで割り当て・解放を繰り返し、最後に残したブロックは
+ * メインスレッドが解放する（割り当てたスレッドと解放するスレッドが異なる） */
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_OPS 200000L
+#define CONCURRENT_LIVE 64
+
+typedef struct ConcurrentWorker {
+    pthread_t thread;
+    void *ring[CONCURRENT_LIVE];
+} ConcurrentWorker;
+
+static ConcurrentWorker g_concurrent_workers[CONCURRENT_THREADS];
+
+static void *concurrent_worker(void *arg)
+{
+    ConcurrentWorker *w = (ConcurrentWorker *)arg;
+    long i;
+    int slot;
+    
+    for (i = 0; i < CONCURRENT_OPS; i++) {
+        slot = (int)(i % CONCURRENT_LIVE);
+        SAFE_FREE(w->ring[slot]);
+        w->ring[slot] = SAFE_MALLOC((size_t)(16 + slot));
+    }
+    return NULL;
+}
+
+static double run_concurrent_workers(int threads)
+{
+    clock_t start = clock();
+    int i, created;
+    
+    memset(g_concurrent_workers, 0, sizeof(g_concurrent_workers));
+    for (created = 0; created < threads; created++) {
+        if (pthread_create(&g_concurrent_workers[created].thread, NULL,
+                           concurrent_worker, &g_concurrent_workers[created]) != 0) {
+            break;
+        }
+    }
+    for (i = 0; i < created; i++) {
+        pthread_join(g_concurrent_workers[i].thread, NULL);
+    }
+    for (i = 0; i < threads; i++) {
+        int slot;
+        for (slot = 0; slot < CONCURRENT_LIVE; slot++) {
+            SAFE_FREE(g_concurrent_workers[i].ring[slot]);
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void test_concurrent_tracking(void)
+{
+    TrackerCounters before, after;
+    size_t live = tracker_live_count();
+    double elapsed;
+    int threads;
+    
+    printf("=== 複数スレッドからの追跡テスト ===\n");
+    
+    g_memory_verbose = 0;
+    for (threads = 1; threads <= CONCURRENT_THREADS; threads *= 2) {
+        tracker_totals(&before);
+        elapsed = run_concurrent_workers(threads);
+        tracker_totals(&after);
+        
+        printf("%dスレッド x %ld 回: CPU時間 %.3f 秒, 割り当て %lu 回, 解放 %lu 回 %s\n",
+               threads, CONCURRENT_OPS, elapsed,
+               after.allocation_count - before.allocation_count,
+               after.free_count - before.free_count,
+               after.allocation_count - before.allocation_count ==
+                       (unsigned long)(threads * CONCURRENT_OPS) &&
+               after.free_count - before.free_count ==
+                       (unsigned long)(threads * CONCURRENT_OPS) &&
+               after.total_freed - before.total_freed ==
+                       after.total_allocated - before.total_allocated &&
+               tracker_live_count() == live ? "OK" : "NG");
+    }
+    g_memory_verbose = 1;
+    printf("\n");
+}
+
+/* 追跡方式の比較ベンチマーク
+ * 以前の方式（追跡ノードを1つずつmallocして片方向リストの先頭に積み、解放時は線形探索）と
+ * 現在のハッシュ表で、live 個を生かしたまま最も古いものから解放する割り当て・解放を繰り返す。
+ * どちらも malloc/free と追跡の登録・削除だけを測る（ログや引数検査は通さない）。
+ * リスト側もロック・呼び出し元の集計・スレッドごとの統計をハッシュ表側と同じだけ行い、
+ * 追跡レコードの索引の違いだけが差に出るようにする */
+#define TRACKER_BENCH_PAIRS 1000000L
+#define TRACKER_BENCH_MAX_LIVE 1000
+
+static MemoryTracker *g_bench_list = NULL;
+static pthread_mutex_t g_bench_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *g_bench_ring[TRACKER_BENCH_MAX_LIVE];
+
+static void bench_list_add(void *ptr, size_t size, const char *file, int line)
+{
+    TrackerCounters *counters;
+    MemoryTracker *tracker;
+    CallSite *site;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    site = call_site_lookup(file, line);
+    
+    pthread_mutex_lock(&g_bench_list_lock);
+    tracker = (MemoryTracker *)malloc(sizeof(MemoryTracker));
+    if (tracker) {
+        tracker->ptr = ptr;
+        tracker->size = size;
+        tracker->file = file;
+        tracker->line = line;
+        tracker->site = site;
+        tracker->next = g_bench_list;
+        g_bench_list = tracker;
+    }
+    pthread_mutex_unlock(&g_bench_list_lock);
+    
+    if (tracker && site) {
+        call_site_record_alloc(site, size);
+    }
+    counters = tracker_counters();
+    if (tracker && counters) {
+        TRACKER_ADD(&counters->total_allocated, size);
+        TRACKER_ADD(&counters->allocation_count, 1UL);
+    }
+}
+
+static void bench_list_remove(void *ptr)
+{
+    TrackerCounters *counters;
+    MemoryTracker **current;
+    MemoryTracker *to_remove = NULL;
+    
+    pthread_once(&g_tracker_once, tracker_init_once);
+    
+    pthread_mutex_lock(&g_bench_list_lock);
+    for (current = &g_bench_list; *current; current = &(*current)->next) {
+        if ((*current)->ptr == ptr) {
+            to_remove = *current;
+            *current = to_remove->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_bench_list_lock);
+    
+    if (!to_remove) {
+        return;
+    }
+    if (to_remove->site) {
+        call_site_record_free(to_remove->site, to_remove->size);
+    }
+    counters = tracker_counters();
+    if (counters) {
+        TRACKER_ADD(&counters->total_freed, to_remove->size);
+        TRACKER_ADD(&counters->free_count, 1UL);
+    }
+    free(to_remove);
+}
+
+static double bench_tracker(int use_list, int live)
+{
+    clock_t start;
+    long i;
+    int slot;
+    
+    memset(g_bench_ring, 0, sizeof(g_bench_ring));
+    start = clock();
+    for (i = 0; i < TRACKER_BENCH_PAIRS; i++) {
+        slot = (int)(i % live);
+        if (use_list) {
+            if (g_bench_ring[slot]) {
+                bench_list_remove(g_bench_ring[slot]);
+                free(g_bench_ring[slot]);
+            }
+            g_bench_ring[slot] = malloc(32);
+            bench_list_add(g_bench_ring[slot], 32, __FILE__, __LINE__);
+        } else {
+            if (g_bench_ring[slot]) {
+                remove_memory_tracker(g_bench_ring[slot], __FILE__, __LINE__, NULL);
+                free(g_bench_ring[slot]);
+            }
+            g_bench_ring[slot] = malloc(32);
+            add_memory_tracker(g_bench_ring[slot], 32, __FILE__, __LINE__);
+        }
+    }
+    for (slot = 0; slot < live; slot++) {
+        if (use_list) {
+            bench_list_remove(g_bench_ring[slot]);
+        } else {
+            remove_memory_tracker(g_bench_ring[slot], __FILE__, __LINE__, NULL);
+        }
+        free(g_bench_ring[slot]);
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void benchmark_tracker(void)
+{
+    static const int live_counts[] = {10, 100, TRACKER_BENCH_MAX_LIVE};
+    TrackerCounters *counters = tracker_counters();
+    TrackerCounters saved;
+    size_t leaks = tracker_live_count();
+    double list_time, table_time;
+    int i;
+    
+    if (!counters) {
+        return;
+    }
+    saved = *counters;
+    
+    printf("=== 追跡方式のベンチマーク (割り当て・解放 %ld 組) ===\n", TRACKER_BENCH_PAIRS);
+    printf("同時に生きている数  リスト(秒)  ハッシュ表(秒)  速度比\n");
+    
+    g_memory_verbose = 0;
+    for (i = 0; i < (int)(sizeof(live_counts) / sizeof(live_counts[0])); i++) {
+        list_time = bench_tracker(1, live_counts[i]);
+        table_time = bench_tracker(0, live_counts[i]);
+        printf("%18d  %10.3f  %14.3f  %5.1fx\n",
+               live_counts[i], list_time, table_time,
+               table_time > 0.0 ? list_time / table_time : 0.0);
+    }
+    g_memory_verbose = 1;
+    
+    /* ベンチマーク分を統計から除く（リークとして残っている分は変わらない） */
+    TRACKER_ADD(&counters->total_allocated, saved.total_allocated - counters->total_allocated);
+    TRACKER_ADD(&counters->total_freed, saved.total_freed - counters->total_freed);
+    TRACKER_ADD(&counters->allocation_count, saved.allocation_count - counters->allocation_count);
+    TRACKER_ADD(&counters->free_count, saved.free_count - counters->free_count);
+    printf("ベンチマーク後の追跡中の割り当て: %lu 件 %s\n\n",
+           (unsigned long)tracker_live_count(), tracker_live_count() == leaks ? "OK" : "NG");
+}
+
 /* メイン関数 */
 int main(void)
 {
@@ -490,10 +1429,15 @@ int main(void)
     test_array_bounds_checking();
     test_string_operations();
     test_memory_leak_detection();
+    test_call_site_profile();
     
     /* メモリリークレポートの表示 */
     MEMORY_LEAK_TRACKER_REPORT();
     
+    /* 複数スレッドからの追跡と追跡方式のベンチマーク */
+    test_concurrent_tracking();
+    benchmark_tracker();
+    
     /* メモリ追跡システムのクリーンアップ */
     MEMORY_LEAK_TRACKER_CLEANUP();
     
@@ -505,18 +1449,17 @@ int main(void)
 実行例:
 === 安全なメモリ操作マクロデモ ===
 
-[MEMORY INFO:ex13_2_safe_memory.c:135] メモリ追跡システムを初期化しました
-
+[MEMORY INFO:ex15_2_safe_memory.c:340] メモリ追跡システムを初期化しました
 === 安全なメモリ割り当てテスト ===
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 40バイト @ 0x1234560
+[MEMORY INFO:ex15_2_safe_memory.c:990] malloc成功: 40バイト @ 0x1234560
 割り当てた配列: 0 1 4 9 16 25 36 49 64 81 
-[MEMORY INFO:ex13_2_safe_memory.c:279] realloc成功: 0x1234560 -> 0x1234580 (80バイト)
+[MEMORY INFO:ex15_2_safe_memory.c:1004] realloc成功: 0x1234560 -> 0x1237840 (80バイト)
 拡張後の配列: 0 1 4 9 16 25 36 49 64 81 100 121 144 169 196 225 256 289 324 361 
-[MEMORY INFO:ex13_2_safe_memory.c:295] free成功: 0x1234580
+[MEMORY INFO:ex15_2_safe_memory.c:1017] free成功: アドレス 0x1237840 を解放しました
 メモリを正常に解放しました
 
 === 配列境界チェックテスト ===
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 20バイト @ 0x12345a0
+[MEMORY INFO:ex15_2_safe_memory.c:1029] malloc成功: 20バイト @ 0x123ab10
 配列内容: 10 20 30 40 50 
 安全なアクセステスト:
   インデックス -1: 境界外アクセス
@@ -532,39 +1475,76 @@ int main(void)
     -> デフォルト値: -1
 
 安全な設定テスト:
-[MEMORY ERROR:ex13_2_safe_memory.c:390] 配列境界エラー: インデックス 10 が範囲 [0, 5) を超えています
-[MEMORY ERROR:ex13_2_safe_memory.c:391] 配列境界エラー: インデックス -1 が範囲 [0, 5) を超えています
+[MEMORY ERROR:ex15_2_safe_memory.c:1059] 配列境界エラー: インデックス 10 が範囲 [0, 5) を超えています
+[MEMORY ERROR:ex15_2_safe_memory.c:1060] 配列境界エラー: インデックス -1 が範囲 [0, 5) を超えています
 設定後の配列: 10 20 999 40 50 
-[MEMORY INFO:ex13_2_safe_memory.c:295] free成功: 0x12345a0
+[MEMORY INFO:ex15_2_safe_memory.c:1068] free成功: アドレス 0x123ab10 を解放しました
 
 === 安全な文字列操作テスト ===
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 64バイト @ 0x12345c0
+[MEMORY INFO:ex15_2_safe_memory.c:1080] malloc成功: 64バイト @ 0x123dda0
 初期文字列: Hello, World!
 連結後: Hello, World! 追加テキスト
 切り詰められた文字列: AAAAAAAAAAAAAAAAAAA
-[MEMORY INFO:ex13_2_safe_memory.c:295] free成功: 0x12345c0
+[MEMORY INFO:ex15_2_safe_memory.c:1098] free成功: アドレス 0x123dda0 を解放しました
 
 === メモリリーク検出テスト ===
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 100バイト @ 0x1234600
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 200バイト @ 0x1234680
-[MEMORY INFO:ex13_2_safe_memory.c:207] malloc成功: 50バイト @ 0x1234780
-[MEMORY INFO:ex13_2_safe_memory.c:295] free成功: 0x1234780
+[MEMORY INFO:ex15_2_safe_memory.c:1111] malloc成功: 100バイト @ 0x1241060
+[MEMORY INFO:ex15_2_safe_memory.c:1112] malloc成功: 200バイト @ 0x1244340
+[MEMORY INFO:ex15_2_safe_memory.c:1113] malloc成功: 50バイト @ 0x1247680
+[MEMORY INFO:ex15_2_safe_memory.c:1116] free成功: アドレス 0x1247680 を解放しました
 意図的にリークを作成しました
-leak1 = 0x1234600 (100バイト)
-leak2 = 0x1234680 (200バイト)
+leak1 = 0x1241060 (100バイト)
+leak2 = 0x1244340 (200バイト)
 no_leakは解放済み
 
+=== 呼び出し元ごとの集計テスト ===
+
+=== 呼び出し元ごとの割り当てプロファイル (10 箇所) ===
+  呼び出し元                   使用中バイト     使用中   割当回数 ピークバイト
+  ex15_2_safe_memory.c:1147          120000       5000       5000       120000
+  ex15_2_safe_memory.c:1150          102400        200        200       102400
+  ex15_2_safe_memory.c:1112             200          1          1          200
+  ex15_2_safe_memory.c:1111             100          1          1          100
+  ex15_2_safe_memory.c:1154               0          0       1000         4096
+  ... ほか 5 箇所
+========================
+
+safe_memory_profile.folded:
+  ex15_2_safe_memory.c;ex15_2_safe_memory.c:1147 120000
+  ex15_2_safe_memory.c;ex15_2_safe_memory.c:1150 102400
+  ex15_2_safe_memory.c;ex15_2_safe_memory.c:1112 200
+  ex15_2_safe_memory.c;ex15_2_safe_memory.c:1111 100
+折りたたみスタックの行数: 4 OK
+
+
 === メモリリークレポート ===
-総割り当て: 474 バイト (5 回)
-総解放: 174 バイト (3 回)
+総割り当て: 4318954 バイト (6207 回)
+総解放: 4318654 バイト (6205 回)
 
 検出されたリーク:
-  0x1234680: 200 バイト (ex13_2_safe_memory.c:448)
-  0x1234600: 100 バイト (ex13_2_safe_memory.c:447)
+  0x1244340: 200 バイト (ex15_2_safe_memory.c:1112)
+  0x1241060: 100 バイト (ex15_2_safe_memory.c:1111)
+
+リークした呼び出し元 (2 箇所):
+  呼び出し元                   使用中バイト     使用中   割当回数 ピークバイト
+  ex15_2_safe_memory.c:1112             200          1          1          200
+  ex15_2_safe_memory.c:1111             100          1          1          100
 
 リーク合計: 300 バイト (2 ブロック)
 ========================
 
-[MEMORY INFO:ex13_2_safe_memory.c:319] メモリ追跡システムをクリーンアップしました
+=== 複数スレッドからの追跡テスト ===
+1スレッド x 200000 回: CPU時間 0.032 秒, 割り当て 200000 回, 解放 200000 回 OK
+2スレッド x 200000 回: CPU時間 0.057 秒, 割り当て 400000 回, 解放 400000 回 OK
+4スレッド x 200000 回: CPU時間 0.109 秒, 割り当て 800000 回, 解放 800000 回 OK
+
+=== 追跡方式のベンチマーク (割り当て・解放 1000000 組) ===
+同時に生きている数  リスト(秒)  ハッシュ表(秒)  速度比
+                10       0.106           0.108    1.0x
+               100       0.272           0.110    2.5x
+              1000       3.314           0.115   28.9x
+ベンチマーク後の追跡中の割り当て: 2 件 OK
+
+[MEMORY INFO:ex15_2_safe_memory.c:977] メモリ追跡システムをクリーンアップしました
 === デモ完了 ===
-*/
\ No newline at end of file
+*/
@@ -2,14 +2,30 @@
  * 演習15-3の解答例: 基本的なメモリプール
  * ファイル名: ex15_3_memory_pool.c
  * 説明: 固定サイズオブジェクト用のメモリプール実装
- * C90準拠
+ * C90準拠（スレッドセーフモードはPOSIXスレッドを使用、
+ *          C11でコンパイルすると並行モードがロックフリーになる）
  */
 
+/* POSIXスレッド・clock_gettimeを使用するための機能テストマクロ */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* C11アトミックが使える場合は並行モードをロックフリースタックで実装する */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#include <stdint.h>
+#define POOL_HAS_ATOMICS 1
+#else
+#define POOL_HAS_ATOMICS 0
+#endif
 
 /* デバッグ出力制御 */
 #define DEBUG_POOL 1
@@ -25,6 +41,14 @@
 #define POOL_ALIGNMENT 8
 #define POOL_MAGIC_NUMBER 0xDEADBEEF
 
+/* 拡張ポリシーの既定値 */
+#define POOL_DEFAULT_GROWTH_FACTOR 2.0   /* 拡張ごとに総容量を何倍にするか */
+#define POOL_DEFAULT_SHRINK_WATERMARK 0.25 /* この使用率を下回ったら空チャンクを返却 */
+
+/* スレッドローカルキャッシュ（マガジン）の設定 */
+#define POOL_MAGAZINE_SIZE 64   /* 1スレッドが保持できる最大オブジェクト数 */
+#define POOL_MAGAZINE_BATCH 32  /* 共有フリーリストとの一括移動数 */
+
 /* アライメント調整マクロ */
 #define ALIGN_SIZE(size, alignment) \
     (((size) + (alignment) - 1) & ~((alignment) - 1))
@@ -34,17 +58,79 @@ typedef struct FreeNode {
     struct FreeNode *next;
 } FreeNode;
 
+#if POOL_HAS_ATOMICS
+/* ロックフリースタックのノード: 次ノードをインデックス+1で保持（0は終端）
+ * ポインタではなくインデックスにすることで、先頭を世代タグと合わせて
+ * 64ビット1語に詰めてCASできる */
+typedef struct LFNode {
+    _Atomic uint32_t next;
+} LFNode;
+
+#define LF_INDEX_MASK 0xFFFFFFFFu
+#define LF_TAG_SHIFT 32
+#endif
+
+/* 拡張用の追加チャンク（最初のメモリ領域とは別に連結リストで管理）
+ * 空きオブジェクトはチャンクごとのフリーリストに持ち、空きのあるチャンクだけを
+ * 別のリストにつなぐ。割り当て・解放でチャンクを探さずに使用数を数えられる */
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+    struct PoolChunk *prev;
+    struct PoolChunk *next_partial; /* 空きのあるチャンク一覧 */
+    struct PoolChunk *prev_partial;
+    char *memory;           /* チャンクのメモリ領域 */
+    FreeNode *free_list;    /* チャンク内の空きオブジェクト */
+    size_t capacity;        /* チャンク内のオブジェクト数 */
+    size_t in_use;          /* チャンク内の使用中オブジェクト数 */
+} PoolChunk;
+
+struct MemoryPool;
+
+/* スレッドローカルキャッシュ（マガジン）
+ * 各スレッドは自分専用のマガジンから割り当て・解放を行い、
+ * 空・満杯になったときだけロックを取って共有フリーリストと一括交換する */
+typedef struct PoolMagazine {
+    struct MemoryPool *pool;       /* 所属プール */
+    struct PoolMagazine *next;     /* プール内のマガジン一覧 */
+    struct PoolMagazine *prev;
+    size_t count;                  /* キャッシュ中のオブジェクト数 */
+    size_t pending_allocs;         /* 未集計の割り当て数 */
+    size_t pending_frees;          /* 未集計の解放数 */
+    void *objects[POOL_MAGAZINE_SIZE];
+} PoolMagazine;
+
 /* メモリプール構造体 */
 typedef struct MemoryPool {
     void *memory_chunk;     /* プール全体のメモリ領域 */
     FreeNode *free_list;    /* フリーリストの先頭 */
     size_t object_size;     /* オブジェクトサイズ */
-    size_t pool_capacity;   /* プールの容量 */
+    size_t pool_capacity;   /* プールの容量（追加チャンクを含む） */
+    size_t base_capacity;   /* memory_chunkの容量 */
     size_t objects_in_use;  /* 使用中オブジェクト数 */
     size_t total_allocated; /* 総割り当て数 */
     size_t total_freed;     /* 総解放数 */
     unsigned int magic;     /* 破損検出用マジックナンバー */
     char name[32];          /* プール名 */
+    /* 拡張ポリシー（pool_create_growable） */
+    int growable;                 /* 1: 枯渇時に追加チャンクを確保 */
+    double growth_factor;         /* 拡張後の総容量 / 拡張前の総容量 */
+    double shrink_watermark;      /* 空チャンク返却の使用率しきい値 */
+    PoolChunk *chunks;            /* 追加チャンク一覧 */
+    PoolChunk *partial_chunks;    /* 空きのある追加チャンク一覧 */
+    size_t chunk_count;           /* 追加チャンク数 */
+    size_t empty_chunks;          /* 使用中オブジェクトのない追加チャンク数 */
+    /* スレッドセーフモード */
+    int thread_safe;              /* 0: 単一スレッド, 1: マガジン方式 */
+    pthread_mutex_t lock;         /* 共有フリーリスト保護用 */
+    pthread_key_t magazine_key;   /* スレッドごとのマガジン */
+    PoolMagazine *magazines;      /* 生存中のマガジン一覧 */
+    /* 並行モード（pool_create_concurrent） */
+    int concurrent;               /* 1: 任意のスレッドから割り当て・解放可能 */
+#if POOL_HAS_ATOMICS
+    _Atomic uint64_t lf_head;     /* 下位32ビット: 先頭インデックス+1, 上位: 世代タグ */
+    atomic_size_t lf_allocated;   /* 総割り当て数 */
+    atomic_size_t lf_freed;       /* 総解放数 */
+#endif
 } MemoryPool;
 
 /* プール検証マクロ */
@@ -66,6 +152,13 @@ typedef struct MemoryPool {
 
 /* 関数プロトタイプ */
 MemoryPool *pool_create(const char *name, size_t object_size, size_t capacity);
+MemoryPool *pool_create_threadsafe(const char *name, size_t object_size,
+                                   size_t capacity);
+MemoryPool *pool_create_concurrent(const char *name, size_t object_size,
+                                   size_t capacity);
+MemoryPool *pool_create_growable(const char *name, size_t object_size,
+                                 size_t capacity, double growth_factor,
+                                 double shrink_watermark);
 void *pool_alloc(MemoryPool *pool);
 void pool_free(MemoryPool *pool, void *ptr);
 void pool_print_status(const MemoryPool *pool);
@@ -114,10 +207,21 @@ MemoryPool *pool_create(const char *name, size_t object_size, size_t capacity)
     pool->memory_chunk = memory;
     pool->object_size = object_size;
     pool->pool_capacity = capacity;
+    pool->base_capacity = capacity;
     pool->objects_in_use = 0;
     pool->total_allocated = 0;
     pool->total_freed = 0;
     pool->magic = POOL_MAGIC_NUMBER;
+    pool->thread_safe = 0;
+    pool->magazines = NULL;
+    pool->concurrent = 0;
+    pool->growable = 0;
+    pool->growth_factor = 1.0;
+    pool->shrink_watermark = 0.0;
+    pool->chunks = NULL;
+    pool->partial_chunks = NULL;
+    pool->chunk_count = 0;
+    pool->empty_chunks = 0;
     strncpy(pool->name, name, sizeof(pool->name) - 1);
     pool->name[sizeof(pool->name) - 1] = '\0';
     
@@ -138,21 +242,533 @@ MemoryPool *pool_create(const char *name, size_t object_size, size_t capacity)
     return pool;
 }
 
-/* オブジェクトの割り当て */
-void *pool_alloc(MemoryPool *pool)
+/* 拡張可能なプールの作成
+ * 枯渇時は総容量がgrowth_factor倍になるよう追加チャンクを確保し、
+ * 使用率がshrink_watermarkを下回ったら空になった追加チャンクを返却する。
+ * 最初のメモリ領域は常に保持するため、定常状態の容量で作成すればよい */
+MemoryPool *pool_create_growable(const char *name, size_t object_size,
+                                 size_t capacity, double growth_factor,
+                                 double shrink_watermark)
+{
+    MemoryPool *pool;
+    
+    if (growth_factor <= 1.0 || shrink_watermark < 0.0 || shrink_watermark >= 1.0) {
+        fprintf(stderr, "無効な拡張ポリシー: 拡張率=%.2f, しきい値=%.2f\n",
+                growth_factor, shrink_watermark);
+        return NULL;
+    }
+    
+    pool = pool_create(name, object_size, capacity);
+    if (!pool) {
+        return NULL;
+    }
+    
+    pool->growable = 1;
+    pool->growth_factor = growth_factor;
+    pool->shrink_watermark = shrink_watermark;
+    
+    printf("[POOL DEBUG] プール '%s' を拡張可能に設定 (拡張率=%.2f, 返却しきい値=%.0f%%)\n",
+           pool->name, growth_factor, shrink_watermark * 100.0);
+    
+    return pool;
+}
+
+/* 空きのあるチャンク一覧への出し入れ */
+static void pool_link_partial(MemoryPool *pool, PoolChunk *chunk)
+{
+    chunk->prev_partial = NULL;
+    chunk->next_partial = pool->partial_chunks;
+    if (pool->partial_chunks) {
+        pool->partial_chunks->prev_partial = chunk;
+    }
+    pool->partial_chunks = chunk;
+}
+
+static void pool_unlink_partial(MemoryPool *pool, PoolChunk *chunk)
+{
+    if (chunk->prev_partial) {
+        chunk->prev_partial->next_partial = chunk->next_partial;
+    } else {
+        pool->partial_chunks = chunk->next_partial;
+    }
+    if (chunk->next_partial) {
+        chunk->next_partial->prev_partial = chunk->prev_partial;
+    }
+}
+
+/* 追加チャンクを確保してチャンク自身のフリーリストを作る */
+static int pool_grow(MemoryPool *pool)
+{
+    PoolChunk *chunk;
+    size_t capacity;
+    size_t i;
+    
+    capacity = (size_t)((double)pool->pool_capacity * (pool->growth_factor - 1.0));
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    
+    chunk = (PoolChunk *)malloc(sizeof(PoolChunk));
+    if (!chunk) {
+        return 0;
+    }
+    chunk->memory = (char *)malloc(pool->object_size * capacity);
+    if (!chunk->memory) {
+        fprintf(stderr, "チャンクメモリの割り当てに失敗: %lu バイト\n",
+                (unsigned long)(pool->object_size * capacity));
+        free(chunk);
+        return 0;
+    }
+    chunk->capacity = capacity;
+    chunk->in_use = 0;
+    chunk->free_list = NULL;
+    for (i = 0; i < capacity; i++) {
+        FreeNode *node = (FreeNode *)(chunk->memory + i * pool->object_size);
+        node->next = chunk->free_list;
+        chunk->free_list = node;
+    }
+    
+    chunk->prev = NULL;
+    chunk->next = pool->chunks;
+    if (pool->chunks) {
+        pool->chunks->prev = chunk;
+    }
+    pool->chunks = chunk;
+    pool_link_partial(pool, chunk);
+    pool->chunk_count++;
+    pool->empty_chunks++;
+    pool->pool_capacity += capacity;
+    
+    printf("[POOL DEBUG] プール '%s' を拡張: +%lu オブジェクト (総容量: %lu, チャンク数: %lu)\n",
+           pool->name, (unsigned long)capacity, (unsigned long)pool->pool_capacity,
+           (unsigned long)pool->chunk_count);
+    
+    return 1;
+}
+
+/* ポインタを含む追加チャンクを検索（最初のメモリ領域・範囲外ならNULL） */
+static PoolChunk *pool_find_chunk(const MemoryPool *pool, const char *ptr)
+{
+    PoolChunk *chunk;
+    
+    for (chunk = pool->chunks; chunk; chunk = chunk->next) {
+        if (ptr >= chunk->memory &&
+            ptr < chunk->memory + chunk->capacity * pool->object_size) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+/* 空になった追加チャンクを一覧から外してOSへ返却 */
+static void pool_release_chunk(MemoryPool *pool, PoolChunk *chunk)
+{
+    /* 空のチャンクは必ず空きのあるチャンク一覧に入っている */
+    pool_unlink_partial(pool, chunk);
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        pool->chunks = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    pool->chunk_count--;
+    pool->empty_chunks--;
+    pool->pool_capacity -= chunk->capacity;
+    
+    printf("[POOL DEBUG] プール '%s' のチャンクを返却: -%lu オブジェクト (総容量: %lu)\n",
+           pool->name, (unsigned long)chunk->capacity,
+           (unsigned long)pool->pool_capacity);
+    
+    free(chunk->memory);
+    free(chunk);
+}
+
+/* 使用率がしきい値を下回っている間、空の追加チャンクを返却
+ * （空のチャンクがあり、使用率がしきい値を下回ったときだけ呼ばれる） */
+static void pool_shrink(MemoryPool *pool)
+{
+    PoolChunk *chunk;
+    PoolChunk *next;
+    
+    for (chunk = pool->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        if ((double)pool->objects_in_use >=
+            pool->shrink_watermark * pool->pool_capacity) {
+            break;
+        }
+        if (chunk->in_use == 0) {
+            pool_release_chunk(pool, chunk);
+        }
+    }
+}
+
+/* マガジンの統計を共有カウンタへ集計（ロック保持中に呼ぶ） */
+static void pool_magazine_fold_stats(MemoryPool *pool, PoolMagazine *mag)
+{
+    pool->total_allocated += mag->pending_allocs;
+    pool->total_freed += mag->pending_frees;
+    mag->pending_allocs = 0;
+    mag->pending_frees = 0;
+}
+
+/* マガジンから共有フリーリストへ最大count個を返却（ロック保持中に呼ぶ） */
+static void pool_magazine_flush_locked(MemoryPool *pool, PoolMagazine *mag,
+                                       size_t count)
 {
     FreeNode *node;
     
-    VALIDATE_POOL(pool);
+    while (count > 0 && mag->count > 0) {
+        node = (FreeNode *)mag->objects[--mag->count];
+        node->next = pool->free_list;
+        pool->free_list = node;
+        pool->objects_in_use--;
+        count--;
+    }
+    pool_magazine_fold_stats(pool, mag);
+}
+
+/* スレッド終了時のデストラクタ: キャッシュを全て返却してマガジンを破棄 */
+static void pool_magazine_destructor(void *arg)
+{
+    PoolMagazine *mag = (PoolMagazine *)arg;
+    MemoryPool *pool = mag->pool;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool_magazine_flush_locked(pool, mag, mag->count);
+    if (mag->prev) {
+        mag->prev->next = mag->next;
+    } else {
+        pool->magazines = mag->next;
+    }
+    if (mag->next) {
+        mag->next->prev = mag->prev;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    free(mag);
+}
+
+/* 呼び出しスレッドのマガジンを取得（初回は作成して登録） */
+static PoolMagazine *pool_get_magazine(MemoryPool *pool)
+{
+    PoolMagazine *mag;
+    
+    mag = (PoolMagazine *)pthread_getspecific(pool->magazine_key);
+    if (mag) {
+        return mag;
+    }
+    
+    mag = (PoolMagazine *)malloc(sizeof(PoolMagazine));
+    if (!mag) {
+        fprintf(stderr, "マガジンの割り当てに失敗\n");
+        return NULL;
+    }
+    mag->pool = pool;
+    mag->count = 0;
+    mag->pending_allocs = 0;
+    mag->pending_frees = 0;
+    mag->prev = NULL;
+    
+    pthread_mutex_lock(&pool->lock);
+    mag->next = pool->magazines;
+    if (pool->magazines) {
+        pool->magazines->prev = mag;
+    }
+    pool->magazines = mag;
+    pthread_mutex_unlock(&pool->lock);
+    
+    if (pthread_setspecific(pool->magazine_key, mag) != 0) {
+        pool_magazine_destructor(mag);
+        return NULL;
+    }
+    return mag;
+}
+
+/* スレッドセーフなプールの作成
+ * 共有フリーリストはミューテックスで保護するが、通常の割り当て・解放は
+ * スレッドローカルのマガジンだけで完結するためロックもアトミック操作も不要。
+ * 各スレッドが最大POOL_MAGAZINE_SIZE個を抱え込むため、
+ * 容量にはスレッド数分の余裕を持たせること */
+MemoryPool *pool_create_threadsafe(const char *name, size_t object_size,
+                                   size_t capacity)
+{
+    MemoryPool *pool;
+    
+    pool = pool_create(name, object_size, capacity);
+    if (!pool) {
+        return NULL;
+    }
+    
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        fprintf(stderr, "プールロックの初期化に失敗\n");
+        pool_destroy(pool);
+        return NULL;
+    }
+    if (pthread_key_create(&pool->magazine_key, pool_magazine_destructor) != 0) {
+        fprintf(stderr, "スレッドキーの作成に失敗\n");
+        pthread_mutex_destroy(&pool->lock);
+        pool_destroy(pool);
+        return NULL;
+    }
+    pool->thread_safe = 1;
+    
+    printf("[POOL DEBUG] プール '%s' をスレッドセーフモードに設定 (マガジン=%d, バッチ=%d)\n",
+           pool->name, POOL_MAGAZINE_SIZE, POOL_MAGAZINE_BATCH);
+    
+    return pool;
+}
+
+/* スレッドセーフモードの割り当て: マガジンが空なら共有リストから一括補充 */
+static void *pool_alloc_threadsafe(MemoryPool *pool)
+{
+    PoolMagazine *mag;
+    FreeNode *node;
+    
+    mag = pool_get_magazine(pool);
+    if (!mag) {
+        return NULL;
+    }
+    
+    if (mag->count == 0) {
+        pthread_mutex_lock(&pool->lock);
+        while (mag->count < POOL_MAGAZINE_BATCH && pool->free_list) {
+            node = pool->free_list;
+            pool->free_list = node->next;
+            mag->objects[mag->count++] = node;
+            pool->objects_in_use++;
+        }
+        pool_magazine_fold_stats(pool, mag);
+        pthread_mutex_unlock(&pool->lock);
+        
+        if (mag->count == 0) {
+            fprintf(stderr, "プール '%s' にオブジェクトが残っていません\n", pool->name);
+            return NULL;
+        }
+    }
+    
+    node = (FreeNode *)mag->objects[--mag->count];
+    mag->pending_allocs++;
+    
+    /* メモリをクリア（セキュリティ向上） */
+    memset(node, 0, pool->object_size);
+    
+    return (void *)node;
+}
+
+/* スレッドセーフモードの解放: マガジンが満杯なら半分を共有リストへ返却 */
+static void pool_free_threadsafe(MemoryPool *pool, void *ptr)
+{
+    PoolMagazine *mag;
+    
+    mag = pool_get_magazine(pool);
+    if (!mag) {
+        return;
+    }
+    
+    if (mag->count == POOL_MAGAZINE_SIZE) {
+        pthread_mutex_lock(&pool->lock);
+        pool_magazine_flush_locked(pool, mag, POOL_MAGAZINE_BATCH);
+        pthread_mutex_unlock(&pool->lock);
+    }
     
-    if (!pool->free_list) {
-        fprintf(stderr, "プール '%s' にオブジェクトが残っていません\n", pool->name);
+    mag->objects[mag->count++] = ptr;
+    mag->pending_frees++;
+}
+
+#if POOL_HAS_ATOMICS
+/* インデックスからノードへの変換 */
+static LFNode *lf_node_at(const MemoryPool *pool, uint32_t index)
+{
+    return (LFNode *)((char *)pool->memory_chunk + (size_t)index * pool->object_size);
+}
+
+/* Treiberスタックのpop
+ * 先頭を更新するたびに世代タグを進めるため、pop中に同じノードが
+ * pop→pushされて先頭に戻っても（ABA）CASは失敗する。
+ * 読んだnextが他スレッドのpop後の書き込みで壊れていても、
+ * その場合は先頭のタグが進んでいるためCASが失敗して読み直しになる */
+static void *lf_pop(MemoryPool *pool)
+{
+    uint64_t old_head;
+    uint64_t new_head;
+    uint32_t index;
+    LFNode *node;
+    
+    old_head = atomic_load_explicit(&pool->lf_head, memory_order_acquire);
+    do {
+        index = (uint32_t)(old_head & LF_INDEX_MASK);
+        if (index == 0) {
+            return NULL;
+        }
+        node = lf_node_at(pool, index - 1);
+        new_head = (((old_head >> LF_TAG_SHIFT) + 1) << LF_TAG_SHIFT) |
+                   atomic_load_explicit(&node->next, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->lf_head, &old_head,
+                                                    new_head,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    return node;
+}
+
+/* Treiberスタックのpush */
+static void lf_push(MemoryPool *pool, void *ptr)
+{
+    uint64_t old_head;
+    uint64_t new_head;
+    uint32_t index;
+    LFNode *node = (LFNode *)ptr;
+    
+    index = (uint32_t)(((char *)ptr - (char *)pool->memory_chunk) / pool->object_size);
+    old_head = atomic_load_explicit(&pool->lf_head, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&node->next, (uint32_t)(old_head & LF_INDEX_MASK),
+                              memory_order_relaxed);
+        new_head = (((old_head >> LF_TAG_SHIFT) + 1) << LF_TAG_SHIFT) |
+                   (uint64_t)(index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->lf_head, &old_head,
+                                                    new_head,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+#endif
+
+/* 並行プールの作成
+ * 割り当てたスレッドと解放するスレッドが異なってもよい（生産者・消費者）。
+ * C11ではアトミックCASによるロックフリースタック、
+ * C90ではミューテックスで保護したフリーリストで実装する */
+MemoryPool *pool_create_concurrent(const char *name, size_t object_size,
+                                   size_t capacity)
+{
+    MemoryPool *pool;
+#if POOL_HAS_ATOMICS
+    size_t i;
+#endif
+    
+#if POOL_HAS_ATOMICS
+    if (capacity >= LF_INDEX_MASK) {
+        fprintf(stderr, "並行プールの容量が大きすぎます: %lu\n",
+                (unsigned long)capacity);
+        return NULL;
+    }
+#endif
+    
+    pool = pool_create(name, object_size, capacity);
+    if (!pool) {
+        return NULL;
+    }
+    
+#if POOL_HAS_ATOMICS
+    /* スラブ先頭から順にpopされるようにインデックスでリストを再構築 */
+    for (i = 0; i < capacity; i++) {
+        atomic_init(&lf_node_at(pool, (uint32_t)i)->next,
+                    i + 1 < capacity ? (uint32_t)(i + 2) : 0u);
+    }
+    atomic_init(&pool->lf_head, (uint64_t)1);
+    atomic_init(&pool->lf_allocated, 0);
+    atomic_init(&pool->lf_freed, 0);
+    pool->free_list = NULL;
+#else
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        fprintf(stderr, "プールロックの初期化に失敗\n");
+        pool_destroy(pool);
         return NULL;
     }
+#endif
+    pool->concurrent = 1;
+    
+    printf("[POOL DEBUG] プール '%s' を並行モードに設定 (%s)\n", pool->name,
+           POOL_HAS_ATOMICS ? "ロックフリー" : "ミューテックス");
+    
+    return pool;
+}
+
+/* 並行モードの割り当て */
+static void *pool_alloc_concurrent(MemoryPool *pool)
+{
+    FreeNode *node;
     
-    /* フリーリストから先頭を取得 */
+#if POOL_HAS_ATOMICS
+    node = (FreeNode *)lf_pop(pool);
+    if (node) {
+        atomic_fetch_add_explicit(&pool->lf_allocated, 1, memory_order_relaxed);
+    }
+#else
+    pthread_mutex_lock(&pool->lock);
     node = pool->free_list;
-    pool->free_list = node->next;
+    if (node) {
+        pool->free_list = node->next;
+        pool->objects_in_use++;
+        pool->total_allocated++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    
+    /* 並行モードの枯渇は他スレッドの解放で解消されうるため、
+     * メッセージは出さず呼び出し側の再試行に任せる */
+    if (!node) {
+        return NULL;
+    }
+    
+    /* メモリをクリア（セキュリティ向上） */
+    memset(node, 0, pool->object_size);
+    
+    return (void *)node;
+}
+
+/* 並行モードの解放 */
+static void pool_free_concurrent(MemoryPool *pool, void *ptr)
+{
+#if POOL_HAS_ATOMICS
+    lf_push(pool, ptr);
+    atomic_fetch_add_explicit(&pool->lf_freed, 1, memory_order_relaxed);
+#else
+    FreeNode *node = (FreeNode *)ptr;
+    
+    pthread_mutex_lock(&pool->lock);
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->objects_in_use--;
+    pool->total_freed++;
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+/* オブジェクトの割り当て */
+void *pool_alloc(MemoryPool *pool)
+{
+    FreeNode *node;
+    PoolChunk *chunk;
+    
+    VALIDATE_POOL(pool);
+    if (pool->thread_safe) {
+        return pool_alloc_threadsafe(pool);
+    }
+    if (pool->concurrent) {
+        return pool_alloc_concurrent(pool);
+    }
+    
+    if (pool->free_list) {
+        /* 最初のメモリ領域のフリーリストから先頭を取得 */
+        node = pool->free_list;
+        pool->free_list = node->next;
+    } else {
+        /* 使い切ったら空きのある追加チャンクから（なければ拡張） */
+        if (!pool->partial_chunks && !(pool->growable && pool_grow(pool))) {
+            fprintf(stderr, "プール '%s' にオブジェクトが残っていません\n", pool->name);
+            return NULL;
+        }
+        chunk = pool->partial_chunks;
+        node = chunk->free_list;
+        chunk->free_list = node->next;
+        if (chunk->in_use++ == 0) {
+            pool->empty_chunks--;
+        }
+        if (!chunk->free_list) {
+            pool_unlink_partial(pool, chunk);
+        }
+    }
     
     /* 統計情報の更新 */
     pool->objects_in_use++;
@@ -176,6 +792,7 @@ void pool_free(MemoryPool *pool, void *ptr)
     char *obj_ptr;
     size_t offset;
     FreeNode *node;
+    PoolChunk *chunk = NULL;
     
     VALIDATE_POOL_VOID(pool);
     
@@ -186,12 +803,17 @@ void pool_free(MemoryPool *pool, void *ptr)
     
     /* ポインタがプール内にあるかチェック */
     pool_start = (char *)pool->memory_chunk;
-    pool_end = pool_start + (pool->object_size * pool->pool_capacity);
+    pool_end = pool_start + (pool->object_size * pool->base_capacity);
     obj_ptr = (char *)ptr;
     
     if (obj_ptr < pool_start || obj_ptr >= pool_end) {
-        fprintf(stderr, "プール外のポインタの解放試行: %p\n", ptr);
-        return;
+        /* 拡張したプールでは追加チャンクも検索 */
+        chunk = pool_find_chunk(pool, obj_ptr);
+        if (!chunk) {
+            fprintf(stderr, "プール外のポインタの解放試行: %p\n", ptr);
+            return;
+        }
+        pool_start = chunk->memory;
     }
     
     /* アライメントチェック */
@@ -201,10 +823,30 @@ void pool_free(MemoryPool *pool, void *ptr)
         return;
     }
     
-    /* フリーリストに追加 */
+    if (pool->thread_safe) {
+        pool_free_threadsafe(pool, ptr);
+        return;
+    }
+    if (pool->concurrent) {
+        pool_free_concurrent(pool, ptr);
+        return;
+    }
+    
+    /* 所属する領域のフリーリストに追加 */
     node = (FreeNode *)ptr;
-    node->next = pool->free_list;
-    pool->free_list = node;
+    if (chunk) {
+        if (!chunk->free_list) {
+            pool_link_partial(pool, chunk);
+        }
+        node->next = chunk->free_list;
+        chunk->free_list = node;
+        if (--chunk->in_use == 0) {
+            pool->empty_chunks++;
+        }
+    } else {
+        node->next = pool->free_list;
+        pool->free_list = node;
+    }
     
     /* 統計情報の更新 */
     pool->objects_in_use--;
@@ -213,6 +855,11 @@ void pool_free(MemoryPool *pool, void *ptr)
     printf("[POOL DEBUG] オブジェクト解放: %p (使用中: %lu/%lu)\n",
            ptr, (unsigned long)pool->objects_in_use, 
            (unsigned long)pool->pool_capacity);
+    
+    if (pool->empty_chunks > 0 &&
+        (double)pool->objects_in_use < pool->shrink_watermark * pool->pool_capacity) {
+        pool_shrink(pool);
+    }
 }
 
 /* プールの使用状況表示 */
@@ -220,38 +867,91 @@ void pool_print_status(const MemoryPool *pool)
 {
     size_t free_count = 0;
     FreeNode *current;
+    const PoolChunk *chunk;
     double usage_ratio;
     double memory_efficiency;
+    size_t in_use;
+    size_t allocated;
+    size_t freed;
     
     if (!pool || pool->magic != POOL_MAGIC_NUMBER) {
         printf("無効なプール\n");
         return;
     }
     
+    in_use = pool->objects_in_use;
+    allocated = pool->total_allocated;
+    freed = pool->total_freed;
+#if POOL_HAS_ATOMICS
+    /* ロックフリーモードの統計はアトミックカウンタから取得 */
+    if (pool->concurrent) {
+        allocated = atomic_load(&((MemoryPool *)pool)->lf_allocated);
+        freed = atomic_load(&((MemoryPool *)pool)->lf_freed);
+        in_use = allocated - freed;
+    }
+#endif
+    
     printf("\n=== プール '%s' の状況 ===\n", pool->name);
     printf("オブジェクトサイズ: %lu バイト\n", (unsigned long)pool->object_size);
     printf("プール容量: %lu オブジェクト\n", (unsigned long)pool->pool_capacity);
-    printf("使用中: %lu オブジェクト\n", (unsigned long)pool->objects_in_use);
+    printf("使用中: %lu オブジェクト\n", (unsigned long)in_use);
     printf("空き: %lu オブジェクト\n", 
-           (unsigned long)(pool->pool_capacity - pool->objects_in_use));
+           (unsigned long)(pool->pool_capacity - in_use));
     
-    usage_ratio = (double)pool->objects_in_use / pool->pool_capacity * 100.0;
+    usage_ratio = (double)in_use / pool->pool_capacity * 100.0;
     printf("使用率: %.1f%%\n", usage_ratio);
     
-    printf("総割り当て: %lu 回\n", (unsigned long)pool->total_allocated);
-    printf("総解放: %lu 回\n", (unsigned long)pool->total_freed);
+    printf("総割り当て: %lu 回\n", (unsigned long)allocated);
+    printf("総解放: %lu 回\n", (unsigned long)freed);
     
     memory_efficiency = pool->pool_capacity > 0 ? 
-        (double)(pool->pool_capacity - pool->objects_in_use) / pool->pool_capacity * 100.0 : 0.0;
+        (double)(pool->pool_capacity - in_use) / pool->pool_capacity * 100.0 : 0.0;
     printf("メモリ効率: %.1f%%\n", memory_efficiency);
     
-    /* フリーリストの長さをカウント */
+    /* フリーリストの長さをカウント（追加チャンクの分も含む） */
     current = pool->free_list;
     while (current) {
         free_count++;
         current = current->next;
     }
+    for (chunk = pool->chunks; chunk; chunk = chunk->next) {
+        for (current = chunk->free_list; current; current = current->next) {
+            free_count++;
+        }
+    }
+#if POOL_HAS_ATOMICS
+    /* ロックフリーモードはインデックスのチェーンを辿る（停止中のみ正確） */
+    if (pool->concurrent) {
+        uint32_t index;
+        
+        index = (uint32_t)(atomic_load(&((MemoryPool *)pool)->lf_head) & LF_INDEX_MASK);
+        while (index != 0) {
+            free_count++;
+            index = atomic_load(&lf_node_at(pool, index - 1)->next);
+        }
+    }
+#endif
     printf("フリーリスト長: %lu\n", (unsigned long)free_count);
+    
+    if (pool->growable) {
+        printf("追加チャンク数: %lu (基本容量: %lu オブジェクト)\n",
+               (unsigned long)pool->chunk_count, (unsigned long)pool->base_capacity);
+    }
+    
+    /* スレッドセーフモード: 使用中にはマガジン内のキャッシュも含まれる
+     * （他スレッドが動作中の場合は概算値） */
+    if (pool->thread_safe) {
+        size_t magazine_count = 0;
+        size_t cached = 0;
+        const PoolMagazine *mag;
+        
+        for (mag = pool->magazines; mag; mag = mag->next) {
+            magazine_count++;
+            cached += mag->count;
+        }
+        printf("マガジン数: %lu (キャッシュ中: %lu オブジェクト)\n",
+               (unsigned long)magazine_count, (unsigned long)cached);
+    }
     printf("========================\n\n");
 }
 
@@ -267,6 +967,37 @@ void pool_destroy(MemoryPool *pool)
         return;
     }
     
+    /* スレッドセーフモード: 残っているマガジンを回収してから検査する */
+    if (pool->thread_safe) {
+        PoolMagazine *mag;
+        PoolMagazine *next;
+        
+        pthread_mutex_lock(&pool->lock);
+        for (mag = pool->magazines; mag; mag = next) {
+            next = mag->next;
+            pool_magazine_flush_locked(pool, mag, mag->count);
+            free(mag);
+        }
+        pool->magazines = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        
+        pthread_key_delete(pool->magazine_key);
+        pthread_mutex_destroy(&pool->lock);
+        pool->thread_safe = 0;
+    }
+    
+#if POOL_HAS_ATOMICS
+    if (pool->concurrent) {
+        pool->objects_in_use = atomic_load(&pool->lf_allocated) -
+                               atomic_load(&pool->lf_freed);
+    }
+#else
+    if (pool->concurrent) {
+        pthread_mutex_destroy(&pool->lock);
+    }
+#endif
+    pool->concurrent = 0;
+    
     printf("[POOL DEBUG] プール '%s' を破棄 (リーク: %lu オブジェクト)\n",
            pool->name, (unsigned long)pool->objects_in_use);
     
@@ -276,6 +1007,12 @@ void pool_destroy(MemoryPool *pool)
     }
     
     /* メモリ解放 */
+    while (pool->chunks) {
+        PoolChunk *next = pool->chunks->next;
+        free(pool->chunks->memory);
+        free(pool->chunks);
+        pool->chunks = next;
+    }
     if (pool->memory_chunk) {
         free(pool->memory_chunk);
     }
@@ -446,6 +1183,53 @@ void test_pool_exhaustion(void)
     pool_destroy(small_pool);
 }
 
+/* 拡張可能プールのテスト */
+void test_pool_growth(void)
+{
+    MemoryPool *pool;
+    Point *points[20];
+    int i;
+    
+    printf("\n=== 拡張可能プールテスト ===\n");
+    
+    pool = pool_create_growable("GrowPool", sizeof(Point), 3,
+                                POOL_DEFAULT_GROWTH_FACTOR,
+                                POOL_DEFAULT_SHRINK_WATERMARK);
+    if (!pool) {
+        return;
+    }
+    
+    /* 基本容量を超えて割り当て（枯渇せずに拡張される） */
+    for (i = 0; i < 20; i++) {
+        points[i] = (Point *)pool_alloc(pool);
+        if (points[i]) {
+            points[i]->x = i * 1.0;
+        } else {
+            printf("Point [%d]: 割り当て失敗\n", i);
+        }
+    }
+    
+    pool_print_status(pool);
+    
+    /* 大半を解放すると空の追加チャンクが返却される */
+    printf("\n後から割り当てたオブジェクトを解放...\n");
+    for (i = 19; i >= 2; i--) {
+        if (points[i]) {
+            pool_free(pool, points[i]);
+            points[i] = NULL;
+        }
+    }
+    
+    pool_print_status(pool);
+    
+    for (i = 0; i < 2; i++) {
+        if (points[i]) {
+            pool_free(pool, points[i]);
+        }
+    }
+    pool_destroy(pool);
+}
+
 /* エラー処理テスト */
 void test_error_handling(void)
 {
@@ -531,6 +1315,273 @@ void test_performance(void)
     pool_destroy(pool);
 }
 
+/* マルチスレッドパフォーマンステスト用の設定 */
+#define MT_MAX_THREADS 16
+#define MT_ITERATIONS_PER_THREAD 200000
+#define MT_BURST 8  /* 1スレッドが同時に保持するオブジェクト数 */
+
+typedef struct PerfThreadArg {
+    MemoryPool *pool;
+    size_t iterations;
+    size_t failures;
+} PerfThreadArg;
+
+/* 経過時間計測（壁時計）: clock()は全スレッドのCPU時間を合算するため使わない */
+static double get_wall_time_sec(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* ワーカースレッド: MT_BURST個ずつ割り当てて解放を繰り返す */
+static void *perf_worker(void *arg)
+{
+    PerfThreadArg *param = (PerfThreadArg *)arg;
+    double *ptrs[MT_BURST];
+    size_t i;
+    int j;
+    
+    for (i = 0; i < param->iterations; i += MT_BURST) {
+        for (j = 0; j < MT_BURST; j++) {
+            ptrs[j] = (double *)pool_alloc(param->pool);
+            if (ptrs[j]) {
+                *ptrs[j] = (double)i;
+            } else {
+                param->failures++;
+            }
+        }
+        for (j = 0; j < MT_BURST; j++) {
+            if (ptrs[j]) {
+                pool_free(param->pool, ptrs[j]);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* マルチスレッドパフォーマンステスト（スレッドセーフモード） */
+void test_performance_threaded(void)
+{
+    static const int thread_counts[] = {1, 2, 4, 8, 16};
+    const size_t pool_size = MT_MAX_THREADS * (POOL_MAGAZINE_SIZE + MT_BURST);
+    pthread_t threads[MT_MAX_THREADS];
+    PerfThreadArg args[MT_MAX_THREADS];
+    MemoryPool *pool;
+    double start, elapsed;
+    size_t total_ops;
+    size_t failures;
+    int t, n, created;
+    
+    printf("\n=== マルチスレッドパフォーマンステスト ===\n");
+    printf("テスト設定: スレッドあたり %lu 回の割り当て・解放 (プールサイズ: %lu)\n",
+           (unsigned long)MT_ITERATIONS_PER_THREAD, (unsigned long)pool_size);
+    
+    pool = pool_create_threadsafe("MTPerfPool", sizeof(double), pool_size);
+    if (!pool) {
+        return;
+    }
+    
+    printf("%8s %12s %16s %10s\n", "スレッド", "実行時間(秒)", "割り当て/秒", "失敗");
+    
+    for (t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+        n = thread_counts[t];
+        
+        start = get_wall_time_sec();
+        for (created = 0; created < n; created++) {
+            args[created].pool = pool;
+            args[created].iterations = MT_ITERATIONS_PER_THREAD;
+            args[created].failures = 0;
+            if (pthread_create(&threads[created], NULL, perf_worker,
+                               &args[created]) != 0) {
+                fprintf(stderr, "スレッド作成に失敗\n");
+                break;
+            }
+        }
+        failures = 0;
+        for (n = 0; n < created; n++) {
+            pthread_join(threads[n], NULL);
+            failures += args[n].failures;
+        }
+        elapsed = get_wall_time_sec() - start;
+        
+        total_ops = (size_t)created * MT_ITERATIONS_PER_THREAD;
+        printf("%8d %12.6f %16.0f %10lu\n", created, elapsed,
+               elapsed > 0.0 ? (double)total_ops / elapsed : 0.0,
+               (unsigned long)failures);
+    }
+    
+    pool_print_status(pool);
+    pool_destroy(pool);
+}
+
+/* 生産者・消費者テスト用の設定 */
+#define PC_MAX_PAIRS 4
+#define PC_BATCH 64                 /* 1回の受け渡しで渡すオブジェクト数 */
+#define PC_QUEUE_DEPTH 16           /* 受け渡しキューの段数 */
+#define PC_BATCHES_PER_PRODUCER 4000
+
+/* 生産者から消費者へバッチを渡すキュー（テスト用の足場） */
+typedef struct HandoffQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void *batches[PC_QUEUE_DEPTH][PC_BATCH];
+    size_t counts[PC_QUEUE_DEPTH];  /* 0はストリーム終端 */
+    size_t head;
+    size_t tail;
+    size_t used;
+} HandoffQueue;
+
+typedef struct PCThreadArg {
+    MemoryPool *pool;
+    HandoffQueue *queue;
+    size_t retries;                 /* 一時的な枯渇による再試行回数 */
+} PCThreadArg;
+
+static void handoff_put(HandoffQueue *q, void **objects, size_t count)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->used == PC_QUEUE_DEPTH) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    if (count > 0) {
+        memcpy(q->batches[q->tail], objects, count * sizeof(void *));
+    }
+    q->counts[q->tail] = count;
+    q->tail = (q->tail + 1) % PC_QUEUE_DEPTH;
+    q->used++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static size_t handoff_get(HandoffQueue *q, void **objects)
+{
+    size_t count;
+    
+    pthread_mutex_lock(&q->lock);
+    while (q->used == 0) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    count = q->counts[q->head];
+    if (count > 0) {
+        memcpy(objects, q->batches[q->head], count * sizeof(void *));
+    }
+    q->head = (q->head + 1) % PC_QUEUE_DEPTH;
+    q->used--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+/* 生産者: 割り当てたオブジェクトをバッチにして消費者へ渡す */
+static void *pc_producer(void *arg)
+{
+    PCThreadArg *param = (PCThreadArg *)arg;
+    void *batch[PC_BATCH];
+    size_t b;
+    int j;
+    
+    for (b = 0; b < PC_BATCHES_PER_PRODUCER; b++) {
+        for (j = 0; j < PC_BATCH; j++) {
+            while ((batch[j] = pool_alloc(param->pool)) == NULL) {
+                param->retries++;
+                sched_yield();
+            }
+            *(double *)batch[j] = (double)b;
+        }
+        handoff_put(param->queue, batch, PC_BATCH);
+    }
+    handoff_put(param->queue, NULL, 0);
+    return NULL;
+}
+
+/* 消費者: 受け取ったオブジェクトを別スレッドから解放する */
+static void *pc_consumer(void *arg)
+{
+    PCThreadArg *param = (PCThreadArg *)arg;
+    void *batch[PC_BATCH];
+    size_t count;
+    size_t j;
+    
+    while ((count = handoff_get(param->queue, batch)) > 0) {
+        for (j = 0; j < count; j++) {
+            pool_free(param->pool, batch[j]);
+        }
+    }
+    return NULL;
+}
+
+/* 生産者・消費者テスト（並行モード: 割り当てと解放が別スレッド） */
+void test_producer_consumer(void)
+{
+    static const int pair_counts[] = {1, 2, 4};
+    const size_t pool_size = PC_MAX_PAIRS * (PC_QUEUE_DEPTH + 2) * PC_BATCH;
+    HandoffQueue queues[PC_MAX_PAIRS];
+    PCThreadArg args[PC_MAX_PAIRS];
+    pthread_t producers[PC_MAX_PAIRS];
+    pthread_t consumers[PC_MAX_PAIRS];
+    MemoryPool *pool;
+    double start, elapsed;
+    size_t total_objects;
+    size_t retries;
+    int t, n, i;
+    
+    printf("\n=== 生産者・消費者テスト ===\n");
+    printf("テスト設定: 生産者あたり %lu オブジェクト (プールサイズ: %lu)\n",
+           (unsigned long)PC_BATCHES_PER_PRODUCER * PC_BATCH,
+           (unsigned long)pool_size);
+    
+    pool = pool_create_concurrent("PCPool", sizeof(double), pool_size);
+    if (!pool) {
+        return;
+    }
+    
+    printf("%8s %12s %16s %10s\n", "ペア数", "実行時間(秒)", "オブジェクト/秒", "再試行");
+    
+    for (t = 0; t < (int)(sizeof(pair_counts) / sizeof(pair_counts[0])); t++) {
+        n = pair_counts[t];
+        
+        for (i = 0; i < n; i++) {
+            pthread_mutex_init(&queues[i].lock, NULL);
+            pthread_cond_init(&queues[i].not_empty, NULL);
+            pthread_cond_init(&queues[i].not_full, NULL);
+            queues[i].head = queues[i].tail = queues[i].used = 0;
+            args[i].pool = pool;
+            args[i].queue = &queues[i];
+            args[i].retries = 0;
+        }
+        
+        start = get_wall_time_sec();
+        for (i = 0; i < n; i++) {
+            pthread_create(&consumers[i], NULL, pc_consumer, &args[i]);
+            pthread_create(&producers[i], NULL, pc_producer, &args[i]);
+        }
+        retries = 0;
+        for (i = 0; i < n; i++) {
+            pthread_join(producers[i], NULL);
+            pthread_join(consumers[i], NULL);
+            retries += args[i].retries;
+        }
+        elapsed = get_wall_time_sec() - start;
+        
+        for (i = 0; i < n; i++) {
+            pthread_cond_destroy(&queues[i].not_full);
+            pthread_cond_destroy(&queues[i].not_empty);
+            pthread_mutex_destroy(&queues[i].lock);
+        }
+        
+        total_objects = (size_t)n * PC_BATCHES_PER_PRODUCER * PC_BATCH;
+        printf("%8d %12.6f %16.0f %10lu\n", n, elapsed,
+               elapsed > 0.0 ? (double)total_objects / elapsed : 0.0,
+               (unsigned long)retries);
+    }
+    
+    pool_print_status(pool);
+    pool_destroy(pool);
+}
+
 /* メイン関数 */
 int main(void)
 {
@@ -540,8 +1591,11 @@ int main(void)
     test_basic_pool_operations();
     test_struct_pool();
     test_pool_exhaustion();
+    test_pool_growth();
     test_error_handling();
     test_performance();
+    test_performance_threaded();
+    test_producer_consumer();
     
     printf("=== デモ完了 ===\n");
     return 0;
@@ -690,6 +1744,25 @@ Point [4]: 割り当て失敗（プール枯渇）
 [POOL DEBUG] オブジェクト解放: 0x1234638 (使用中: 0/3)
 [POOL DEBUG] プール 'SmallPool' を破棄 (リーク: 0 オブジェクト)
 
+=== 拡張可能プールテスト ===
+[POOL DEBUG] プール 'GrowPool' を作成: オブジェクトサイズ=24, 容量=3
+[POOL DEBUG] プール 'GrowPool' を拡張可能に設定 (拡張率=2.00, 返却しきい値=25%)
+...
+[POOL DEBUG] プール 'GrowPool' を拡張: +3 オブジェクト (総容量: 6, チャンク数: 1)
+...
+[POOL DEBUG] プール 'GrowPool' を拡張: +6 オブジェクト (総容量: 12, チャンク数: 2)
+...
+[POOL DEBUG] プール 'GrowPool' を拡張: +12 オブジェクト (総容量: 24, チャンク数: 3)
+...
+後から割り当てたオブジェクトを解放...
+...
+[POOL DEBUG] プール 'GrowPool' のチャンクを返却: -12 オブジェクト (総容量: 12)
+...
+[POOL DEBUG] プール 'GrowPool' のチャンクを返却: -6 オブジェクト (総容量: 6)
+...
+[POOL DEBUG] プール 'GrowPool' のチャンクを返却: -3 オブジェクト (総容量: 3)
+[POOL DEBUG] プール 'GrowPool' を破棄 (リーク: 0 オブジェクト)
+
 === エラー処理テスト ===
 [POOL DEBUG] プール 'ErrorTestPool' を作成: オブジェクトサイズ=8, 容量=4
 [POOL DEBUG] オブジェクト割り当て: 0x1234668 (使用中: 1/4)
@@ -720,5 +1793,29 @@ NULL ポインタの解放試行
 ========================
 
 [POOL DEBUG] プール 'PerfPool' を破棄 (リーク: 0 オブジェクト)
+
+=== マルチスレッドパフォーマンステスト ===
+テスト設定: スレッドあたり 200000 回の割り当て・解放 (プールサイズ: 1152)
+[POOL DEBUG] プール 'MTPerfPool' を作成: オブジェクトサイズ=8, 容量=1152
+[POOL DEBUG] プール 'MTPerfPool' をスレッドセーフモードに設定 (マガジン=64, バッチ=32)
+スレッド 実行時間(秒) 割り当て/秒     失敗
+       1     0.006709         29811377          0
+       2     0.012332         32436465          0
+       4     0.027739         28840299          0
+       8     0.061901         25847531          0
+      16     0.120011         26664126          0
+...
+[POOL DEBUG] プール 'MTPerfPool' を破棄 (リーク: 0 オブジェクト)
+
+=== 生産者・消費者テスト ===
+テスト設定: 生産者あたり 256000 オブジェクト (プールサイズ: 4608)
+[POOL DEBUG] プール 'PCPool' を作成: オブジェクトサイズ=8, 容量=4608
+[POOL DEBUG] プール 'PCPool' を並行モードに設定 (ロックフリー)
+ペア数 実行時間(秒) オブジェクト/秒  再試行
+       1     0.018513         13827974          0
+       2     0.036552         14007424          0
+       4     0.071935         14234992          0
+...
+[POOL DEBUG] プール 'PCPool' を破棄 (リーク: 0 オブジェクト)
 === デモ完了 ===
 */
\ No newline at end of file
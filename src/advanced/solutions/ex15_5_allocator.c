@@ -1,10 +1,13 @@
 /*
  * 演習15-5の解答例: 高性能メモリアロケーター
  * ファイル名: ex15_5_allocator.c
- * 説明: サイズ別メモリプール、断片化最小化、統計情報収集
- * C90準拠
+ * 説明: サイズクラス別メモリプール、断片化最小化、統計情報収集
+ * C90準拠（ヘッダーなしモードはposix_memalign、レイテンシ計測はclock_gettimeを使用）
  */
 
+/* posix_memalign・clock_gettimeを使用するための機能テストマクロ */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,16 +15,24 @@
 #include <assert.h>
 
 /* アロケーターの設定 */
-#define SMALL_OBJECT_SIZE 64
-#define MEDIUM_OBJECT_SIZE 256
-#define LARGE_OBJECT_SIZE 1024
+#define SIZE_CLASS_GRANULE_SHIFT 4                    /* 16バイト単位 */
+#define SIZE_CLASS_GRANULE (1 << SIZE_CLASS_GRANULE_SHIFT)
+#define SIZE_CLASSES_PER_DOUBLING 4                   /* 2倍ごとのクラス数 */
+#define MAX_SMALL_SIZE (32 * 1024)                    /* プール管理の上限 */
+#define NUM_SIZE_CLASSES 40                           /* 16〜64を4分割 + 64〜32KiBを2倍ごとに4分割 */
+#define SIZE_CLASS_LOOKUP_SIZE (MAX_SMALL_SIZE / SIZE_CLASS_GRANULE + 1)
+
+#define SLAB_SIZE (64 * 1024)    /* 1スラブあたりの目安バイト数（ヘッダーなしモードではアライメント単位） */
+#define SLAB_MIN_OBJECTS 4       /* 1スラブあたりの最小オブジェクト数 */
+#define SYSTEM_SIZE_CLASS (-1)   /* システムmallocによる割り当て */
 
-#define SMALL_POOL_CAPACITY 1024
-#define MEDIUM_POOL_CAPACITY 256
-#define LARGE_POOL_CAPACITY 64
+#define ALLOCATOR_MAGIC 0xA110CA7EU
+#define BLOCK_MAGIC 0xB10C0005U
+#define SLAB_MAGIC 0x51AB0005U
 
-#define ALLOCATOR_MAGIC 0xAL0CAT0R
-#define BLOCK_MAGIC 0xB10CK5
+/* 動作モード */
+#define ALLOC_MODE_HEADER 0       /* 各ブロックにBlockHeaderを付ける */
+#define ALLOC_MODE_HEADERLESS 1   /* スラブ単位のメタデータのみ（小オブジェクトのオーバーヘッド0） */
 
 /* デバッグモード */
 #define DEBUG_ALLOCATOR 1
@@ -32,54 +43,122 @@
 #define ALLOC_DEBUG(msg)
 #endif
 
+/* サンプリング統計（-DALLOC_STATS_SAMPLING=0 でレイテンシ計測のコードごと除去される） */
+#ifndef ALLOC_STATS_SAMPLING
+#define ALLOC_STATS_SAMPLING 1
+#endif
+#define ALLOC_DEFAULT_SAMPLE_RATE 64   /* N回に1回だけ時刻を読む */
+
+/* レイテンシヒストグラム: 2の累乗ごとに4分割した対数線形バケット（ナノ秒） */
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS (32 * LATENCY_SUB_BUCKETS)
+#define LATENCY_CLASSES (NUM_SIZE_CLASSES + 1)  /* 最後はシステム割り当て */
+
 /* メモリブロックヘッダー */
 typedef struct BlockHeader {
     size_t size;
     unsigned int magic;
     struct BlockHeader *next;
     struct BlockHeader *prev;
-    int pool_type;  /* 0: small, 1: medium, 2: large, 3: system */
+    int size_class;  /* サイズクラス番号、SYSTEM_SIZE_CLASSはシステム割り当て */
     int is_free;
 } BlockHeader;
 
-/* フリーリストノード */
+/* フリーリストノード（解放済みブロックの先頭に重ねる） */
 typedef struct FreeNode {
     struct FreeNode *next;
-    size_t size;
 } FreeNode;
 
+/* スラブ（プールが必要に応じて追加するメモリ領域）
+ * ヘッダーなしモードではSLAB_SIZE境界に置き、オブジェクトのアドレスを
+ * SLAB_SIZEで切り捨てるとこのヘッダーに到達する */
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+    struct PoolSlab *prev;      /* 大きなブロックの一覧用 */
+    unsigned int magic;
+    int size_class;             /* SYSTEM_SIZE_CLASSは大きなブロック */
+    size_t size;                /* 大きなブロックのサイズ */
+} PoolSlab;
+
+/* スラブ内の最初のオブジェクトまでのオフセット */
+#define SLAB_HEADER_SIZE \
+    ((sizeof(PoolSlab) + SIZE_CLASS_GRANULE - 1) & ~(size_t)(SIZE_CLASS_GRANULE - 1))
+
 /* メモリプール構造体 */
 typedef struct MemoryPool {
-    void *memory_chunk;
+    int size_class;
+    PoolSlab *slabs;
     FreeNode *free_list;
     size_t object_size;
+    size_t objects_per_slab;
     size_t capacity;
     size_t used_count;
     size_t free_count;
 } MemoryPool;
 
+/* サイズクラス（プールとクラス別統計） */
+typedef struct SizeClass {
+    MemoryPool pool;
+    size_t alloc_count;      /* 総割り当て回数 */
+    size_t requested_bytes;  /* 要求バイト数の累計 */
+} SizeClass;
+
 /* アロケーター統計情報 */
 typedef struct AllocStats {
     size_t total_allocated;
     size_t total_freed;
     size_t current_usage;
     size_t peak_usage;
-    size_t small_allocs;
-    size_t medium_allocs;
-    size_t large_allocs;
     size_t system_allocs;
     size_t failed_allocs;
-    double total_alloc_time;
-    double total_free_time;
+    size_t free_calls;
+    size_t bytes_saved;      /* ヘッダーなしモードで節約したバイト数 */
+    size_t saved_objects;    /* 節約の対象となった割り当て数 */
 } AllocStats;
 
+/* レイテンシヒストグラム */
+typedef struct LatencyHistogram {
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long samples;
+    unsigned long total_ns;
+    unsigned long max_ns;
+} LatencyHistogram;
+
+/* サイズクラス別の統計 */
+typedef struct SizeClassStats {
+    size_t object_size;
+    size_t alloc_count;
+    size_t requested_bytes;
+    size_t used_count;
+    size_t capacity;
+} SizeClassStats;
+
+/* 統計のスナップショット（allocator_stats_snapshotで取得） */
+typedef struct AllocStatsSnapshot {
+    AllocStats stats;
+    size_t header_size;                             /* 1ブロックあたりのヘッダー */
+    SizeClassStats classes[NUM_SIZE_CLASSES];
+    unsigned int sample_rate;                       /* 0は計測なし */
+    LatencyHistogram alloc_latency[LATENCY_CLASSES];
+    LatencyHistogram free_latency[LATENCY_CLASSES];
+} AllocStatsSnapshot;
+
 /* カスタムアロケーター構造体 */
 typedef struct CustomAllocator {
-    MemoryPool small_pool;
-    MemoryPool medium_pool;
-    MemoryPool large_pool;
+    SizeClass classes[NUM_SIZE_CLASSES];
+    unsigned char class_lookup[SIZE_CLASS_LOOKUP_SIZE]; /* 16バイト単位→クラス番号 */
     BlockHeader *system_blocks;
+    PoolSlab *large_slabs;      /* ヘッダーなしモードの大きなブロック */
+    int mode;                   /* ALLOC_MODE_HEADER / ALLOC_MODE_HEADERLESS */
     AllocStats stats;
+#if ALLOC_STATS_SAMPLING
+    unsigned int sample_rate;       /* 0でサンプリング停止 */
+    unsigned int alloc_countdown;   /* 次のサンプルまでの割り当て数 */
+    unsigned int free_countdown;    /* 次のサンプルまでの解放数 */
+    LatencyHistogram alloc_latency[LATENCY_CLASSES];
+    LatencyHistogram free_latency[LATENCY_CLASSES];
+#endif
     unsigned int magic;
     int initialized;
 } CustomAllocator;
@@ -88,11 +167,14 @@ typedef struct CustomAllocator {
 static CustomAllocator g_allocator = {0};
 
 /* ヘルパー関数のプロトタイプ */
-static int init_pool(MemoryPool *pool, size_t object_size, size_t capacity);
+static void init_pool(MemoryPool *pool, int size_class, size_t object_size);
+static int pool_grow(MemoryPool *pool);
 static void *pool_alloc(MemoryPool *pool);
-static int pool_free(MemoryPool *pool, void *ptr);
+static void pool_free(MemoryPool *pool, void *ptr);
 static void destroy_pool(MemoryPool *pool);
+static void init_size_classes(void);
 static double get_time_sec(void);
+void allocator_set_sample_rate(unsigned int rate);
 
 /* 時間計測関数 */
 static double get_time_sec(void)
@@ -100,35 +182,137 @@ static double get_time_sec(void)
     return (double)clock() / CLOCKS_PER_SEC;
 }
 
-/* メモリプールの初期化 */
-static int init_pool(MemoryPool *pool, size_t object_size, size_t capacity)
+#if ALLOC_STATS_SAMPLING
+/* レイテンシ計測用の単調増加時刻（ナノ秒） */
+static unsigned long get_time_ns(void)
 {
-    size_t total_size;
-    char *ptr;
-    size_t i;
+    struct timespec ts;
     
-    pool->object_size = object_size;
-    pool->capacity = capacity;
-    pool->used_count = 0;
-    pool->free_count = capacity;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/* 値→バケット番号: 4未満はそのまま、以降は最上位ビットと続く2ビットで決める */
+static int latency_bucket(unsigned long ns)
+{
+    int msb = 0;
+    int index;
     
-    total_size = object_size * capacity;
-    pool->memory_chunk = malloc(total_size);
-    if (!pool->memory_chunk) {
-        return -1;
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    while ((ns >> msb) > 1) {
+        msb++;
+    }
+    index = (msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS +
+            (int)((ns >> (msb - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+/* バケット番号→そのバケットに入る最大値 */
+static unsigned long latency_bucket_upper(int index)
+{
+    int group = index / LATENCY_SUB_BUCKETS;
+    int sub = index % LATENCY_SUB_BUCKETS;
+    int shift;
+    
+    if (group == 0) {
+        return (unsigned long)index;
+    }
+    shift = group - 1;
+    return ((unsigned long)(LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void latency_record(LatencyHistogram *hist, unsigned long ns)
+{
+    hist->counts[latency_bucket(ns)]++;
+    hist->samples++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns) {
+        hist->max_ns = ns;
     }
+}
+
+/* 分位点（0.0〜1.0）を含むバケットの上限値（最大値を超えない） */
+static unsigned long latency_percentile(const LatencyHistogram *hist, double q)
+{
+    unsigned long target;
+    unsigned long seen = 0;
+    int i;
     
-    /* フリーリストの構築 */
+    if (hist->samples == 0) {
+        return 0;
+    }
+    target = (unsigned long)(q * hist->samples);
+    if (target == 0) {
+        target = 1;
+    }
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            return latency_bucket_upper(i) < hist->max_ns ?
+                   latency_bucket_upper(i) : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+#endif
+
+/* メモリプールの初期化（メモリはpool_growで必要時に確保） */
+static void init_pool(MemoryPool *pool, int size_class, size_t object_size)
+{
+    pool->size_class = size_class;
+    pool->slabs = NULL;
     pool->free_list = NULL;
-    ptr = (char *)pool->memory_chunk;
+    pool->object_size = object_size;
+    pool->objects_per_slab = (SLAB_SIZE - SLAB_HEADER_SIZE) / object_size;
+    /* ヘッダーなしモードではスラブがSLAB_SIZEを超えられない */
+    if (pool->objects_per_slab < SLAB_MIN_OBJECTS &&
+        g_allocator.mode != ALLOC_MODE_HEADERLESS) {
+        pool->objects_per_slab = SLAB_MIN_OBJECTS;
+    }
+    pool->capacity = 0;
+    pool->used_count = 0;
+    pool->free_count = 0;
+}
+
+/* スラブを1つ追加してフリーリストを補充 */
+static int pool_grow(MemoryPool *pool)
+{
+    PoolSlab *slab;
+    char *ptr;
+    size_t i;
     
-    for (i = 0; i < capacity; i++) {
-        FreeNode *node = (FreeNode *)(ptr + i * object_size);
-        node->size = object_size;
+    if (g_allocator.mode == ALLOC_MODE_HEADERLESS) {
+        void *memory;
+        if (posix_memalign(&memory, SLAB_SIZE, SLAB_SIZE) != 0) {
+            return -1;
+        }
+        slab = (PoolSlab *)memory;
+    } else {
+        slab = (PoolSlab *)malloc(SLAB_HEADER_SIZE + pool->object_size * pool->objects_per_slab);
+        if (!slab) {
+            return -1;
+        }
+    }
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = pool->size_class;
+    slab->size = pool->object_size;
+    slab->prev = NULL;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    
+    /* フリーリストの構築（スラブ先頭から順に使われるよう逆順に積む） */
+    ptr = (char *)slab + SLAB_HEADER_SIZE;
+    for (i = pool->objects_per_slab; i > 0; i--) {
+        FreeNode *node = (FreeNode *)(ptr + (i - 1) * pool->object_size);
         node->next = pool->free_list;
         pool->free_list = node;
     }
     
+    pool->capacity += pool->objects_per_slab;
+    pool->free_count += pool->objects_per_slab;
+    
     return 0;
 }
 
@@ -137,7 +321,7 @@ static void *pool_alloc(MemoryPool *pool)
 {
     FreeNode *node;
     
-    if (!pool->free_list) {
+    if (!pool->free_list && pool_grow(pool) < 0) {
         return NULL;
     }
     
@@ -150,44 +334,77 @@ static void *pool_alloc(MemoryPool *pool)
 }
 
 /* プールへメモリ解放 */
-static int pool_free(MemoryPool *pool, void *ptr)
+static void pool_free(MemoryPool *pool, void *ptr)
 {
     FreeNode *node;
-    char *pool_start;
-    char *pool_end;
-    char *obj_ptr;
-    
-    /* プール範囲チェック */
-    pool_start = (char *)pool->memory_chunk;
-    pool_end = pool_start + (pool->object_size * pool->capacity);
-    obj_ptr = (char *)ptr;
-    
-    if (obj_ptr < pool_start || obj_ptr >= pool_end) {
-        return -1;
-    }
     
     node = (FreeNode *)ptr;
-    node->size = pool->object_size;
     node->next = pool->free_list;
     pool->free_list = node;
     
     pool->used_count--;
     pool->free_count++;
-    
-    return 0;
 }
 
 /* プールの破棄 */
 static void destroy_pool(MemoryPool *pool)
 {
-    if (pool->memory_chunk) {
-        free(pool->memory_chunk);
-        pool->memory_chunk = NULL;
+    PoolSlab *slab, *next;
+    
+    for (slab = pool->slabs; slab; slab = next) {
+        next = slab->next;
+        free(slab);
     }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
 }
 
-/* アロケーターの初期化 */
-int allocator_init(void)
+/* サイズクラス表と検索テーブルの構築
+ * 16〜64バイトは16バイト刻み、それ以降は2倍の範囲ごとに4等分する
+ * （80, 96, 112, 128, 160, 192, 224, 256, ... , 32768） */
+static void init_size_classes(void)
+{
+    size_t class_size = SIZE_CLASS_GRANULE;
+    size_t spacing = SIZE_CLASS_GRANULE;
+    size_t granule;
+    int index;
+    
+    for (index = 0; index < NUM_SIZE_CLASSES; index++) {
+        init_pool(&g_allocator.classes[index].pool, index, class_size);
+        g_allocator.classes[index].alloc_count = 0;
+        g_allocator.classes[index].requested_bytes = 0;
+        
+        /* 2の累乗に達したら刻み幅をその1/4にする */
+        if (class_size >= 4 * SIZE_CLASS_GRANULE &&
+            (class_size & (class_size - 1)) == 0) {
+            spacing = class_size / SIZE_CLASSES_PER_DOUBLING;
+        }
+        class_size += spacing;
+    }
+    
+    /* 16バイト単位のサイズから収まる最小クラスへの変換表 */
+    index = 0;
+    for (granule = 0; granule < SIZE_CLASS_LOOKUP_SIZE; granule++) {
+        while (g_allocator.classes[index].pool.object_size <
+               granule << SIZE_CLASS_GRANULE_SHIFT) {
+            index++;
+        }
+        g_allocator.class_lookup[granule] = (unsigned char)index;
+    }
+}
+
+/* サイズ→クラス番号（O(1)の表引き） */
+static int size_to_class(size_t block_size)
+{
+    if (block_size > MAX_SMALL_SIZE) {
+        return SYSTEM_SIZE_CLASS;
+    }
+    return g_allocator.class_lookup[(block_size + SIZE_CLASS_GRANULE - 1) >>
+                                    SIZE_CLASS_GRANULE_SHIFT];
+}
+
+/* アロケーターの初期化（モード指定） */
+int allocator_init_mode(int mode)
 {
     if (g_allocator.initialized) {
         ALLOC_DEBUG("アロケーターは既に初期化されています");
@@ -195,65 +412,139 @@ int allocator_init(void)
     }
     
     memset(&g_allocator, 0, sizeof(g_allocator));
+    g_allocator.mode = mode;
+    allocator_set_sample_rate(ALLOC_DEFAULT_SAMPLE_RATE);
     
-    /* 各プールの初期化 */
-    if (init_pool(&g_allocator.small_pool, SMALL_OBJECT_SIZE, SMALL_POOL_CAPACITY) < 0) {
-        fprintf(stderr, "小オブジェクトプールの初期化に失敗\n");
-        return -1;
-    }
-    
-    if (init_pool(&g_allocator.medium_pool, MEDIUM_OBJECT_SIZE, MEDIUM_POOL_CAPACITY) < 0) {
-        fprintf(stderr, "中オブジェクトプールの初期化に失敗\n");
-        destroy_pool(&g_allocator.small_pool);
-        return -1;
-    }
-    
-    if (init_pool(&g_allocator.large_pool, LARGE_OBJECT_SIZE, LARGE_POOL_CAPACITY) < 0) {
-        fprintf(stderr, "大オブジェクトプールの初期化に失敗\n");
-        destroy_pool(&g_allocator.small_pool);
-        destroy_pool(&g_allocator.medium_pool);
-        return -1;
-    }
+    init_size_classes();
     
     g_allocator.magic = ALLOCATOR_MAGIC;
     g_allocator.initialized = 1;
     
     ALLOC_DEBUG("カスタムアロケーターを初期化しました");
-    printf("  小プール: %d x %dバイト\n", SMALL_POOL_CAPACITY, SMALL_OBJECT_SIZE);
-    printf("  中プール: %d x %dバイト\n", MEDIUM_POOL_CAPACITY, MEDIUM_OBJECT_SIZE);
-    printf("  大プール: %d x %dバイト\n", LARGE_POOL_CAPACITY, LARGE_OBJECT_SIZE);
+    printf("  サイズクラス: %d 個 (%lu〜%lu バイト)\n", NUM_SIZE_CLASSES,
+           (unsigned long)g_allocator.classes[0].pool.object_size,
+           (unsigned long)g_allocator.classes[NUM_SIZE_CLASSES - 1].pool.object_size);
+    printf("  スラブ: %d バイト単位で必要時に確保\n", SLAB_SIZE);
+    printf("  モード: %s\n", mode == ALLOC_MODE_HEADERLESS ?
+           "ヘッダーなし（スラブ単位メタデータ）" : "ブロックヘッダー付き");
     
     return 0;
 }
 
-/* カスタムmalloc実装 */
-void *custom_malloc(size_t size)
+/* アロケーターの初期化 */
+int allocator_init(void)
 {
-    void *ptr = NULL;
-    BlockHeader *header;
-    double start_time;
-    int pool_type = -1;
+    return allocator_init_mode(ALLOC_MODE_HEADER);
+}
+
+/* ポインタからスラブヘッダーを求める（ヘッダーなしモード） */
+static PoolSlab *slab_of(const void *ptr)
+{
+    return (PoolSlab *)((size_t)ptr & ~(size_t)(SLAB_SIZE - 1));
+}
+
+/* ヘッダーなしモードの割り当て
+ * 小オブジェクトはクラスのスラブから切り出し、大きなブロックは
+ * SLAB_SIZE境界にスラブヘッダーを置いて確保する */
+static void *alloc_headerless(size_t size, size_t *block_size)
+{
+    SizeClass *sc;
+    PoolSlab *slab;
+    void *memory;
+    void *ptr;
+    int size_class;
+    int header_class;
+    size_t header_block;
     
-    if (!g_allocator.initialized) {
-        fprintf(stderr, "アロケーターが初期化されていません\n");
+    size_class = size_to_class(size);
+    if (size_class != SYSTEM_SIZE_CLASS) {
+        sc = &g_allocator.classes[size_class];
+        ptr = pool_alloc(&sc->pool);
+        if (ptr) {
+            sc->alloc_count++;
+            sc->requested_bytes += size;
+            *block_size = sc->pool.object_size;
+            
+            /* ヘッダー付きモードなら消費していたブロックサイズとの差 */
+            header_class = size_to_class(size + sizeof(BlockHeader));
+            header_block = header_class == SYSTEM_SIZE_CLASS ?
+                size + sizeof(BlockHeader) :
+                g_allocator.classes[header_class].pool.object_size;
+            g_allocator.stats.bytes_saved += header_block - *block_size;
+            g_allocator.stats.saved_objects++;
+            return ptr;
+        }
+    }
+    
+    if (posix_memalign(&memory, SLAB_SIZE, SLAB_HEADER_SIZE + size) != 0) {
         return NULL;
     }
+    slab = (PoolSlab *)memory;
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = SYSTEM_SIZE_CLASS;
+    slab->size = size;
+    slab->prev = NULL;
+    slab->next = g_allocator.large_slabs;
+    if (g_allocator.large_slabs) {
+        g_allocator.large_slabs->prev = slab;
+    }
+    g_allocator.large_slabs = slab;
+    g_allocator.stats.system_allocs++;
+    
+    *block_size = size;
+    return (char *)slab + SLAB_HEADER_SIZE;
+}
+
+/* ヘッダーなしモードの解放（*sizeに解放したブロックサイズを返す） */
+static int free_headerless(void *ptr, size_t *size)
+{
+    PoolSlab *slab = slab_of(ptr);
+    
+    if (slab->magic != SLAB_MAGIC) {
+        fprintf(stderr, "不正なメモリブロック\n");
+        return -1;
+    }
+    
+    if (slab->size_class == SYSTEM_SIZE_CLASS) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            g_allocator.large_slabs = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+        *size = slab->size;
+        free(slab);
+        return 0;
+    }
     
-    start_time = get_time_sec();
+    if (slab->size_class < 0 || slab->size_class >= NUM_SIZE_CLASSES) {
+        fprintf(stderr, "不明なサイズクラス\n");
+        return -1;
+    }
+    *size = slab->size;
+    pool_free(&g_allocator.classes[slab->size_class].pool, ptr);
+    return 0;
+}
+
+/* ヘッダー付きモードの割り当て */
+static void *alloc_with_header(size_t size)
+{
+    void *ptr = NULL;
+    BlockHeader *header;
+    int size_class;
     
-    /* サイズに応じたプール選択 */
-    if (size <= SMALL_OBJECT_SIZE - sizeof(BlockHeader)) {
-        ptr = pool_alloc(&g_allocator.small_pool);
-        pool_type = 0;
-        if (ptr) g_allocator.stats.small_allocs++;
-    } else if (size <= MEDIUM_OBJECT_SIZE - sizeof(BlockHeader)) {
-        ptr = pool_alloc(&g_allocator.medium_pool);
-        pool_type = 1;
-        if (ptr) g_allocator.stats.medium_allocs++;
-    } else if (size <= LARGE_OBJECT_SIZE - sizeof(BlockHeader)) {
-        ptr = pool_alloc(&g_allocator.large_pool);
-        pool_type = 2;
-        if (ptr) g_allocator.stats.large_allocs++;
+    /* サイズクラスの選択（ヘッダー込みのサイズで表引き） */
+    size_class = size_to_class(size + sizeof(BlockHeader));
+    if (size_class != SYSTEM_SIZE_CLASS) {
+        ptr = pool_alloc(&g_allocator.classes[size_class].pool);
+        if (ptr) {
+            g_allocator.classes[size_class].alloc_count++;
+            g_allocator.classes[size_class].requested_bytes += size;
+        } else {
+            size_class = SYSTEM_SIZE_CLASS;
+        }
     }
     
     /* プールから割り当てできない場合はシステムmalloc */
@@ -261,13 +552,12 @@ void *custom_malloc(size_t size)
         size_t total_size = size + sizeof(BlockHeader);
         header = (BlockHeader *)malloc(total_size);
         if (!header) {
-            g_allocator.stats.failed_allocs++;
             return NULL;
         }
         
         header->size = size;
         header->magic = BLOCK_MAGIC;
-        header->pool_type = 3;  /* system */
+        header->size_class = SYSTEM_SIZE_CLASS;
         header->is_free = 0;
         header->next = g_allocator.system_blocks;
         header->prev = NULL;
@@ -284,7 +574,7 @@ void *custom_malloc(size_t size)
         header = (BlockHeader *)ptr;
         header->size = size;
         header->magic = BLOCK_MAGIC;
-        header->pool_type = pool_type;
+        header->size_class = size_class;
         header->is_free = 0;
         header->next = NULL;
         header->prev = NULL;
@@ -292,6 +582,166 @@ void *custom_malloc(size_t size)
         ptr = (char *)header + sizeof(BlockHeader);
     }
     
+    return ptr;
+}
+
+/* ヘッダー付きモードの解放（*sizeに要求サイズを返す） */
+static int free_with_header(void *ptr, size_t *size)
+{
+    BlockHeader *header;
+    
+    /* ヘッダーの取得と検証 */
+    header = (BlockHeader *)((char *)ptr - sizeof(BlockHeader));
+    if (header->magic != BLOCK_MAGIC) {
+        fprintf(stderr, "不正なメモリブロック\n");
+        return -1;
+    }
+    
+    if (header->is_free) {
+        fprintf(stderr, "二重解放の検出\n");
+        return -1;
+    }
+    
+    /* 解放後はヘッダーがフリーリストに上書きされるため先に読む */
+    *size = header->size;
+    header->is_free = 1;
+    
+    /* サイズクラスに応じた解放 */
+    if (header->size_class == SYSTEM_SIZE_CLASS) {
+        /* リストから削除 */
+        if (header->prev) {
+            header->prev->next = header->next;
+        } else {
+            g_allocator.system_blocks = header->next;
+        }
+        if (header->next) {
+            header->next->prev = header->prev;
+        }
+        free(header);
+    } else if (header->size_class >= 0 && header->size_class < NUM_SIZE_CLASSES) {
+        pool_free(&g_allocator.classes[header->size_class].pool, header);
+    } else {
+        fprintf(stderr, "不明なサイズクラス\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+#if ALLOC_STATS_SAMPLING
+/* サンプリング間隔の設定（1で毎回、0で計測停止） */
+void allocator_set_sample_rate(unsigned int rate)
+{
+    g_allocator.sample_rate = rate;
+    g_allocator.alloc_countdown = rate;
+    g_allocator.free_countdown = rate;
+}
+
+/* サンプル対象かどうか: 通常はカウンタの減算と比較だけで済む */
+static int should_sample(unsigned int *countdown)
+{
+    if (g_allocator.sample_rate == 0 || --*countdown > 0) {
+        return 0;
+    }
+    *countdown = g_allocator.sample_rate;
+    return 1;
+}
+
+/* 割り当て要求のレイテンシ集計先（最後の要素はシステム割り当て） */
+static int latency_class_of_request(size_t size)
+{
+    int size_class;
+    
+    if (g_allocator.mode == ALLOC_MODE_HEADERLESS) {
+        size_class = size_to_class(size);
+    } else {
+        size_class = size_to_class(size + sizeof(BlockHeader));
+    }
+    return size_class == SYSTEM_SIZE_CLASS ? NUM_SIZE_CLASSES : size_class;
+}
+
+/* 解放対象ブロックのレイテンシ集計先（解放前に呼ぶ） */
+static int latency_class_of_block(const void *ptr)
+{
+    int size_class;
+    
+    if (g_allocator.mode == ALLOC_MODE_HEADERLESS) {
+        size_class = slab_of(ptr)->size_class;
+    } else {
+        size_class = ((const BlockHeader *)((const char *)ptr - sizeof(BlockHeader)))->size_class;
+    }
+    if (size_class < 0 || size_class >= NUM_SIZE_CLASSES) {
+        return NUM_SIZE_CLASSES;
+    }
+    return size_class;
+}
+#else
+void allocator_set_sample_rate(unsigned int rate)
+{
+    (void)rate;
+}
+#endif
+
+/* 統計のスナップショットを取得 */
+void allocator_stats_snapshot(AllocStatsSnapshot *snapshot)
+{
+    int i;
+    
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->stats = g_allocator.stats;
+    snapshot->header_size = g_allocator.mode == ALLOC_MODE_HEADERLESS ?
+                            0 : sizeof(BlockHeader);
+    for (i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const SizeClass *sc = &g_allocator.classes[i];
+        snapshot->classes[i].object_size = sc->pool.object_size;
+        snapshot->classes[i].alloc_count = sc->alloc_count;
+        snapshot->classes[i].requested_bytes = sc->requested_bytes;
+        snapshot->classes[i].used_count = sc->pool.used_count;
+        snapshot->classes[i].capacity = sc->pool.capacity;
+    }
+#if ALLOC_STATS_SAMPLING
+    snapshot->sample_rate = g_allocator.sample_rate;
+    memcpy(snapshot->alloc_latency, g_allocator.alloc_latency,
+           sizeof(snapshot->alloc_latency));
+    memcpy(snapshot->free_latency, g_allocator.free_latency,
+           sizeof(snapshot->free_latency));
+#endif
+}
+
+/* カスタムmalloc実装 */
+void *custom_malloc(size_t size)
+{
+    void *ptr;
+#if ALLOC_STATS_SAMPLING
+    unsigned long start_ns = 0;
+    int latency_class = 0;
+    int sampled;
+#endif
+    
+    if (!g_allocator.initialized) {
+        fprintf(stderr, "アロケーターが初期化されていません\n");
+        return NULL;
+    }
+    
+#if ALLOC_STATS_SAMPLING
+    sampled = should_sample(&g_allocator.alloc_countdown);
+    if (sampled) {
+        latency_class = latency_class_of_request(size);
+        start_ns = get_time_ns();
+    }
+#endif
+    
+    /* ヘッダーなしモードは要求サイズを保持しないため、使用量はブロックサイズで計上 */
+    if (g_allocator.mode == ALLOC_MODE_HEADERLESS) {
+        ptr = alloc_headerless(size, &size);
+    } else {
+        ptr = alloc_with_header(size);
+    }
+    if (!ptr) {
+        g_allocator.stats.failed_allocs++;
+        return NULL;
+    }
+    
     /* 統計更新 */
     g_allocator.stats.total_allocated += size;
     g_allocator.stats.current_usage += size;
@@ -299,7 +749,12 @@ void *custom_malloc(size_t size)
         g_allocator.stats.peak_usage = g_allocator.stats.current_usage;
     }
     
-    g_allocator.stats.total_alloc_time += get_time_sec() - start_time;
+#if ALLOC_STATS_SAMPLING
+    if (sampled) {
+        latency_record(&g_allocator.alloc_latency[latency_class],
+                       get_time_ns() - start_ns);
+    }
+#endif
     
     return ptr;
 }
@@ -307,8 +762,13 @@ void *custom_malloc(size_t size)
 /* カスタムfree実装 */
 void custom_free(void *ptr)
 {
-    BlockHeader *header;
-    double start_time;
+    size_t size;
+    int result;
+#if ALLOC_STATS_SAMPLING
+    unsigned long start_ns = 0;
+    int latency_class = 0;
+    int sampled;
+#endif
     
     if (!ptr) return;
     
@@ -317,60 +777,73 @@ void custom_free(void *ptr)
         return;
     }
     
-    start_time = get_time_sec();
-    
-    /* ヘッダーの取得と検証 */
-    header = (BlockHeader *)((char *)ptr - sizeof(BlockHeader));
-    if (header->magic != BLOCK_MAGIC) {
-        fprintf(stderr, "不正なメモリブロック\n");
-        return;
+#if ALLOC_STATS_SAMPLING
+    sampled = should_sample(&g_allocator.free_countdown);
+    if (sampled) {
+        latency_class = latency_class_of_block(ptr);
+        start_ns = get_time_ns();
     }
+#endif
     
-    if (header->is_free) {
-        fprintf(stderr, "二重解放の検出\n");
-        return;
+    if (g_allocator.mode == ALLOC_MODE_HEADERLESS) {
+        result = free_headerless(ptr, &size);
+    } else {
+        result = free_with_header(ptr, &size);
     }
-    
-    /* プールタイプに応じた解放 */
-    switch (header->pool_type) {
-        case 0:  /* small pool */
-            pool_free(&g_allocator.small_pool, header);
-            break;
-        case 1:  /* medium pool */
-            pool_free(&g_allocator.medium_pool, header);
-            break;
-        case 2:  /* large pool */
-            pool_free(&g_allocator.large_pool, header);
-            break;
-        case 3:  /* system allocation */
-            /* リストから削除 */
-            if (header->prev) {
-                header->prev->next = header->next;
-            } else {
-                g_allocator.system_blocks = header->next;
-            }
-            if (header->next) {
-                header->next->prev = header->prev;
-            }
-            free(header);
-            break;
-        default:
-            fprintf(stderr, "不明なプールタイプ\n");
-            return;
+    if (result < 0) {
+        return;
     }
     
     /* 統計更新 */
-    g_allocator.stats.total_freed += header->size;
-    g_allocator.stats.current_usage -= header->size;
-    g_allocator.stats.total_free_time += get_time_sec() - start_time;
+    g_allocator.stats.total_freed += size;
+    g_allocator.stats.current_usage -= size;
+    g_allocator.stats.free_calls++;
     
-    header->is_free = 1;
+#if ALLOC_STATS_SAMPLING
+    if (sampled) {
+        latency_record(&g_allocator.free_latency[latency_class],
+                       get_time_ns() - start_ns);
+    }
+#endif
+}
+
+#if ALLOC_STATS_SAMPLING
+/* レイテンシ表の表示（サンプルのあるクラスのみ） */
+static void print_latency_table(const char *title, const LatencyHistogram *hists,
+                                const AllocStatsSnapshot *snapshot)
+{
+    int i;
+    
+    printf("%s:\n", title);
+    printf("    クラス サンプル 平均(ns)  p50(ns)  p99(ns)  最大(ns)\n");
+    for (i = 0; i < LATENCY_CLASSES; i++) {
+        const LatencyHistogram *hist = &hists[i];
+        if (hist->samples == 0) {
+            continue;
+        }
+        if (i < NUM_SIZE_CLASSES) {
+            printf("  %8lu", (unsigned long)snapshot->classes[i].object_size);
+        } else {
+            printf("  システム");
+        }
+        printf(" %8lu %8lu %8lu %8lu %9lu\n",
+               hist->samples, hist->total_ns / hist->samples,
+               latency_percentile(hist, 0.50), latency_percentile(hist, 0.99),
+               hist->max_ns);
+    }
 }
+#endif
 
 /* 統計情報の表示 */
 void allocator_print_stats(void)
 {
-    AllocStats *stats = &g_allocator.stats;
+    static AllocStatsSnapshot snapshot;   /* ヒストグラムを含むためスタックに置かない */
+    const AllocStats *stats = &snapshot.stats;
+    size_t class_bytes;
+    double fragmentation;
+    int i;
+    
+    allocator_stats_snapshot(&snapshot);
     
     printf("\n=== アロケーター統計情報 ===\n");
     printf("総割り当て量: %lu バイト\n", (unsigned long)stats->total_allocated);
@@ -379,40 +852,45 @@ void allocator_print_stats(void)
     printf("ピーク使用量: %lu バイト\n", (unsigned long)stats->peak_usage);
     printf("\n");
     
-    printf("割り当て回数:\n");
-    printf("  小 (<%d): %lu 回\n", SMALL_OBJECT_SIZE, (unsigned long)stats->small_allocs);
-    printf("  中 (<%d): %lu 回\n", MEDIUM_OBJECT_SIZE, (unsigned long)stats->medium_allocs);
-    printf("  大 (<%d): %lu 回\n", LARGE_OBJECT_SIZE, (unsigned long)stats->large_allocs);
+    /* 内部断片化 = ブロックのうちヘッダーにも要求サイズにも使われなかった割合 */
+    printf("サイズクラス別 (使用されたクラスのみ):\n");
+    printf("    クラス   割り当て  使用中/容量 内部断片化\n");
+    for (i = 0; i < NUM_SIZE_CLASSES; i++) {
+        const SizeClassStats *sc = &snapshot.classes[i];
+        if (sc->alloc_count == 0) {
+            continue;
+        }
+        class_bytes = sc->alloc_count * sc->object_size;
+        fragmentation = (double)(class_bytes - sc->requested_bytes -
+                                 sc->alloc_count * snapshot.header_size) /
+                        class_bytes * 100.0;
+        printf("  %8lu %10lu %5lu/%-6lu %9.1f%%\n",
+               (unsigned long)sc->object_size, (unsigned long)sc->alloc_count,
+               (unsigned long)sc->used_count, (unsigned long)sc->capacity,
+               fragmentation);
+    }
     printf("  システム: %lu 回\n", (unsigned long)stats->system_allocs);
     printf("  失敗: %lu 回\n", (unsigned long)stats->failed_allocs);
     printf("\n");
     
-    printf("プール使用状況:\n");
-    printf("  小: %lu/%d (%.1f%%)\n", 
-           (unsigned long)g_allocator.small_pool.used_count,
-           SMALL_POOL_CAPACITY,
-           (double)g_allocator.small_pool.used_count / SMALL_POOL_CAPACITY * 100);
-    printf("  中: %lu/%d (%.1f%%)\n",
-           (unsigned long)g_allocator.medium_pool.used_count,
-           MEDIUM_POOL_CAPACITY,
-           (double)g_allocator.medium_pool.used_count / MEDIUM_POOL_CAPACITY * 100);
-    printf("  大: %lu/%d (%.1f%%)\n",
-           (unsigned long)g_allocator.large_pool.used_count,
-           LARGE_POOL_CAPACITY,
-           (double)g_allocator.large_pool.used_count / LARGE_POOL_CAPACITY * 100);
-    printf("\n");
-    
-    if (stats->small_allocs + stats->medium_allocs + stats->large_allocs + stats->system_allocs > 0) {
-        printf("平均割り当て時間: %.6f 秒\n",
-               stats->total_alloc_time / 
-               (stats->small_allocs + stats->medium_allocs + stats->large_allocs + stats->system_allocs));
+    if (stats->saved_objects > 0) {
+        printf("ヘッダーなしによる節約: %lu バイト (1オブジェクトあたり %.1f バイト)\n",
+               (unsigned long)stats->bytes_saved,
+               (double)stats->bytes_saved / stats->saved_objects);
+        printf("\n");
     }
     
-    if (stats->total_freed > 0) {
-        printf("平均解放時間: %.6f 秒\n",
-               stats->total_free_time / 
-               (stats->total_allocated > 0 ? stats->total_freed / sizeof(BlockHeader) : 1));
+#if ALLOC_STATS_SAMPLING
+    if (snapshot.sample_rate > 0) {
+        printf("レイテンシ (%u 回に1回サンプリング)\n", snapshot.sample_rate);
+        print_latency_table("割り当て", snapshot.alloc_latency, &snapshot);
+        print_latency_table("解放", snapshot.free_latency, &snapshot);
+    } else {
+        printf("レイテンシ: サンプリング停止中\n");
     }
+#else
+    printf("レイテンシ: 計測無効 (ALLOC_STATS_SAMPLING=0)\n");
+#endif
     
     printf("=============================\n");
 }
@@ -421,6 +899,7 @@ void allocator_print_stats(void)
 void allocator_shutdown(void)
 {
     BlockHeader *block, *next;
+    int i;
     
     if (!g_allocator.initialized) {
         return;
@@ -433,11 +912,16 @@ void allocator_shutdown(void)
         free(block);
         block = next;
     }
+    while (g_allocator.large_slabs) {
+        PoolSlab *slab_next = g_allocator.large_slabs->next;
+        free(g_allocator.large_slabs);
+        g_allocator.large_slabs = slab_next;
+    }
     
     /* プールの破棄 */
-    destroy_pool(&g_allocator.small_pool);
-    destroy_pool(&g_allocator.medium_pool);
-    destroy_pool(&g_allocator.large_pool);
+    for (i = 0; i < NUM_SIZE_CLASSES; i++) {
+        destroy_pool(&g_allocator.classes[i].pool);
+    }
     
     g_allocator.initialized = 0;
     ALLOC_DEBUG("アロケーターをシャットダウンしました");
@@ -445,6 +929,19 @@ void allocator_shutdown(void)
 
 /* テスト関数群 */
 
+/* ヘッダーなしモードで節約したバイト数の報告（startは計測開始時点の統計） */
+static void report_bytes_saved(const AllocStats *start)
+{
+    size_t saved = g_allocator.stats.bytes_saved - start->bytes_saved;
+    size_t objects = g_allocator.stats.saved_objects - start->saved_objects;
+    
+    if (g_allocator.mode != ALLOC_MODE_HEADERLESS || objects == 0) {
+        return;
+    }
+    printf("ヘッダーなしモードの節約: 1オブジェクトあたり %.1f バイト (%lu オブジェクト)\n",
+           (double)saved / objects, (unsigned long)objects);
+}
+
 /* 基本動作テスト */
 void test_basic_allocation(void)
 {
@@ -479,8 +976,10 @@ void test_performance(void)
     void **ptrs;
     double start, end;
     int i;
+    AllocStats before;
     
     printf("=== パフォーマンステスト ===\n");
+    before = g_allocator.stats;
     
     ptrs = (void **)malloc(sizeof(void *) * iterations);
     if (!ptrs) return;
@@ -496,6 +995,7 @@ void test_performance(void)
     }
     end = get_time_sec();
     printf("カスタムアロケーター: %.6f 秒\n", end - start);
+    report_bytes_saved(&before);
     
     /* 標準malloc/free */
     start = get_time_sec();
@@ -518,8 +1018,10 @@ void test_fragmentation(void)
 {
     void *ptrs[100];
     int i, j;
+    AllocStats before;
     
     printf("=== 断片化テスト ===\n");
+    before = g_allocator.stats;
     
     /* 交互に割り当てと解放を繰り返す */
     for (j = 0; j < 5; j++) {
@@ -552,6 +1054,8 @@ void test_fragmentation(void)
         
         allocator_print_stats();
     }
+    
+    report_bytes_saved(&before);
 }
 
 /* メイン関数 */
@@ -576,6 +1080,20 @@ int main(void)
     /* シャットダウン */
     allocator_shutdown();
     
+    /* ヘッダーなしモードで同じテストを実行 */
+    printf("\n=== ヘッダーなしモード ===\n\n");
+    if (allocator_init_mode(ALLOC_MODE_HEADERLESS) < 0) {
+        fprintf(stderr, "アロケーターの初期化に失敗\n");
+        return 1;
+    }
+    
+    test_basic_allocation();
+    test_performance();
+    test_fragmentation();
+    
+    allocator_print_stats();
+    allocator_shutdown();
+    
     printf("\n=== デモ完了 ===\n");
     return 0;
 }
@@ -585,9 +1103,9 @@ int main(void)
 === 高性能メモリアロケーターデモ ===
 
 [ALLOCATOR] カスタムアロケーターを初期化しました
-  小プール: 1024 x 64バイト
-  中プール: 256 x 256バイト
-  大プール: 64 x 1024バイト
+  サイズクラス: 40 個 (16〜32768 バイト)
+  スラブ: 65536 バイト単位で必要時に確保
+  モード: ブロックヘッダー付き
 
 === 基本割り当てテスト ===
 割り当て[0]: 50 バイト @ 0x1234560
@@ -603,28 +1121,52 @@ int main(void)
 ラウンド 1:
 
 === アロケーター統計情報 ===
-総割り当て量: 27000 バイト
-総解放量: 27000 バイト
+総割り当て量: 2541111 バイト
+総解放量: 2541111 バイト
 現在使用量: 0 バイト
-ピーク使用量: 15000 バイト
+ピーク使用量: 2509711 バイト
 
-割り当て回数:
-  小 (<64): 334 回
-  中 (<256): 333 回
-  大 (<1024): 333 回
+サイズクラス別 (使用されたクラスのみ):
+    クラス   割り当て  使用中/容量 内部断片化
+        48        166     0/1365         7.8%
+        64        330     0/1023        11.3%
+        80        367     0/819          8.7%
+        96        327     0/682          7.4%
+       112        318     0/585          6.3%
+...
+      1280          1     0/51          18.8%
   システム: 0 回
   失敗: 0 回
 
-プール使用状況:
-  小: 0/1024 (0.0%)
-  中: 0/256 (0.0%)
-  大: 0/64 (0.0%)
-
-平均割り当て時間: 0.000012 秒
-平均解放時間: 0.000008 秒
+レイテンシ (64 回に1回サンプリング)
+割り当て:
+    クラス サンプル 平均(ns)  p50(ns)  p99(ns)  最大(ns)
+        48        5       57       55       63        69
+        64        3       57       55       55        64
+        80        8       74       63       95       121
+...
+解放:
+    クラス サンプル 平均(ns)  p50(ns)  p99(ns)  最大(ns)
+...
 =============================
 
 [ALLOCATOR] アロケーターをシャットダウンしました
 
+=== ヘッダーなしモード ===
+
+[ALLOCATOR] カスタムアロケーターを初期化しました
+  サイズクラス: 40 個 (16〜32768 バイト)
+  スラブ: 65536 バイト単位で必要時に確保
+  モード: ヘッダーなし（スラブ単位メタデータ）
+...
+=== パフォーマンステスト ===
+カスタムアロケーター: 0.013103 秒
+ヘッダーなしモードの節約: 1オブジェクトあたり 45.8 バイト (10000 オブジェクト)
+標準malloc/free: 0.001092 秒
+...
+ヘッダーなしモードの節約: 1オブジェクトあたり 44.5 バイト (750 オブジェクト)
+...
+[ALLOCATOR] アロケーターをシャットダウンしました
+
 === デモ完了 ===
 */
\ No newline at end of file
@@ -2,21 +2,83 @@
  * 演習15-8の解答例: ガベージコレクション機能付きメモリ管理
  * ファイル名: ex15_8_gc_framework.c
  * 説明: マーク&スイープ、参照カウント、世代別GCの実装
- * C90準拠
+ *       全体GCではLisp-2方式のスライディングコンパクションでヒープを詰め直す
+ *       インクリメンタルモードでは割り当てごとに時間予算内でマークを進める
+ *       並列モードではワークスティーリングによる並列マークと領域分割の並列スイープを行う
+ *       マークと世代の所属はサイドビットマップで管理し、スイープはビットマップを走査する
+ *       マイナーGCと非移動モードでは回収した隙間をサイズクラス別の空きリストで再利用する
+ *       遅延参照カウントモードでは減少をログにまとめ、循環は試行削除で回収する
+ *       ルートはスロット表とハンドルでO(1)に登録・解除し、スコープ単位のフレームも使える
+ * C90準拠（停止時間の計測はclock_gettime、並列GCはPOSIXスレッドと
+ *          GCC/Clangの__sync組み込み関数を使用）
+ *
+ * 注意: コンパクションはオブジェクトを移動するため、ルートセットと配列要素以外で
+ *       保持しているポインタは全体GCの後に無効になる
  */
 
+/* POSIXスレッド・clock_gettimeを使用するための機能テストマクロ */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* マークビットの原子的な設定（使えない環境では並列GCを無効にする） */
+#if defined(__GNUC__)
+#define GC_HAS_ATOMIC_MARK 1
+#else
+#define GC_HAS_ATOMIC_MARK 0
+#endif
 
 /* GCの設定 */
 #define GC_HEAP_SIZE (1024 * 1024)  /* 1MB */
 #define GC_THRESHOLD 0.75            /* GCトリガー閾値 */
 #define GC_INITIAL_ROOTS 256
+#define GC_NO_SLOT 0xFFFFFFFFU       /* ルート表に登録されていない */
 #define GC_GENERATION_COUNT 3        /* 世代数 */
 #define GC_PROMOTION_AGE 2           /* 昇格年齢 */
+#define GC_ALIGNMENT 8               /* オブジェクトの配置境界 */
+#define GC_MARK_STACK_INITIAL 1024   /* マークスタックの初期容量 */
+#define GC_CARD_SHIFT 9              /* カードサイズ 512バイト */
+#define GC_CARD_SIZE (1UL << GC_CARD_SHIFT)
+#define GC_GRANULE_SHIFT 3           /* ビットマップの1ビット = 8バイト */
+#define GC_DEFAULT_BUDGET_US 50      /* インクリメンタルGCの1回あたりの時間予算 */
+#define GC_BUDGET_CHECK_INTERVAL 32  /* 時刻を確認する間隔（オブジェクト数） */
+#define GC_SWEEP_CHUNK_WORDS 4       /* インクリメンタルスイープで時刻を確認する間隔（ビットマップのワード数） */
+#define GC_MAX_THREADS 64            /* 並列GCの最大スレッド数 */
+#define GC_STEAL_BATCH 64            /* 他スレッドに公開する作業の単位 */
+#define GC_GEN_FREED 0xFF            /* 解放済みオブジェクトの世代番号 */
+#define GC_SMALL_CLASSES 32          /* 8バイト刻みのサイズクラス（256バイトまで） */
+#define GC_SIZE_CLASSES 48           /* 以降は2倍ごとのサイズクラス */
+#define GC_RC_LOG_SIZE 4096          /* 遅延参照カウントの減少ログを処理する単位 */
+
+/* 遅延参照カウントの状態（下位2ビットが試行削除の色） */
+#define RC_COLOR_MASK 0x03
+#define RC_BLACK 0x00                /* 使用中 */
+#define RC_GRAY 0x01                 /* 試行削除中 */
+#define RC_WHITE 0x02                /* 循環ゴミ */
+#define RC_PURPLE 0x03               /* 循環の候補 */
+#define RC_BUFFERED 0x04             /* 候補バッファに登録済み */
+#define RC_IN_ZCT 0x08               /* ゼロカウント表に登録済み */
+
+/* 停止時間ヒストグラム（対数線形: 2倍ごとに4分割） */
+#define PAUSE_SUB_BUCKET_BITS 2
+#define PAUSE_SUB_BUCKETS (1 << PAUSE_SUB_BUCKET_BITS)
+#define PAUSE_BUCKETS (32 * PAUSE_SUB_BUCKETS)
+
+#define GC_ALIGN(n) (((n) + GC_ALIGNMENT - 1) & ~(size_t)(GC_ALIGNMENT - 1))
+
+/* サイドビットマップ（グラニュールごとに1ビット、オブジェクトの先頭位置に立てる） */
+#define GC_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define GC_BIT_WORD(granule) ((granule) / GC_WORD_BITS)
+#define GC_BIT_MASK(granule) (1UL << ((granule) % GC_WORD_BITS))
+#define GC_CARD_WORDS (((size_t)GC_CARD_SIZE >> GC_GRANULE_SHIFT) / GC_WORD_BITS)
 
 /* デバッグ設定 */
 #define DEBUG_GC 1
@@ -29,6 +91,29 @@
 #define GC_DEBUG_VAR(var, fmt)
 #endif
 
+/* プリフェッチヒント（GCC/Clang以外では何もしない） */
+#if defined(__GNUC__)
+#define GC_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define GC_PREFETCH(addr) ((void)0)
+#endif
+
+/* 最下位の立っているビットの位置（0は渡さない） */
+#if defined(__GNUC__)
+#define GC_CTZ(x) __builtin_ctzl(x)
+#else
+static int gc_ctz(unsigned long x)
+{
+    int n = 0;
+    while (!(x & 1UL)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+#define GC_CTZ(x) gc_ctz(x)
+#endif
+
 /* オブジェクトタイプ */
 typedef enum {
     OBJ_INT,
@@ -38,17 +123,17 @@ typedef enum {
     OBJ_STRUCT
 } ObjectType;
 
-/* GCヘッダー（すべてのGC管理オブジェクトに付与） */
+/* GCヘッダー（すべてのGC管理オブジェクトに付与）
+ * マークと世代の所属はヘッダーではなくサイドビットマップで管理する */
 typedef struct GCHeader {
-    struct GCHeader *next;      /* 次のオブジェクト */
-    struct GCHeader *prev;      /* 前のオブジェクト */
+    struct GCHeader *forward;   /* 移動先アドレス（コンパクション用） */
     size_t size;               /* オブジェクトサイズ */
     ObjectType type;           /* オブジェクトタイプ */
-    unsigned char marked;      /* マークフラグ */
-    unsigned char generation;  /* 世代番号 */
     unsigned char age;         /* 年齢（GCを生き延びた回数） */
-    unsigned char is_root;     /* ルートオブジェクトフラグ */
-    int ref_count;            /* 参照カウント */
+    unsigned char rc_state;    /* 遅延参照カウントの色とバッファ登録 */
+    unsigned short root_count; /* ルートからの参照数（ハンドルとフレーム） */
+    int ref_count;            /* 参照カウント（遅延モードではヒープ内の参照のみ） */
+    unsigned int root_slot;    /* ルート表のスロット番号 */
 } GCHeader;
 
 /* GCオブジェクト（実際のデータはヘッダーの後に続く） */
@@ -71,16 +156,97 @@ typedef struct GCString {
     char *data;
 } GCString;
 
-/* GCルートセット */
+/* 空きブロック（回収した領域の先頭に置く）
+ * size は GCHeader の size と同じ位置にあり、死んだオブジェクトと区別せずに大きさで辿れる。
+ * 末尾の1ワードにも size を置き、後ろのブロックから先頭を引けるようにする */
+typedef struct GCFreeBlock {
+    struct GCFreeBlock *next;
+    size_t size;
+    struct GCFreeBlock *prev;   /* 隣のブロックと結合するときに一覧から外すため */
+} GCFreeBlock;
+
+/* オブジェクトへのポインタの可変長バッファ（遅延参照カウント用） */
+typedef struct GCRefBuffer {
+    GCObject **items;
+    size_t count;
+    size_t capacity;
+} GCRefBuffer;
+
+/* GCルートセット
+ * roots は解除されたスロットをNULLにしたまま使い回すので、走査は
+ * 先頭から count までの連続した配列を読むだけでよい */
 typedef struct GCRootSet {
     GCObject **roots;
     size_t capacity;
-    size_t count;
+    size_t count;               /* 使用したことのあるスロット数 */
+    size_t *free_slots;         /* 空きスロット番号のスタック */
+    size_t free_count;
+    GCObject **frame_roots;     /* スコープ付きフレームのルート（スタック） */
+    size_t frame_count;
+    size_t frame_capacity;
 } GCRootSet;
 
+/* ルートのハンドル（スロット番号。オブジェクトが移動しても変わらない） */
+typedef size_t GCRootHandle;
+#define GC_NO_ROOT ((GCRootHandle)-1)
+
+/* マークスタック（再帰の代わりに使う明示的な作業リスト） */
+typedef struct GCMarkStack {
+    GCObject **items;
+    size_t capacity;
+    size_t count;
+    int overflowed;           /* 拡張に失敗して積み残しがある */
+} GCMarkStack;
+
+/* GCの進行状態（インクリメンタルモード） */
+typedef enum {
+    GC_PHASE_IDLE,            /* 収集していない */
+    GC_PHASE_MARKING,         /* 三色マーキング中（灰色 = マークスタック上） */
+    GC_PHASE_SWEEPING         /* マークを終え、ビットマップを少しずつスイープ中 */
+} GCPhase;
+
+/* 停止時間ヒストグラム */
+typedef struct PauseHistogram {
+    unsigned long counts[PAUSE_BUCKETS];
+    unsigned long samples;
+    unsigned long total_ns;
+    unsigned long max_ns;
+} PauseHistogram;
+
+/* スイープ結果（並列スイープでは領域ごとに集計してから反映する） */
+typedef struct SweepResult {
+    size_t freed_objects;
+    size_t freed_bytes;
+    size_t promoted;
+    long count_delta[GC_GENERATION_COUNT];
+    long size_delta[GC_GENERATION_COUNT];
+} SweepResult;
+
+/* 並列GCのワーカー */
+typedef struct GCWorker {
+    pthread_t thread;
+    int id;
+    
+    /* マーク：先頭側は所有スレッド専用、公開分はロックを取って盗み合う */
+    GCObject **local;
+    size_t local_count;
+    size_t local_capacity;
+    GCObject **shared;
+    size_t shared_count;
+    pthread_mutex_t lock;
+    int lock_ready;
+    size_t marked;
+    size_t steals;
+    int overflowed;
+    
+    /* スイープ：担当するビットマップのワード範囲と集計 */
+    size_t sweep_begin;
+    size_t sweep_end;
+    SweepResult sweep;
+} GCWorker;
+
 /* 世代情報 */
 typedef struct Generation {
-    GCHeader *head;           /* オブジェクトリストの先頭 */
     size_t count;            /* オブジェクト数 */
     size_t total_size;       /* 総サイズ */
     size_t gc_count;         /* GC実行回数 */
@@ -93,32 +259,112 @@ typedef struct GarbageCollector {
     size_t used_size;                        /* 使用済みサイズ */
     void *free_ptr;                          /* 空き領域ポインタ */
     GCRootSet root_set;                      /* ルートセット */
-    Generation generations[GC_GENERATION_COUNT];  /* 世代別リスト */
+    GCMarkStack mark_stack;                  /* マークスタック */
+    int mark_generation;                     /* マーク対象の最大世代 */
+    
+    /* カードテーブル（古い世代から若い世代への参照の記録） */
+    unsigned char *cards;                    /* 1 = dirty */
+    size_t card_count;
+    
+    /* サイドビットマップ（マークと世代の所属） */
+    unsigned long *mark_bits;                /* マーク済み */
+    unsigned long *gen_bits[GC_GENERATION_COUNT];  /* どれにも立っていなければ解放済み */
+    unsigned long *free_bits;                /* 空きリストにつないだブロックの先頭 */
+    size_t bitmap_words;
+    
+    /* 空きリスト（コンパクションしない回収で、生存オブジェクト間の隙間をつなぐ） */
+    GCFreeBlock *free_lists[GC_SIZE_CLASSES];
+    size_t free_bytes;
+    size_t free_blocks;
+    int non_moving;                          /* 全体GCでもコンパクションしない */
+    
+    /* 遅延参照カウント（Deutsch-Bobrow方式：ルートからの参照は数えない） */
+    int deferred_rc;
+    GCRefBuffer rc_log;                      /* 減少ログ */
+    GCRefBuffer rc_zct;                      /* ゼロカウント表 */
+    GCRefBuffer rc_candidates;               /* 循環の候補（試行削除の起点） */
+    GCRefBuffer rc_work;                     /* 試行削除の作業スタック */
+    
+    /* インクリメンタルGC */
+    int incremental;                         /* インクリメンタルモード */
+    GCPhase phase;                           /* 現在のフェーズ */
+    unsigned long budget_ns;                 /* 1回あたりのマーク・スイープ時間予算 */
+    size_t sweep_cursor;                     /* 次にスイープするビットマップのワード */
+    size_t sweep_end;                        /* スイープ開始時の割り当て済み範囲の末尾 */
+    
+    /* 並列GC（0なら従来の逐次GC） */
+    int threads;
+    Generation generations[GC_GENERATION_COUNT];  /* 世代別の統計 */
     
     /* 統計情報 */
     size_t total_allocated;
     size_t total_freed;
     size_t gc_runs;
     double total_gc_time;
+    size_t compactions;                      /* コンパクション回数 */
+    size_t total_moved;                      /* 移動したバイト数 */
+    size_t objects_marked;                   /* マークしたオブジェクト数 */
+    size_t max_mark_stack;                   /* マークスタックの最大深さ */
+    size_t cards_scanned;                    /* マイナーGCで走査したカード数 */
+    size_t incremental_steps;                /* インクリメンタルGC（マーク・スイープ）の実行回数 */
+    size_t parallel_runs;                    /* 並列GCの実行回数 */
+    size_t steals;                           /* 作業を盗んだ回数 */
+    size_t freelist_allocs;                  /* 空きリストから割り当てた回数 */
+    size_t rc_batches;                       /* 減少ログを処理した回数 */
+    size_t rc_freed;                         /* 遅延参照カウントで解放した数 */
+    size_t rc_cycle_freed;                   /* うち試行削除で回収した循環ゴミ */
+    unsigned long last_mark_ns;              /* 直近の全体GCのフェーズ別時間 */
+    unsigned long last_sweep_ns;
+    unsigned long last_compact_ns;
+    PauseHistogram pauses;                   /* 停止時間の分布 */
 } GarbageCollector;
 
 /* グローバルGCインスタンス */
 static GarbageCollector g_gc = {0};
 
+/* 並列GCのワーカーと終了判定 */
+static GCWorker g_workers[GC_MAX_THREADS];
+static pthread_mutex_t g_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_idle_workers;
+static int g_mark_workers;                   /* 終了判定に参加するワーカー数 */
+static int g_mark_done;
+
 /* 関数プロトタイプ */
 static int gc_init(void);
 static void gc_shutdown(void);
 static GCObject *gc_alloc(size_t size, ObjectType type);
-static void gc_add_root(GCObject *obj);
+static GCRootHandle gc_add_root(GCObject *obj);
 static void gc_remove_root(GCObject *obj);
+static void gc_release_root(GCRootHandle handle);
+static GCObject *gc_root_object(GCRootHandle handle);
+static size_t gc_push_root_frame(void);
+static int gc_frame_root(GCObject *obj);
+static void gc_pop_root_frame(size_t frame);
 static void gc_collect(void);
 static void gc_mark(GCObject *obj);
-static void gc_sweep(void);
+static void gc_mark_roots(void);
+static void gc_sweep(int max_generation);
+static void gc_compact(void);
 static void gc_mark_and_sweep(void);
+static void gc_array_set(GCArray *array, size_t index, GCObject *value);
 static void gc_ref_inc(GCObject *obj);
 static void gc_ref_dec(GCObject *obj);
 static void gc_generational_collect(int generation);
 static void gc_print_stats(void);
+static void gc_set_incremental(int enabled, unsigned long budget_us);
+static void gc_incremental_start(void);
+static void gc_incremental_step(void);
+static void gc_incremental_finish(void);
+static void gc_shade(GCObject *obj);
+static void incremental_begin_sweep(void);
+static void gc_set_threads(int threads);
+static void gc_parallel_mark(void);
+static void gc_parallel_sweep(void);
+static void gc_set_compaction(int enabled);
+static void gc_set_deferred_rc(int enabled);
+static void gc_rc_flush(void);
+static void gc_rc_collect_cycles(void);
+static void rc_before_trace(void);
 
 /* 時間計測 */
 static double get_time_sec(void)
@@ -126,24 +372,149 @@ static double get_time_sec(void)
     return (double)clock() / CLOCKS_PER_SEC;
 }
 
-/* GCの初期化 */
-static int gc_init(void)
+static unsigned long get_time_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/* 値→バケット番号: 4未満はそのまま、以降は最上位ビットと続く2ビットで決める */
+static int pause_bucket(unsigned long ns)
+{
+    int msb = 0;
+    int index;
+    
+    if (ns < PAUSE_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    while ((ns >> msb) > 1) {
+        msb++;
+    }
+    index = (msb - PAUSE_SUB_BUCKET_BITS + 1) * PAUSE_SUB_BUCKETS +
+            (int)((ns >> (msb - PAUSE_SUB_BUCKET_BITS)) & (PAUSE_SUB_BUCKETS - 1));
+    return index < PAUSE_BUCKETS ? index : PAUSE_BUCKETS - 1;
+}
+
+/* バケット番号→そのバケットに入る最大値 */
+static unsigned long pause_bucket_upper(int index)
+{
+    int group = index / PAUSE_SUB_BUCKETS;
+    int sub = index % PAUSE_SUB_BUCKETS;
+    
+    if (group == 0) {
+        return (unsigned long)index;
+    }
+    return ((unsigned long)(PAUSE_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+static void pause_record(unsigned long ns)
+{
+    PauseHistogram *hist = &g_gc.pauses;
+    
+    hist->counts[pause_bucket(ns)]++;
+    hist->samples++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns) {
+        hist->max_ns = ns;
+    }
+}
+
+/* 分位点（0.0〜1.0）を含むバケットの上限値（最大値を超えない） */
+static unsigned long pause_percentile(double q)
+{
+    const PauseHistogram *hist = &g_gc.pauses;
+    unsigned long target;
+    unsigned long seen = 0;
+    int i;
+    
+    if (hist->samples == 0) {
+        return 0;
+    }
+    target = (unsigned long)(q * hist->samples);
+    if (target == 0) {
+        target = 1;
+    }
+    for (i = 0; i < PAUSE_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            return pause_bucket_upper(i) < hist->max_ns ?
+                   pause_bucket_upper(i) : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+/* 空きリストを空にする */
+static void freelist_reset(void);
+
+/* ヒープと管理テーブルの解放 */
+static void gc_free_tables(void)
+{
+    int gen;
+    
+    free(g_gc.heap);
+    g_gc.heap = NULL;
+    freelist_reset();
+    free(g_gc.root_set.roots);
+    g_gc.root_set.roots = NULL;
+    g_gc.root_set.count = 0;
+    free(g_gc.root_set.free_slots);
+    g_gc.root_set.free_slots = NULL;
+    g_gc.root_set.free_count = 0;
+    free(g_gc.root_set.frame_roots);
+    g_gc.root_set.frame_roots = NULL;
+    g_gc.root_set.frame_count = 0;
+    g_gc.root_set.frame_capacity = 0;
+    free(g_gc.mark_stack.items);
+    g_gc.mark_stack.items = NULL;
+    free(g_gc.cards);
+    g_gc.cards = NULL;
+    free(g_gc.mark_bits);
+    g_gc.mark_bits = NULL;
+    free(g_gc.free_bits);
+    g_gc.free_bits = NULL;
+    free(g_gc.rc_log.items);
+    free(g_gc.rc_zct.items);
+    free(g_gc.rc_candidates.items);
+    free(g_gc.rc_work.items);
+    memset(&g_gc.rc_log, 0, sizeof(GCRefBuffer));
+    memset(&g_gc.rc_zct, 0, sizeof(GCRefBuffer));
+    memset(&g_gc.rc_candidates, 0, sizeof(GCRefBuffer));
+    memset(&g_gc.rc_work, 0, sizeof(GCRefBuffer));
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        free(g_gc.gen_bits[gen]);
+        g_gc.gen_bits[gen] = NULL;
+    }
+}
+
+/* ヒープサイズを指定したGCの初期化 */
+static int gc_init_heap(size_t heap_size)
 {
     int i;
+    int bits_ok = 1;
     
     if (g_gc.heap) {
         GC_DEBUG("GCは既に初期化されています");
         return 0;
     }
     
+    /* 世代の初期化 */
+    for (i = 0; i < GC_GENERATION_COUNT; i++) {
+        g_gc.generations[i].count = 0;
+        g_gc.generations[i].total_size = 0;
+        g_gc.generations[i].gc_count = 0;
+    }
+    
     /* ヒープ領域の確保 */
-    g_gc.heap = malloc(GC_HEAP_SIZE);
+    g_gc.heap = malloc(heap_size);
     if (!g_gc.heap) {
         fprintf(stderr, "ヒープメモリの確保に失敗\n");
         return -1;
     }
     
-    g_gc.heap_size = GC_HEAP_SIZE;
+    g_gc.heap_size = heap_size;
     g_gc.used_size = 0;
     g_gc.free_ptr = g_gc.heap;
     
@@ -151,347 +522,2001 @@ static int gc_init(void)
     g_gc.root_set.capacity = GC_INITIAL_ROOTS;
     g_gc.root_set.count = 0;
     g_gc.root_set.roots = (GCObject **)calloc(GC_INITIAL_ROOTS, sizeof(GCObject *));
-    if (!g_gc.root_set.roots) {
-        free(g_gc.heap);
-        return -1;
+    g_gc.root_set.free_count = 0;
+    g_gc.root_set.free_slots = (size_t *)malloc(GC_INITIAL_ROOTS * sizeof(size_t));
+    g_gc.root_set.frame_count = 0;
+    
+    /* マークスタックの初期化 */
+    g_gc.mark_stack.capacity = GC_MARK_STACK_INITIAL;
+    g_gc.mark_stack.count = 0;
+    g_gc.mark_stack.overflowed = 0;
+    g_gc.mark_stack.items = (GCObject **)malloc(GC_MARK_STACK_INITIAL * sizeof(GCObject *));
+    g_gc.mark_generation = GC_GENERATION_COUNT - 1;
+    g_gc.phase = GC_PHASE_IDLE;
+    if (g_gc.budget_ns == 0) {
+        g_gc.budget_ns = GC_DEFAULT_BUDGET_US * 1000UL;
     }
     
-    /* 世代の初期化 */
+    /* カードテーブルの初期化 */
+    g_gc.card_count = (heap_size + GC_CARD_SIZE - 1) >> GC_CARD_SHIFT;
+    g_gc.cards = (unsigned char *)calloc(g_gc.card_count, 1);
+    
+    /* サイドビットマップの初期化（カード単位で走査するので端数のカードも覆う） */
+    g_gc.bitmap_words = g_gc.card_count * GC_CARD_WORDS;
+    g_gc.mark_bits = (unsigned long *)calloc(g_gc.bitmap_words, sizeof(unsigned long));
+    g_gc.free_bits = (unsigned long *)calloc(g_gc.bitmap_words, sizeof(unsigned long));
     for (i = 0; i < GC_GENERATION_COUNT; i++) {
-        g_gc.generations[i].head = NULL;
-        g_gc.generations[i].count = 0;
-        g_gc.generations[i].total_size = 0;
-        g_gc.generations[i].gc_count = 0;
+        g_gc.gen_bits[i] = (unsigned long *)calloc(g_gc.bitmap_words, sizeof(unsigned long));
+        if (!g_gc.gen_bits[i]) bits_ok = 0;
+    }
+    
+    if (!g_gc.root_set.roots || !g_gc.root_set.free_slots || !g_gc.mark_stack.items ||
+        !g_gc.cards || !g_gc.mark_bits || !g_gc.free_bits || !bits_ok) {
+        fprintf(stderr, "GC管理テーブルの確保に失敗\n");
+        gc_free_tables();
+        return -1;
     }
     
     GC_DEBUG("ガベージコレクターを初期化しました");
-    GC_DEBUG_VAR(GC_HEAP_SIZE, "%d");
+    GC_DEBUG_VAR((unsigned long)heap_size, "%lu");
     
     return 0;
 }
 
-/* オブジェクトを世代リストに追加 */
-static void add_to_generation(GCHeader *header, int gen)
+/* GCの初期化 */
+static int gc_init(void)
 {
-    Generation *generation = &g_gc.generations[gen];
-    
-    header->generation = gen;
-    header->next = generation->head;
-    header->prev = NULL;
-    
-    if (generation->head) {
-        generation->head->prev = header;
-    }
-    generation->head = header;
-    
-    generation->count++;
-    generation->total_size += header->size;
+    return gc_init_heap(GC_HEAP_SIZE);
 }
 
-/* オブジェクトを世代リストから削除 */
-static void remove_from_generation(GCHeader *header)
+/* アドレス→グラニュール番号（ビットマップ上の位置） */
+static size_t granule_of(const void *addr)
 {
-    Generation *generation = &g_gc.generations[header->generation];
-    
-    if (header->prev) {
-        header->prev->next = header->next;
-    } else {
-        generation->head = header->next;
-    }
-    
-    if (header->next) {
-        header->next->prev = header->prev;
-    }
-    
-    generation->count--;
-    generation->total_size -= header->size;
+    return (size_t)((const char *)addr - (const char *)g_gc.heap) >> GC_GRANULE_SHIFT;
 }
 
-/* メモリ割り当て */
-static GCObject *gc_alloc(size_t size, ObjectType type)
+/* グラニュール番号→その位置に始まるオブジェクト */
+static GCHeader *header_at(size_t granule)
 {
-    GCHeader *header;
-    size_t total_size;
-    
-    if (!g_gc.heap) {
-        fprintf(stderr, "GCが初期化されていません\n");
-        return NULL;
-    }
-    
-    total_size = sizeof(GCHeader) + size;
-    
-    /* メモリ不足チェック */
-    if (g_gc.used_size + total_size > g_gc.heap_size) {
-        GC_DEBUG("メモリ不足、GCを実行します");
-        gc_collect();
-        
-        /* GC後も不足している場合 */
-        if (g_gc.used_size + total_size > g_gc.heap_size) {
-            fprintf(stderr, "メモリ不足: 要求=%lu, 空き=%lu\n",
-                    (unsigned long)total_size,
-                    (unsigned long)(g_gc.heap_size - g_gc.used_size));
-            return NULL;
-        }
-    }
-    
-    /* GC閾値チェック */
-    if ((double)g_gc.used_size / g_gc.heap_size > GC_THRESHOLD) {
-        GC_DEBUG("閾値超過、GCを実行します");
-        gc_collect();
-    }
-    
-    /* メモリ割り当て */
-    header = (GCHeader *)g_gc.free_ptr;
-    g_gc.free_ptr = (char *)g_gc.free_ptr + total_size;
-    g_gc.used_size += total_size;
-    
-    /* ヘッダー初期化 */
-    memset(header, 0, sizeof(GCHeader));
-    header->size = total_size;
-    header->type = type;
-    header->marked = 0;
-    header->generation = 0;  /* 新規オブジェクトは第0世代 */
-    header->age = 0;
-    header->is_root = 0;
-    header->ref_count = 1;   /* 初期参照カウント */
-    
-    /* 世代リストに追加 */
-    add_to_generation(header, 0);
-    
-    g_gc.total_allocated += total_size;
-    
-    return (GCObject *)header;
+    return (GCHeader *)((char *)g_gc.heap + (granule << GC_GRANULE_SHIFT));
 }
 
-/* ルートセットに追加 */
-static void gc_add_root(GCObject *obj)
+static int bit_test(const unsigned long *map, size_t granule)
 {
-    size_t i;
-    
-    if (!obj) return;
-    
-    /* 既に登録済みかチェック */
-    for (i = 0; i < g_gc.root_set.count; i++) {
-        if (g_gc.root_set.roots[i] == obj) {
-            return;
-        }
-    }
+    return (map[GC_BIT_WORD(granule)] & GC_BIT_MASK(granule)) != 0;
+}
+
+static void bit_set(unsigned long *map, size_t granule)
+{
+    map[GC_BIT_WORD(granule)] |= GC_BIT_MASK(granule);
+}
+
+static void bit_clear(unsigned long *map, size_t granule)
+{
+    map[GC_BIT_WORD(granule)] &= ~GC_BIT_MASK(granule);
+}
+
+/* 割り当て済み領域を覆うビットマップのワード数 */
+static size_t used_words(void)
+{
+    return (granule_of(g_gc.free_ptr) + GC_WORD_BITS - 1) / GC_WORD_BITS;
+}
+
+/* ワード内で世代ビットのいずれかが立っている位置（生存オブジェクトの先頭） */
+static unsigned long live_word(size_t word)
+{
+    unsigned long bits = 0;
+    int gen;
     
-    /* 容量チェック */
-    if (g_gc.root_set.count >= g_gc.root_set.capacity) {
-        size_t new_capacity = g_gc.root_set.capacity * 2;
-        GCObject **new_roots = (GCObject **)realloc(g_gc.root_set.roots,
-                                                    new_capacity * sizeof(GCObject *));
-        if (!new_roots) {
-            fprintf(stderr, "ルートセット拡張に失敗\n");
-            return;
-        }
-        g_gc.root_set.roots = new_roots;
-        g_gc.root_set.capacity = new_capacity;
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        bits |= g_gc.gen_bits[gen][word];
     }
-    
-    g_gc.root_set.roots[g_gc.root_set.count++] = obj;
-    obj->header.is_root = 1;
-    
-    GC_DEBUG("ルートに追加");
+    return bits;
 }
 
-/* ルートセットから削除 */
-static void gc_remove_root(GCObject *obj)
+/* オブジェクトの世代（どの世代のビットも立っていなければ解放済み） */
+static int object_generation(const GCHeader *header)
 {
-    size_t i;
-    
-    if (!obj) return;
+    size_t granule = granule_of(header);
+    int gen;
     
-    for (i = 0; i < g_gc.root_set.count; i++) {
-        if (g_gc.root_set.roots[i] == obj) {
-            /* 削除 */
-            g_gc.root_set.roots[i] = g_gc.root_set.roots[--g_gc.root_set.count];
-            obj->header.is_root = 0;
-            GC_DEBUG("ルートから削除");
-            return;
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        if (bit_test(g_gc.gen_bits[gen], granule)) {
+            return gen;
         }
     }
+    return GC_GEN_FREED;
 }
 
-/* オブジェクトのマーク（再帰的） */
-static void gc_mark(GCObject *obj)
+static int is_marked(const GCHeader *header)
 {
-    GCHeader *header;
-    
-    if (!obj) return;
-    
-    header = &obj->header;
+    return bit_test(g_gc.mark_bits, granule_of(header));
+}
+
+/* マークビットを立て、新たに立てた場合は1を返す（並列マークでは原子的に行う） */
+static int try_mark(const GCHeader *header)
+{
+    size_t granule = granule_of(header);
+    unsigned long *word = &g_gc.mark_bits[GC_BIT_WORD(granule)];
+    unsigned long mask = GC_BIT_MASK(granule);
     
-    /* 既にマーク済み */
-    if (header->marked) return;
+#if GC_HAS_ATOMIC_MARK
+    return (__sync_fetch_and_or(word, mask) & mask) == 0;
+#else
+    if (*word & mask) return 0;
+    *word |= mask;
+    return 1;
+#endif
+}
+
+/* 世代への登録と削除（ビットマップと統計を更新） */
+static void generation_add(GCHeader *header, int gen)
+{
+    bit_set(g_gc.gen_bits[gen], granule_of(header));
+    g_gc.generations[gen].count++;
+    g_gc.generations[gen].total_size += header->size;
+}
+
+static void generation_remove(GCHeader *header, int gen)
+{
+    bit_clear(g_gc.gen_bits[gen], granule_of(header));
+    g_gc.generations[gen].count--;
+    g_gc.generations[gen].total_size -= header->size;
+}
+
+/* 付随データの解放 */
+static void release_payload(GCHeader *header);
+
+/* オブジェクトを世代から外して解放済みにする（領域はコンパクションで回収） */
+static void free_object(GCHeader *header)
+{
+    int gen = object_generation(header);
     
-    header->marked = 1;
+    if (gen == GC_GEN_FREED) return;
     
-    /* タイプ別の子オブジェクトマーク */
+    generation_remove(header, gen);
+    release_payload(header);
+    g_gc.total_freed += header->size;
+}
+
+/* ヒープ外に確保した付随データの解放 */
+static void release_payload(GCHeader *header)
+{
     switch (header->type) {
         case OBJ_ARRAY: {
-            GCArray *array = (GCArray *)obj;
-            size_t i;
-            for (i = 0; i < array->length; i++) {
-                gc_mark(array->elements[i]);
-            }
+            GCArray *array = (GCArray *)header;
+            free(array->elements);
+            array->elements = NULL;
+            array->length = 0;
             break;
         }
-        case OBJ_STRUCT:
-            /* 構造体の場合は内部のGCオブジェクトをマーク */
-            /* 実装は構造体の定義に依存 */
+        case OBJ_STRING: {
+            GCString *string = (GCString *)header;
+            free(string->data);
+            string->data = NULL;
+            string->length = 0;
             break;
+        }
         default:
-            /* プリミティブ型は子オブジェクトなし */
             break;
     }
 }
 
-/* スイープ（未マークオブジェクトの解放） */
-static void gc_sweep(void)
+/* ヒープ内オフセットに対応するカード番号 */
+static size_t card_index(const void *addr)
+{
+    return (size_t)((const char *)addr - (const char *)g_gc.heap) >> GC_CARD_SHIFT;
+}
+
+/* 配列が世代genより若い世代のオブジェクトを参照しているか */
+static int has_younger_child(GCHeader *header, int gen)
+{
+    if (header->type == OBJ_ARRAY) {
+        GCArray *array = (GCArray *)header;
+        size_t i;
+        for (i = 0; i < array->length; i++) {
+            GCObject *child = array->elements[i];
+            if (child && object_generation(&child->header) < gen) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* カード上の古い世代のオブジェクトに、より若い世代への参照があるか
+ * カードの範囲はビットマップのワード単位で区切れるので、世代ビットだけを辿る */
+static int card_has_old_to_young(size_t card)
 {
+    size_t word;
     int gen;
     
-    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
-        GCHeader *current = g_gc.generations[gen].head;
-        
-        while (current) {
-            GCHeader *next = current->next;
-            
-            if (!current->marked) {
-                /* 未マークオブジェクトを解放 */
-                GC_DEBUG("オブジェクトを解放");
-                
-                remove_from_generation(current);
-                
-                /* メモリは実際には解放しない（シンプルなヒープ実装） */
-                /* 実際のGCではメモリコンパクションが必要 */
-                
-                g_gc.total_freed += current->size;
-            } else {
-                /* マークをクリア */
-                current->marked = 0;
-                
-                /* 年齢を増やして昇格チェック */
-                current->age++;
-                if (gen < GC_GENERATION_COUNT - 1 && 
-                    current->age >= GC_PROMOTION_AGE) {
-                    /* 次世代に昇格 */
-                    remove_from_generation(current);
-                    add_to_generation(current, gen + 1);
-                    current->age = 0;
-                    GC_DEBUG("オブジェクトを昇格");
+    for (word = card * GC_CARD_WORDS; word < (card + 1) * GC_CARD_WORDS; word++) {
+        for (gen = 1; gen < GC_GENERATION_COUNT; gen++) {
+            unsigned long bits = g_gc.gen_bits[gen][word];
+            while (bits) {
+                GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(bits));
+                bits &= bits - 1;
+                if (has_younger_child(header, gen)) {
+                    return 1;
                 }
             }
-            
-            current = next;
         }
     }
+    return 0;
 }
 
-/* マーク&スイープGC実行 */
-static void gc_mark_and_sweep(void)
+/* dirtyカードを再評価し、古い→若い参照が残っていないカードをクリア */
+static void refresh_cards(void)
 {
-    size_t i;
-    double start_time = get_time_sec();
+    size_t card;
     
-    GC_DEBUG("マーク&スイープGC開始");
-    
-    /* マークフェーズ：ルートから到達可能なオブジェクトをマーク */
-    for (i = 0; i < g_gc.root_set.count; i++) {
-        gc_mark(g_gc.root_set.roots[i]);
+    for (card = 0; card < g_gc.card_count; card++) {
+        if (g_gc.cards[card]) {
+            g_gc.cards[card] = (unsigned char)card_has_old_to_young(card);
+        }
     }
+}
+
+/* コンパクション後にカードテーブルを作り直す */
+static void rebuild_cards(void)
+{
+    size_t card;
     
-    /* スイープフェーズ：未マークオブジェクトを解放 */
-    gc_sweep();
-    
-    double elapsed = get_time_sec() - start_time;
-    g_gc.total_gc_time += elapsed;
-    g_gc.gc_runs++;
-    
-    GC_DEBUG("マーク&スイープGC完了");
-    GC_DEBUG_VAR(elapsed, "%.6f");
+    for (card = 0; card < g_gc.card_count; card++) {
+        g_gc.cards[card] = (unsigned char)card_has_old_to_young(card);
+    }
 }
 
-/* 世代別GC実行 */
-static void gc_generational_collect(int max_generation)
+/* サイズ→サイズクラス（小さいサイズは完全一致、大きいサイズは2倍ごと） */
+static int size_class(size_t size)
 {
-    int gen;
-    size_t i;
-    double start_time = get_time_sec();
+    int cls;
     
-    GC_DEBUG("世代別GC開始");
+    if (size <= GC_SMALL_CLASSES * GC_ALIGNMENT) {
+        return (int)(size / GC_ALIGNMENT) - 1;
+    }
+    for (cls = GC_SMALL_CLASSES, size >>= 9; size && cls < GC_SIZE_CLASSES - 1; size >>= 1) {
+        cls++;
+    }
+    return cls;
+}
+
+static void freelist_reset(void)
+{
+    int cls;
+    
+    for (cls = 0; cls < GC_SIZE_CLASSES; cls++) {
+        g_gc.free_lists[cls] = NULL;
+    }
+    if (g_gc.free_bits) {
+        memset(g_gc.free_bits, 0, g_gc.bitmap_words * sizeof(unsigned long));
+    }
+    g_gc.free_bytes = 0;
+    g_gc.free_blocks = 0;
+}
+
+static void freelist_push(char *addr, size_t size)
+{
+    GCFreeBlock *block = (GCFreeBlock *)addr;
+    int cls = size_class(size);
+    
+    block->size = size;
+    block->prev = NULL;
+    block->next = g_gc.free_lists[cls];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    g_gc.free_lists[cls] = block;
+    memcpy(addr + size - sizeof(size_t), &size, sizeof(size_t));
+    bit_set(g_gc.free_bits, granule_of(block));
+    g_gc.free_bytes += size;
+    g_gc.free_blocks++;
+}
+
+static void freelist_unlink(GCFreeBlock *block)
+{
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        g_gc.free_lists[size_class(block->size)] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    bit_clear(g_gc.free_bits, granule_of(block));
+    g_gc.free_bytes -= block->size;
+    g_gc.free_blocks--;
+}
+
+/* 空きリストからの割り当て
+ * 同じサイズのクラスにあれば先頭を取るだけ（高速経路）。なければ大きいクラスから
+ * 最初に収まるブロックを取り、オブジェクトにできる大きさの残りは空きリストに戻す。
+ * *size には実際に使うサイズ（分割しなかった端数を含む）を返す */
+static GCHeader *freelist_take(size_t *size)
+{
+    int cls = size_class(*size);
+    GCFreeBlock *block = NULL;
+    
+    if (cls < GC_SMALL_CLASSES && g_gc.free_lists[cls]) {
+        block = g_gc.free_lists[cls];
+    } else {
+        for (; cls < GC_SIZE_CLASSES && !block; cls++) {
+            GCFreeBlock *candidate;
+            for (candidate = g_gc.free_lists[cls]; candidate; candidate = candidate->next) {
+                if (candidate->size >= *size) {
+                    block = candidate;
+                    break;
+                }
+            }
+        }
+    }
+    if (!block) {
+        return NULL;
+    }
+    
+    freelist_unlink(block);
+    if (block->size - *size >= GC_ALIGN(sizeof(GCHeader))) {
+        freelist_push((char *)block + *size, block->size - *size);
+    } else {
+        *size = block->size;
+    }
+    g_gc.freelist_allocs++;
+    return (GCHeader *)block;
+}
+
+/* 空きリスト、なければ末尾のバンプ領域から割り当てる */
+static GCHeader *take_block(size_t *size)
+{
+    GCHeader *header = freelist_take(size);
+    
+    if (!header && (char *)g_gc.free_ptr + *size <= (char *)g_gc.heap + g_gc.heap_size) {
+        header = (GCHeader *)g_gc.free_ptr;
+        g_gc.free_ptr = (char *)g_gc.free_ptr + *size;
+    }
+    return header;
+}
+
+/* コンパクションしない回収：生存オブジェクトの間の隙間を空きリストにつなぐ
+ * 隣接する死んだオブジェクトや既存の空きブロックは1つの隙間としてまとまる */
+static void rebuild_free_lists(void)
+{
+    char *cursor = (char *)g_gc.heap;    /* 直前の生存オブジェクトの末尾 */
+    size_t words = used_words();
+    size_t word;
+    size_t live_bytes = 0;
+    
+    freelist_reset();
+    for (word = 0; word < words; word++) {
+        unsigned long live = live_word(word);
+        while (live) {
+            GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(live));
+            live &= live - 1;
+            if ((char *)header > cursor) {
+                freelist_push(cursor, (size_t)((char *)header - cursor));
+            }
+            cursor = (char *)header + header->size;
+            live_bytes += header->size;
+        }
+    }
+    
+    /* 末尾の隙間はバンプ領域に戻す */
+    g_gc.free_ptr = cursor;
+    g_gc.used_size = live_bytes;
+}
+
+/* 隙間の中のブロックの大きさ（空きブロックと死んだオブジェクトのどちらでも同じ位置にある。
+ * 型の違う構造体を通して読むと最適化で順序が入れ替わりうるので、バイト列としてコピーする） */
+static size_t gap_piece_size(const char *addr)
+{
+    size_t size;
+    
+    memcpy(&size, addr + offsetof(GCFreeBlock, size), sizeof(size_t));
+    return size;
+}
+
+/* addr を含む隙間の先頭：直前の空きブロックの先頭か生存オブジェクトの末尾（なければヒープ先頭）
+ * 直前が空きブロックなら末尾の size から先頭を引き、そうでなければビットマップを遡る */
+static char *gap_start_before(const char *addr)
+{
+    size_t granule = granule_of(addr);
+    size_t word = GC_BIT_WORD(granule);
+    unsigned long bits;
+    
+    if (addr > (char *)g_gc.heap) {
+        size_t size;
+        
+        memcpy(&size, addr - sizeof(size_t), sizeof(size_t));
+        
+        /* 生存オブジェクトの末尾のデータでも、先頭の空きビットと size が一致しなければ採らない */
+        if (size > 0 && size % GC_ALIGNMENT == 0 && size <= (size_t)(addr - (char *)g_gc.heap) &&
+            bit_test(g_gc.free_bits, granule_of(addr - size)) &&
+            gap_piece_size(addr - size) == size) {
+            return (char *)addr - size;
+        }
+    }
+    
+    bits = (live_word(word) | g_gc.free_bits[word]) & (GC_BIT_MASK(granule) - 1);
+    for (;;) {
+        if (bits) {
+            int bit = GC_WORD_BITS - 1;
+            GCHeader *header;
+            
+            while (!(bits & (1UL << bit))) {
+                bit--;
+            }
+            header = header_at(word * GC_WORD_BITS + bit);
+            if (g_gc.free_bits[word] & (1UL << bit)) {
+                return (char *)header;
+            }
+            return (char *)header + header->size;
+        }
+        if (word == 0) {
+            return (char *)g_gc.heap;
+        }
+        word--;
+        bits = live_word(word) | g_gc.free_bits[word];
+    }
+}
+
+/* 世代ビットを消したばかりのオブジェクトを空きリストに戻す（マイナーGCとインクリメンタルGCのスイープ用）
+ * 直前の空きブロックから次の生存オブジェクトまでの空きブロックと解放済みオブジェクトを1つにまとめる。
+ * 手間はその隙間の大きさだけで、生存オブジェクトの数によらない。
+ * まとめた範囲を [*start, 戻り値) で返す（同じスイープで後から見つかる死んだオブジェクトを飛ばすため） */
+static char *freelist_release(GCHeader *header, char **start_out)
+{
+    char *start = gap_start_before((const char *)header);
+    char *cursor = start;
+    
+    /* 隙間は空きブロックと死んだオブジェクトで埋まっていて、どちらも size で辿れる */
+    while (cursor < (char *)g_gc.free_ptr &&
+           object_generation((GCHeader *)cursor) == GC_GEN_FREED) {
+        size_t size = gap_piece_size(cursor);
+        
+        if (bit_test(g_gc.free_bits, granule_of(cursor))) {
+            freelist_unlink((GCFreeBlock *)cursor);
+        } else {
+            g_gc.used_size -= size;
+        }
+        cursor += size;
+    }
+    
+    /* 末尾の隙間はバンプ領域に戻す */
+    if (cursor >= (char *)g_gc.free_ptr) {
+        g_gc.free_ptr = start;
+    } else {
+        freelist_push(start, (size_t)(cursor - start));
+    }
+    *start_out = start;
+    return cursor;
+}
+
+/* 全体GC後の回収（コンパクション、非移動モードでは空きリスト） */
+static void gc_reclaim(void)
+{
+    if (g_gc.non_moving) {
+        rebuild_free_lists();
+    } else {
+        gc_compact();
+    }
+}
+
+/* メモリ割り当て */
+static GCObject *gc_alloc(size_t size, ObjectType type)
+{
+    GCHeader *header;
+    size_t total_size;
+    
+    if (!g_gc.heap) {
+        fprintf(stderr, "GCが初期化されていません\n");
+        return NULL;
+    }
+    
+    /* ビットマップの1ビットが1オブジェクトの先頭に対応するよう、位置を揃える */
+    total_size = GC_ALIGN(sizeof(GCHeader) + size);
+    
+    /* インクリメンタルモード：割り当てのたびにマークやスイープを少し進める */
+    if (g_gc.phase != GC_PHASE_IDLE) {
+        gc_incremental_step();
+    }
+    
+    /* GC閾値チェック */
+    if ((double)g_gc.used_size / g_gc.heap_size > GC_THRESHOLD) {
+        if (!g_gc.incremental) {
+            GC_DEBUG("閾値超過、GCを実行します");
+            gc_collect();
+        } else if (g_gc.phase == GC_PHASE_IDLE) {
+            GC_DEBUG("閾値超過、インクリメンタルGCを開始します");
+            gc_incremental_start();
+        }
+    }
+    
+    /* メモリ割り当て（空きリスト → バンプ領域） */
+    header = take_block(&total_size);
+    if (!header) {
+        /* メモリ不足（収集途中なら残りを一括で終わらせる） */
+        int was_collecting = g_gc.phase != GC_PHASE_IDLE;
+        
+        GC_DEBUG("メモリ不足、GCを実行します");
+        gc_collect();
+        header = take_block(&total_size);
+        
+        /* インクリメンタルGCはコンパクションしないので、断片化で足りなければ一括GCで詰める */
+        if (!header && was_collecting) {
+            gc_collect();
+            header = take_block(&total_size);
+        }
+        
+        /* GC後も不足している場合 */
+        if (!header) {
+            fprintf(stderr, "メモリ不足: 要求=%lu, 空き=%lu\n",
+                    (unsigned long)total_size,
+                    (unsigned long)(g_gc.heap_size - g_gc.used_size));
+            return NULL;
+        }
+    }
+    g_gc.used_size += total_size;
+    
+    /* ヘッダー初期化 */
+    memset(header, 0, sizeof(GCHeader));
+    header->size = total_size;
+    header->type = type;
+    header->age = 0;
+    header->root_count = 0;
+    header->root_slot = GC_NO_SLOT;
+    header->ref_count = g_gc.deferred_rc ? 0 : 1;  /* 遅延モードでは作成者の参照を数えない */
+    
+    /* マーク中に生まれたオブジェクトは黒として割り当てる
+     * （スイープ中はまだスイープしていない範囲だけ。スイープ済みの範囲にマークを残さない） */
+    if (g_gc.phase == GC_PHASE_MARKING ||
+        (g_gc.phase == GC_PHASE_SWEEPING &&
+         GC_BIT_WORD(granule_of(header)) >= g_gc.sweep_cursor &&
+         GC_BIT_WORD(granule_of(header)) < g_gc.sweep_end)) {
+        bit_set(g_gc.mark_bits, granule_of(header));
+    }
+    
+    /* 新規オブジェクトは第0世代 */
+    generation_add(header, 0);
+    
+    g_gc.total_allocated += total_size;
+    
+    return (GCObject *)header;
+}
+
+/* ルート表を拡張（スロット配列と空きスロットのスタックを同じ容量にそろえる） */
+static int root_set_grow(void)
+{
+    GCRootSet *set = &g_gc.root_set;
+    size_t new_capacity = set->capacity * 2;
+    GCObject **new_roots;
+    size_t *new_free;
+    
+    new_roots = (GCObject **)realloc(set->roots, new_capacity * sizeof(GCObject *));
+    if (!new_roots) return -1;
+    set->roots = new_roots;
+    new_free = (size_t *)realloc(set->free_slots, new_capacity * sizeof(size_t));
+    if (!new_free) return -1;
+    set->free_slots = new_free;
+    set->capacity = new_capacity;
+    return 0;
+}
+
+/* ルートセットに追加（O(1)）：空きスロットを優先して使い、ハンドルを返す */
+static GCRootHandle gc_add_root(GCObject *obj)
+{
+    GCRootSet *set = &g_gc.root_set;
+    size_t slot;
+    
+    if (!obj) return GC_NO_ROOT;
+    
+    /* 既に登録済みなら同じハンドルを返す */
+    if (obj->header.root_slot != GC_NO_SLOT) {
+        return obj->header.root_slot;
+    }
+    
+    if (set->free_count > 0) {
+        slot = set->free_slots[--set->free_count];
+    } else {
+        if (set->count >= set->capacity && root_set_grow() < 0) {
+            fprintf(stderr, "ルートセット拡張に失敗\n");
+            return GC_NO_ROOT;
+        }
+        slot = set->count++;
+    }
+    
+    set->roots[slot] = obj;
+    obj->header.root_slot = (unsigned int)slot;
+    obj->header.root_count++;
+    gc_shade(obj);
+    
+    GC_DEBUG("ルートに追加");
+    return slot;
+}
+
+/* ハンドルでルートを解除（O(1)） */
+static void gc_release_root(GCRootHandle handle)
+{
+    GCRootSet *set = &g_gc.root_set;
+    GCObject *obj;
+    
+    if (handle >= set->count || !set->roots[handle]) return;
+    
+    /* 削除（マーク中はスナップショットの一部として灰色にする） */
+    obj = set->roots[handle];
+    gc_shade(obj);
+    set->roots[handle] = NULL;
+    set->free_slots[set->free_count++] = handle;
+    obj->header.root_slot = GC_NO_SLOT;
+    if (obj->header.root_count > 0) obj->header.root_count--;
+    GC_DEBUG("ルートから削除");
+}
+
+/* ルートセットから削除（ヘッダーのスロット番号を使うので探索しない） */
+static void gc_remove_root(GCObject *obj)
+{
+    unsigned int slot;
+    
+    if (!obj) return;
+    
+    slot = obj->header.root_slot;
+    if (slot != GC_NO_SLOT && slot < g_gc.root_set.count &&
+        g_gc.root_set.roots[slot] == obj) {
+        gc_release_root(slot);
+    }
+}
+
+/* ハンドルが指す現在のオブジェクト（コンパクション後は移動先） */
+static GCObject *gc_root_object(GCRootHandle handle)
+{
+    if (handle >= g_gc.root_set.count) return NULL;
+    return g_gc.root_set.roots[handle];
+}
+
+/* スコープ付きルートフレームを開始（戻り値を gc_pop_root_frame に渡す） */
+static size_t gc_push_root_frame(void)
+{
+    return g_gc.root_set.frame_count;
+}
+
+/* 現在のフレームにルートを積む（スロット管理をしないので登録が軽い） */
+static int gc_frame_root(GCObject *obj)
+{
+    GCRootSet *set = &g_gc.root_set;
+    
+    if (set->frame_count >= set->frame_capacity) {
+        size_t new_capacity = set->frame_capacity ? set->frame_capacity * 2 : GC_INITIAL_ROOTS;
+        GCObject **new_frame = (GCObject **)realloc(set->frame_roots,
+                                                    new_capacity * sizeof(GCObject *));
+        if (!new_frame) {
+            fprintf(stderr, "ルートフレーム拡張に失敗\n");
+            return -1;
+        }
+        set->frame_roots = new_frame;
+        set->frame_capacity = new_capacity;
+    }
+    
+    set->frame_roots[set->frame_count++] = obj;
+    if (obj) {
+        obj->header.root_count++;
+        gc_shade(obj);
+    }
+    return 0;
+}
+
+/* フレームを閉じ、それ以降に積んだルートをまとめて解除する */
+static void gc_pop_root_frame(size_t frame)
+{
+    GCRootSet *set = &g_gc.root_set;
+    
+    while (set->frame_count > frame) {
+        GCObject *obj = set->frame_roots[--set->frame_count];
+        
+        if (!obj) continue;
+        gc_shade(obj);
+        if (obj->header.root_count > 0) obj->header.root_count--;
+    }
+}
+
+/* マークスタックに積む（マーク済みかどうかは取り出す時に調べる） */
+static void mark_stack_push(GCObject *obj)
+{
+    GCMarkStack *stack = &g_gc.mark_stack;
+    
+    if (!obj) return;
+    
+    if (stack->count >= stack->capacity) {
+        size_t new_capacity = stack->capacity * 2;
+        GCObject **new_items = (GCObject **)realloc(stack->items,
+                                                    new_capacity * sizeof(GCObject *));
+        if (!new_items) {
+            /* 積めなかった分は後でヒープを再走査して拾う */
+            stack->overflowed = 1;
+            return;
+        }
+        stack->items = new_items;
+        stack->capacity = new_capacity;
+    }
+    
+    /* 取り出すまでにヘッダーをキャッシュに載せておく */
+    GC_PREFETCH(obj);
+    stack->items[stack->count++] = obj;
+    
+    if (stack->count > g_gc.max_mark_stack) {
+        g_gc.max_mark_stack = stack->count;
+    }
+}
+
+/* マークスタックから1つ取り出して黒にし、子を灰色にする */
+static void mark_stack_scan_one(void)
+{
+    GCMarkStack *stack = &g_gc.mark_stack;
+    GCObject *obj = stack->items[--stack->count];
+    GCHeader *header = &obj->header;
+    
+    /* 今回収集しない古い世代、解放済み、または既にマーク済み */
+    if (object_generation(header) > g_gc.mark_generation || !try_mark(header)) return;
+    
+    g_gc.objects_marked++;
+    
+    /* タイプ別の子オブジェクトマーク */
+    switch (header->type) {
+        case OBJ_ARRAY: {
+            GCArray *array = (GCArray *)obj;
+            size_t i;
+            for (i = array->length; i > 0; i--) {
+                mark_stack_push(array->elements[i - 1]);
+            }
+            break;
+        }
+        case OBJ_STRUCT:
+            /* 構造体の場合は内部のGCオブジェクトをマーク */
+            /* 実装は構造体の定義に依存 */
+            break;
+        default:
+            /* プリミティブ型は子オブジェクトなし */
+            break;
+    }
+}
+
+/* マークスタックが空になるまで処理 */
+static void mark_stack_drain(void)
+{
+    while (g_gc.mark_stack.count > 0) {
+        mark_stack_scan_one();
+    }
+}
+
+/* dirtyカード上の古いオブジェクトから、収集対象の世代への参照を積む */
+static void push_card_children(void)
+{
+    size_t card, word;
+    int gen;
+    
+    for (card = 0; card < g_gc.card_count; card++) {
+        if (!g_gc.cards[card]) continue;
+        
+        /* カード上の古い世代のオブジェクトだけを世代ビットから拾う */
+        for (word = card * GC_CARD_WORDS; word < (card + 1) * GC_CARD_WORDS; word++) {
+            for (gen = g_gc.mark_generation + 1; gen < GC_GENERATION_COUNT; gen++) {
+                unsigned long bits = g_gc.gen_bits[gen][word];
+                while (bits) {
+                    GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(bits));
+                    bits &= bits - 1;
+                    if (header->type == OBJ_ARRAY) {
+                        GCArray *array = (GCArray *)header;
+                        size_t i;
+                        for (i = 0; i < array->length; i++) {
+                            GCObject *child = array->elements[i];
+                            if (child && object_generation(&child->header) <= g_gc.mark_generation) {
+                                mark_stack_push(child);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        g_gc.cards_scanned++;
+    }
+}
+
+/* スタック拡張に失敗した場合の回復：マーク済み配列の未マークの子を積み直す */
+static void mark_stack_recover(void)
+{
+    size_t word, words;
+    
+    while (g_gc.mark_stack.overflowed) {
+        g_gc.mark_stack.overflowed = 0;
+        GC_DEBUG("マークスタック溢れ、ヒープを再走査します");
+        
+        words = used_words();
+        for (word = 0; word < words; word++) {
+            unsigned long bits = g_gc.mark_bits[word];
+            while (bits) {
+                GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(bits));
+                bits &= bits - 1;
+                if (header->type == OBJ_ARRAY) {
+                    GCArray *array = (GCArray *)header;
+                    size_t i;
+                    for (i = 0; i < array->length; i++) {
+                        GCObject *child = array->elements[i];
+                        if (child && !is_marked(&child->header)) {
+                            mark_stack_push(child);
+                        }
+                    }
+                    mark_stack_drain();
+                }
+            }
+        }
+        
+        /* マイナーGCでは古い世代はマークされないのでカードから拾い直す */
+        if (g_gc.mark_generation < GC_GENERATION_COUNT - 1) {
+            push_card_children();
+            mark_stack_drain();
+        }
+    }
+}
+
+/* オブジェクトのマーク（明示的なスタックを使い、C言語のスタックを消費しない） */
+static void gc_mark(GCObject *obj)
+{
+    mark_stack_push(obj);
+    mark_stack_drain();
+    mark_stack_recover();
+}
+
+/* ルートセットからのマーク */
+static void gc_mark_roots(void)
+{
+    size_t i;
+    
+    for (i = 0; i < g_gc.root_set.count; i++) {
+        gc_mark(g_gc.root_set.roots[i]);
+    }
+    for (i = 0; i < g_gc.root_set.frame_count; i++) {
+        gc_mark(g_gc.root_set.frame_roots[i]);
+    }
+}
+
+/* dirtyカードからのマーク（マイナーGC用の記憶集合） */
+static void gc_mark_cards(void)
+{
+    push_card_children();
+    mark_stack_drain();
+    mark_stack_recover();
+}
+
+/* ビットマップのワード[first, last)をスイープする
+ * 世代ビットのうちマークビットのないものが死んだオブジェクト。
+ * 昇格したオブジェクトを同じGCで再び調べないよう、古い世代から処理する */
+static void sweep_words(size_t first, size_t last, int max_generation,
+                        int note_cards, int to_freelist, SweepResult *result)
+{
+    size_t word;
+    int gen;
+    char *merged_start = NULL, *merged_end = NULL;   /* 直前に空きリストへ戻した範囲 */
+    
+    for (word = first; word < last; word++) {
+        unsigned long marks = g_gc.mark_bits[word];
+        
+        for (gen = max_generation; gen >= 0; gen--) {
+            unsigned long bits = g_gc.gen_bits[gen][word];
+            unsigned long dead = bits & ~marks;
+            unsigned long live = bits & marks;
+            
+            if (!bits) continue;
+            g_gc.gen_bits[gen][word] = live;
+            
+            /* 未マークオブジェクトの解放 */
+            for (bits = dead; bits; bits &= bits - 1) {
+                GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(bits));
+                release_payload(header);
+                result->freed_objects++;
+                result->freed_bytes += header->size;
+                result->count_delta[gen]--;
+                result->size_delta[gen] -= (long)header->size;
+            }
+            
+            /* 空きリストに戻す（まとめた空きブロックの見出しと末尾の size が死んだオブジェクトを
+             * 上書きするので、付随データと統計を先に済ませておく） */
+            while (to_freelist && dead) {
+                GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(dead));
+                dead &= dead - 1;
+                if ((char *)header < merged_start || (char *)header >= merged_end) {
+                    merged_end = freelist_release(header, &merged_start);
+                }
+            }
+            
+            /* 年齢を増やして昇格チェック */
+            while (live) {
+                int bit = GC_CTZ(live);
+                GCHeader *header = header_at(word * GC_WORD_BITS + bit);
+                live &= live - 1;
+                
+                header->age++;
+                if (gen < GC_GENERATION_COUNT - 1 && header->age >= GC_PROMOTION_AGE) {
+                    unsigned long mask = 1UL << bit;
+                    
+                    /* 次世代に昇格 */
+                    g_gc.gen_bits[gen][word] &= ~mask;
+                    g_gc.gen_bits[gen + 1][word] |= mask;
+                    header->age = 0;
+                    result->promoted++;
+                    result->count_delta[gen]--;
+                    result->size_delta[gen] -= (long)header->size;
+                    result->count_delta[gen + 1]++;
+                    result->size_delta[gen + 1] += (long)header->size;
+                    
+                    /* 若い要素を持ったまま昇格した配列は記憶集合に入れる */
+                    if (note_cards && has_younger_child(header, gen + 1)) {
+                        g_gc.cards[card_index(header)] = 1;
+                    }
+                }
+            }
+        }
+        
+        /* 次のGCに備えてマークをクリア */
+        g_gc.mark_bits[word] = 0;
+    }
+}
+
+/* スイープ結果を世代の統計に反映 */
+static void apply_sweep_result(const SweepResult *result)
+{
+    int gen;
+    
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        Generation *generation = &g_gc.generations[gen];
+        generation->count = (size_t)((long)generation->count + result->count_delta[gen]);
+        generation->total_size = (size_t)((long)generation->total_size + result->size_delta[gen]);
+    }
+    g_gc.total_freed += result->freed_bytes;
+}
+
+/* スイープ（未マークオブジェクトの解放） */
+static void gc_sweep(int max_generation)
+{
+    SweepResult result;
+    unsigned long freed;
+    unsigned long promoted;
+    
+    if (max_generation > GC_GENERATION_COUNT - 1) {
+        max_generation = GC_GENERATION_COUNT - 1;
+    }
+    
+    /* 全体GCの後はコンパクションでカードを作り直すので、昇格時の記録はマイナーGCだけ。
+     * マイナーGCは死んだオブジェクトをその場で空きリストに戻す */
+    memset(&result, 0, sizeof(result));
+    sweep_words(0, used_words(), max_generation,
+                max_generation < GC_GENERATION_COUNT - 1,
+                max_generation < GC_GENERATION_COUNT - 1, &result);
+    apply_sweep_result(&result);
+    
+    freed = (unsigned long)result.freed_objects;
+    promoted = (unsigned long)result.promoted;
+    GC_DEBUG_VAR(freed, "%lu");
+    GC_DEBUG_VAR(promoted, "%lu");
+}
+
+/* 転送先の取得（死んだオブジェクトへの参照はNULLになる） */
+static GCObject *forward_ref(GCObject *obj)
+{
+    if (!obj || object_generation(&obj->header) == GC_GEN_FREED) {
+        return NULL;
+    }
+    return (GCObject *)obj->header.forward;
+}
+
+/* コンパクション（Lisp-2方式のスライディング）
+ * 世代ビットの立っているオブジェクトを生存とみなし、アドレス順を保ったまま
+ * ヒープ先頭へ詰める。スイープや参照カウントで解放された領域はここで回収される */
+static void gc_compact(void)
+{
+    char *heap_start = (char *)g_gc.heap;
+    size_t words = used_words();
+    size_t word;
+    char *dest;
+    size_t i;
+    size_t moved = 0;
+    int gen;
+    
+    /* 1. アドレス順に転送先を計算（生存ビットだけを辿る） */
+    dest = heap_start;
+    for (word = 0; word < words; word++) {
+        unsigned long live = live_word(word);
+        while (live) {
+            GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(live));
+            live &= live - 1;
+            header->forward = (GCHeader *)dest;
+            dest += header->size;
+        }
+    }
+    
+    /* 2. 参照の更新（ルート、配列要素） */
+    for (i = 0; i < g_gc.root_set.count; i++) {
+        GCObject *root = g_gc.root_set.roots[i];
+        
+        if (!root) continue;
+        g_gc.root_set.roots[i] = forward_ref(root);
+        if (!g_gc.root_set.roots[i]) {
+            /* 参照カウントで解放済みのルートはスロットを空ける */
+            g_gc.root_set.free_slots[g_gc.root_set.free_count++] = i;
+        }
+    }
+    for (i = 0; i < g_gc.root_set.frame_count; i++) {
+        g_gc.root_set.frame_roots[i] = forward_ref(g_gc.root_set.frame_roots[i]);
+    }
+    for (word = 0; word < words; word++) {
+        unsigned long live = live_word(word);
+        while (live) {
+            GCHeader *header = header_at(word * GC_WORD_BITS + GC_CTZ(live));
+            live &= live - 1;
+            if (header->type == OBJ_ARRAY) {
+                GCArray *array = (GCArray *)header;
+                for (i = 0; i < array->length; i++) {
+                    array->elements[i] = forward_ref(array->elements[i]);
+                }
+            }
+        }
+    }
+    
+    /* 3. オブジェクトの移動と世代ビットの付け替え
+     * 移動先は常に低位アドレスなので、ワードを退避してから前方へ書き戻せる */
+    for (word = 0; word < words; word++) {
+        unsigned long bits[GC_GENERATION_COUNT];
+        unsigned long live = 0;
+        
+        for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+            bits[gen] = g_gc.gen_bits[gen][word];
+            g_gc.gen_bits[gen][word] = 0;
+            live |= bits[gen];
+        }
+        while (live) {
+            int bit = GC_CTZ(live);
+            GCHeader *header = header_at(word * GC_WORD_BITS + bit);
+            GCHeader *to = header->forward;
+            size_t size = header->size;
+            
+            live &= live - 1;
+            gen = 0;
+            while (!(bits[gen] & (1UL << bit))) {
+                gen++;
+            }
+            if (to != header) {
+                memmove(to, header, size);
+                moved += size;
+            }
+            bit_set(g_gc.gen_bits[gen], granule_of(to));
+        }
+    }
+    
+    g_gc.free_ptr = dest;
+    g_gc.used_size = (size_t)(dest - heap_start);
+    freelist_reset();
+    rebuild_cards();
+    g_gc.compactions++;
+    g_gc.total_moved += moved;
+    
+    GC_DEBUG("コンパクション完了");
+    GC_DEBUG_VAR((unsigned long)moved, "%lu");
+}
+
+/* コンパクションの有無（無効にすると全体GCも空きリストで回収する） */
+static void gc_set_compaction(int enabled)
+{
+    g_gc.non_moving = !enabled;
+}
+
+/* 並列GCのスレッド数設定（0で従来の逐次GC） */
+static void gc_set_threads(int threads)
+{
+    if (threads < 0) threads = 0;
+    if (threads > GC_MAX_THREADS) threads = GC_MAX_THREADS;
+    if (!GC_HAS_ATOMIC_MARK && threads > 1) threads = 1;
+    g_gc.threads = threads;
+}
+
+/* ワーカー専用スタックへ積む */
+static void worker_push(GCWorker *w, GCObject *obj)
+{
+    if (!obj) return;
+    
+    if (w->local_count >= w->local_capacity) {
+        size_t new_capacity = w->local_capacity ? w->local_capacity * 2 : GC_MARK_STACK_INITIAL;
+        GCObject **new_local = (GCObject **)realloc(w->local, new_capacity * sizeof(GCObject *));
+        if (!new_local) {
+            /* 積み残しは並列マーク後に逐次の回復処理で拾う */
+            w->overflowed = 1;
+            return;
+        }
+        w->local = new_local;
+        w->local_capacity = new_capacity;
+    }
+    GC_PREFETCH(obj);
+    w->local[w->local_count++] = obj;
+}
+
+/* 手元に十分な作業があれば、古い側を1バッチ分公開する */
+static void worker_publish(GCWorker *w)
+{
+    if (w->local_count < GC_STEAL_BATCH * 2 || !w->shared) return;
+    if (pthread_mutex_trylock(&w->lock) != 0) return;
+    
+    if (w->shared_count == 0) {
+        memcpy(w->shared, w->local, GC_STEAL_BATCH * sizeof(GCObject *));
+        memmove(w->local, w->local + GC_STEAL_BATCH,
+                (w->local_count - GC_STEAL_BATCH) * sizeof(GCObject *));
+        w->local_count -= GC_STEAL_BATCH;
+        w->shared_count = GC_STEAL_BATCH;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* victimの公開分を取る（自分自身なら全部、他人なら半分） */
+static int worker_take(GCWorker *w, GCWorker *victim)
+{
+    size_t n, i;
+    
+    pthread_mutex_lock(&victim->lock);
+    n = victim->shared_count;
+    if (victim != w && n > 1) {
+        n = (n + 1) / 2;
+    }
+    for (i = 0; i < n; i++) {
+        worker_push(w, victim->shared[--victim->shared_count]);
+    }
+    pthread_mutex_unlock(&victim->lock);
+    
+    if (n > 0 && victim != w) {
+        w->steals++;
+    }
+    return n > 0;
+}
+
+/* 他のワーカーが公開している作業があるか */
+static int work_available(GCWorker *w)
+{
+    int i;
+    
+    for (i = 1; i < g_gc.threads; i++) {
+        GCWorker *victim = &g_workers[(w->id + i) % g_gc.threads];
+        size_t count;
+        
+        pthread_mutex_lock(&victim->lock);
+        count = victim->shared_count;
+        pthread_mutex_unlock(&victim->lock);
+        if (count > 0) return 1;
+    }
+    return 0;
+}
+
+/* 作業が尽きたら他のワーカーから盗む。全員が手ぶらになったら終了
+ * 手ぶらのワーカーは作業を持たず、公開するのは作業中のワーカーだけなので、
+ * 手ぶらの数が全員に達した時点で未処理の作業は残っていない */
+static int worker_find_work(GCWorker *w)
+{
+    int i;
+    
+    if (worker_take(w, w)) return 1;
+    
+    pthread_mutex_lock(&g_idle_lock);
+    g_idle_workers++;
+    for (;;) {
+        if (g_mark_done) break;
+        if (g_idle_workers == g_mark_workers) {
+            g_mark_done = 1;
+            break;
+        }
+        pthread_mutex_unlock(&g_idle_lock);
+        
+        if (!work_available(w)) {
+            sched_yield();
+            pthread_mutex_lock(&g_idle_lock);
+            continue;
+        }
+        
+        /* 盗みに行く前に手ぶら扱いから外す */
+        pthread_mutex_lock(&g_idle_lock);
+        g_idle_workers--;
+        pthread_mutex_unlock(&g_idle_lock);
+        
+        for (i = 1; i < g_gc.threads; i++) {
+            if (worker_take(w, &g_workers[(w->id + i) % g_gc.threads])) {
+                return 1;
+            }
+        }
+        
+        pthread_mutex_lock(&g_idle_lock);
+        g_idle_workers++;
+    }
+    pthread_mutex_unlock(&g_idle_lock);
+    return 0;
+}
+
+/* 並列マークのワーカー本体 */
+static void *mark_worker(void *arg)
+{
+    GCWorker *w = (GCWorker *)arg;
+    size_t ops = 0;
+    
+    do {
+        while (w->local_count > 0) {
+            GCObject *obj = w->local[--w->local_count];
+            GCHeader *header = &obj->header;
+            
+            /* 解放済みは辿らない。マークビットは原子的に立てる */
+            if (object_generation(header) == GC_GEN_FREED || !try_mark(header)) continue;
+            w->marked++;
+            
+            if (header->type == OBJ_ARRAY) {
+                GCArray *array = (GCArray *)obj;
+                size_t i;
+                for (i = array->length; i > 0; i--) {
+                    worker_push(w, array->elements[i - 1]);
+                }
+            }
+            
+            if ((++ops & (GC_STEAL_BATCH - 1)) == 0) {
+                worker_publish(w);
+            }
+        }
+    } while (worker_find_work(w));
+    
+    return NULL;
+}
+
+/* 1番以降のワーカーを起動し、起動できた数（0番を含む）を返す
+ * 0番は呼び出しスレッドが担当する */
+static int start_workers(void *(*body)(void *))
+{
+    int i;
+    
+    for (i = 1; i < g_gc.threads; i++) {
+        if (pthread_create(&g_workers[i].thread, NULL, body, &g_workers[i]) != 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void join_workers(int started)
+{
+    int i;
+    
+    for (i = 1; i < started; i++) {
+        pthread_join(g_workers[i].thread, NULL);
+    }
+}
+
+/* 並列マーク：ルートをワーカーに配り、ワークスティーリングで辿る */
+static void gc_parallel_mark(void)
+{
+    int i, started;
+    size_t r;
+    int overflowed = 0;
+    
+    for (i = 0; i < g_gc.threads; i++) {
+        GCWorker *w = &g_workers[i];
+        w->id = i;
+        w->local_count = 0;
+        w->marked = 0;
+        w->steals = 0;
+        w->overflowed = 0;
+        if (!w->lock_ready) {
+            pthread_mutex_init(&w->lock, NULL);
+            w->lock_ready = 1;
+        }
+        if (!w->shared) {
+            /* 確保できなければ公開せずに自分で処理する */
+            w->shared = (GCObject **)malloc(GC_STEAL_BATCH * sizeof(GCObject *));
+        }
+        w->shared_count = 0;
+    }
+    for (r = 0; r < g_gc.root_set.count; r++) {
+        worker_push(&g_workers[r % g_gc.threads], g_gc.root_set.roots[r]);
+    }
+    for (r = 0; r < g_gc.root_set.frame_count; r++) {
+        worker_push(&g_workers[r % g_gc.threads], g_gc.root_set.frame_roots[r]);
+    }
+    
+    g_idle_workers = 0;
+    g_mark_workers = g_gc.threads;
+    g_mark_done = 0;
+    started = start_workers(mark_worker);
+    if (started < g_gc.threads) {
+        /* 起動できなかったワーカーの作業は0番が引き取る */
+        pthread_mutex_lock(&g_idle_lock);
+        g_mark_workers = started;
+        pthread_mutex_unlock(&g_idle_lock);
+        for (i = started; i < g_gc.threads; i++) {
+            while (g_workers[i].local_count > 0) {
+                GCWorker *w = &g_workers[i];
+                worker_push(&g_workers[0], w->local[--w->local_count]);
+            }
+        }
+    }
+    mark_worker(&g_workers[0]);
+    join_workers(started);
+    
+    for (i = 0; i < g_gc.threads; i++) {
+        g_gc.objects_marked += g_workers[i].marked;
+        g_gc.steals += g_workers[i].steals;
+        overflowed |= g_workers[i].overflowed;
+    }
+    if (overflowed) {
+        g_gc.mark_stack.overflowed = 1;
+        mark_stack_recover();
+    }
+}
+
+/* 並列スイープのワーカー本体：担当するワード範囲のビットマップを処理する */
+static void *sweep_worker(void *arg)
+{
+    GCWorker *w = (GCWorker *)arg;
+    
+    memset(&w->sweep, 0, sizeof(w->sweep));
+    sweep_words(w->sweep_begin, w->sweep_end, GC_GENERATION_COUNT - 1, 0, 0, &w->sweep);
+    return NULL;
+}
+
+/* 並列スイープ：ビットマップをワード単位で分割し、各領域の集計を統計に反映する
+ * ワードごとに担当が分かれるので同期は不要。カードテーブルは直後のコンパクションで作り直す */
+static void gc_parallel_sweep(void)
+{
+    size_t words = used_words();
+    int i, started;
+    
+    for (i = 0; i < g_gc.threads; i++) {
+        g_workers[i].sweep_begin = words * (size_t)i / (size_t)g_gc.threads;
+        g_workers[i].sweep_end = words * (size_t)(i + 1) / (size_t)g_gc.threads;
+    }
+    
+    started = start_workers(sweep_worker);
+    for (i = started; i < g_gc.threads; i++) {
+        sweep_worker(&g_workers[i]);
+    }
+    sweep_worker(&g_workers[0]);
+    join_workers(started);
+    
+    for (i = 0; i < g_gc.threads; i++) {
+        apply_sweep_result(&g_workers[i].sweep);
+    }
+}
+
+/* マーク&スイープGC実行 */
+static void gc_mark_and_sweep(void)
+{
+    double start_time = get_time_sec();
+    unsigned long start_ns = get_time_ns();
+    unsigned long phase_ns;
+    double elapsed;
+    
+    GC_DEBUG("マーク&スイープGC開始");
+    
+    /* 遅延参照カウントのバッファはオブジェクトの移動で無効になるので先に処理 */
+    rc_before_trace();
+    
+    if (g_gc.threads > 0) {
+        /* 並列マーク・並列スイープ */
+        gc_parallel_mark();
+        phase_ns = get_time_ns();
+        g_gc.last_mark_ns = phase_ns - start_ns;
+        gc_parallel_sweep();
+        g_gc.parallel_runs++;
+    } else {
+        /* マークフェーズ：ルートから到達可能なオブジェクトをマーク */
+        gc_mark_roots();
+        phase_ns = get_time_ns();
+        g_gc.last_mark_ns = phase_ns - start_ns;
+        
+        /* スイープフェーズ：未マークオブジェクトを解放 */
+        gc_sweep(GC_GENERATION_COUNT - 1);
+    }
+    g_gc.last_sweep_ns = get_time_ns() - phase_ns;
+    
+    /* コンパクションフェーズ：生存オブジェクトを詰めて空き領域を回収
+     * （非移動モードでは隙間を空きリストにつなぐ） */
+    phase_ns = get_time_ns();
+    gc_reclaim();
+    g_gc.last_compact_ns = get_time_ns() - phase_ns;
+    
+    elapsed = get_time_sec() - start_time;
+    g_gc.total_gc_time += elapsed;
+    g_gc.gc_runs++;
+    pause_record(get_time_ns() - start_ns);
+    
+    GC_DEBUG("マーク&スイープGC完了");
+    GC_DEBUG_VAR(elapsed, "%.6f");
+}
+
+/* 世代別GC実行
+ * マイナーGCはルートとdirtyカードだけを起点にし、古い世代は辿らない */
+static void gc_generational_collect(int max_generation)
+{
+    int gen;
+    double start_time;
+    unsigned long start_ns;
+    double elapsed;
+    
+    /* 進行中のインクリメンタルGCは先に完了させる */
+    if (g_gc.phase != GC_PHASE_IDLE) {
+        gc_incremental_finish();
+    }
+    
+    start_time = get_time_sec();
+    start_ns = get_time_ns();
+    
+    GC_DEBUG("世代別GC開始");
     GC_DEBUG_VAR(max_generation, "%d");
+    rc_before_trace();
+    
+    if (max_generation > GC_GENERATION_COUNT - 1) {
+        max_generation = GC_GENERATION_COUNT - 1;
+    }
     
-    /* 若い世代から指定世代まで収集 */
-    for (gen = 0; gen <= max_generation && gen < GC_GENERATION_COUNT; gen++) {
+    for (gen = 0; gen <= max_generation; gen++) {
         g_gc.generations[gen].gc_count++;
-        
-        /* この世代のルートオブジェクトをマーク */
-        for (i = 0; i < g_gc.root_set.count; i++) {
-            GCObject *obj = g_gc.root_set.roots[i];
-            if (obj && obj->header.generation == gen) {
-                gc_mark(obj);
-            }
-        }
+    }
+    
+    /* 若い世代から指定世代までをマーク */
+    g_gc.mark_generation = max_generation;
+    gc_mark_roots();
+    if (max_generation < GC_GENERATION_COUNT - 1) {
+        gc_mark_cards();
     }
     
     /* スイープ */
-    gc_sweep();
+    gc_sweep(max_generation);
+    g_gc.mark_generation = GC_GENERATION_COUNT - 1;
+    
+    /* 全世代を収集した場合のみコンパクション（非移動モードでは空きリストの作り直し）
+     * マイナーGCはスイープで解放した分だけ空きリストに戻してある */
+    if (max_generation == GC_GENERATION_COUNT - 1) {
+        gc_reclaim();
+    } else {
+        refresh_cards();
+    }
     
-    double elapsed = get_time_sec() - start_time;
+    elapsed = get_time_sec() - start_time;
     g_gc.total_gc_time += elapsed;
     g_gc.gc_runs++;
+    pause_record(get_time_ns() - start_ns);
     
     GC_DEBUG("世代別GC完了");
 }
 
-/* 参照カウント増加 */
+/* 書き込みバリア付きの配列要素代入
+ * 古い配列に若いオブジェクトを格納した場合、そのカードをdirtyにする
+ * インクリメンタルマーク中は上書き前の値を灰色にする（SATB） */
+static void gc_array_set(GCArray *array, size_t index, GCObject *value)
+{
+    GCObject *old = array->elements[index];
+    
+    /* スナップショットバリア：上書きされる参照先をマーク対象に残す */
+    gc_shade(old);
+    array->elements[index] = value;
+    
+    if (value && object_generation(&value->header) < object_generation(&array->header)) {
+        g_gc.cards[card_index(array)] = 1;
+    }
+    
+    /* 遅延参照カウント：ヒープ内の参照の増減（減少はログに積むだけ） */
+    if (g_gc.deferred_rc) {
+        gc_ref_inc(value);
+        gc_ref_dec(old);
+    }
+}
+
+/* バッファに追加（拡張できなければ-1） */
+static int ref_buffer_push(GCRefBuffer *buffer, GCObject *obj)
+{
+    if (buffer->count >= buffer->capacity) {
+        size_t new_capacity = buffer->capacity ? buffer->capacity * 2 : GC_RC_LOG_SIZE;
+        GCObject **new_items = (GCObject **)realloc(buffer->items,
+                                                    new_capacity * sizeof(GCObject *));
+        if (!new_items) {
+            return -1;
+        }
+        buffer->items = new_items;
+        buffer->capacity = new_capacity;
+    }
+    buffer->items[buffer->count++] = obj;
+    return 0;
+}
+
+static int rc_freed_object(GCObject *obj)
+{
+    return object_generation(&obj->header) == GC_GEN_FREED;
+}
+
+static void rc_set_color(GCObject *obj, int color)
+{
+    obj->header.rc_state = (unsigned char)((obj->header.rc_state & ~RC_COLOR_MASK) | color);
+}
+
+static int rc_color(const GCObject *obj)
+{
+    return obj->header.rc_state & RC_COLOR_MASK;
+}
+
+/* 減少を1件適用する
+ * 0になったものはゼロカウント表へ（ルートから参照されていないか後でまとめて確認する）、
+ * 0にならなかったものは循環ゴミの候補にする */
+static void rc_apply_dec(GCObject *obj)
+{
+    GCHeader *header = &obj->header;
+    
+    if (rc_freed_object(obj)) return;
+    if (header->ref_count > 0) {
+        header->ref_count--;
+    }
+    
+    if (header->ref_count == 0) {
+        if (!(header->rc_state & RC_IN_ZCT) && ref_buffer_push(&g_gc.rc_zct, obj) == 0) {
+            header->rc_state |= RC_IN_ZCT;
+        }
+    } else {
+        rc_set_color(obj, RC_PURPLE);
+        if (!(header->rc_state & RC_BUFFERED) &&
+            ref_buffer_push(&g_gc.rc_candidates, obj) == 0) {
+            header->rc_state |= RC_BUFFERED;
+        }
+    }
+}
+
+/* 減少ログを記録（積めなければその場で適用） */
+static void rc_log_dec(GCObject *obj)
+{
+    if (ref_buffer_push(&g_gc.rc_log, obj) != 0) {
+        rc_apply_dec(obj);
+    }
+}
+
+/* 参照カウントで解放：子への参照は減少ログに積み、同じバッチで処理する */
+static void rc_release(GCObject *obj)
+{
+    if (obj->header.type == OBJ_ARRAY) {
+        GCArray *array = (GCArray *)obj;
+        size_t i;
+        for (i = 0; i < array->length; i++) {
+            if (array->elements[i]) {
+                rc_log_dec(array->elements[i]);
+            }
+        }
+    }
+    free_object(&obj->header);
+    g_gc.rc_freed++;
+}
+
+/* 減少ログをまとめて処理し、ゼロカウント表を照合する
+ * ルートに登録されたオブジェクトはスタックから参照されているものとみなして残す */
+static void gc_rc_flush(void)
+{
+    size_t i, kept;
+    
+    if (g_gc.rc_log.count == 0 && g_gc.rc_zct.count == 0) return;
+    g_gc.rc_batches++;
+    
+    do {
+        while (g_gc.rc_log.count > 0) {
+            rc_apply_dec(g_gc.rc_log.items[--g_gc.rc_log.count]);
+        }
+        
+        for (i = 0, kept = 0; i < g_gc.rc_zct.count; i++) {
+            GCObject *obj = g_gc.rc_zct.items[i];
+            
+            if (rc_freed_object(obj)) continue;
+            if (obj->header.ref_count == 0 && obj->header.root_count > 0) {
+                g_gc.rc_zct.items[kept++] = obj;
+                continue;
+            }
+            obj->header.rc_state &= ~RC_IN_ZCT;
+            if (obj->header.ref_count == 0) {
+                rc_release(obj);
+            }
+        }
+        g_gc.rc_zct.count = kept;
+    } while (g_gc.rc_log.count > 0);
+}
+
+/* 試行削除の作業スタック
+ * 各段階で1つのオブジェクトを積むのは色が変わる時の1回だけなので、
+ * 開始前に（入れ子の分も含めて）生存オブジェクト数の2倍を確保しておけば溢れない */
+static int rc_reserve_work(void)
+{
+    size_t needed = 1;
+    int gen;
+    
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        needed += 2 * g_gc.generations[gen].count;
+    }
+    if (g_gc.rc_work.capacity < needed) {
+        GCObject **items = (GCObject **)realloc(g_gc.rc_work.items, needed * sizeof(GCObject *));
+        if (!items) {
+            return -1;
+        }
+        g_gc.rc_work.items = items;
+        g_gc.rc_work.capacity = needed;
+    }
+    g_gc.rc_work.count = 0;
+    return 0;
+}
+
+static void rc_push_work(GCObject *obj)
+{
+    g_gc.rc_work.items[g_gc.rc_work.count++] = obj;
+}
+
+/* ルートに登録されているか、試行削除の後もカウントが残っている（外から参照されている） */
+static int rc_externally_referenced(const GCObject *obj)
+{
+    return obj->header.ref_count > 0 || obj->header.root_count > 0;
+}
+
+/* 灰色に塗り、内部の参照の分だけ子のカウントを試しに減らす */
+static void rc_mark_gray(GCObject *root)
+{
+    size_t base = g_gc.rc_work.count;
+    
+    rc_set_color(root, RC_GRAY);
+    rc_push_work(root);
+    while (g_gc.rc_work.count > base) {
+        GCObject *obj = g_gc.rc_work.items[--g_gc.rc_work.count];
+        if (obj->header.type == OBJ_ARRAY) {
+            GCArray *array = (GCArray *)obj;
+            size_t i;
+            for (i = 0; i < array->length; i++) {
+                GCObject *child = array->elements[i];
+                if (!child || rc_freed_object(child)) continue;
+                child->header.ref_count--;
+                if (rc_color(child) != RC_GRAY) {
+                    rc_set_color(child, RC_GRAY);
+                    rc_push_work(child);
+                }
+            }
+        }
+    }
+}
+
+/* 外から参照されている部分を黒に戻し、減らしたカウントを元に戻す */
+static void rc_scan_black(GCObject *root)
+{
+    size_t base = g_gc.rc_work.count;
+    
+    rc_set_color(root, RC_BLACK);
+    rc_push_work(root);
+    while (g_gc.rc_work.count > base) {
+        GCObject *obj = g_gc.rc_work.items[--g_gc.rc_work.count];
+        if (obj->header.type == OBJ_ARRAY) {
+            GCArray *array = (GCArray *)obj;
+            size_t i;
+            for (i = 0; i < array->length; i++) {
+                GCObject *child = array->elements[i];
+                if (!child || rc_freed_object(child)) continue;
+                child->header.ref_count++;
+                if (rc_color(child) != RC_BLACK) {
+                    rc_set_color(child, RC_BLACK);
+                    rc_push_work(child);
+                }
+            }
+        }
+    }
+}
+
+/* 灰色のうち外から参照されているものは黒に戻し、それ以外は白にする
+ * 白にした後で黒に戻されたもの（後から外部参照が見つかった）は辿らない */
+static void rc_scan(GCObject *root)
+{
+    size_t base = g_gc.rc_work.count;
+    
+    if (rc_color(root) != RC_GRAY) return;
+    if (rc_externally_referenced(root)) {
+        rc_scan_black(root);
+        return;
+    }
+    rc_set_color(root, RC_WHITE);
+    rc_push_work(root);
+    while (g_gc.rc_work.count > base) {
+        GCObject *obj = g_gc.rc_work.items[--g_gc.rc_work.count];
+        GCArray *array;
+        size_t i;
+        
+        if (rc_color(obj) != RC_WHITE || obj->header.type != OBJ_ARRAY) continue;
+        array = (GCArray *)obj;
+        for (i = 0; i < array->length; i++) {
+            GCObject *child = array->elements[i];
+            if (!child || rc_freed_object(child) || rc_color(child) != RC_GRAY) continue;
+            if (rc_externally_referenced(child)) {
+                rc_scan_black(child);
+            } else {
+                rc_set_color(child, RC_WHITE);
+                rc_push_work(child);
+            }
+        }
+    }
+}
+
+/* 白いまま残ったオブジェクト（外から参照されない循環）を解放 */
+static void rc_collect_white(GCObject *root)
+{
+    size_t base = g_gc.rc_work.count;
+    
+    if (rc_color(root) != RC_WHITE || (root->header.rc_state & RC_BUFFERED)) return;
+    rc_set_color(root, RC_BLACK);
+    rc_push_work(root);
+    while (g_gc.rc_work.count > base) {
+        GCObject *obj = g_gc.rc_work.items[--g_gc.rc_work.count];
+        if (obj->header.type == OBJ_ARRAY) {
+            GCArray *array = (GCArray *)obj;
+            size_t i;
+            for (i = 0; i < array->length; i++) {
+                GCObject *child = array->elements[i];
+                if (child && !rc_freed_object(child) && rc_color(child) == RC_WHITE &&
+                    !(child->header.rc_state & RC_BUFFERED)) {
+                    rc_set_color(child, RC_BLACK);
+                    rc_push_work(child);
+                }
+            }
+        }
+        free_object(&obj->header);
+        g_gc.rc_freed++;
+        g_gc.rc_cycle_freed++;
+    }
+}
+
+/* 試行削除（Bacon-Rajan方式の同期的な循環回収）
+ * 候補から到達できる部分グラフで内部参照の分を引き、それでも0になるものを回収する */
+static void gc_rc_collect_cycles(void)
+{
+    GCRefBuffer *candidates = &g_gc.rc_candidates;
+    size_t i, kept;
+    
+    gc_rc_flush();
+    if (candidates->count == 0) return;
+    if (rc_reserve_work() != 0) {
+        /* 作業スタックを確保できなければ、循環は追跡型GCに任せる */
+        return;
+    }
+    
+    /* 1. 候補のうち紫のままのものから灰色に塗る */
+    for (i = 0, kept = 0; i < candidates->count; i++) {
+        GCObject *obj = candidates->items[i];
+        
+        if (rc_freed_object(obj)) continue;
+        if (rc_color(obj) == RC_PURPLE) {
+            rc_mark_gray(obj);
+            candidates->items[kept++] = obj;
+        } else {
+            obj->header.rc_state &= ~RC_BUFFERED;
+        }
+    }
+    candidates->count = kept;
+    
+    /* 2. 外からの参照が残る部分を黒に戻す */
+    for (i = 0; i < candidates->count; i++) {
+        rc_scan(candidates->items[i]);
+    }
+    
+    /* 3. 白い部分を回収 */
+    for (i = 0; i < candidates->count; i++) {
+        GCObject *obj = candidates->items[i];
+        obj->header.rc_state &= ~RC_BUFFERED;
+        rc_collect_white(obj);
+    }
+    candidates->count = 0;
+}
+
+/* 追跡型GCの前に呼ぶ：オブジェクトの移動や解放でバッファ内のポインタが無効になるので、
+ * 減少ログを処理してから残りのバッファを空にする（残った循環は追跡型GCが回収する） */
+static void rc_before_trace(void)
+{
+    size_t i;
+    
+    gc_rc_flush();
+    for (i = 0; i < g_gc.rc_zct.count; i++) {
+        g_gc.rc_zct.items[i]->header.rc_state &= ~RC_IN_ZCT;
+    }
+    g_gc.rc_zct.count = 0;
+    for (i = 0; i < g_gc.rc_candidates.count; i++) {
+        GCObject *obj = g_gc.rc_candidates.items[i];
+        if (!rc_freed_object(obj)) {
+            obj->header.rc_state = RC_BLACK;
+        }
+    }
+    g_gc.rc_candidates.count = 0;
+}
+
+/* 遅延参照カウントモードの設定
+ * 有効にすると、カウントはヒープ内の参照（gc_array_setで自動的に増減）だけを数え、
+ * ルートやローカル変数からの参照は数えない。ローカル変数だけで保持するオブジェクトは
+ * ルートに登録しておく */
+static void gc_set_deferred_rc(int enabled)
+{
+    if (!enabled && g_gc.deferred_rc) {
+        rc_before_trace();
+    }
+    g_gc.deferred_rc = enabled;
+}
+
+/* 参照カウント増加（遅延モードでも即座に反映するので、カウントは実際より小さくならない） */
 static void gc_ref_inc(GCObject *obj)
 {
     if (obj) {
         obj->header.ref_count++;
+        if (g_gc.deferred_rc) {
+            rc_set_color(obj, RC_BLACK);
+            return;
+        }
         GC_DEBUG_VAR(obj->header.ref_count, "%d");
     }
 }
 
-/* 参照カウント減少 */
-static void gc_ref_dec(GCObject *obj)
+/* 参照カウント減少（遅延モードではログに積み、GC_RC_LOG_SIZE件ごとにまとめて処理） */
+static void gc_ref_dec(GCObject *obj)
+{
+    if (!obj) return;
+    
+    if (g_gc.deferred_rc) {
+        rc_log_dec(obj);
+        if (g_gc.rc_log.count >= GC_RC_LOG_SIZE) {
+            gc_rc_flush();
+        }
+        return;
+    }
+    
+    obj->header.ref_count--;
+    GC_DEBUG_VAR(obj->header.ref_count, "%d");
+    
+    if (obj->header.ref_count == 0) {
+        GC_DEBUG("参照カウント0、即座に解放");
+        
+        /* タイプ別の子オブジェクト処理 */
+        switch (obj->header.type) {
+            case OBJ_ARRAY: {
+                GCArray *array = (GCArray *)obj;
+                size_t i;
+                for (i = 0; i < array->length; i++) {
+                    gc_ref_dec(array->elements[i]);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        
+        /* 世代から外す（ヒープ領域は次のGCで回収） */
+        free_object(&obj->header);
+    }
+}
+
+/* 一般的なGC実行 */
+static void gc_collect(void)
+{
+    /* インクリメンタルGCの途中ならその続きから完了させる */
+    if (g_gc.phase != GC_PHASE_IDLE) {
+        gc_incremental_finish();
+        return;
+    }
+    
+    /* デフォルトはマーク&スイープ */
+    gc_mark_and_sweep();
+}
+
+/* インクリメンタルモードの設定（budget_usが0なら既定値） */
+static void gc_set_incremental(int enabled, unsigned long budget_us)
+{
+    if (!enabled && g_gc.phase != GC_PHASE_IDLE) {
+        gc_incremental_finish();
+    }
+    g_gc.incremental = enabled;
+    g_gc.budget_ns = (budget_us ? budget_us : GC_DEFAULT_BUDGET_US) * 1000UL;
+}
+
+/* マーク中であれば白いオブジェクトを灰色にする */
+static void gc_shade(GCObject *obj)
+{
+    if (g_gc.phase == GC_PHASE_MARKING && obj && !is_marked(&obj->header)) {
+        mark_stack_push(obj);
+    }
+}
+
+/* マークを完了させてスイープに移る
+ * この時点で割り当て済みの範囲だけをスイープし、以降に割り当てた分は次の収集に回す */
+static void incremental_begin_sweep(void)
+{
+    mark_stack_drain();
+    mark_stack_recover();
+    
+    rc_before_trace();
+    g_gc.sweep_cursor = 0;
+    g_gc.sweep_end = used_words();
+    g_gc.phase = GC_PHASE_SWEEPING;
+}
+
+/* ビットマップの数ワード分をスイープし、最後まで進んだら収集を完了する
+ * 死んだオブジェクトはその場で空きリストに戻し、コンパクションは明示的な全体GCに任せる */
+static void incremental_sweep_chunk(void)
+{
+    SweepResult result;
+    size_t last = g_gc.sweep_cursor + GC_SWEEP_CHUNK_WORDS;
+    
+    if (last > g_gc.sweep_end) {
+        last = g_gc.sweep_end;
+    }
+    
+    /* 移動しないので、若い要素を持ったまま昇格した配列はカードに記録する */
+    memset(&result, 0, sizeof(result));
+    sweep_words(g_gc.sweep_cursor, last, GC_GENERATION_COUNT - 1, 1, 1, &result);
+    apply_sweep_result(&result);
+    g_gc.sweep_cursor = last;
+    
+    if (g_gc.sweep_cursor == g_gc.sweep_end) {
+        g_gc.phase = GC_PHASE_IDLE;
+        g_gc.gc_runs++;
+        GC_DEBUG("インクリメンタルGC完了");
+    }
+}
+
+/* インクリメンタルGCの開始：ルートのスナップショットを灰色にする */
+static void gc_incremental_start(void)
+{
+    unsigned long start_ns = get_time_ns();
+    size_t i;
+    
+    g_gc.phase = GC_PHASE_MARKING;
+    for (i = 0; i < g_gc.root_set.count; i++) {
+        mark_stack_push(g_gc.root_set.roots[i]);
+    }
+    for (i = 0; i < g_gc.root_set.frame_count; i++) {
+        mark_stack_push(g_gc.root_set.frame_roots[i]);
+    }
+    pause_record(get_time_ns() - start_ns);
+}
+
+/* 時間予算の範囲でマークを進め、灰色がなくなれば同じ予算でスイープを進める */
+static void gc_incremental_step(void)
 {
-    if (!obj) return;
-    
-    obj->header.ref_count--;
-    GC_DEBUG_VAR(obj->header.ref_count, "%d");
-    
-    if (obj->header.ref_count == 0) {
-        GC_DEBUG("参照カウント0、即座に解放");
-        
-        /* タイプ別の子オブジェクト処理 */
-        switch (obj->header.type) {
-            case OBJ_ARRAY: {
-                GCArray *array = (GCArray *)obj;
-                size_t i;
-                for (i = 0; i < array->length; i++) {
-                    gc_ref_dec(array->elements[i]);
-                }
+    unsigned long start_ns = get_time_ns();
+    unsigned long deadline = start_ns + g_gc.budget_ns;
+    unsigned long elapsed;
+    size_t work = 0;
+    
+    if (g_gc.phase == GC_PHASE_MARKING) {
+        while (g_gc.mark_stack.count > 0) {
+            mark_stack_scan_one();
+            if (++work % GC_BUDGET_CHECK_INTERVAL == 0 && get_time_ns() >= deadline) {
                 break;
             }
-            default:
-                break;
         }
-        
-        /* リストから削除 */
-        remove_from_generation(&obj->header);
-        g_gc.total_freed += obj->header.size;
+        if (g_gc.mark_stack.count == 0) {
+            incremental_begin_sweep();
+        }
+    }
+    while (g_gc.phase == GC_PHASE_SWEEPING && get_time_ns() < deadline) {
+        incremental_sweep_chunk();
     }
+    g_gc.incremental_steps++;
+    
+    elapsed = get_time_ns() - start_ns;
+    g_gc.total_gc_time += elapsed / 1e9;
+    pause_record(elapsed);
 }
 
-/* 一般的なGC実行 */
-static void gc_collect(void)
+/* 残りのマークとスイープを一括で済ませて収集を完了（明示的なGC・メモリ不足時） */
+static void gc_incremental_finish(void)
 {
-    /* デフォルトはマーク&スイープ */
-    gc_mark_and_sweep();
+    unsigned long start_ns = get_time_ns();
+    unsigned long elapsed;
+    
+    if (g_gc.phase == GC_PHASE_MARKING) {
+        incremental_begin_sweep();
+    }
+    while (g_gc.phase == GC_PHASE_SWEEPING) {
+        incremental_sweep_chunk();
+    }
+    
+    elapsed = get_time_ns() - start_ns;
+    g_gc.total_gc_time += elapsed / 1e9;
+    pause_record(elapsed);
 }
 
 /* 統計情報表示 */
@@ -511,6 +2536,26 @@ static void gc_print_stats(void)
     if (g_gc.gc_runs > 0) {
         printf("平均GC時間: %.6f 秒\n", g_gc.total_gc_time / g_gc.gc_runs);
     }
+    printf("コンパクション: %lu 回, 移動 %lu バイト\n",
+           (unsigned long)g_gc.compactions, (unsigned long)g_gc.total_moved);
+    printf("マーク: %lu オブジェクト, スタック最大 %lu 要素\n",
+           (unsigned long)g_gc.objects_marked, (unsigned long)g_gc.max_mark_stack);
+    printf("マイナーGCで走査したカード: %lu 枚\n", (unsigned long)g_gc.cards_scanned);
+    printf("空きリスト: %lu ブロック, %lu バイト (再利用 %lu 回)\n",
+           (unsigned long)g_gc.free_blocks, (unsigned long)g_gc.free_bytes,
+           (unsigned long)g_gc.freelist_allocs);
+    if (g_gc.rc_batches > 0) {
+        printf("遅延参照カウント: バッチ %lu 回, 解放 %lu オブジェクト (うち循環 %lu)\n",
+               (unsigned long)g_gc.rc_batches, (unsigned long)g_gc.rc_freed,
+               (unsigned long)g_gc.rc_cycle_freed);
+    }
+    if (g_gc.parallel_runs > 0) {
+        printf("並列GC: %lu 回, 作業の盗み %lu 回\n",
+               (unsigned long)g_gc.parallel_runs, (unsigned long)g_gc.steals);
+    }
+    printf("停止時間: 最大 %lu us, p99 %lu us (%lu 回, インクリメンタル %lu 回)\n",
+           g_gc.pauses.max_ns / 1000, pause_percentile(0.99) / 1000,
+           g_gc.pauses.samples, (unsigned long)g_gc.incremental_steps);
     
     printf("\n世代別情報:\n");
     for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
@@ -528,14 +2573,32 @@ static void gc_print_stats(void)
 /* GCのシャットダウン */
 static void gc_shutdown(void)
 {
-    if (g_gc.heap) {
-        free(g_gc.heap);
-        g_gc.heap = NULL;
+    size_t word, words;
+    int i;
+    
+    /* 生存オブジェクトの付随データを解放 */
+    words = g_gc.heap ? used_words() : 0;
+    for (word = 0; word < words; word++) {
+        unsigned long live = live_word(word);
+        while (live) {
+            release_payload(header_at(word * GC_WORD_BITS + GC_CTZ(live)));
+            live &= live - 1;
+        }
     }
     
-    if (g_gc.root_set.roots) {
-        free(g_gc.root_set.roots);
-        g_gc.root_set.roots = NULL;
+    gc_free_tables();
+    
+    for (i = 0; i < GC_MAX_THREADS; i++) {
+        GCWorker *w = &g_workers[i];
+        free(w->local);
+        w->local = NULL;
+        w->local_capacity = 0;
+        free(w->shared);
+        w->shared = NULL;
+        if (w->lock_ready) {
+            pthread_mutex_destroy(&w->lock);
+            w->lock_ready = 0;
+        }
     }
     
     GC_DEBUG("ガベージコレクターをシャットダウンしました");
@@ -553,6 +2616,12 @@ GCObject *gc_new_int(int value)
     return obj;
 }
 
+/* 整数オブジェクトの値 */
+int gc_int_value(GCObject *obj)
+{
+    return *(int *)((char *)obj + sizeof(GCHeader));
+}
+
 /* 配列オブジェクト作成 */
 GCArray *gc_new_array(size_t length)
 {
@@ -619,6 +2688,91 @@ void test_basic_gc(void)
     gc_collect();
 }
 
+/* ルートハンドルテスト */
+#define GC_FRAME_TEST_ROOTS 100
+#define GC_ROOT_BENCH_MAX 10000
+
+static size_t live_object_count(void)
+{
+    size_t count = 0;
+    int gen;
+    
+    for (gen = 0; gen < GC_GENERATION_COUNT; gen++) {
+        count += g_gc.generations[gen].count;
+    }
+    return count;
+}
+
+void test_root_handles(void)
+{
+    static GCObject *objs[GC_ROOT_BENCH_MAX];
+    static GCRootHandle handles[GC_ROOT_BENCH_MAX];
+    GCRootHandle ha, hb, hc;
+    size_t frame, before;
+    double start, add_time, release_time;
+    int i, n, ok;
+    
+    printf("\n=== ルートハンドルテスト ===\n");
+    
+    /* 解除したスロットは次の登録で再利用される */
+    ha = gc_add_root(gc_new_int(1));
+    hb = gc_add_root(gc_new_int(2));
+    gc_release_root(ha);
+    hc = gc_add_root(gc_new_int(3));
+    printf("空きスロットの再利用: %s\n", hc == ha ? "OK" : "NG");
+    
+    /* コンパクションで移動してもハンドルから現在のアドレスを引ける */
+    gc_new_int(-1);
+    gc_collect();
+    printf("移動後のハンドル参照: %s\n",
+           gc_int_value(gc_root_object(hb)) == 2 &&
+           gc_int_value(gc_root_object(hc)) == 3 ? "OK" : "NG");
+    gc_release_root(hb);
+    gc_release_root(hc);
+    
+    /* スコープ付きフレーム：まとめて積み、まとめて解除する */
+    frame = gc_push_root_frame();
+    for (i = 0; i < GC_FRAME_TEST_ROOTS; i++) {
+        gc_frame_root(gc_new_int(i));
+    }
+    gc_collect();
+    ok = 1;
+    for (i = 0; i < GC_FRAME_TEST_ROOTS; i++) {
+        GCObject *obj = g_gc.root_set.frame_roots[frame + i];
+        if (!obj || gc_int_value(obj) != i) ok = 0;
+    }
+    printf("フレーム内のルートの保持: %s\n", ok ? "OK" : "NG");
+    before = live_object_count();
+    gc_pop_root_frame(frame);
+    gc_collect();
+    printf("フレーム解除後の回収: %s\n",
+           before - live_object_count() >= GC_FRAME_TEST_ROOTS ? "OK" : "NG");
+    
+    /* 登録・解除の1件あたりの時間はルート数に依存しない */
+    printf("ルート登録・解除の時間:\n");
+    for (n = GC_ROOT_BENCH_MAX / 10; n <= GC_ROOT_BENCH_MAX; n *= 10) {
+        for (i = 0; i < n; i++) {
+            objs[i] = gc_new_int(i);
+        }
+        start = get_time_sec();
+        for (i = 0; i < n; i++) {
+            handles[i] = gc_add_root(objs[i]);
+        }
+        add_time = get_time_sec() - start;
+        
+        /* 登録順とは無関係な順序で解除する */
+        start = get_time_sec();
+        for (i = 0; i < n; i++) {
+            gc_release_root(handles[(size_t)i * 7919 % n]);
+        }
+        release_time = get_time_sec() - start;
+        
+        printf("  %5d 件: 登録 %.1f ns/件, 解除 %.1f ns/件\n", n,
+               add_time * 1e9 / n, release_time * 1e9 / n);
+        gc_collect();
+    }
+}
+
 /* 参照カウントテスト */
 void test_reference_counting(void)
 {
@@ -688,7 +2842,9 @@ void test_generational_gc(void)
 /* 循環参照テスト */
 void test_circular_reference(void)
 {
-    GCArray *array1, *array2;
+    GCArray *array1, *array2, *reused, *holder;
+    GCObject *leaf;
+    char *heap_end;
     
     printf("\n=== 循環参照テスト ===\n");
     
@@ -698,8 +2854,8 @@ void test_circular_reference(void)
     
     if (array1 && array2) {
         /* 循環参照を作成 */
-        array1->elements[0] = (GCObject *)array2;
-        array2->elements[0] = (GCObject *)array1;
+        gc_array_set(array1, 0, (GCObject *)array2);
+        gc_array_set(array2, 0, (GCObject *)array1);
         
         /* 参照カウントを増やす */
         gc_ref_inc((GCObject *)array2);
@@ -714,11 +2870,425 @@ void test_circular_reference(void)
         printf("参照カウント方式では解放されません\n");
         gc_print_stats();
         
-        /* マーク&スイープで解放 */
+        /* マーク&スイープで解放（コンパクションせず、空いた領域を空きリストにつなぐ） */
+        heap_end = (char *)g_gc.free_ptr;
+        gc_set_compaction(0);
         gc_collect();
         printf("マーク&スイープ後:\n");
         gc_print_stats();
+        
+        /* 新しいオブジェクトは末尾ではなく回収した領域に置かれる */
+        reused = gc_new_array(2);
+        printf("解放領域の再利用: %s\n",
+               reused && (char *)reused < heap_end ? "OK" : "NG");
+        gc_set_compaction(1);
+    }
+    
+    /* 遅延参照カウント：ヒープ内の参照だけを数え、循環は試行削除で回収する */
+    printf("\n--- 遅延参照カウント ---\n");
+    gc_set_deferred_rc(1);
+    holder = gc_new_array(1);
+    array1 = gc_new_array(2);
+    array2 = gc_new_array(2);
+    leaf = gc_new_int(1);
+    
+    if (holder && array1 && array2 && leaf) {
+        gc_add_root((GCObject *)holder);
+        gc_array_set(array1, 0, (GCObject *)array2);
+        gc_array_set(array2, 0, (GCObject *)array1);
+        
+        /* 外からの参照を付けて外す（減少はログに積まれ、まとめて処理される） */
+        gc_array_set(holder, 0, (GCObject *)array1);
+        gc_array_set(holder, 0, NULL);
+        gc_rc_flush();
+        printf("循環参照のカウント: array1=%d, array2=%d\n",
+               array1->header.ref_count, array2->header.ref_count);
+        
+        gc_rc_collect_cycles();
+        printf("試行削除による循環の回収: %s\n",
+               object_generation(&array1->header) == GC_GEN_FREED &&
+               object_generation(&array2->header) == GC_GEN_FREED ? "OK" : "NG");
+        
+        /* カウントが0でもルートから参照されていれば残す */
+        gc_add_root(leaf);
+        gc_array_set(holder, 0, leaf);
+        gc_array_set(holder, 0, NULL);
+        gc_rc_flush();
+        printf("ルートから参照されるオブジェクトの保持: %s\n",
+               object_generation(&leaf->header) != GC_GEN_FREED ? "OK" : "NG");
+        gc_remove_root(leaf);
+        gc_rc_flush();
+        printf("ルート解除後の解放: %s\n",
+               object_generation(&leaf->header) == GC_GEN_FREED ? "OK" : "NG");
+        
+        gc_remove_root((GCObject *)holder);
+    }
+    gc_set_deferred_rc(0);
+}
+
+/* コンパクションテスト */
+void test_compaction(void)
+{
+    GCArray *array;
+    GCObject *keep;
+    GCRootHandle array_root, keep_root;
+    size_t before, after;
+    int i, ok;
+    
+    printf("\n=== コンパクションテスト ===\n");
+    
+    /* 生存オブジェクトの間に到達不能なオブジェクトを挟む */
+    array = gc_new_array(8);
+    array_root = gc_add_root((GCObject *)array);
+    for (i = 0; i < 64; i++) {
+        GCObject *obj = gc_new_int(i);
+        if (i % 8 == 0) {
+            gc_array_set(array, i / 8, obj);
+        }
+    }
+    keep = gc_new_int(12345);
+    keep_root = gc_add_root(keep);
+    
+    before = g_gc.used_size;
+    gc_collect();
+    after = g_gc.used_size;
+    
+    /* 移動後のアドレスはルートセットから取り直す */
+    array = (GCArray *)gc_root_object(array_root);
+    keep = gc_root_object(keep_root);
+    
+    ok = (gc_int_value(keep) == 12345);
+    for (i = 0; i < 8; i++) {
+        if (gc_int_value(array->elements[i]) != i * 8) {
+            ok = 0;
+        }
+    }
+    
+    printf("使用中: %lu -> %lu バイト\n",
+           (unsigned long)before, (unsigned long)after);
+    printf("参照の更新: %s\n", ok ? "OK" : "NG");
+    
+    gc_remove_root((GCObject *)array);
+    gc_remove_root(keep);
+    gc_collect();
+}
+
+/* カードマーキングテスト */
+#define GC_CARD_TEST_OLD 5000
+#define GC_CARD_TEST_YOUNG 500
+
+/* 指定オブジェクトがいずれかの世代に残っているか */
+static int is_live(GCObject *obj)
+{
+    return object_generation(&obj->header) != GC_GEN_FREED;
+}
+
+void test_card_marking(void)
+{
+    GCArray *old_array;
+    GCObject *young;
+    GCObject *value;
+    GCRootHandle array_root;
+    size_t cards_before;
+    double start, minor_time, full_time;
+    int i;
+    
+    printf("\n=== カードマーキングテスト ===\n");
+    
+    /* 全体GCを繰り返して古い世代の配列を作る */
+    old_array = gc_new_array(GC_CARD_TEST_OLD);
+    array_root = gc_add_root((GCObject *)old_array);
+    for (i = 0; i < GC_CARD_TEST_OLD; i++) {
+        /* 割り当てでGCが走ると配列が移動するので取り直す */
+        value = gc_new_int(i);
+        old_array = (GCArray *)gc_root_object(array_root);
+        gc_array_set(old_array, i, value);
+    }
+    for (i = 0; i < GC_PROMOTION_AGE; i++) {
+        gc_collect();
+    }
+    
+    /* 古い配列だけから参照される若いオブジェクトと、到達不能な若いオブジェクト */
+    young = gc_new_int(777);
+    old_array = (GCArray *)gc_root_object(array_root);
+    gc_array_set(old_array, 0, young);
+    for (i = 0; i < GC_CARD_TEST_YOUNG; i++) {
+        gc_new_int(-i);
+    }
+    /* ゴミの割り当て中に全体GCが走っていれば両方とも移動している */
+    old_array = (GCArray *)gc_root_object(array_root);
+    young = old_array->elements[0];
+    
+    cards_before = g_gc.cards_scanned;
+    start = get_time_sec();
+    gc_generational_collect(0);
+    minor_time = get_time_sec() - start;
+    
+    /* マイナーGCは移動しないので、young のヘッダーで生死を確かめられる */
+    printf("古い配列の世代: %d\n", object_generation(&old_array->header));
+    printf("古い→若い参照の保持: %s\n",
+           is_live(young) && gc_int_value(old_array->elements[0]) == 777 ? "OK" : "NG");
+    printf("走査したカード: %lu 枚 (全 %lu 枚)\n",
+           (unsigned long)(g_gc.cards_scanned - cards_before),
+           (unsigned long)g_gc.card_count);
+    
+    /* 同じ量のゴミで全体GCと比較 */
+    for (i = 0; i < GC_CARD_TEST_YOUNG; i++) {
+        gc_new_int(-i);
+    }
+    start = get_time_sec();
+    gc_generational_collect(GC_GENERATION_COUNT - 1);
+    full_time = get_time_sec() - start;
+    printf("マイナーGC: %.6f 秒, 全体GC: %.6f 秒\n", minor_time, full_time);
+    
+    gc_release_root(array_root);
+    gc_collect();
+}
+
+/* インクリメンタルGCテスト */
+#define GC_INC_TEST_LIVE 1000
+#define GC_INC_TEST_FANOUT 8
+#define GC_INC_TEST_GARBAGE 20000
+
+/* 生存データを保ちながらゴミを割り当て続け、割り当て中の最大停止時間を返す
+ * （最後の明示的な全体GCは検証のためなので数えない） */
+static unsigned long run_pause_workload(const char *label)
+{
+    GCArray *table;
+    GCRootHandle table_root;
+    PauseHistogram pauses;
+    unsigned long p99;
+    int i, j, ok;
+    
+    memset(&g_gc.pauses, 0, sizeof(g_gc.pauses));
+    
+    table = gc_new_array(GC_INC_TEST_LIVE);
+    table_root = gc_add_root((GCObject *)table);
+    for (i = 0; i < GC_INC_TEST_LIVE; i++) {
+        GCArray *row = gc_new_array(GC_INC_TEST_FANOUT);
+        /* 割り当てでGCが走ると表が移動するので取り直す */
+        table = (GCArray *)gc_root_object(table_root);
+        gc_array_set(table, i, (GCObject *)row);
+        for (j = 0; j < GC_INC_TEST_FANOUT; j++) {
+            GCObject *value = gc_new_int(i * GC_INC_TEST_FANOUT + j);
+            table = (GCArray *)gc_root_object(table_root);
+            row = (GCArray *)table->elements[i];
+            gc_array_set(row, j, value);
+        }
+    }
+    
+    for (i = 0; i < GC_INC_TEST_GARBAGE; i++) {
+        gc_new_int(-i);
+    }
+    pauses = g_gc.pauses;
+    p99 = pause_percentile(0.99);
+    gc_collect();
+    
+    /* 生存データが壊れていないか */
+    table = (GCArray *)gc_root_object(table_root);
+    ok = 1;
+    for (i = 0; i < GC_INC_TEST_LIVE; i++) {
+        GCArray *row = (GCArray *)table->elements[i];
+        for (j = 0; j < GC_INC_TEST_FANOUT; j++) {
+            if (gc_int_value(row->elements[j]) != i * GC_INC_TEST_FANOUT + j) {
+                ok = 0;
+            }
+        }
+    }
+    
+    printf("%s: 停止 %lu 回, 最大 %lu us, p99 %lu us, 生存データ %s\n",
+           label, pauses.samples, pauses.max_ns / 1000, p99 / 1000,
+           ok ? "OK" : "NG");
+    
+    gc_remove_root((GCObject *)table);
+    gc_collect();
+    return pauses.max_ns;
+}
+
+void test_incremental_gc(void)
+{
+    unsigned long full_max, incremental_max;
+    
+    printf("\n=== インクリメンタルGCテスト ===\n");
+    
+    full_max = run_pause_workload("一括GC");
+    
+    gc_set_incremental(1, GC_DEFAULT_BUDGET_US);
+    incremental_max = run_pause_workload("インクリメンタルGC");
+    gc_set_incremental(0, 0);
+    
+    /* スイープも予算内に分けるので、最大停止時間は一括GCより十分短い */
+    printf("最大停止時間 (一括の半分未満): %s\n",
+           incremental_max * 2 < full_max ? "OK" : "NG");
+    
+    gc_print_stats();
+}
+
+/* 大規模ヒープでのベンチマーク設定 */
+#define GC_BENCH_HEAP_SIZE (128UL * 1024 * 1024)
+#define GC_BENCH_LIST_LENGTH 1000000
+#define GC_BENCH_FANOUT 1000
+#define GC_BENCH_GARBAGE 500000
+#define GC_CHURN_WINDOW 1000
+#define GC_CHURN_ALLOCS 200000
+#define GC_RC_BENCH_POOL 1000
+#define GC_RC_BENCH_STORES 1000000
+
+/* 配列へのポインタ書き込みを繰り返し、遅延参照カウントの有無で比べる
+ * 書き込まれるオブジェクトはルートに登録する（ローカル変数からの参照は数えないため） */
+static void bench_rc_stores(void)
+{
+    static GCObject *pool[GC_RC_BENCH_POOL];
+    GCArray *slots;
+    double start, plain, deferred;
+    size_t batches;
+    long i;
+    int mode;
+    
+    slots = gc_new_array(GC_RC_BENCH_POOL);
+    if (!slots) return;
+    gc_add_root((GCObject *)slots);
+    for (i = 0; i < GC_RC_BENCH_POOL; i++) {
+        pool[i] = gc_new_int((int)i);
+        gc_add_root(pool[i]);
+    }
+    
+    plain = deferred = 0.0;
+    batches = g_gc.rc_batches;
+    for (mode = 0; mode < 2; mode++) {
+        gc_set_deferred_rc(mode);
+        start = get_time_sec();
+        for (i = 0; i < GC_RC_BENCH_STORES; i++) {
+            gc_array_set(slots, (size_t)(i % GC_RC_BENCH_POOL),
+                         pool[(i * 7) % GC_RC_BENCH_POOL]);
+        }
+        gc_rc_flush();
+        if (mode) {
+            deferred = get_time_sec() - start;
+        } else {
+            plain = get_time_sec() - start;
+        }
+    }
+    gc_set_deferred_rc(0);
+    
+    printf("ポインタ書き込み %d 回: バリアのみ %.6f 秒, 遅延参照カウント %.6f 秒 (バッチ %lu 回)\n",
+           GC_RC_BENCH_STORES, plain, deferred,
+           (unsigned long)(g_gc.rc_batches - batches));
+    
+    for (i = 0; i < GC_RC_BENCH_POOL; i++) {
+        gc_remove_root(pool[i]);
+    }
+    gc_remove_root((GCObject *)slots);
+}
+
+/* 様々なサイズのオブジェクトを割り当て続け、直近GC_CHURN_WINDOW個だけを生かす
+ * ヒープ容量の数倍を割り当てても、回収した領域を再利用できれば枯渇しない */
+static void bench_freelist_churn(int compaction)
+{
+    GCArray *window;
+    GCRootHandle window_root;
+    double start, elapsed;
+    size_t runs_before = g_gc.gc_runs;
+    size_t reuse_before = g_gc.freelist_allocs;
+    long failures = 0;
+    long i;
+    
+    gc_set_compaction(compaction);
+    window = gc_new_array(GC_CHURN_WINDOW);
+    if (!window) {
+        gc_set_compaction(1);
+        return;
+    }
+    window_root = gc_add_root((GCObject *)window);
+    
+    start = get_time_sec();
+    for (i = 0; i < GC_CHURN_ALLOCS; i++) {
+        GCObject *obj = gc_alloc((size_t)(i % 16) * 8, OBJ_STRUCT);
+        if (!obj) {
+            failures++;
+            continue;
+        }
+        /* コンパクションで窓が移動するので取り直す */
+        window = (GCArray *)gc_root_object(window_root);
+        gc_array_set(window, (size_t)(i % GC_CHURN_WINDOW), obj);
+    }
+    elapsed = get_time_sec() - start;
+    
+    printf("%s: %d 回割り当て, 失敗 %ld 回, GC %lu 回, 空きリストから %lu 回, %.6f 秒\n",
+           compaction ? "コンパクション" : "空きリスト", GC_CHURN_ALLOCS, failures,
+           (unsigned long)(g_gc.gc_runs - runs_before),
+           (unsigned long)(g_gc.freelist_allocs - reuse_before), elapsed);
+    
+    gc_release_root(window_root);
+    gc_set_compaction(1);
+}
+
+/* 幅の広い木（GC_BENCH_FANOUT x GC_BENCH_FANOUT）を作ってルートに登録 */
+static GCArray *build_bench_tree(void)
+{
+    GCArray *tree;
+    GCRootHandle tree_root;
+    long i, j;
+    
+    tree = gc_new_array(GC_BENCH_FANOUT);
+    if (!tree) return NULL;
+    tree_root = gc_add_root((GCObject *)tree);
+    for (i = 0; i < GC_BENCH_FANOUT; i++) {
+        GCArray *child = gc_new_array(GC_BENCH_FANOUT);
+        if (!child) break;
+        /* 割り当てでGCが走ると木が移動するので取り直す */
+        tree = (GCArray *)gc_root_object(tree_root);
+        gc_array_set(tree, i, (GCObject *)child);
+        for (j = 0; j < GC_BENCH_FANOUT; j++) {
+            GCObject *value = gc_new_int((int)j);
+            tree = (GCArray *)gc_root_object(tree_root);
+            child = (GCArray *)tree->elements[i];
+            gc_array_set(child, j, value);
+        }
+    }
+    return (GCArray *)gc_root_object(tree_root);
+}
+
+/* スレッド数を変えて全体GCの時間を測る */
+static void bench_parallel_collect(void)
+{
+    static const int thread_counts[] = {1, 2, 4, 8, 16};
+    size_t t;
+    long i;
+    
+    printf("\nスレッド数別の収集時間 (生存 %d オブジェクト + ゴミ %d オブジェクト):\n",
+           GC_BENCH_FANOUT * GC_BENCH_FANOUT + GC_BENCH_FANOUT + 1, GC_BENCH_GARBAGE);
+    
+    gc_shutdown();
+    if (gc_init_heap(GC_BENCH_HEAP_SIZE) < 0) {
+        return;
+    }
+    if (!build_bench_tree()) {
+        return;
+    }
+    
+    for (t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        unsigned long start, elapsed, live;
+        int gen;
+        
+        gc_set_threads(thread_counts[t]);
+        for (i = 0; i < GC_BENCH_GARBAGE; i++) {
+            gc_new_int((int)i);
+        }
+        
+        start = get_time_ns();
+        gc_collect();
+        elapsed = get_time_ns() - start;
+        
+        for (gen = 0, live = 0; gen < GC_GENERATION_COUNT; gen++) {
+            live += g_gc.generations[gen].count;
+        }
+        printf("  %2d スレッド: %.3f ms (マーク %.3f ms, スイープ %.3f ms, コンパクション %.3f ms), 生存 %lu\n",
+               g_gc.threads, elapsed / 1e6,
+               g_gc.last_mark_ns / 1e6, g_gc.last_sweep_ns / 1e6,
+               g_gc.last_compact_ns / 1e6, live);
     }
+    gc_set_threads(0);
 }
 
 /* パフォーマンステスト */
@@ -761,6 +3331,78 @@ void test_gc_performance(void)
     printf("最終GC時間: %.6f 秒\n", end - start);
     
     gc_print_stats();
+    
+    /* 回収した領域の再利用 */
+    printf("\n割り当てと解放の繰り返し (ヒープ %lu バイト):\n", (unsigned long)g_gc.heap_size);
+    bench_freelist_churn(1);
+    bench_freelist_churn(0);
+    bench_rc_stores();
+    
+    /* 並列GCのスケーラビリティ */
+    bench_parallel_collect();
+    gc_print_stats();
+}
+
+/* マーク処理性能ベンチマーク */
+
+/* ルートからのマークだけを計測し、マークを元に戻す */
+static void bench_mark(const char *label)
+{
+    size_t before = g_gc.objects_marked;
+    size_t marked;
+    double start, elapsed;
+    
+    g_gc.max_mark_stack = 0;
+    start = get_time_sec();
+    gc_mark_roots();
+    elapsed = get_time_sec() - start;
+    marked = g_gc.objects_marked - before;
+    
+    printf("%s: %lu オブジェクト, %.6f 秒", label, (unsigned long)marked, elapsed);
+    if (elapsed > 0) {
+        printf(", %.0f オブジェクト/秒", marked / elapsed);
+    }
+    printf("\n");
+    
+    memset(g_gc.mark_bits, 0, g_gc.bitmap_words * sizeof(unsigned long));
+}
+
+void test_mark_throughput(void)
+{
+    GCRootHandle head_root = GC_NO_ROOT;
+    long i;
+    
+    printf("\n=== マーク性能ベンチマーク ===\n");
+    
+    /* 大きなヒープで作り直す */
+    gc_shutdown();
+    if (gc_init_heap(GC_BENCH_HEAP_SIZE) < 0) {
+        return;
+    }
+    
+    /* 100万要素の連結リスト（再帰マークではCのスタックが溢れる深さ） */
+    /* 先頭だけをルートにして付け替える（割り当てでGCが走っても鎖が残り、移動にも追従する） */
+    for (i = 0; i < GC_BENCH_LIST_LENGTH; i++) {
+        GCArray *node = gc_new_array(1);
+        if (!node) break;
+        if (head_root != GC_NO_ROOT) {
+            gc_array_set(node, 0, gc_root_object(head_root));
+            gc_release_root(head_root);
+        }
+        head_root = gc_add_root((GCObject *)node);
+    }
+    bench_mark("連結リスト");
+    printf("マークスタック最大: %lu 要素\n", (unsigned long)g_gc.max_mark_stack);
+    
+    gc_shutdown();
+    if (gc_init_heap(GC_BENCH_HEAP_SIZE) < 0) {
+        return;
+    }
+    
+    /* 幅の広い木（1000 x 1000） */
+    if (!build_bench_tree()) return;
+    bench_mark("ファンアウト木");
+    printf("マークスタック最大: %lu 要素\n", (unsigned long)g_gc.max_mark_stack);
 }
 
 /* メイン関数 */
@@ -776,10 +3418,15 @@ int main(void)
     
     /* 各種テスト実行 */
     test_basic_gc();
+    test_root_handles();
     test_reference_counting();
     test_generational_gc();
     test_circular_reference();
+    test_compaction();
+    test_card_marking();
+    test_incremental_gc();
     test_gc_performance();
+    test_mark_throughput();
     
     /* シャットダウン */
     gc_shutdown();
@@ -793,7 +3440,7 @@ int main(void)
 === ガベージコレクションフレームワークデモ ===
 
 [GC] ガベージコレクターを初期化しました
-[GC] GC_HEAP_SIZE = 1048576
+[GC] (unsigned long)heap_size = 1048576
 
 === 基本的なGCテスト ===
 [GC] ルートに追加
@@ -802,37 +3449,66 @@ GC前:
 
 === GC統計情報 ===
 ヒープサイズ: 1048576 バイト
-使用中: 96 バイト (0.0%)
-総割り当て: 96 バイト
+使用中: 120 バイト (0.0%)
+総割り当て: 120 バイト
 総解放: 0 バイト
 GC実行回数: 0 回
+コンパクション: 0 回, 移動 0 バイト
+マーク: 0 オブジェクト, スタック最大 0 要素
+マイナーGCで走査したカード: 0 枚
+空きリスト: 0 ブロック, 0 バイト (再利用 0 回)
+停止時間: 最大 0 us, p99 0 us (0 回, インクリメンタル 0 回)
 
 世代別情報:
-  第0世代: 3 オブジェクト, 96 バイト, GC 0 回
+  第0世代: 3 オブジェクト, 120 バイト, GC 0 回
   第1世代: 0 オブジェクト, 0 バイト, GC 0 回
   第2世代: 0 オブジェクト, 0 バイト, GC 0 回
 ===================
 
 [GC] マーク&スイープGC開始
-[GC] オブジェクトを解放
+[GC] freed = 1
+[GC] promoted = 0
+[GC] コンパクション完了
+[GC] (unsigned long)moved = 0
 [GC] マーク&スイープGC完了
-[GC] elapsed = 0.000012
+[GC] elapsed = 0.000030
 GC後:
 
 === GC統計情報 ===
 ヒープサイズ: 1048576 バイト
-使用中: 96 バイト (0.0%)
-総割り当て: 96 バイト
-総解放: 32 バイト
+使用中: 80 バイト (0.0%)
+総割り当て: 120 バイト
+総解放: 40 バイト
 GC実行回数: 1 回
-平均GC時間: 0.000012 秒
+平均GC時間: 0.000030 秒
+コンパクション: 1 回, 移動 0 バイト
+マーク: 2 オブジェクト, スタック最大 1 要素
+マイナーGCで走査したカード: 0 枚
+空きリスト: 0 ブロック, 0 バイト (再利用 0 回)
+停止時間: 最大 16 us, p99 16 us (1 回, インクリメンタル 0 回)
 
 世代別情報:
-  第0世代: 2 オブジェクト, 64 バイト, GC 0 回
+  第0世代: 2 オブジェクト, 80 バイト, GC 0 回
   第1世代: 0 オブジェクト, 0 バイト, GC 0 回
   第2世代: 0 オブジェクト, 0 バイト, GC 0 回
 ===================
 
+=== ルートハンドルテスト ===
+...
+空きスロットの再利用: OK
+...
+移動後のハンドル参照: OK
+...
+フレーム内のルートの保持: OK
+...
+フレーム解除後の回収: OK
+ルート登録・解除の時間:
+...
+   1000 件: 登録 147.0 ns/件, 解除 115.0 ns/件
+...
+  10000 件: 登録 140.3 ns/件, 解除 146.3 ns/件
+...
+
 === 参照カウントテスト ===
 初期状態: obj1 ref=1, obj2 ref=1
 [GC] ref_count = 2
@@ -853,7 +3529,8 @@ GC実行回数: 1 回
 ...
 [GC] 世代別GC開始
 [GC] max_generation = 0
-[GC] オブジェクトを昇格
+[GC] freed = 40
+[GC] promoted = 0
 [GC] 世代別GC完了
 
 --- サイクル 2 ---
@@ -863,6 +3540,10 @@ GC実行回数: 1 回
 ...
 [GC] 世代別GC開始
 [GC] max_generation = 2
+[GC] freed = 5
+[GC] promoted = 5
+[GC] コンパクション完了
+[GC] (unsigned long)moved = 600
 [GC] 世代別GC完了
 
 === 循環参照テスト ===
@@ -875,33 +3556,131 @@ GC実行回数: 1 回
 
 === GC統計情報 ===
 ヒープサイズ: 1048576 バイト
-使用中: 2048 バイト (0.2%)
-総割り当て: 2048 バイト
-総解放: 1600 バイト
-GC実行回数: 5 回
-平均GC時間: 0.000024 秒
+使用中: 696 バイト (0.1%)
+総割り当て: 6296 バイト
+総解放: 5600 バイト
+GC実行回数: 6 回
+平均GC時間: 0.000015 秒
+コンパクション: 3 回, 移動 600 バイト
+マーク: 57 オブジェクト, スタック最大 1 要素
+マイナーGCで走査したカード: 0 枚
+空きリスト: 0 ブロック, 0 バイト (再利用 79 回)
+停止時間: 最大 17 us, p99 17 us (6 回, インクリメンタル 0 回)
 
 世代別情報:
-  第0世代: 2 オブジェクト, 128 バイト, GC 3 回
-  第1世代: 0 オブジェクト, 0 バイト, GC 2 回
+  第0世代: 2 オブジェクト, 96 バイト, GC 4 回
+  第1世代: 15 オブジェクト, 600 バイト, GC 1 回
   第2世代: 0 オブジェクト, 0 バイト, GC 1 回
 ===================
 
 [GC] マーク&スイープGC開始
-[GC] オブジェクトを解放
-[GC] オブジェクトを解放
+[GC] freed = 2
+[GC] promoted = 10
+[GC] コンパクション完了
+[GC] (unsigned long)moved = 0
 [GC] マーク&スイープGC完了
 マーク&スイープ後:
+...
+解放領域の再利用: OK
+
+--- 遅延参照カウント ---
+[GC] ルートに追加
+循環参照のカウント: array1=1, array2=1
+試行削除による循環の回収: OK
+[GC] ルートに追加
+ルートから参照されるオブジェクトの保持: OK
+[GC] ルートから削除
+ルート解除後の解放: OK
+[GC] ルートから削除
+
+=== コンパクションテスト ===
+[GC] ルートに追加
+[GC] ルートに追加
+[GC] マーク&スイープGC開始
+[GC] freed = 56
+[GC] promoted = 5
+[GC] コンパクション完了
+[GC] (unsigned long)moved = 320
+[GC] マーク&スイープGC完了
+[GC] elapsed = 0.000018
+使用中: 3248 -> 1008 バイト
+参照の更新: OK
+...
+
+=== カードマーキングテスト ===
+[GC] ルートに追加
+...
+[GC] 世代別GC開始
+[GC] max_generation = 0
+[GC] freed = 500
+[GC] promoted = 0
+[GC] 世代別GC完了
+古い配列の世代: 1
+古い→若い参照の保持: OK
+走査したカード: 1 枚 (全 2048 枚)
+...
+マイナーGC: 0.000033 秒, 全体GC: 0.000172 秒
+...
+
+=== インクリメンタルGCテスト ===
+[GC] ルートに追加
+[GC] 閾値超過、GCを実行します
+[GC] マーク&スイープGC開始
+...
+一括GC: 停止 1 回, 最大 250 us, p99 250 us, 生存データ OK
+...
+[GC] 閾値超過、インクリメンタルGCを開始します
+[GC] インクリメンタルGC完了
+...
+インクリメンタルGC: 停止 6 回, 最大 50 us, p99 50 us, 生存データ OK
+...
+最大停止時間 (一括の半分未満): OK
+...
+停止時間: 最大 352 us, p99 98 us (8 回, インクリメンタル 5 回)
+...
 
 === GCパフォーマンステスト ===
 [GC] 閾値超過、GCを実行します
 [GC] マーク&スイープGC開始
 ...
-割り当て時間: 0.045678 秒 (10000 オブジェクト)
+割り当て時間: 0.009825 秒 (10000 オブジェクト)
 [GC] マーク&スイープGC開始
 [GC] マーク&スイープGC完了
-最終GC時間: 0.002345 秒
+最終GC時間: 0.000141 秒
+...
+
+割り当てと解放の繰り返し (ヒープ 1048576 バイト):
+...
+コンパクション: 200000 回割り当て, 失敗 0 回, GC 37 回, 空きリストから 0 回, 0.028263 秒
+...
+空きリスト: 200000 回割り当て, 失敗 0 回, GC 37 回, 空きリストから 177017 回, 0.024895 秒
+...
+ポインタ書き込み 1000000 回: バリアのみ 0.006041 秒, 遅延参照カウント 0.012706 秒 (バッチ 245 回)
+
+スレッド数別の収集時間 (生存 1001001 オブジェクト + ゴミ 500000 オブジェクト):
+   1 スレッド: 52.205 ms (マーク 17.037 ms, スイープ 11.471 ms, コンパクション 23.681 ms), 生存 1001001
+   2 スレッド: 53.050 ms (マーク 15.899 ms, スイープ 9.529 ms, コンパクション 27.606 ms), 生存 1001001
+   4 スレッド: 66.098 ms (マーク 23.751 ms, スイープ 11.226 ms, コンパクション 31.106 ms), 生存 1001001
+   8 スレッド: 61.906 ms (マーク 19.543 ms, スイープ 12.738 ms, コンパクション 29.606 ms), 生存 1001001
+  16 スレッド: 61.172 ms (マーク 19.953 ms, スイープ 11.987 ms, コンパクション 29.212 ms), 生存 1001001
+（1コアの環境での測定。マークとスイープは複数コアでスレッド数に応じて短縮される）
+...
+並列GC: 5 回, 作業の盗み 140 回
+...
 
+=== マーク性能ベンチマーク ===
+[GC] ガベージコレクターをシャットダウンしました
+[GC] ガベージコレクターを初期化しました
+[GC] (unsigned long)heap_size = 134217728
+[GC] ルートに追加
+連結リスト: 1000000 オブジェクト, 0.013377 秒, 74755177 オブジェクト/秒
+マークスタック最大: 1 要素
+[GC] ガベージコレクターをシャットダウンしました
+[GC] ガベージコレクターを初期化しました
+[GC] (unsigned long)heap_size = 134217728
+[GC] ルートに追加
+ファンアウト木: 1001001 オブジェクト, 0.016264 秒, 61547036 オブジェクト/秒
+マークスタック最大: 1999 要素
 [GC] ガベージコレクターをシャットダウンしました
 
 === デモ完了 ===
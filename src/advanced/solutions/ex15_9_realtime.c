@@ -2,23 +2,81 @@
  * 演習15-9の解答例: リアルタイムメモリアロケーター
  * ファイル名: ex15_9_realtime.c
  * 説明: 決定的時間保証、最悪ケース対応、システム統合
- * C90準拠
+ *       割り当てはTLSF（2段のビットマップによるO(1)のグッドフィット）で行い、
+ *       解放時に隣接する空きブロックと即座に結合する
+ *       実行時間はTSC（x86）またはCLOCK_MONOTONIC_RAWで計測し、
+ *       サイズクラスごとのヒストグラムからp50/p99/p99.9/最大を求める
+ *       ヒープはCPUごとのサブヒープに分け、他CPUのブロックの解放は
+ *       ロックフリーの返却キューを通して所有者に戻す
+ *       タスクは起動時にブロックを予約し、デッドライン付きの割り当ては
+ *       予約済みの蓄えから取り出す（足りなければ低優先度の予約を取り上げる）
+ *       ヒープはmmapで確保して事前フォールト・mlockし、巨大ページを要求できる
+ *       （使えなければ通常のページやmallocに戻る）
+ * C90準拠（時間計測はPOSIXのclock_gettime、x86-64ではGCCインラインアセンブリのrdtsc/rdtscp、
+ *          サブヒープはPOSIXスレッドとGCC/Clangの__sync組み込み関数、
+ *          ヒープの確保はPOSIXのmmap/mlockとLinuxのMAP_HUGETLB/MADV_HUGEPAGEを使用）
  */
 
+#define _POSIX_C_SOURCE 200112L
+#if defined(__linux__)
+#define _GNU_SOURCE                         /* sched_getcpu, pthread_setaffinity_np */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 /* リアルタイムアロケーター設定 */
 #define RT_HEAP_SIZE (4 * 1024 * 1024)     /* 4MB */
 #define RT_MIN_BLOCK_SIZE 32                /* 最小ブロックサイズ */
-#define RT_MAX_BLOCK_SIZE 65536             /* 最大ブロックサイズ */
+#define RT_MAX_BLOCK_SIZE 65536             /* 統計用サイズクラスの上限 */
 #define RT_SIZE_CLASSES 12                  /* サイズクラス数 */
 #define RT_DEADLINE_MARGIN 0.8              /* デッドラインマージン */
 #define RT_WCET_SAFETY_FACTOR 1.2           /* 最悪実行時間安全係数 */
+#define RT_ALIGNMENT 16                     /* データ領域の配置境界 */
+#define RT_BLOCK_MAGIC 0xDEADBEEFU
+#define RT_MAX_CPUS 64                      /* サブヒープ数の上限 */
+#define RT_MIN_CPU_HEAP (512 * 1024)        /* サブヒープ1つの最小サイズ */
+#define RT_REMOTE_DRAIN_BATCH 8             /* 1回の操作で結合する返却ブロックの上限 */
+#define RT_STASH_COUNT_BITS 16              /* 予約1件あたりのブロック数は65535まで */
+#define RT_STASH_COUNT_MASK ((1UL << RT_STASH_COUNT_BITS) - 1)
+#define RT_STASH_VERSION_ONE (1UL << RT_STASH_COUNT_BITS)
+#ifndef RT_CPU_HEAPS
+#define RT_CPU_HEAPS 0                      /* サブヒープ数（0ならオンラインのCPU数） */
+#endif
+#define RT_HUGE_PAGE_SIZE (2 * 1024 * 1024) /* 巨大ページの大きさ（x86-64の2MB） */
+
+/* ヒープの確保方法（rt_allocator_init の heap_flags、使えないものは外して続行する） */
+#define RT_HEAP_PLAIN 0x0                   /* mallocで確保（初回アクセスでページフォールト） */
+#define RT_HEAP_PREFAULT 0x1                /* 初期化時に全ページに触れておく */
+#define RT_HEAP_MLOCK 0x2                   /* mlockでスワップアウトを防ぐ */
+#define RT_HEAP_HUGEPAGE 0x4                /* 巨大ページ（明示的なhugetlb、だめならTHP）を要求 */
+#define RT_HEAP_LOCKED (RT_HEAP_PREFAULT | RT_HEAP_MLOCK | RT_HEAP_HUGEPAGE)
+
+/* TLSF（Two-Level Segregated Fit）の設定
+ * 第1レベルは2のべき乗ごと、第2レベルはその範囲を RT_SL_COUNT 等分する */
+#define RT_SL_LOG2 4
+#define RT_SL_COUNT (1 << RT_SL_LOG2)
+#define RT_FL_SHIFT 5                       /* log2(RT_MIN_BLOCK_SIZE) */
+#define RT_FL_COUNT 26                      /* 2^31 バイト未満を扱う */
+
+/* レイテンシヒストグラム（対数線形: 2倍ごとに8分割、約12%の分解能） */
+#define RT_HIST_SUB_BUCKET_BITS 3
+#define RT_HIST_SUB_BUCKETS (1 << RT_HIST_SUB_BUCKET_BITS)
+#define RT_HIST_BUCKETS (40 * RT_HIST_SUB_BUCKETS)
+
+/* TSCの周波数較正に使う時間 */
+#define RT_TSC_CALIBRATION_NS 20000000UL
+
+#define RT_ALIGN(n) (((n) + RT_ALIGNMENT - 1) & ~(size_t)(RT_ALIGNMENT - 1))
 
 /* デバッグ設定 */
 #define DEBUG_REALTIME 1
@@ -31,43 +89,119 @@
 #define RT_DEBUG_VAR(var, fmt)
 #endif
 
-/* メモリブロックヘッダー */
+/* 匿名マッピング（なければmallocで確保する） */
+#if defined(MAP_ANONYMOUS)
+#define RT_MAP_ANON MAP_ANONYMOUS
+#elif defined(MAP_ANON)
+#define RT_MAP_ANON MAP_ANON
+#endif
+
+/* サブヒープの占有と返却キューに使う原子操作（使えない環境ではサブヒープを1つにする） */
+#if defined(__GNUC__)
+#define RT_HAS_ATOMIC 1
+#else
+#define RT_HAS_ATOMIC 0
+#endif
+
+/* 他スレッドが原子操作で書き換える値の読み出し */
+#if defined(__ATOMIC_ACQUIRE)
+#define RT_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define RT_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#else
+#define RT_LOAD(ptr) (*(ptr))
+#define RT_STORE(ptr, value) (*(ptr) = (value))
+#endif
+
+/* サイクル単位の計測（x86-64のGCC/Clangのみ） */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define RT_HAS_TSC 1
+#else
+#define RT_HAS_TSC 0
+#endif
+
+/* ビット位置の検索（0は渡さない）：最下位は空きリストの選択、最上位は対応付けに使う */
+#if defined(__GNUC__)
+#define RT_FFS(x) __builtin_ctzl(x)
+#define RT_FLS(x) ((int)(sizeof(unsigned long) * CHAR_BIT) - 1 - __builtin_clzl(x))
+#else
+static int rt_ffs(unsigned long x)
+{
+    int n = 0;
+    while (!(x & 1UL)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+static int rt_fls(unsigned long x)
+{
+    int n = -1;
+    while (x) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+#define RT_FFS(x) rt_ffs(x)
+#define RT_FLS(x) rt_fls(x)
+#endif
+
+/* メモリブロックヘッダー
+ * ブロックはヒープ上に隙間なく並び、next/prevは空きのときだけ使う */
 typedef struct RTBlock {
-    struct RTBlock *next;
-    struct RTBlock *prev;
-    size_t size;
+    struct RTBlock *next;        /* 空きリストの次 */
+    struct RTBlock *prev;        /* 空きリストの前 */
+    struct RTBlock *prev_phys;   /* 物理的に直前のブロック（結合用） */
+    size_t size;                 /* データ領域のサイズ */
     unsigned int in_use;
     unsigned int magic;
     /* リアルタイム情報 */
-    unsigned long alloc_time;    /* 割り当て時刻 */
+    unsigned long alloc_time;    /* 割り当て時刻（返却キュー中は返却側でかかった時間） */
     unsigned long deadline;      /* デッドライン */
     int priority;               /* 優先度 */
 } RTBlock;
 
-/* サイズクラス情報 */
+#define RT_HEADER_SIZE RT_ALIGN(sizeof(RTBlock))
+
+/* TLSFの空きブロック管理
+ * fl_bitmap のビット f は sl_bitmap[f] が空でないこと、
+ * sl_bitmap[f] のビット s は blocks[f][s] が空でないことを表す */
+typedef struct RTTlsf {
+    unsigned long fl_bitmap;
+    unsigned long sl_bitmap[RT_FL_COUNT];
+    RTBlock *blocks[RT_FL_COUNT][RT_SL_COUNT];
+    unsigned long coalesces;                 /* 解放時の結合回数 */
+} RTTlsf;
+
+/* レイテンシヒストグラム（ナノ秒） */
+typedef struct RTHistogram {
+    unsigned long counts[RT_HIST_BUCKETS];
+    unsigned long samples;
+    unsigned long total_ns;
+    unsigned long max_ns;       /* 観測した最悪実行時間 */
+} RTHistogram;
+
+/* サイズクラス情報（割り当てはTLSFが行い、ここでは統計だけを集計する） */
 typedef struct RTSizeClass {
-    size_t size;                /* ブロックサイズ */
-    RTBlock *free_list;         /* フリーリスト */
-    size_t free_count;          /* 空きブロック数 */
-    size_t total_count;         /* 総ブロック数 */
+    size_t size;                /* クラスの上限サイズ */
     /* 統計情報 */
-    unsigned long wcet_alloc;   /* 割り当て最悪実行時間 */
-    unsigned long wcet_free;    /* 解放最悪実行時間 */
     unsigned long total_allocs; /* 総割り当て数 */
     unsigned long total_frees;  /* 総解放数 */
-    double avg_alloc_time;      /* 平均割り当て時間 */
-    double avg_free_time;       /* 平均解放時間 */
+    RTHistogram alloc_latency;  /* 割り当て時間の分布 */
+    RTHistogram free_latency;   /* 解放時間の分布 */
 } RTSizeClass;
 
-/* リアルタイムアロケーター */
-typedef struct RTAllocator {
-    void *heap;                               /* ヒープ領域 */
-    size_t heap_size;                        /* ヒープサイズ */
+/* CPUごとのサブヒープ
+ * 割り当てと自CPUでの解放は所有するサブヒープだけを触り、
+ * 他CPUのブロックの解放は remote_frees に積んで所有者に任せる */
+typedef struct RTHeap {
+    char *base;                              /* このサブヒープの先頭 */
+    size_t size;                             /* サブヒープのサイズ */
+    RTTlsf tlsf;                             /* 空きブロックの索引 */
     RTSizeClass size_classes[RT_SIZE_CLASSES]; /* サイズクラス配列 */
-    
-    /* システム統合情報 */
-    unsigned long system_tick_rate;          /* システムティックレート */
-    unsigned long current_tick;              /* 現在のティック */
+    volatile int busy;                       /* 操作中フラグ（割り込み禁止の代わり） */
+    RTBlock *volatile remote_frees;          /* 他CPUから返却されたブロック（ロックフリーのスタック） */
+    RTBlock *remote_pending;                 /* 取り出し済みでまだ結合していない返却ブロック（占有中だけ触る） */
     
     /* 統計情報 */
     size_t total_allocated;
@@ -76,128 +210,820 @@ typedef struct RTAllocator {
     size_t peak_usage;
     unsigned long deadline_misses;           /* デッドラインミス数 */
     unsigned long allocation_failures;       /* 割り当て失敗数 */
+    unsigned long remote_returns;            /* 他CPUから返却された数 */
+    unsigned long borrowed;                  /* 他のサブヒープに割り当てを頼んだ数 */
     
     /* リアルタイム制約 */
-    unsigned long max_alloc_time;            /* 最大割り当て時間 */
-    unsigned long max_free_time;             /* 最大解放時間 */
-    int preemption_disabled;                 /* プリエンプション無効フラグ */
+    unsigned long max_alloc_time;            /* 最大割り当て時間（ナノ秒） */
+    unsigned long max_free_time;             /* 最大解放時間（ナノ秒） */
+} RTHeap;
+
+/* 予約（周期タスクが起動時に確保しておくブロックの蓄え）
+ * top の下位 RT_STASH_COUNT_BITS ビットが待機中のブロック数、残りは更新ごとに
+ * 増える版数で、取り出しのCASが古い値で成功するABAを防ぐ。
+ * 戻すのは所有タスクだけ、取り出すのは所有タスクと高優先度の予約の受け付け */
+typedef struct RTReservation {
+    size_t size;                             /* 1ブロックのサイズ */
+    int priority;                            /* 優先度（大きいほど高い） */
+    int capacity;                            /* 予約したブロック数 */
+    void *volatile *slots;                   /* 待機中のブロック（スタック） */
+    volatile unsigned long top;              /* 待機数と版数 */
+    volatile unsigned long revoked;          /* 高優先度の予約に取り上げられた数 */
+    unsigned long pending_revoked;           /* 受け付け中の予約に取り上げられた数（受け付けロック中だけ使う） */
+    unsigned long served;                    /* 蓄えから割り当てた回数 */
+    unsigned long overruns;                  /* 蓄えが尽きて通常の割り当てに回った回数 */
+    struct RTReservation *next;              /* 予約一覧（優先度の高い順） */
+} RTReservation;
+
+/* リアルタイムアロケーター */
+typedef struct RTAllocator {
+    void *heap;                               /* ヒープ領域 */
+    size_t heap_size;                        /* ヒープサイズ */
+    void *heap_mapping;                      /* mmapした領域（mallocならNULL） */
+    size_t heap_mapping_size;                /* mmapした大きさ */
+    unsigned int heap_flags;                 /* 実際に有効になった RT_HEAP_* */
+    const char *heap_backing;                /* ヒープの裏付け（表示用） */
+    RTHeap *cpu_heaps;                       /* CPUごとのサブヒープ */
+    int cpu_count;                           /* サブヒープ数 */
+    size_t cpu_heap_size;                    /* サブヒープ1つのサイズ */
+    RTReservation *reservations;             /* 受け付けた予約（優先度の高い順） */
+    
+    /* システム統合情報 */
+    unsigned long system_tick_rate;          /* システムティックレート */
+    unsigned long current_tick;              /* 現在のティック */
 } RTAllocator;
 
 /* グローバルアロケーターインスタンス */
 static RTAllocator g_rt_allocator = {0};
 
-/* プラットフォーム依存のタイミング関数 */
+/* 予約の受け付けと解除の排他（起動時の処理なのでリアルタイム経路では使わない） */
+static pthread_mutex_t g_rt_reservation_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 高分解能タイマー（計測区間の開始と終了で読み方を変えられるようにする） */
+typedef enum {
+    RT_TIMER_MONOTONIC,          /* clock_gettime(CLOCK_MONOTONIC_RAW) */
+    RT_TIMER_TSC                 /* x86のタイムスタンプカウンター */
+} RTTimerKind;
+
+typedef struct RTTimer {
+    RTTimerKind kind;
+    const char *name;
+    unsigned long (*begin)(void);   /* 区間の開始（生のカウント） */
+    unsigned long (*end)(void);     /* 区間の終了（生のカウント） */
+    double ns_per_count;            /* カウント→ナノ秒 */
+} RTTimer;
+
+static RTTimer g_rt_timer;
+
+/* 周波数調整の影響を受けない単調時計（なければCLOCK_MONOTONIC） */
+static unsigned long rt_clock_ns(void)
+{
+    struct timespec ts;
+    
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/* デッドライン用のティック（clock()はプロセス全体のCPU時間なので単調時計から求める） */
 static unsigned long rt_get_ticks(void)
 {
-    /* 簡易実装：clock()を使用 */
-    return (unsigned long)(clock() * 1000 / CLOCKS_PER_SEC);
+    unsigned long rate = g_rt_allocator.system_tick_rate ? g_rt_allocator.system_tick_rate : 1000;
+    
+    return rt_clock_ns() / (1000000000UL / rate);
+}
+
+#if RT_HAS_TSC
+static void rt_cpuid(unsigned int leaf, unsigned int regs[4])
+{
+    __asm__ __volatile__("cpuid"
+                         : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                         : "a"(leaf), "c"(0));
+}
+
+/* 開始側：lfenceで先行する命令の完了を待ってから読む */
+static unsigned long rt_tsc_begin(void)
+{
+    unsigned int lo, hi;
+    
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((unsigned long)hi << 32) | lo;
+}
+
+/* 終了側：rdtscpは先行命令の完了を待ち、後のlfenceで後続命令の追い越しを防ぐ */
+static unsigned long rt_tsc_end(void)
+{
+    unsigned int lo, hi, aux;
+    
+    __asm__ __volatile__("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+    (void)aux;
+    return ((unsigned long)hi << 32) | lo;
+}
+
+/* 周波数が一定のTSCとrdtscpがあるか（CPUID 0x80000007 EDX[8], 0x80000001 EDX[27]） */
+static int rt_tsc_usable(void)
+{
+    unsigned int regs[4];
+    
+    rt_cpuid(0x80000000U, regs);
+    if (regs[0] < 0x80000007U) {
+        return 0;
+    }
+    rt_cpuid(0x80000001U, regs);
+    if (!(regs[3] & (1U << 27))) {
+        return 0;
+    }
+    rt_cpuid(0x80000007U, regs);
+    return (regs[3] & (1U << 8)) != 0;
+}
+#endif
+
+/* 計測に使うタイマーを選ぶ（TSCが使えなければ単調時計に切り替えて-1を返す） */
+static int rt_timer_select(RTTimerKind kind)
+{
+#if RT_HAS_TSC
+    if (kind == RT_TIMER_TSC && rt_tsc_usable()) {
+        unsigned long ns0, ns1, c0, c1;
+        
+        /* 単調時計と並べて周波数を較正する */
+        ns0 = rt_clock_ns();
+        c0 = rt_tsc_begin();
+        do {
+            ns1 = rt_clock_ns();
+        } while (ns1 - ns0 < RT_TSC_CALIBRATION_NS);
+        c1 = rt_tsc_end();
+        
+        g_rt_timer.kind = RT_TIMER_TSC;
+        g_rt_timer.name = "TSC (rdtsc/rdtscp)";
+        g_rt_timer.begin = rt_tsc_begin;
+        g_rt_timer.end = rt_tsc_end;
+        g_rt_timer.ns_per_count = (double)(ns1 - ns0) / (double)(c1 - c0);
+        return 0;
+    }
+#endif
+    g_rt_timer.kind = RT_TIMER_MONOTONIC;
+    g_rt_timer.name = "CLOCK_MONOTONIC_RAW";
+    g_rt_timer.begin = rt_clock_ns;
+    g_rt_timer.end = rt_clock_ns;
+    g_rt_timer.ns_per_count = 1.0;
+    return kind == RT_TIMER_MONOTONIC ? 0 : -1;
+}
+
+/* 計測区間の長さ（ナノ秒） */
+static unsigned long rt_timer_elapsed_ns(unsigned long begin, unsigned long end)
+{
+    return (unsigned long)((double)(end - begin) * g_rt_timer.ns_per_count + 0.5);
+}
+
+/* 値→バケット番号: 8未満はそのまま、以降は最上位ビットと続く3ビットで決める */
+static int rt_hist_bucket(unsigned long ns)
+{
+    int msb = 0;
+    int index;
+    
+    if (ns < RT_HIST_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    while ((ns >> msb) > 1) {
+        msb++;
+    }
+    index = (msb - RT_HIST_SUB_BUCKET_BITS + 1) * RT_HIST_SUB_BUCKETS +
+            (int)((ns >> (msb - RT_HIST_SUB_BUCKET_BITS)) & (RT_HIST_SUB_BUCKETS - 1));
+    return index < RT_HIST_BUCKETS ? index : RT_HIST_BUCKETS - 1;
+}
+
+/* バケット番号→そのバケットに入る最大値 */
+static unsigned long rt_hist_bucket_upper(int index)
+{
+    int group = index / RT_HIST_SUB_BUCKETS;
+    int sub = index % RT_HIST_SUB_BUCKETS;
+    
+    if (group == 0) {
+        return (unsigned long)index;
+    }
+    return ((unsigned long)(RT_HIST_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+static void rt_hist_record(RTHistogram *hist, unsigned long ns)
+{
+    hist->counts[rt_hist_bucket(ns)]++;
+    hist->samples++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns) {
+        hist->max_ns = ns;
+    }
+}
+
+/* 分位点（0.0〜1.0）を含むバケットの上限値（最大値を超えない） */
+static unsigned long rt_hist_percentile(const RTHistogram *hist, double q)
+{
+    unsigned long target;
+    unsigned long seen = 0;
+    int i;
+    
+    if (hist->samples == 0) {
+        return 0;
+    }
+    /* 最近傍順位法: ceil(q * n) 番目（切り捨てると裾の分位点を低く見積もる） */
+    target = (unsigned long)(q * hist->samples);
+    if ((double)target < q * hist->samples) {
+        target++;
+    }
+    if (target == 0) {
+        target = 1;
+    }
+    for (i = 0; i < RT_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            return rt_hist_bucket_upper(i) < hist->max_ns ?
+                   rt_hist_bucket_upper(i) : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+/* p50/p99/p99.9/最大を1行で表示 */
+static void rt_hist_print(const char *label, const RTHistogram *hist)
+{
+    printf("%s  %7lu  %7lu  %7lu  %7lu\n", label,
+           rt_hist_percentile(hist, 0.50),
+           rt_hist_percentile(hist, 0.99),
+           rt_hist_percentile(hist, 0.999),
+           hist->max_ns);
 }
 
-/* 割り込み無効化（シミュレーション） */
-static void rt_disable_interrupts(void)
+/* サブヒープの占有を試みる（割り込み禁止の代わり。同じCPUでの横取りや
+ * スレッドの移動が起きたときだけ失敗する） */
+static int rt_heap_try_lock(RTHeap *heap)
 {
-    g_rt_allocator.preemption_disabled = 1;
+#if RT_HAS_ATOMIC
+    return __sync_bool_compare_and_swap(&heap->busy, 0, 1);
+#else
+    if (heap->busy) return 0;
+    heap->busy = 1;
+    return 1;
+#endif
 }
 
-/* 割り込み有効化（シミュレーション） */
-static void rt_enable_interrupts(void)
+static void rt_heap_unlock(RTHeap *heap)
 {
-    g_rt_allocator.preemption_disabled = 0;
+#if RT_HAS_ATOMIC
+    __sync_lock_release(&heap->busy);
+#else
+    heap->busy = 0;
+#endif
+}
+
+/* 統計の集計など、必ず占有したいときに使う */
+static void rt_heap_lock(RTHeap *heap)
+{
+    while (!rt_heap_try_lock(heap)) {
+        sched_yield();
+    }
+}
+
+/* 使用中→返却中に切り替える（失敗すれば二重解放） */
+static int rt_block_begin_free(RTBlock *block)
+{
+#if RT_HAS_ATOMIC
+    return __sync_bool_compare_and_swap(&block->in_use, 1U, 2U);
+#else
+    if (block->in_use != 1U) return 0;
+    block->in_use = 2U;
+    return 1;
+#endif
+}
+
+/* 予約の待機数の更新 */
+static int rt_cas_ulong(volatile unsigned long *ptr, unsigned long old_value, unsigned long new_value)
+{
+#if RT_HAS_ATOMIC
+    return __sync_bool_compare_and_swap(ptr, old_value, new_value);
+#else
+    if (*ptr != old_value) return 0;
+    *ptr = new_value;
+    return 1;
+#endif
+}
+
+static void rt_fetch_add_ulong(volatile unsigned long *ptr, unsigned long value)
+{
+#if RT_HAS_ATOMIC
+    __sync_fetch_and_add(ptr, value);
+#else
+    *ptr += value;
+#endif
+}
+
+/* 返却キューに積む（複数の生産者がCASで先頭に追加する） */
+static void rt_remote_push(RTHeap *heap, RTBlock *block)
+{
+#if RT_HAS_ATOMIC
+    RTBlock *head = RT_LOAD(&heap->remote_frees);
+    RTBlock *seen;
+    
+    for (;;) {
+        block->next = head;
+        seen = __sync_val_compare_and_swap(&heap->remote_frees, head, block);
+        if (seen == head) {
+            break;
+        }
+        head = seen;
+    }
+#else
+    block->next = heap->remote_frees;
+    heap->remote_frees = block;
+#endif
+}
+
+/* 返却キューを丸ごと取り出す（所有者だけが呼ぶので取り出し側のABAは起きない） */
+static RTBlock *rt_remote_take_all(RTHeap *heap)
+{
+    RTBlock *list;
+    
+    if (!RT_LOAD(&heap->remote_frees)) {
+        return NULL;
+    }
+#if RT_HAS_ATOMIC
+    list = __sync_lock_test_and_set(&heap->remote_frees, (RTBlock *)NULL);
+#else
+    list = heap->remote_frees;
+    heap->remote_frees = NULL;
+#endif
+    return list;
+}
+
+/* 現在のCPU番号（取得できなければ0） */
+static int rt_current_cpu(void)
+{
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    return cpu >= 0 ? cpu : 0;
+#else
+    return 0;
+#endif
+}
+
+/* 現在のCPUのサブヒープを占有する（使用中なら空いている他のサブヒープ） */
+static RTHeap *rt_heap_enter(void)
+{
+    int count = g_rt_allocator.cpu_count;
+    int start = rt_current_cpu() % count;
+    int i;
+    
+    for (;;) {
+        for (i = 0; i < count; i++) {
+            RTHeap *heap = &g_rt_allocator.cpu_heaps[(start + i) % count];
+            if (rt_heap_try_lock(heap)) {
+                return heap;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/* ブロックを所有するサブヒープ（アドレスから求める） */
+static RTHeap *rt_heap_of(RTBlock *block)
+{
+    size_t offset = (size_t)((char *)block - (char *)g_rt_allocator.heap);
+    
+    return &g_rt_allocator.cpu_heaps[offset / g_rt_allocator.cpu_heap_size];
 }
 
 /* サイズクラスの初期化 */
-static void rt_init_size_classes(void)
+static void rt_init_size_classes(RTHeap *heap)
 {
     int i;
     size_t size = RT_MIN_BLOCK_SIZE;
     
     for (i = 0; i < RT_SIZE_CLASSES && size <= RT_MAX_BLOCK_SIZE; i++) {
-        g_rt_allocator.size_classes[i].size = size;
-        g_rt_allocator.size_classes[i].free_list = NULL;
-        g_rt_allocator.size_classes[i].free_count = 0;
-        g_rt_allocator.size_classes[i].total_count = 0;
-        g_rt_allocator.size_classes[i].wcet_alloc = 0;
-        g_rt_allocator.size_classes[i].wcet_free = 0;
-        g_rt_allocator.size_classes[i].total_allocs = 0;
-        g_rt_allocator.size_classes[i].total_frees = 0;
-        g_rt_allocator.size_classes[i].avg_alloc_time = 0.0;
-        g_rt_allocator.size_classes[i].avg_free_time = 0.0;
+        memset(&heap->size_classes[i], 0, sizeof(RTSizeClass));
+        heap->size_classes[i].size = size;
         
         size *= 2;  /* 指数的に増加 */
     }
 }
 
-/* ヒープの事前分割 */
-static int rt_partition_heap(void)
+/* 物理的に直後のブロック */
+static RTBlock *rt_next_phys(RTBlock *block)
+{
+    return (RTBlock *)((char *)block + RT_HEADER_SIZE + block->size);
+}
+
+/* サイズを第1・第2レベルの添字に対応付ける（size >= RT_MIN_BLOCK_SIZE） */
+static void rt_tlsf_mapping(size_t size, int *fl, int *sl)
+{
+    int f = RT_FLS((unsigned long)size);
+    
+    *sl = (int)(size >> (f - RT_SL_LOG2)) - RT_SL_COUNT;
+    *fl = f - RT_FL_SHIFT;
+}
+
+/* 空きブロックを対応するリストの先頭に入れる */
+static void rt_tlsf_insert(RTTlsf *tlsf, RTBlock *block)
+{
+    int fl, sl;
+    
+    rt_tlsf_mapping(block->size, &fl, &sl);
+    block->in_use = 0;
+    block->prev = NULL;
+    block->next = tlsf->blocks[fl][sl];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    tlsf->blocks[fl][sl] = block;
+    tlsf->fl_bitmap |= 1UL << fl;
+    tlsf->sl_bitmap[fl] |= 1UL << sl;
+}
+
+/* 空きブロックをリストから外す（リストが空になればビットを落とす） */
+static void rt_tlsf_remove(RTTlsf *tlsf, RTBlock *block)
+{
+    int fl, sl;
+    
+    rt_tlsf_mapping(block->size, &fl, &sl);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        tlsf->blocks[fl][sl] = block->next;
+        if (!block->next) {
+            tlsf->sl_bitmap[fl] &= ~(1UL << sl);
+            if (!tlsf->sl_bitmap[fl]) {
+                tlsf->fl_bitmap &= ~(1UL << fl);
+            }
+        }
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+}
+
+/* size 以上が必ず入っている空きリストを探して先頭のブロックを外す
+ * 検索サイズを次のリストの境界まで切り上げるので、リスト内を辿る必要がない */
+static RTBlock *rt_tlsf_take(RTTlsf *tlsf, size_t size)
+{
+    RTBlock *block;
+    unsigned long map;
+    int fl, sl;
+    
+    size += ((size_t)1 << (RT_FLS((unsigned long)size) - RT_SL_LOG2)) - 1;
+    rt_tlsf_mapping(size, &fl, &sl);
+    if (fl >= RT_FL_COUNT) {
+        return NULL;
+    }
+    
+    map = tlsf->sl_bitmap[fl] & (~0UL << sl);
+    if (!map) {
+        map = tlsf->fl_bitmap & (~0UL << (fl + 1));
+        if (!map) {
+            return NULL;
+        }
+        fl = RT_FFS(map);
+        map = tlsf->sl_bitmap[fl];
+    }
+    sl = RT_FFS(map);
+    
+    block = tlsf->blocks[fl][sl];
+    rt_tlsf_remove(tlsf, block);
+    return block;
+}
+
+/* 余った後半を新しい空きブロックとして切り出す */
+static void rt_tlsf_split(RTTlsf *tlsf, RTBlock *block, size_t size)
+{
+    RTBlock *rest;
+    
+    if (block->size < size + RT_HEADER_SIZE + RT_MIN_BLOCK_SIZE) {
+        return;
+    }
+    
+    rest = (RTBlock *)((char *)block + RT_HEADER_SIZE + size);
+    rest->size = block->size - size - RT_HEADER_SIZE;
+    rest->magic = RT_BLOCK_MAGIC;
+    rest->prev_phys = block;
+    rt_next_phys(rest)->prev_phys = rest;
+    block->size = size;
+    rt_tlsf_insert(tlsf, rest);
+}
+
+/* 隣接する空きブロックと結合してからリストに戻す（前後それぞれ高々1回） */
+static void rt_tlsf_release(RTTlsf *tlsf, RTBlock *block)
+{
+    RTBlock *next = rt_next_phys(block);
+    RTBlock *prev = block->prev_phys;
+    
+    if (!RT_LOAD(&next->in_use)) {
+        rt_tlsf_remove(tlsf, next);
+        block->size += RT_HEADER_SIZE + next->size;
+        next->magic = 0;
+        rt_next_phys(block)->prev_phys = block;
+        tlsf->coalesces++;
+    }
+    if (prev && !RT_LOAD(&prev->in_use)) {
+        rt_tlsf_remove(tlsf, prev);
+        prev->size += RT_HEADER_SIZE + block->size;
+        block->magic = 0;
+        block = prev;
+        rt_next_phys(block)->prev_phys = block;
+        tlsf->coalesces++;
+    }
+    rt_tlsf_insert(tlsf, block);
+}
+
+/* サブヒープ全体を1つの空きブロックと終端の番兵にする */
+static void rt_heap_init(RTHeap *heap, char *base, size_t size)
+{
+    RTBlock *first = (RTBlock *)base;
+    RTBlock *sentinel;
+    
+    memset(heap, 0, sizeof(*heap));
+    heap->base = base;
+    heap->size = size;
+    rt_init_size_classes(heap);
+    
+    first->size = size - 2 * RT_HEADER_SIZE;
+    first->magic = RT_BLOCK_MAGIC;
+    first->prev_phys = NULL;
+    first->alloc_time = 0;
+    first->deadline = 0;
+    first->priority = 0;
+    
+    /* 番兵は常に使用中として扱い、末尾での結合を止める */
+    sentinel = rt_next_phys(first);
+    sentinel->size = 0;
+    sentinel->in_use = 1;
+    sentinel->magic = RT_BLOCK_MAGIC;
+    sentinel->prev_phys = first;
+    
+    rt_tlsf_insert(&heap->tlsf, first);
+}
+
+/* 統計用のサイズクラスを見つける（上限を超えるサイズは最後のクラスに数える） */
+static int rt_find_size_class(size_t size)
 {
-    char *heap_ptr = (char *)g_rt_allocator.heap;
-    size_t remaining = g_rt_allocator.heap_size;
     int i;
     
-    /* 各サイズクラスにブロックを割り当て */
-    for (i = 0; i < RT_SIZE_CLASSES; i++) {
-        RTSizeClass *sc = &g_rt_allocator.size_classes[i];
-        size_t block_size = sc->size + sizeof(RTBlock);
-        size_t blocks_for_class;
-        size_t j;
-        
-        /* このサイズクラスに割り当てるブロック数を決定 */
-        if (i < RT_SIZE_CLASSES / 2) {
-            /* 小さいサイズは多めに */
-            blocks_for_class = remaining / (block_size * 4);
-        } else {
-            /* 大きいサイズは少なめに */
-            blocks_for_class = remaining / (block_size * 16);
+    for (i = 0; i < RT_SIZE_CLASSES - 1; i++) {
+        if (((size_t)RT_MIN_BLOCK_SIZE << i) >= size) {
+            return i;
         }
+    }
+    
+    return RT_SIZE_CLASSES - 1;
+}
+
+/* ブロックをサブヒープに戻す（占有中に呼ぶ） */
+static void rt_heap_free_block(RTHeap *heap, RTBlock *block)
+{
+    RTSizeClass *sc = &heap->size_classes[rt_find_size_class(block->size)];
+    
+    /* 統計更新（結合でサイズが変わる前に記録する） */
+    sc->total_frees++;
+    heap->total_freed += block->size;
+    heap->current_usage -= block->size;
+    
+    /* 隣接する空きブロックと結合してフリーリストに戻す */
+    rt_tlsf_release(&heap->tlsf, block);
+}
+
+/* 他CPUから返却されたブロックを最大 limit 個だけ戻す（占有中に呼ぶ）
+ * 返却キューは丸ごと remote_pending に移し、そこから少しずつ結合するので
+ * 1回の操作の手間は返却の溜まり具合によらない。
+ * 結合の時間は積んだ側の時間と合わせて解放時間の分布に記録する */
+static void rt_heap_drain(RTHeap *heap, unsigned long limit)
+{
+    RTBlock *block;
+    RTSizeClass *sc;
+    unsigned long start_time, elapsed;
+    
+    for (; limit > 0; limit--) {
+        if (!heap->remote_pending) {
+            heap->remote_pending = rt_remote_take_all(heap);
+            if (!heap->remote_pending) {
+                break;
+            }
+        }
+        block = heap->remote_pending;
+        heap->remote_pending = block->next;
+        
+        start_time = g_rt_timer.begin();
+        sc = &heap->size_classes[rt_find_size_class(block->size)];
+        rt_heap_free_block(heap, block);
+        elapsed = rt_timer_elapsed_ns(start_time, g_rt_timer.end()) + block->alloc_time;
         
-        if (blocks_for_class == 0) {
-            blocks_for_class = 1;
+        rt_hist_record(&sc->free_latency, elapsed);
+        if (elapsed > heap->max_free_time) {
+            heap->max_free_time = elapsed;
         }
+        heap->remote_returns++;
+    }
+}
+
+/* 返却分を少し戻してから空きブロックを取り出す（占有中に呼ぶ）
+ * 見つからないときだけ返却分を全部戻して探し直す（ヒープが尽きかけたときの経路） */
+static RTBlock *rt_heap_take(RTHeap *heap, size_t size)
+{
+    RTBlock *block;
+    
+    rt_heap_drain(heap, RT_REMOTE_DRAIN_BATCH);
+    block = rt_tlsf_take(&heap->tlsf, size);
+    if (!block && (heap->remote_pending || RT_LOAD(&heap->remote_frees))) {
+        rt_heap_drain(heap, ULONG_MAX);
+        block = rt_tlsf_take(&heap->tlsf, size);
+    }
+    if (block) {
+        rt_tlsf_split(&heap->tlsf, block, size);
+    }
+    return block;
+}
+
+/* 空きブロックの数と最大サイズ（統計用にサブヒープを先頭から辿る） */
+static size_t rt_heap_free_blocks(RTHeap *heap, size_t *largest)
+{
+    RTBlock *block = (RTBlock *)heap->base;
+    size_t count = 0;
+    
+    while (block->size > 0) {
+        if (!RT_LOAD(&block->in_use)) {
+            count++;
+            if (block->size > *largest) {
+                *largest = block->size;
+            }
+        }
+        block = rt_next_phys(block);
+    }
+    return count;
+}
+
+/* 全サブヒープの空きブロック数と最大サイズ（返却待ちのブロックも先に戻す） */
+static size_t rt_free_blocks(size_t *largest)
+{
+    size_t count = 0;
+    int i;
+    
+    *largest = 0;
+    for (i = 0; i < g_rt_allocator.cpu_count; i++) {
+        RTHeap *heap = &g_rt_allocator.cpu_heaps[i];
         
-        /* ブロックを作成してフリーリストに追加 */
-        for (j = 0; j < blocks_for_class && remaining >= block_size; j++) {
-            RTBlock *block = (RTBlock *)heap_ptr;
-            
-            block->size = sc->size;
-            block->in_use = 0;
-            block->magic = 0xDEADBEEF;
-            block->next = sc->free_list;
-            block->prev = NULL;
-            block->alloc_time = 0;
-            block->deadline = 0;
-            block->priority = 0;
-            
-            if (sc->free_list) {
-                sc->free_list->prev = block;
+        rt_heap_lock(heap);
+        rt_heap_drain(heap, ULONG_MAX);
+        count += rt_heap_free_blocks(heap, largest);
+        rt_heap_unlock(heap);
+    }
+    return count;
+}
+
+/* ヒープ領域の確保
+ * RT_HEAP_PLAIN 以外は mmap で確保し、要求に応じて巨大ページ・事前フォールト・mlock を行う。
+ * 使えなかった機能は heap_flags から外し、mmap自体が失敗したら malloc に戻る */
+static void *rt_heap_map(size_t size, unsigned int flags)
+{
+    char *heap = NULL;
+    
+    g_rt_allocator.heap_mapping = NULL;
+    g_rt_allocator.heap_flags = RT_HEAP_PLAIN;
+    g_rt_allocator.heap_backing = "malloc";
+    
+#if defined(RT_MAP_ANON)
+    if (flags != RT_HEAP_PLAIN) {
+        size_t length = (size + RT_HUGE_PAGE_SIZE - 1) & ~(size_t)(RT_HUGE_PAGE_SIZE - 1);
+        void *map = MAP_FAILED;
+        
+#if defined(MAP_HUGETLB)
+        /* 明示的な巨大ページ（事前に予約された hugetlb ページがなければ失敗する） */
+        if (flags & RT_HEAP_HUGEPAGE) {
+            map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | RT_MAP_ANON | MAP_HUGETLB, -1, 0);
+            if (map != MAP_FAILED) {
+                g_rt_allocator.heap_mapping = map;
+                g_rt_allocator.heap_mapping_size = length;
+                g_rt_allocator.heap_flags |= RT_HEAP_HUGEPAGE;
+                g_rt_allocator.heap_backing = "mmap (hugetlb)";
+                heap = (char *)map;
             }
-            sc->free_list = block;
-            
-            sc->free_count++;
-            sc->total_count++;
+        }
+#endif
+        if (!heap) {
+            /* 通常のページ。巨大ページの境界に揃えるため余分に取って前後を返す */
+            size_t extra = (flags & RT_HEAP_HUGEPAGE) ? RT_HUGE_PAGE_SIZE : 0;
             
-            heap_ptr += block_size;
-            remaining -= block_size;
+            map = mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | RT_MAP_ANON, -1, 0);
+            if (map != MAP_FAILED) {
+                size_t head = extra ? (size_t)(-(unsigned long)map & (RT_HUGE_PAGE_SIZE - 1)) : 0;
+                
+                if (head > 0) {
+                    munmap(map, head);
+                }
+                if (extra - head > 0) {
+                    munmap((char *)map + head + length, extra - head);
+                }
+                heap = (char *)map + head;
+                g_rt_allocator.heap_mapping = heap;
+                g_rt_allocator.heap_mapping_size = length;
+                g_rt_allocator.heap_backing = "mmap";
+#if defined(MADV_HUGEPAGE)
+                /* 透過的巨大ページ（THP）を要求する */
+                if ((flags & RT_HEAP_HUGEPAGE) && madvise(heap, length, MADV_HUGEPAGE) == 0) {
+                    g_rt_allocator.heap_flags |= RT_HEAP_HUGEPAGE;
+                    g_rt_allocator.heap_backing = "mmap (THP)";
+                }
+#endif
+            }
+        }
+        if (!heap) {
+            RT_DEBUG("mmapに失敗したためmallocで確保します");
         }
+    }
+#endif
+    
+    if (!heap) {
+        return malloc(size);
+    }
+    
+    /* 事前フォールト：計測中の割り当てで初回アクセスのフォールトが起きないよう全ページに書く */
+    if (flags & RT_HEAP_PREFAULT) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t offset;
         
-        RT_DEBUG_VAR(i, "%d");
-        RT_DEBUG_VAR(sc->total_count, "%lu");
+        if (page <= 0) {
+            page = 4096;
+        }
+        for (offset = 0; offset < g_rt_allocator.heap_mapping_size; offset += (size_t)page) {
+            ((volatile char *)heap)[offset] = 0;
+        }
+        g_rt_allocator.heap_flags |= RT_HEAP_PREFAULT;
     }
     
-    return 0;
+    /* mlock：RLIMIT_MEMLOCK を超える場合などは失敗するので、ロックなしで続ける */
+    if (flags & RT_HEAP_MLOCK) {
+        if (mlock(heap, g_rt_allocator.heap_mapping_size) == 0) {
+            g_rt_allocator.heap_flags |= RT_HEAP_MLOCK;
+        } else {
+            RT_DEBUG("mlockに失敗したためロックせずに続行します");
+        }
+    }
+    return heap;
+}
+
+/* ヒープ領域の解放 */
+static void rt_heap_unmap(void)
+{
+    if (!g_rt_allocator.heap_mapping) {
+        free(g_rt_allocator.heap);
+        return;
+    }
+    if (g_rt_allocator.heap_flags & RT_HEAP_MLOCK) {
+        munlock(g_rt_allocator.heap_mapping, g_rt_allocator.heap_mapping_size);
+    }
+    munmap(g_rt_allocator.heap_mapping, g_rt_allocator.heap_mapping_size);
 }
 
-/* アロケーターの初期化 */
-int rt_allocator_init(unsigned long tick_rate)
+/* サブヒープ数（RT_CPU_HEAPS が0ならオンラインのCPU数、CPU番号はその剰余で割り当てる） */
+static int rt_cpu_heap_count(void)
 {
+    long cpus = RT_CPU_HEAPS;
+    
+    if (cpus <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (cpus < 1 || !RT_HAS_ATOMIC) {
+        cpus = 1;
+    }
+    if (cpus > RT_MAX_CPUS) {
+        cpus = RT_MAX_CPUS;
+    }
+    /* 小さく分けすぎると大きな要求が入らないので、余ったCPUはサブヒープを共有する */
+    if (cpus > RT_HEAP_SIZE / RT_MIN_CPU_HEAP) {
+        cpus = RT_HEAP_SIZE / RT_MIN_CPU_HEAP;
+    }
+    return (int)cpus;
+}
+
+/* アロケーターの初期化（heap_flags は RT_HEAP_* の組み合わせ） */
+int rt_allocator_init(unsigned long tick_rate, unsigned int heap_flags)
+{
+    int i;
+    
     if (g_rt_allocator.heap) {
         RT_DEBUG("アロケーターは既に初期化されています");
         return 0;
     }
     
     /* ヒープメモリ確保 */
-    g_rt_allocator.heap = malloc(RT_HEAP_SIZE);
-    if (!g_rt_allocator.heap) {
+    g_rt_allocator.heap = rt_heap_map(RT_HEAP_SIZE, heap_flags);
+    g_rt_allocator.cpu_count = rt_cpu_heap_count();
+    g_rt_allocator.cpu_heaps = (RTHeap *)calloc((size_t)g_rt_allocator.cpu_count, sizeof(RTHeap));
+    if (!g_rt_allocator.heap || !g_rt_allocator.cpu_heaps) {
         fprintf(stderr, "ヒープメモリの確保に失敗\n");
+        if (g_rt_allocator.heap) {
+            rt_heap_unmap();
+        }
+        free(g_rt_allocator.cpu_heaps);
+        memset(&g_rt_allocator, 0, sizeof(g_rt_allocator));
         return -1;
     }
     
@@ -205,260 +1031,524 @@ int rt_allocator_init(unsigned long tick_rate)
     g_rt_allocator.system_tick_rate = tick_rate;
     g_rt_allocator.current_tick = rt_get_ticks();
     
-    /* サイズクラスの初期化 */
-    rt_init_size_classes();
+    /* 計測用タイマー（TSCが使えなければ単調時計） */
+    rt_timer_select(RT_TIMER_TSC);
     
-    /* ヒープの事前分割 */
-    if (rt_partition_heap() < 0) {
-        free(g_rt_allocator.heap);
-        return -1;
+    /* ヒープをCPUの数に等分し、それぞれに空きブロック索引を作る */
+    g_rt_allocator.cpu_heap_size =
+        (RT_HEAP_SIZE / g_rt_allocator.cpu_count) & ~(size_t)(RT_ALIGNMENT - 1);
+    for (i = 0; i < g_rt_allocator.cpu_count; i++) {
+        rt_heap_init(&g_rt_allocator.cpu_heaps[i],
+                     (char *)g_rt_allocator.heap + i * g_rt_allocator.cpu_heap_size,
+                     g_rt_allocator.cpu_heap_size);
     }
     
     RT_DEBUG("リアルタイムアロケーターを初期化しました");
     RT_DEBUG_VAR(RT_HEAP_SIZE, "%d");
+    RT_DEBUG_VAR(g_rt_allocator.heap_backing, "%s");
     RT_DEBUG_VAR(tick_rate, "%lu");
+    RT_DEBUG_VAR(g_rt_timer.name, "%s");
+    RT_DEBUG_VAR(g_rt_allocator.cpu_count, "%d");
     
     return 0;
 }
 
-/* 適切なサイズクラスを見つける */
-static int rt_find_size_class(size_t size)
-{
-    int i;
-    
-    for (i = 0; i < RT_SIZE_CLASSES; i++) {
-        if (g_rt_allocator.size_classes[i].size >= size) {
-            return i;
-        }
-    }
-    
-    return -1;
-}
-
 /* リアルタイムメモリ割り当て */
 void *rt_malloc(size_t size, unsigned long deadline, int priority)
 {
-    int class_idx;
+    RTHeap *heap, *owner;
     RTSizeClass *sc;
     RTBlock *block;
-    unsigned long start_time, end_time, elapsed;
+    unsigned long now, start_time, elapsed;
+    int i;
     
     if (!g_rt_allocator.heap || size == 0) {
         return NULL;
     }
     
-    /* 割り込み無効化（決定的動作のため） */
-    rt_disable_interrupts();
+    now = rt_get_ticks();
     
-    start_time = rt_get_ticks();
+    /* 自CPUのサブヒープを占有（グローバルな排他区間はない） */
+    heap = rt_heap_enter();
     
-    /* サイズクラスを見つける */
-    class_idx = rt_find_size_class(size);
-    if (class_idx < 0) {
-        RT_DEBUG("要求サイズが大きすぎます");
-        g_rt_allocator.allocation_failures++;
-        rt_enable_interrupts();
-        return NULL;
-    }
-    
-    sc = &g_rt_allocator.size_classes[class_idx];
+    start_time = g_rt_timer.begin();
     
-    /* フリーブロックを取得 */
-    block = sc->free_list;
+    /* ブロックサイズに丸めてビットマップ検索で空きブロックを取得 */
+    if (size < RT_MIN_BLOCK_SIZE) {
+        size = RT_MIN_BLOCK_SIZE;
+    }
+    block = NULL;
+    owner = heap;
+    if (size < g_rt_allocator.cpu_heap_size) {
+        size = RT_ALIGN(size);
+        block = rt_heap_take(heap, size);
+        
+        /* 自分のサブヒープが尽きたら、占有されていない他のサブヒープから取る */
+        for (i = 1; !block && i < g_rt_allocator.cpu_count; i++) {
+            owner = &g_rt_allocator.cpu_heaps[(heap - g_rt_allocator.cpu_heaps + i) %
+                                              g_rt_allocator.cpu_count];
+            if (rt_heap_try_lock(owner)) {
+                block = rt_heap_take(owner, size);
+                if (!block) {
+                    rt_heap_unlock(owner);
+                }
+            }
+        }
+    }
     if (!block) {
-        RT_DEBUG("フリーブロックがありません");
-        g_rt_allocator.allocation_failures++;
-        rt_enable_interrupts();
+        RT_DEBUG("十分な大きさの空きブロックがありません");
+        heap->allocation_failures++;
+        rt_heap_unlock(heap);
         return NULL;
     }
-    
-    /* フリーリストから削除 */
-    sc->free_list = block->next;
-    if (block->next) {
-        block->next->prev = NULL;
+    if (owner != heap) {
+        heap->borrowed++;
     }
-    sc->free_count--;
+    
+    sc = &owner->size_classes[rt_find_size_class(block->size)];
     
     /* ブロック情報を設定 */
     block->in_use = 1;
-    block->alloc_time = start_time;
+    block->alloc_time = now;
     block->deadline = deadline;
     block->priority = priority;
     
     /* 統計更新 */
     sc->total_allocs++;
-    g_rt_allocator.total_allocated += block->size;
-    g_rt_allocator.current_usage += block->size;
+    owner->total_allocated += block->size;
+    owner->current_usage += block->size;
     
-    if (g_rt_allocator.current_usage > g_rt_allocator.peak_usage) {
-        g_rt_allocator.peak_usage = g_rt_allocator.current_usage;
+    if (owner->current_usage > owner->peak_usage) {
+        owner->peak_usage = owner->current_usage;
     }
     
-    end_time = rt_get_ticks();
-    elapsed = end_time - start_time;
+    elapsed = rt_timer_elapsed_ns(start_time, g_rt_timer.end());
     
-    /* 最悪実行時間の更新 */
-    if (elapsed > sc->wcet_alloc) {
-        sc->wcet_alloc = elapsed;
-    }
-    if (elapsed > g_rt_allocator.max_alloc_time) {
-        g_rt_allocator.max_alloc_time = elapsed;
+    /* 最悪実行時間と分布の更新 */
+    rt_hist_record(&sc->alloc_latency, elapsed);
+    if (elapsed > owner->max_alloc_time) {
+        owner->max_alloc_time = elapsed;
     }
     
-    /* 平均時間の更新 */
-    sc->avg_alloc_time = (sc->avg_alloc_time * (sc->total_allocs - 1) + elapsed) 
-                         / sc->total_allocs;
-    
     /* デッドラインチェック */
-    if (deadline > 0 && end_time > deadline) {
-        g_rt_allocator.deadline_misses++;
+    if (deadline > 0 && rt_get_ticks() > deadline) {
+        heap->deadline_misses++;
         RT_DEBUG("デッドラインミス");
     }
     
-    rt_enable_interrupts();
+    if (owner != heap) {
+        rt_heap_unlock(owner);
+    }
+    rt_heap_unlock(heap);
     
     /* データ領域のポインタを返す */
-    return (char *)block + sizeof(RTBlock);
+    return (char *)block + RT_HEADER_SIZE;
 }
 
 /* リアルタイムメモリ解放 */
 void rt_free(void *ptr)
 {
     RTBlock *block;
+    RTHeap *owner;
     RTSizeClass *sc;
-    int class_idx;
-    unsigned long start_time, end_time, elapsed;
+    unsigned long start_time, elapsed;
+    
+    if (!ptr) {
+        return;
+    }
+    
+    /* ブロックヘッダーを取得 */
+    block = (RTBlock *)((char *)ptr - RT_HEADER_SIZE);
+    
+    /* マジックナンバーチェック（結合で吸収されたヘッダーも消してある） */
+    if ((char *)block < (char *)g_rt_allocator.heap ||
+        (char *)block >= (char *)g_rt_allocator.heap + g_rt_allocator.heap_size ||
+        block->magic != RT_BLOCK_MAGIC) {
+        fprintf(stderr, "不正なブロック\n");
+        return;
+    }
+    
+    /* 二重解放チェック */
+    if (!rt_block_begin_free(block)) {
+        fprintf(stderr, "二重解放\n");
+        return;
+    }
+    
+    /* 他CPUのブロックは返却キューに積むだけにする（積むまでの時間は所有者が結合時に記録する） */
+    start_time = g_rt_timer.begin();
+    owner = rt_heap_of(block);
+    if (owner != &g_rt_allocator.cpu_heaps[rt_current_cpu() % g_rt_allocator.cpu_count] ||
+        !rt_heap_try_lock(owner)) {
+        elapsed = rt_timer_elapsed_ns(start_time, g_rt_timer.end());
+        block->alloc_time = elapsed;
+        rt_remote_push(owner, block);
+        return;
+    }
+    
+    sc = &owner->size_classes[rt_find_size_class(block->size)];
+    rt_heap_free_block(owner, block);
+    rt_heap_drain(owner, RT_REMOTE_DRAIN_BATCH);
+    
+    elapsed = rt_timer_elapsed_ns(start_time, g_rt_timer.end());
+    
+    /* 最悪実行時間と分布の更新 */
+    rt_hist_record(&sc->free_latency, elapsed);
+    if (elapsed > owner->max_free_time) {
+        owner->max_free_time = elapsed;
+    }
+    
+    rt_heap_unlock(owner);
+}
+
+/* 予約の蓄えから1つ取り出す（ロックフリー、空ならNULL） */
+static void *rt_stash_pop(RTReservation *res)
+{
+    unsigned long top;
+    void *block;
+    
+    do {
+        top = RT_LOAD(&res->top);
+        if ((top & RT_STASH_COUNT_MASK) == 0) {
+            return NULL;
+        }
+        block = RT_LOAD(&res->slots[(top & RT_STASH_COUNT_MASK) - 1]);
+    } while (!rt_cas_ulong(&res->top, top, top + RT_STASH_VERSION_ONE - 1));
+    return block;
+}
+
+/* 予約の蓄えに戻す（所有タスクだけが呼ぶ。取り上げられた分は戻さない） */
+static int rt_stash_push(RTReservation *res, void *block)
+{
+    unsigned long top, count;
+    
+    do {
+        top = RT_LOAD(&res->top);
+        count = top & RT_STASH_COUNT_MASK;
+        if (count + RT_LOAD(&res->revoked) >= (unsigned long)res->capacity) {
+            return 0;
+        }
+        RT_STORE(&res->slots[count], block);
+    } while (!rt_cas_ulong(&res->top, top, top + RT_STASH_VERSION_ONE + 1));
+    return 1;
+}
+
+/* 優先度の低い予約から待機中のブロックを1つ取り上げてヒープに返す（受け付けロック中に呼ぶ） */
+static int rt_revoke_one(int priority)
+{
+    RTReservation *res, *victim = NULL;
+    void *block;
+    
+    /* 一覧は優先度の高い順なので、条件を満たす最後の予約が最も低い */
+    for (res = g_rt_allocator.reservations; res; res = res->next) {
+        if (res->priority < priority && (RT_LOAD(&res->top) & RT_STASH_COUNT_MASK) > 0) {
+            victim = res;
+        }
+    }
+    if (!victim || !(block = rt_stash_pop(victim))) {
+        return 0;
+    }
+    rt_fetch_add_ulong(&victim->revoked, 1UL);
+    victim->pending_revoked++;
+    rt_free(block);
+    return 1;
+}
+
+/* 受け付けに失敗した予約のために取り上げたブロックを確保し直して持ち主の蓄えに戻す
+ * （受け付けロック中に、失敗した予約の確保分を解放した後で呼ぶ） */
+static void rt_revoke_rollback(void)
+{
+    RTReservation *res;
+    void *block;
+    
+    for (res = g_rt_allocator.reservations; res; res = res->next) {
+        for (; res->pending_revoked > 0; res->pending_revoked--) {
+            block = rt_malloc(res->size, 0, res->priority);
+            if (!block) {
+                break;
+            }
+            /* revoked を変えるのは受け付けロック中だけ */
+            RT_STORE(&res->revoked, RT_LOAD(&res->revoked) - 1);
+            if (!rt_stash_push(res, block)) {
+                RT_STORE(&res->revoked, RT_LOAD(&res->revoked) + 1);
+                rt_free(block);
+                break;
+            }
+        }
+        res->pending_revoked = 0;
+    }
+}
+
+/* 受け付けが成功したら取り上げを確定する（受け付けロック中に呼ぶ） */
+static void rt_revoke_commit(void)
+{
+    RTReservation *res;
+    
+    for (res = g_rt_allocator.reservations; res; res = res->next) {
+        res->pending_revoked = 0;
+    }
+}
+
+/* 予約の受け付け：size のブロックを count 個、起動時に確保して蓄える
+ * 空きが足りなければ低優先度の予約の待機中ブロックを取り上げ、
+ * それでも足りなければ何も確保せずにNULLを返す（デッドライン時ではなく起動時に失敗させる） */
+RTReservation *rt_reserve(size_t size, int count, int priority)
+{
+    RTReservation *res, **link;
+    void *block;
+    int i;
     
-    if (!ptr) {
-        return;
+    if (!g_rt_allocator.heap || size == 0 || count <= 0 ||
+        (unsigned long)count > RT_STASH_COUNT_MASK) {
+        return NULL;
     }
     
-    rt_disable_interrupts();
-    
-    start_time = rt_get_ticks();
+    res = (RTReservation *)calloc(1, sizeof(RTReservation));
+    if (!res) {
+        return NULL;
+    }
+    res->slots = (void *volatile *)calloc((size_t)count, sizeof(void *));
+    if (!res->slots) {
+        free(res);
+        return NULL;
+    }
+    res->size = size;
+    res->priority = priority;
+    res->capacity = count;
     
-    /* ブロックヘッダーを取得 */
-    block = (RTBlock *)((char *)ptr - sizeof(RTBlock));
+    pthread_mutex_lock(&g_rt_reservation_lock);
     
-    /* マジックナンバーチェック */
-    if (block->magic != 0xDEADBEEF) {
-        fprintf(stderr, "不正なブロック\n");
-        rt_enable_interrupts();
-        return;
+    for (i = 0; i < count; i++) {
+        while (!(block = rt_malloc(size, 0, priority))) {
+            if (!rt_revoke_one(priority)) {
+                break;
+            }
+        }
+        if (!block) {
+            break;
+        }
+        res->slots[i] = block;
     }
     
-    /* 二重解放チェック */
-    if (!block->in_use) {
-        fprintf(stderr, "二重解放\n");
-        rt_enable_interrupts();
-        return;
+    if (i < count) {
+        /* 受け付けられない：確保した分を戻し、取り上げたブロックも持ち主に返す */
+        while (i > 0) {
+            rt_free(res->slots[--i]);
+        }
+        rt_revoke_rollback();
+        pthread_mutex_unlock(&g_rt_reservation_lock);
+        free((void *)res->slots);
+        free(res);
+        RT_DEBUG("予約を受け付けられません");
+        return NULL;
     }
+    res->top = (unsigned long)count;
+    rt_revoke_commit();
     
-    /* サイズクラスを見つける */
-    class_idx = rt_find_size_class(block->size);
-    if (class_idx < 0) {
-        fprintf(stderr, "不正なブロックサイズ\n");
-        rt_enable_interrupts();
-        return;
+    /* 優先度の高い順に一覧へ入れる */
+    for (link = &g_rt_allocator.reservations; *link && (*link)->priority >= priority;
+         link = &(*link)->next) {
     }
+    res->next = *link;
+    *link = res;
     
-    sc = &g_rt_allocator.size_classes[class_idx];
+    pthread_mutex_unlock(&g_rt_reservation_lock);
+    return res;
+}
+
+/* 予約からの割り当て：蓄えから取り出すだけなのでサブヒープを占有しない */
+void *rt_reserved_alloc(RTReservation *res)
+{
+    void *block = rt_stash_pop(res);
     
-    /* フリーリストに追加 */
-    block->in_use = 0;
-    block->next = sc->free_list;
-    block->prev = NULL;
-    if (sc->free_list) {
-        sc->free_list->prev = block;
+    if (block) {
+        res->served++;
+        return block;
     }
-    sc->free_list = block;
-    sc->free_count++;
-    
-    /* 統計更新 */
-    sc->total_frees++;
-    g_rt_allocator.total_freed += block->size;
-    g_rt_allocator.current_usage -= block->size;
-    
-    end_time = rt_get_ticks();
-    elapsed = end_time - start_time;
     
-    /* 最悪実行時間の更新 */
-    if (elapsed > sc->wcet_free) {
-        sc->wcet_free = elapsed;
+    /* 予約を超えた分は通常の割り当てに回る */
+    res->overruns++;
+    return rt_malloc(res->size, 0, res->priority);
+}
+
+/* 予約への返却（所有タスクから呼ぶ。蓄えが満杯なら通常の解放） */
+void rt_reserved_free(RTReservation *res, void *ptr)
+{
+    if (ptr && !rt_stash_push(res, ptr)) {
+        rt_free(ptr);
     }
-    if (elapsed > g_rt_allocator.max_free_time) {
-        g_rt_allocator.max_free_time = elapsed;
+}
+
+/* 予約の解除：待機中のブロックをヒープに返す
+ * （予約から割り当てて使用中のブロックは rt_free で解放する） */
+void rt_release_reservation(RTReservation *res)
+{
+    RTReservation **link;
+    void *block;
+    
+    if (!res) {
+        return;
     }
     
-    /* 平均時間の更新 */
-    if (sc->total_frees > 0) {
-        sc->avg_free_time = (sc->avg_free_time * (sc->total_frees - 1) + elapsed) 
-                            / sc->total_frees;
+    pthread_mutex_lock(&g_rt_reservation_lock);
+    for (link = &g_rt_allocator.reservations; *link; link = &(*link)->next) {
+        if (*link == res) {
+            *link = res->next;
+            break;
+        }
     }
+    pthread_mutex_unlock(&g_rt_reservation_lock);
     
-    rt_enable_interrupts();
+    while ((block = rt_stash_pop(res)) != NULL) {
+        rt_free(block);
+    }
+    free((void *)res->slots);
+    free(res);
 }
 
-/* WCET（最悪実行時間）の取得 */
-unsigned long rt_get_wcet_alloc(size_t size)
+/* 全サブヒープで同じクラスの最悪実行時間（占有して読む） */
+static unsigned long rt_class_wcet(size_t size, int free_side)
 {
     int class_idx = rt_find_size_class(size);
+    unsigned long wcet = 0;
+    int i;
     
-    if (class_idx >= 0) {
-        return (unsigned long)(g_rt_allocator.size_classes[class_idx].wcet_alloc 
-                              * RT_WCET_SAFETY_FACTOR);
+    for (i = 0; i < g_rt_allocator.cpu_count; i++) {
+        RTHeap *heap = &g_rt_allocator.cpu_heaps[i];
+        RTSizeClass *sc = &heap->size_classes[class_idx];
+        
+        rt_heap_lock(heap);
+        if (free_side ? sc->free_latency.max_ns > wcet : sc->alloc_latency.max_ns > wcet) {
+            wcet = free_side ? sc->free_latency.max_ns : sc->alloc_latency.max_ns;
+        }
+        rt_heap_unlock(heap);
     }
-    
-    return ULONG_MAX;
+    return wcet;
+}
+
+/* WCET（観測した最悪実行時間、ナノ秒）の取得 */
+unsigned long rt_get_wcet_alloc(size_t size)
+{
+    return (unsigned long)(rt_class_wcet(size, 0) * RT_WCET_SAFETY_FACTOR);
 }
 
 unsigned long rt_get_wcet_free(size_t size)
 {
-    int class_idx = rt_find_size_class(size);
+    return (unsigned long)(rt_class_wcet(size, 1) * RT_WCET_SAFETY_FACTOR);
+}
+
+/* ヒストグラムを足し合わせる */
+static void rt_hist_merge(RTHistogram *dst, const RTHistogram *src)
+{
+    int i;
     
-    if (class_idx >= 0) {
-        return (unsigned long)(g_rt_allocator.size_classes[class_idx].wcet_free 
-                              * RT_WCET_SAFETY_FACTOR);
+    for (i = 0; i < RT_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->samples += src->samples;
+    dst->total_ns += src->total_ns;
+    if (src->max_ns > dst->max_ns) {
+        dst->max_ns = src->max_ns;
     }
-    
-    return ULONG_MAX;
 }
 
-/* 統計情報表示 */
+/* 統計情報表示（サブヒープごとに占有して集計する） */
 void rt_print_stats(void)
 {
-    int i;
+    static RTSizeClass classes[RT_SIZE_CLASSES];
+    size_t free_blocks, largest;
+    size_t total_allocated = 0, total_freed = 0, current_usage = 0, peak_usage = 0;
+    unsigned long deadline_misses = 0, allocation_failures = 0, coalesces = 0;
+    unsigned long max_alloc_time = 0, max_free_time = 0;
+    int i, h;
+    
+    free_blocks = rt_free_blocks(&largest);
+    
+    memset(classes, 0, sizeof(classes));
+    for (h = 0; h < g_rt_allocator.cpu_count; h++) {
+        RTHeap *heap = &g_rt_allocator.cpu_heaps[h];
+        
+        rt_heap_lock(heap);
+        total_allocated += heap->total_allocated;
+        total_freed += heap->total_freed;
+        current_usage += heap->current_usage;
+        peak_usage += heap->peak_usage;
+        deadline_misses += heap->deadline_misses;
+        allocation_failures += heap->allocation_failures;
+        coalesces += heap->tlsf.coalesces;
+        if (heap->max_alloc_time > max_alloc_time) max_alloc_time = heap->max_alloc_time;
+        if (heap->max_free_time > max_free_time) max_free_time = heap->max_free_time;
+        for (i = 0; i < RT_SIZE_CLASSES; i++) {
+            classes[i].size = heap->size_classes[i].size;
+            classes[i].total_allocs += heap->size_classes[i].total_allocs;
+            classes[i].total_frees += heap->size_classes[i].total_frees;
+            rt_hist_merge(&classes[i].alloc_latency, &heap->size_classes[i].alloc_latency);
+            rt_hist_merge(&classes[i].free_latency, &heap->size_classes[i].free_latency);
+        }
+        rt_heap_unlock(heap);
+    }
     
     printf("\n=== リアルタイムアロケーター統計 ===\n");
-    printf("ヒープサイズ: %lu バイト\n", (unsigned long)g_rt_allocator.heap_size);
+    printf("ヒープサイズ: %lu バイト (サブヒープ %d 個)\n",
+           (unsigned long)g_rt_allocator.heap_size, g_rt_allocator.cpu_count);
+    printf("ヒープの裏付け: %s%s%s\n", g_rt_allocator.heap_backing,
+           (g_rt_allocator.heap_flags & RT_HEAP_PREFAULT) ? ", 事前フォールト済み" : "",
+           (g_rt_allocator.heap_flags & RT_HEAP_MLOCK) ? ", mlock済み" : "");
     printf("現在使用量: %lu バイト (%.1f%%)\n",
-           (unsigned long)g_rt_allocator.current_usage,
-           (double)g_rt_allocator.current_usage / g_rt_allocator.heap_size * 100);
-    printf("ピーク使用量: %lu バイト\n", (unsigned long)g_rt_allocator.peak_usage);
-    printf("総割り当て: %lu バイト\n", (unsigned long)g_rt_allocator.total_allocated);
-    printf("総解放: %lu バイト\n", (unsigned long)g_rt_allocator.total_freed);
-    printf("デッドラインミス: %lu 回\n", g_rt_allocator.deadline_misses);
-    printf("割り当て失敗: %lu 回\n", g_rt_allocator.allocation_failures);
-    printf("最大割り当て時間: %lu ティック\n", g_rt_allocator.max_alloc_time);
-    printf("最大解放時間: %lu ティック\n", g_rt_allocator.max_free_time);
-    
-    printf("\nサイズクラス情報:\n");
-    printf("サイズ  総数  空き  割当数  解放数  WCET割当  WCET解放  平均割当  平均解放\n");
-    printf("-----  ----  ----  ------  ------  --------  --------  --------  --------\n");
+           (unsigned long)current_usage,
+           (double)current_usage / g_rt_allocator.heap_size * 100);
+    printf("ピーク使用量: %lu バイト (サブヒープごとのピークの合計)\n", (unsigned long)peak_usage);
+    printf("総割り当て: %lu バイト\n", (unsigned long)total_allocated);
+    printf("総解放: %lu バイト\n", (unsigned long)total_freed);
+    printf("空きブロック: %lu 個, 最大 %lu バイト (結合 %lu 回)\n",
+           (unsigned long)free_blocks, (unsigned long)largest, coalesces);
+    printf("デッドラインミス: %lu 回\n", deadline_misses);
+    printf("割り当て失敗: %lu 回\n", allocation_failures);
+    printf("最大割り当て時間: %lu ns\n", max_alloc_time);
+    printf("最大解放時間: %lu ns\n", max_free_time);
+    printf("計測タイマー: %s\n", g_rt_timer.name);
+    
+    if (g_rt_allocator.cpu_count > 1) {
+        printf("\nサブヒープ情報:\n");
+        for (h = 0; h < g_rt_allocator.cpu_count; h++) {
+            RTHeap *heap = &g_rt_allocator.cpu_heaps[h];
+            
+            rt_heap_lock(heap);
+            printf("  CPU%-3d 使用中 %8lu バイト, 借用 %6lu 回, 他CPUからの返却 %6lu 回\n",
+                   h, (unsigned long)heap->current_usage,
+                   heap->borrowed, heap->remote_returns);
+            rt_heap_unlock(heap);
+        }
+    }
+    
+    if (g_rt_allocator.reservations) {
+        RTReservation *res;
+        
+        printf("\n予約情報:\n");
+        printf("優先度   サイズ  予約数  待機中  割当数  超過  取り上げ\n");
+        pthread_mutex_lock(&g_rt_reservation_lock);
+        for (res = g_rt_allocator.reservations; res; res = res->next) {
+            printf("%6d  %7lu  %6d  %6lu  %6lu  %4lu  %8lu\n",
+                   res->priority, (unsigned long)res->size, res->capacity,
+                   RT_LOAD(&res->top) & RT_STASH_COUNT_MASK,
+                   res->served, res->overruns, RT_LOAD(&res->revoked));
+        }
+        pthread_mutex_unlock(&g_rt_reservation_lock);
+    }
+    
+    printf("\nサイズクラス情報 (時間はナノ秒):\n");
+    printf("サイズ  使用中  割当数  解放数  操作      p50      p99    p99.9     最大\n");
+    printf("-----  ------  ------  ------  ----  -------  -------  -------  -------\n");
     
     for (i = 0; i < RT_SIZE_CLASSES; i++) {
-        RTSizeClass *sc = &g_rt_allocator.size_classes[i];
-        if (sc->total_count > 0) {
-            printf("%5lu  %4lu  %4lu  %6lu  %6lu  %8lu  %8lu  %8.2f  %8.2f\n",
+        RTSizeClass *sc = &classes[i];
+        if (sc->total_allocs > 0) {
+            printf("%5lu  %6lu  %6lu  %6lu  ",
                    (unsigned long)sc->size,
-                   (unsigned long)sc->total_count,
-                   (unsigned long)sc->free_count,
+                   sc->total_allocs - sc->total_frees,
                    sc->total_allocs,
-                   sc->total_frees,
-                   sc->wcet_alloc,
-                   sc->wcet_free,
-                   sc->avg_alloc_time,
-                   sc->avg_free_time);
+                   sc->total_frees);
+            rt_hist_print("割当", &sc->alloc_latency);
+            rt_hist_print("                               解放", &sc->free_latency);
         }
     }
     
@@ -469,7 +1559,15 @@ void rt_print_stats(void)
 void rt_allocator_shutdown(void)
 {
     if (g_rt_allocator.heap) {
-        free(g_rt_allocator.heap);
+        /* 解除されずに残った予約はヒープと一緒に捨てる */
+        while (g_rt_allocator.reservations) {
+            RTReservation *res = g_rt_allocator.reservations;
+            g_rt_allocator.reservations = res->next;
+            free((void *)res->slots);
+            free(res);
+        }
+        rt_heap_unmap();
+        free(g_rt_allocator.cpu_heaps);
         memset(&g_rt_allocator, 0, sizeof(g_rt_allocator));
         RT_DEBUG("リアルタイムアロケーターをシャットダウンしました");
     }
@@ -515,84 +1613,250 @@ void test_basic_realtime(void)
     rt_print_stats();
 }
 
+/* TLSF割り当てテスト */
+#define RT_FIT_TEST_BLOCKS 8000
+
+void test_tlsf_fit(void)
+{
+    static void *ptrs[RT_FIT_TEST_BLOCKS];
+    void *large;
+    size_t free_blocks, largest;
+    int i, allocated = 0;
+    
+    printf("\n=== TLSF割り当てテスト ===\n");
+    
+    /* サイズクラスの上限を超える要求もヒープに空きがあれば通る */
+    large = rt_malloc(RT_MAX_BLOCK_SIZE * 4, 0, 0);
+    printf("%dバイトの割り当て: %s\n", RT_MAX_BLOCK_SIZE * 4, large ? "OK" : "NG");
+    
+    /* 同じサイズを大量に要求しても他のクラスの領域に取り残されない */
+    for (i = 0; i < RT_FIT_TEST_BLOCKS; i++) {
+        ptrs[i] = rt_malloc(256, 0, 0);
+        if (ptrs[i]) {
+            allocated++;
+        }
+    }
+    printf("256バイト x %d: %d 個成功 %s\n", RT_FIT_TEST_BLOCKS, allocated,
+           allocated == RT_FIT_TEST_BLOCKS ? "OK" : "NG");
+    
+    /* 1つおきに解放してから残りを解放しても、結合でサブヒープごとに1つの空きブロックに戻る */
+    for (i = 0; i < RT_FIT_TEST_BLOCKS; i += 2) {
+        rt_free(ptrs[i]);
+    }
+    free_blocks = rt_free_blocks(&largest);
+    printf("1つおきに解放後: 空きブロック %lu 個\n", (unsigned long)free_blocks);
+    for (i = 1; i < RT_FIT_TEST_BLOCKS; i += 2) {
+        rt_free(ptrs[i]);
+    }
+    rt_free(large);
+    free_blocks = rt_free_blocks(&largest);
+    printf("全解放後の結合: %s (空きブロック %lu 個, 最大 %lu バイト)\n",
+           free_blocks == (size_t)g_rt_allocator.cpu_count ? "OK" : "NG",
+           (unsigned long)free_blocks, (unsigned long)largest);
+}
+
 /* WCET計測テスト */
-void test_wcet_measurement(void)
+#define RT_WCET_BLOCKS 1000
+#define RT_WCET_ROUNDS 10
+
+/* ヒープを指定の方法で作り直してWCETを計測する
+ * 単発の最大値はプリエンプションやTHPの処理に1回当たるだけで桁違いに伸び、
+ * 事前フォールトの有無より雑音で決まってしまう。比較には計測中のページフォールト数と
+ * p99.9 x 安全係数（決定性検証テストと同じ見積もり）を使い、最大値は参考として出す */
+static void measure_wcet(unsigned int heap_flags, const char *label)
 {
+    static void *ptrs[RT_WCET_BLOCKS];
+    static RTHistogram alloc_hist, free_hist;
+    unsigned long tick_rate = g_rt_allocator.system_tick_rate;
+    struct rusage before, after;
     int i, j;
-    void *ptrs[100];
-    unsigned long wcet_alloc, wcet_free;
     
-    printf("\n=== WCET計測テスト ===\n");
+    rt_allocator_shutdown();
+    if (rt_allocator_init(tick_rate, heap_flags) < 0) {
+        printf("  %s: 初期化に失敗 NG\n", label);
+        return;
+    }
     
-    /* 複数回の割り当て・解放でWCETを計測 */
-    for (i = 0; i < 10; i++) {
-        for (j = 0; j < 100; j++) {
+    /* 複数回の割り当て・解放で時間の分布を計測 */
+    memset(&alloc_hist, 0, sizeof(alloc_hist));
+    memset(&free_hist, 0, sizeof(free_hist));
+    getrusage(RUSAGE_SELF, &before);
+    for (i = 0; i < RT_WCET_ROUNDS; i++) {
+        for (j = 0; j < RT_WCET_BLOCKS; j++) {
+            unsigned long start = g_rt_timer.begin();
             ptrs[j] = rt_malloc(128, 0, 0);
+            rt_hist_record(&alloc_hist, rt_timer_elapsed_ns(start, g_rt_timer.end()));
         }
-        for (j = 0; j < 100; j++) {
+        for (j = 0; j < RT_WCET_BLOCKS; j++) {
+            unsigned long start = g_rt_timer.begin();
             rt_free(ptrs[j]);
+            rt_hist_record(&free_hist, rt_timer_elapsed_ns(start, g_rt_timer.end()));
         }
     }
+    getrusage(RUSAGE_SELF, &after);
+    
+    printf("  %s [%s%s%s]:\n", label, g_rt_allocator.heap_backing,
+           (g_rt_allocator.heap_flags & RT_HEAP_PREFAULT) ? ", 事前フォールト" : "",
+           (g_rt_allocator.heap_flags & RT_HEAP_MLOCK) ? ", mlock" : "");
+    printf("    計測中のページフォールト %ld 回\n",
+           after.ru_minflt + after.ru_majflt - before.ru_minflt - before.ru_majflt);
+    printf("    割り当て: p50 %lu ns, p99.9 %lu ns → WCET見積もり %lu ns\n",
+           rt_hist_percentile(&alloc_hist, 0.50), rt_hist_percentile(&alloc_hist, 0.999),
+           (unsigned long)(rt_hist_percentile(&alloc_hist, 0.999) * RT_WCET_SAFETY_FACTOR));
+    printf("    解放:     p50 %lu ns, p99.9 %lu ns → WCET見積もり %lu ns\n",
+           rt_hist_percentile(&free_hist, 0.50), rt_hist_percentile(&free_hist, 0.999),
+           (unsigned long)(rt_hist_percentile(&free_hist, 0.999) * RT_WCET_SAFETY_FACTOR));
+    printf("    (参考) 単発の最大値: 割り当て %lu ns, 解放 %lu ns (割り込み等の雑音を含む)\n",
+           alloc_hist.max_ns, free_hist.max_ns);
+}
+
+void test_wcet_measurement(void)
+{
+    printf("\n=== WCET計測テスト ===\n");
+    printf("128バイトブロックのWCET (%d個 x %d回):\n", RT_WCET_BLOCKS, RT_WCET_ROUNDS);
+    
+    /* 初回アクセスのページフォールトが計測に入る場合と入らない場合を比べる
+     * （後者のヒープで以降のテストを続ける） */
+    measure_wcet(RT_HEAP_PLAIN, "事前フォールトなし");
+    measure_wcet(RT_HEAP_LOCKED, "事前フォールトあり");
+}
+
+/* CPUごとのテストスレッド */
+#define RT_STRESS_BLOCKS 1000
+#define RT_STRESS_DEADLINE 1                /* 割り当て1回に許すティック数 */
+#define RT_PERIODIC_CYCLES 10
+
+typedef struct RTWorker {
+    pthread_t thread;
+    int cpu;
+    int allocated;                          /* ストレステストで確保できた数 */
+    unsigned long failures;                 /* 割り当て失敗数 */
+    unsigned long deadline_misses;          /* デッドラインを過ぎて戻った割り当て */
+    unsigned long rejected;                 /* 起動時に受け付けられなかった予約 */
+    void *ptrs[RT_STRESS_BLOCKS];
+} RTWorker;
+
+static RTWorker g_workers[RT_MAX_CPUS];
+
+/* 周期タスクの構成 */
+static const Task g_task_table[3] = {
+    {1, 512, 100, 80, 3, NULL},     /* 高優先度 */
+    {2, 1024, 200, 150, 2, NULL},   /* 中優先度 */
+    {3, 2048, 500, 400, 1, NULL}    /* 低優先度 */
+};
+
+/* テストスレッド数（オンラインのCPUごとに1本） */
+static int rt_test_thread_count(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (cpus < 1 || !RT_HAS_ATOMIC) {
+        cpus = 1;
+    }
+    if (cpus > RT_MAX_CPUS) {
+        cpus = RT_MAX_CPUS;
+    }
+    return (int)cpus;
+}
+
+/* 呼び出したスレッドをCPUに固定する（できなければそのまま動かす） */
+static void rt_pin_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
     
-    wcet_alloc = rt_get_wcet_alloc(128);
-    wcet_free = rt_get_wcet_free(128);
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+/* CPUごとに1本ずつスレッドを走らせて待つ（作れなければ呼び出し元で実行） */
+static void rt_run_workers(int threads, void *(*body)(void *))
+{
+    int i;
     
-    printf("128バイトブロックのWCET:\n");
-    printf("  割り当て: %lu ティック (安全係数込み)\n", wcet_alloc);
-    printf("  解放: %lu ティック (安全係数込み)\n", wcet_free);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&g_workers[i].thread, NULL, body, &g_workers[i]) != 0) {
+            g_workers[i].thread = pthread_self();
+            body(&g_workers[i]);
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        if (!pthread_equal(g_workers[i].thread, pthread_self())) {
+            pthread_join(g_workers[i].thread, NULL);
+        }
+    }
 }
 
-/* 周期タスクシミュレーション */
-void test_periodic_tasks(void)
+/* デッドライン付きで割り当て、失敗とデッドラインミスを数える */
+static void *rt_worker_malloc(RTWorker *w, size_t size, unsigned long deadline, int priority)
+{
+    void *p = rt_malloc(size, deadline, priority);
+    
+    if (!p) {
+        w->failures++;
+    } else if (rt_get_ticks() > deadline) {
+        w->deadline_misses++;
+    }
+    return p;
+}
+
+/* 周期タスクシミュレーション（1スレッド分） */
+static void *periodic_worker(void *arg)
 {
+    RTWorker *w = (RTWorker *)arg;
     Task tasks[3];
-    int i, j;
+    RTReservation *reservations[3];
     unsigned long current_time;
-    int cycles = 10;
-    
-    printf("\n=== 周期タスクシミュレーション ===\n");
+    int i, j;
     
-    /* タスク定義 */
-    tasks[0] = (Task){1, 512, 100, 80, 3, NULL};    /* 高優先度 */
-    tasks[1] = (Task){2, 1024, 200, 150, 2, NULL};  /* 中優先度 */
-    tasks[2] = (Task){3, 2048, 500, 400, 1, NULL};  /* 低優先度 */
+    rt_pin_thread(w->cpu);
+    memcpy(tasks, g_task_table, sizeof(tasks));
     
-    printf("タスク構成:\n");
+    /* 起動時に各タスクの分を予約する（受け付けられなければ通常の割り当てで動く） */
     for (i = 0; i < 3; i++) {
-        printf("  タスク%d: サイズ=%lu, 周期=%lu, デッドライン=%lu, 優先度=%d\n",
-               tasks[i].id,
-               (unsigned long)tasks[i].memory_size,
-               tasks[i].period,
-               tasks[i].deadline,
-               tasks[i].priority);
+        reservations[i] = rt_reserve(tasks[i].memory_size, 1, tasks[i].priority);
+        if (!reservations[i]) {
+            w->rejected++;
+        }
     }
     
-    /* 周期実行シミュレーション */
-    for (j = 0; j < cycles; j++) {
+    for (j = 0; j < RT_PERIODIC_CYCLES; j++) {
         current_time = rt_get_ticks();
         
         for (i = 0; i < 3; i++) {
             /* 周期チェック */
             if (j % (tasks[i].period / 100) == 0) {
+                if (reservations[i]) {
+                    /* 予約の蓄えとの間で受け渡すだけ */
+                    rt_reserved_free(reservations[i], tasks[i].memory);
+                    tasks[i].memory = rt_reserved_alloc(reservations[i]);
+                    if (!tasks[i].memory) {
+                        w->failures++;
+                    } else if (rt_get_ticks() > current_time + tasks[i].deadline) {
+                        w->deadline_misses++;
+                    }
+                    continue;
+                }
+                
                 /* 前回のメモリを解放 */
                 if (tasks[i].memory) {
                     rt_free(tasks[i].memory);
                 }
                 
                 /* 新規割り当て */
-                tasks[i].memory = rt_malloc(tasks[i].memory_size,
-                                           current_time + tasks[i].deadline,
-                                           tasks[i].priority);
-                
-                if (!tasks[i].memory) {
-                    printf("  タスク%d: 割り当て失敗\n", tasks[i].id);
-                }
+                tasks[i].memory = rt_worker_malloc(w, tasks[i].memory_size,
+                                                   current_time + tasks[i].deadline,
+                                                   tasks[i].priority);
             }
         }
         
         /* 少し待機（実際のタスク実行をシミュレート） */
         {
-            volatile int dummy = 0;
+            volatile unsigned long dummy = 0;
             int k;
             for (k = 0; k < 100000; k++) {
                 dummy += k;
@@ -605,115 +1869,321 @@ void test_periodic_tasks(void)
         if (tasks[i].memory) {
             rt_free(tasks[i].memory);
         }
+        rt_release_reservation(reservations[i]);
+    }
+    return NULL;
+}
+
+/* 各スレッドの失敗とデッドラインミスを表示 */
+static void rt_report_workers(int threads)
+{
+    unsigned long rejected = 0, failures = 0, misses = 0;
+    int i;
+    
+    for (i = 0; i < threads; i++) {
+        printf("  CPU%-3d 予約拒否 %lu 件, 割り当て失敗 %lu 回, デッドラインミス %lu 回\n",
+               g_workers[i].cpu, g_workers[i].rejected,
+               g_workers[i].failures, g_workers[i].deadline_misses);
+        rejected += g_workers[i].rejected;
+        failures += g_workers[i].failures;
+        misses += g_workers[i].deadline_misses;
+    }
+    printf("合計: 予約拒否 %lu 件, 割り当て失敗 %lu 回, デッドラインミス %lu 回\n",
+           rejected, failures, misses);
+}
+
+/* ワーカーの状態を初期化 */
+static void rt_reset_workers(int threads)
+{
+    int i;
+    
+    for (i = 0; i < threads; i++) {
+        memset(&g_workers[i], 0, sizeof(g_workers[i]));
+        g_workers[i].cpu = i;
+    }
+}
+
+/* 周期タスクシミュレーション */
+void test_periodic_tasks(void)
+{
+    int threads = rt_test_thread_count();
+    int i;
+    
+    printf("\n=== 周期タスクシミュレーション ===\n");
+    
+    printf("タスク構成:\n");
+    for (i = 0; i < 3; i++) {
+        printf("  タスク%d: サイズ=%lu, 周期=%lu, デッドライン=%lu, 優先度=%d\n",
+               g_task_table[i].id,
+               (unsigned long)g_task_table[i].memory_size,
+               g_task_table[i].period,
+               g_task_table[i].deadline,
+               g_task_table[i].priority);
     }
+    printf("スレッド数: %d (CPUごとに1本)\n", threads);
+    
+    rt_reset_workers(threads);
+    rt_run_workers(threads, periodic_worker);
+    rt_report_workers(threads);
     
     printf("\nシミュレーション完了\n");
 }
 
+/* ストレステスト前半：自分のサブヒープで可能な限り割り当て、半分を入れ替える */
+static void *stress_alloc_worker(void *arg)
+{
+    RTWorker *w = (RTWorker *)arg;
+    int i;
+    
+    rt_pin_thread(w->cpu);
+    
+    /* 可能な限り割り当て */
+    for (i = 0; i < RT_STRESS_BLOCKS; i++) {
+        w->ptrs[i] = rt_worker_malloc(w, 256, rt_get_ticks() + RT_STRESS_DEADLINE, 0);
+        if (!w->ptrs[i]) {
+            break;
+        }
+        w->allocated++;
+    }
+    
+    /* 半分解放して再割り当て */
+    for (i = 0; i < w->allocated / 2; i++) {
+        rt_free(w->ptrs[i]);
+    }
+    for (i = 0; i < w->allocated / 2; i++) {
+        w->ptrs[i] = rt_worker_malloc(w, 256, rt_get_ticks() + RT_STRESS_DEADLINE, 0);
+    }
+    return NULL;
+}
+
+/* ストレステスト後半：隣のCPUが確保したブロックを解放する（返却キュー経由） */
+static void *stress_cross_free_worker(void *arg)
+{
+    RTWorker *w = (RTWorker *)arg;
+    RTWorker *peer;
+    int threads = rt_test_thread_count();
+    int i;
+    
+    rt_pin_thread(w->cpu);
+    
+    peer = &g_workers[(w->cpu + 1) % threads];
+    for (i = 0; i < peer->allocated; i++) {
+        rt_free(peer->ptrs[i]);
+    }
+    return NULL;
+}
+
 /* ストレステスト */
 void test_stress_realtime(void)
 {
-    void *ptrs[1000];
-    int i, allocated = 0;
+    int threads = rt_test_thread_count();
+    int i, allocated = 0, least = RT_STRESS_BLOCKS;
     unsigned long start, end;
     
     printf("\n=== リアルタイムストレステスト ===\n");
+    printf("スレッド数: %d (CPUごとに1本)\n", threads);
     
     start = rt_get_ticks();
     
-    /* 可能な限り割り当て */
-    for (i = 0; i < 1000; i++) {
-        ptrs[i] = rt_malloc(256, 0, 0);
-        if (ptrs[i]) {
-            allocated++;
-        } else {
-            break;
+    rt_reset_workers(threads);
+    rt_run_workers(threads, stress_alloc_worker);
+    for (i = 0; i < threads; i++) {
+        allocated += g_workers[i].allocated;
+        if (g_workers[i].allocated < least) {
+            least = g_workers[i].allocated;
         }
     }
+    rt_run_workers(threads, stress_cross_free_worker);
     
-    printf("最大割り当て数: %d\n", allocated);
+    end = rt_get_ticks();
     
-    /* 半分解放 */
-    for (i = 0; i < allocated / 2; i++) {
-        rt_free(ptrs[i]);
+    printf("最大割り当て数: %d (スレッドあたり最小 %d)\n", allocated, least);
+    rt_report_workers(threads);
+    printf("総実行時間: %lu ティック\n", end - start);
+}
+
+/* 予約APIのテスト：起動時の受け付け、優先度による取り上げ、割り当て時間の比較 */
+#define RT_FILL_MAX 65536
+#define RT_RESERVE_ITERATIONS 100000
+
+static void *g_fill_ptrs[RT_FILL_MAX];
+
+static void measure_reserved_latency(RTReservation *res)
+{
+    static RTHistogram reserved_hist, plain_hist;
+    void *p;
+    int i;
+    
+    memset(&reserved_hist, 0, sizeof(reserved_hist));
+    memset(&plain_hist, 0, sizeof(plain_hist));
+    for (i = 0; i < RT_RESERVE_ITERATIONS; i++) {
+        unsigned long start = g_rt_timer.begin();
+        p = rt_reserved_alloc(res);
+        rt_reserved_free(res, p);
+        rt_hist_record(&reserved_hist, rt_timer_elapsed_ns(start, g_rt_timer.end()));
+        
+        start = g_rt_timer.begin();
+        p = rt_malloc(res->size, 0, res->priority);
+        rt_free(p);
+        rt_hist_record(&plain_hist, rt_timer_elapsed_ns(start, g_rt_timer.end()));
     }
     
-    /* 再割り当て */
-    for (i = 0; i < allocated / 2; i++) {
-        ptrs[i] = rt_malloc(256, 0, 0);
-        if (!ptrs[i]) {
-            printf("再割り当て失敗: %d\n", i);
-            break;
-        }
+    printf("割り当て・解放時間 (%luバイト x %d, %s):\n",
+           (unsigned long)res->size, RT_RESERVE_ITERATIONS, g_rt_timer.name);
+    printf("  予約から     : p50 %lu ns, p99.9 %lu ns, 最大 %lu ns\n",
+           rt_hist_percentile(&reserved_hist, 0.50),
+           rt_hist_percentile(&reserved_hist, 0.999), reserved_hist.max_ns);
+    printf("  rt_malloc    : p50 %lu ns, p99.9 %lu ns, 最大 %lu ns\n",
+           rt_hist_percentile(&plain_hist, 0.50),
+           rt_hist_percentile(&plain_hist, 0.999), plain_hist.max_ns);
+}
+
+void test_reservations(void)
+{
+    RTReservation *high, *low, *urgent, *idle, *huge;
+    void *blocks[16];
+    static const size_t fill_sizes[] = {4096, 256, 32};
+    int filled = 0, i, j, ok;
+    
+    printf("\n=== 予約APIテスト ===\n");
+    
+    /* 起動時に受け付ける */
+    high = rt_reserve(512, 16, 3);
+    low = rt_reserve(512, 16, 1);
+    printf("予約受け付け (優先度3, 512x16): %s\n", high ? "OK" : "NG");
+    printf("予約受け付け (優先度1, 512x16): %s\n", low ? "OK" : "NG");
+    if (!high || !low) {
+        rt_release_reservation(high);
+        rt_release_reservation(low);
+        return;
     }
     
-    /* 全解放 */
-    for (i = 0; i < allocated; i++) {
-        if (ptrs[i]) {
-            rt_free(ptrs[i]);
+    /* 低優先度の通常割り当てでヒープを使い切る */
+    for (i = 0; i < (int)(sizeof(fill_sizes) / sizeof(fill_sizes[0])); i++) {
+        while (filled < RT_FILL_MAX &&
+               (g_fill_ptrs[filled] = rt_malloc(fill_sizes[i], 0, 0)) != NULL) {
+            filled++;
         }
     }
+    printf("ヒープを使い切るまで割り当て: %d 個\n", filled);
     
-    end = rt_get_ticks();
-    printf("総実行時間: %lu ティック\n", end - start);
+    /* ヒープが満杯でも予約済みの分は必ず割り当てられる */
+    ok = 1;
+    for (j = 0; j < 16; j++) {
+        blocks[j] = rt_reserved_alloc(high);
+        if (!blocks[j]) ok = 0;
+    }
+    printf("満杯のヒープで予約から16個割り当て: %s\n",
+           ok && high->overruns == 0 ? "OK" : "NG");
+    for (j = 0; j < 16; j++) {
+        rt_reserved_free(high, blocks[j]);
+    }
+    
+    /* 取り上げても足りない高優先度の予約は断り、取り上げた分を持ち主に戻す */
+    huge = rt_reserve(RT_HEAP_SIZE / 4, 1, 5);
+    printf("優先度5の予約を拒否して取り上げを戻す: %s\n",
+           huge == NULL && low->revoked == 0 && high->revoked == 0 &&
+           (low->top & RT_STASH_COUNT_MASK) == 16 &&
+           (high->top & RT_STASH_COUNT_MASK) == 16 ? "OK" : "NG");
+    rt_release_reservation(huge);
+    
+    /* 高優先度の新しい予約は低優先度の待機中ブロックを取り上げて受け付ける */
+    urgent = rt_reserve(512, 16, 5);
+    printf("優先度5の予約 (低優先度から取り上げ): %s\n",
+           urgent && low->revoked == 16 && high->revoked == 0 ? "OK" : "NG");
+    
+    /* 取り上げる相手がいなければ起動時に断る */
+    idle = rt_reserve(512, 16, 0);
+    printf("優先度0の予約を起動時に拒否: %s\n", idle == NULL ? "OK" : "NG");
+    rt_release_reservation(idle);
+    
+    for (i = 0; i < filled; i++) {
+        rt_free(g_fill_ptrs[i]);
+    }
+    
+    measure_reserved_latency(high);
+    
+    rt_release_reservation(urgent);
+    rt_release_reservation(low);
+    rt_release_reservation(high);
 }
 
 /* 決定性検証テスト */
-void test_determinism(void)
+#define RT_DETERMINISM_ITERATIONS 100000
+
+static void measure_determinism(RTTimerKind kind)
 {
+    static RTHistogram hist;
+    unsigned long overhead = ULONG_MAX;
+    unsigned long p50, p999;
     void *p;
-    unsigned long times[100];
-    unsigned long min_time = ULONG_MAX, max_time = 0;
-    double avg_time = 0;
     int i;
     
-    printf("\n=== 決定性検証テスト ===\n");
+    if (rt_timer_select(kind) < 0) {
+        printf("  TSC: 使用できません\n");
+        return;
+    }
+    
+    /* 連続して読んだときの最小差をタイマー自体のコストとみなす */
+    for (i = 0; i < 1000; i++) {
+        unsigned long start = g_rt_timer.begin();
+        unsigned long elapsed = rt_timer_elapsed_ns(start, g_rt_timer.end());
+        if (elapsed < overhead) overhead = elapsed;
+    }
     
-    /* 同じ操作を繰り返して時間のばらつきを測定 */
-    for (i = 0; i < 100; i++) {
-        unsigned long start = rt_get_ticks();
+    /* 同じ操作を繰り返して時間の分布を測定 */
+    memset(&hist, 0, sizeof(hist));
+    for (i = 0; i < RT_DETERMINISM_ITERATIONS; i++) {
+        unsigned long start = g_rt_timer.begin();
         p = rt_malloc(512, 0, 0);
         rt_free(p);
-        unsigned long elapsed = rt_get_ticks() - start;
-        
-        times[i] = elapsed;
-        if (elapsed < min_time) min_time = elapsed;
-        if (elapsed > max_time) max_time = elapsed;
-        avg_time += elapsed;
+        rt_hist_record(&hist, rt_timer_elapsed_ns(start, g_rt_timer.end()));
     }
     
-    avg_time /= 100;
-    
-    printf("実行時間統計 (512バイト割り当て・解放):\n");
-    printf("  最小: %lu ティック\n", min_time);
-    printf("  最大: %lu ティック\n", max_time);
-    printf("  平均: %.2f ティック\n", avg_time);
-    printf("  ジッター: %lu ティック\n", max_time - min_time);
-    
-    /* ジッターが小さいほど決定的 */
-    if (max_time - min_time < 10) {
-        printf("  → 高い決定性\n");
+    p50 = rt_hist_percentile(&hist, 0.50);
+    p999 = rt_hist_percentile(&hist, 0.999);
+    printf("  %s (読み出しコスト %lu ns):\n", g_rt_timer.name, overhead);
+    printf("    p50 %lu ns, p99 %lu ns, p99.9 %lu ns, 最大 %lu ns\n",
+           p50, rt_hist_percentile(&hist, 0.99), p999, hist.max_ns);
+    printf("    ジッター (p99.9 - p50): %lu ns\n", p999 - p50);
+    printf("    見積もりに使う値 (p99.9 x 安全係数): %lu ns\n",
+           (unsigned long)(p999 * RT_WCET_SAFETY_FACTOR));
+    
+    /* 裾が中央値の数倍に収まっていれば決定的とみなす */
+    if (p999 < p50 * 4) {
+        printf("    → 高い決定性\n");
     } else {
-        printf("  → 改善の余地あり\n");
+        printf("    → 改善の余地あり\n");
     }
 }
 
+void test_determinism(void)
+{
+    printf("\n=== 決定性検証テスト ===\n");
+    printf("実行時間統計 (512バイト割り当て・解放 x %d):\n", RT_DETERMINISM_ITERATIONS);
+    
+    measure_determinism(RT_TIMER_MONOTONIC);
+    measure_determinism(RT_TIMER_TSC);
+}
+
 /* メイン関数 */
 int main(void)
 {
     printf("=== リアルタイムメモリアロケーターデモ ===\n\n");
     
-    /* アロケーター初期化（1000ティック/秒） */
-    if (rt_allocator_init(1000) < 0) {
+    /* アロケーター初期化（1000ティック/秒、事前フォールト・mlock・巨大ページ） */
+    if (rt_allocator_init(1000, RT_HEAP_LOCKED) < 0) {
         fprintf(stderr, "アロケーターの初期化に失敗\n");
         return 1;
     }
     
     /* 各種テスト実行 */
     test_basic_realtime();
+    test_tlsf_fit();
     test_wcet_measurement();
     test_periodic_tasks();
     test_stress_realtime();
+    test_reservations();
     test_determinism();
     
     /* 最終統計 */
@@ -732,89 +2202,206 @@ int main(void)
 
 [RT] リアルタイムアロケーターを初期化しました
 [RT] RT_HEAP_SIZE = 4194304
+[RT] g_rt_allocator.heap_backing = mmap (THP)
 [RT] tick_rate = 1000
-[RT] i = 0
-[RT] sc->total_count = 16384
-[RT] i = 1
-[RT] sc->total_count = 8192
-...
-
+[RT] g_rt_timer.name = TSC (rdtsc/rdtscp)
+[RT] g_rt_allocator.cpu_count = 1
 === 基本リアルタイム動作テスト ===
 割り当て結果:
   64バイト: 0x1234560
-  256バイト: 0x1234660
-  1024バイト: 0x1234960
+  256バイト: 0x12345e0
+  1024バイト: 0x1234720
 
 === リアルタイムアロケーター統計 ===
-ヒープサイズ: 4194304 バイト
+ヒープサイズ: 4194304 バイト (サブヒープ 1 個)
+ヒープの裏付け: mmap (THP), 事前フォールト済み, mlock済み
 現在使用量: 0 バイト (0.0%)
-ピーク使用量: 1344 バイト
+ピーク使用量: 1344 バイト (サブヒープごとのピークの合計)
 総割り当て: 1344 バイト
 総解放: 1344 バイト
+空きブロック: 1 個, 最大 4194176 バイト (結合 3 回)
 デッドラインミス: 0 回
 割り当て失敗: 0 回
-最大割り当て時間: 2 ティック
-最大解放時間: 1 ティック
-
-サイズクラス情報:
-サイズ  総数  空き  割当数  解放数  WCET割当  WCET解放  平均割当  平均解放
------  ----  ----  ------  ------  --------  --------  --------  --------
-   32  16384 16384       0       0         0         0      0.00      0.00
-   64  8192  8192       1       1         2         1      2.00      1.00
-  128  4096  4096       0       0         0         0      0.00      0.00
-  256  2048  2048       1       1         1         1      1.00      1.00
-  512  1024  1024       0       0         0         0      0.00      0.00
- 1024   512   512       1       1         1         1      1.00      1.00
+最大割り当て時間: 770 ns
+最大解放時間: 176 ns
+計測タイマー: TSC (rdtsc/rdtscp)
+
+サイズクラス情報 (時間はナノ秒):
+サイズ  使用中  割当数  解放数  操作      p50      p99    p99.9     最大
+-----  ------  ------  ------  ----  -------  -------  -------  -------
+   64       0       1       1  割当      770      770      770      770
+                               解放      152      152      152      152
+  256       0       1       1  割当      124      124      124      124
+                               解放      144      144      144      144
+ 1024       0       1       1  割当      128      128      128      128
+                               解放      176      176      176      176
 ====================================
 
+
+=== TLSF割り当てテスト ===
+262144バイトの割り当て: OK
+256バイト x 8000: 8000 個成功 OK
+1つおきに解放後: 空きブロック 4001 個
+全解放後の結合: OK (空きブロック 1 個, 最大 4194176 バイト)
+
 === WCET計測テスト ===
-128バイトブロックのWCET:
-  割り当て: 2 ティック (安全係数込み)
-  解放: 1 ティック (安全係数込み)
+128バイトブロックのWCET (1000個 x 10回):
+[RT] リアルタイムアロケーターをシャットダウンしました
+[RT] リアルタイムアロケーターを初期化しました
+[RT] RT_HEAP_SIZE = 4194304
+[RT] g_rt_allocator.heap_backing = malloc
+[RT] tick_rate = 1000
+[RT] g_rt_timer.name = TSC (rdtsc/rdtscp)
+[RT] g_rt_allocator.cpu_count = 1
+  事前フォールトなし [malloc]:
+    計測中のページフォールト 48 回
+    割り当て: p50 191 ns, p99.9 2303 ns → WCET見積もり 2763 ns
+    解放:     p50 143 ns, p99.9 319 ns → WCET見積もり 382 ns
+    (参考) 単発の最大値: 割り当て 28738 ns, 解放 448 ns (割り込み等の雑音を含む)
+[RT] リアルタイムアロケーターをシャットダウンしました
+[RT] リアルタイムアロケーターを初期化しました
+[RT] RT_HEAP_SIZE = 4194304
+[RT] g_rt_allocator.heap_backing = mmap (THP)
+[RT] tick_rate = 1000
+[RT] g_rt_timer.name = TSC (rdtsc/rdtscp)
+[RT] g_rt_allocator.cpu_count = 1
+  事前フォールトあり [mmap (THP), 事前フォールト, mlock]:
+    計測中のページフォールト 0 回
+    割り当て: p50 191 ns, p99.9 415 ns → WCET見積もり 498 ns
+    解放:     p50 143 ns, p99.9 351 ns → WCET見積もり 421 ns
+    (参考) 単発の最大値: 割り当て 12058 ns, 解放 1447 ns (割り込み等の雑音を含む)
 
 === 周期タスクシミュレーション ===
 タスク構成:
   タスク1: サイズ=512, 周期=100, デッドライン=80, 優先度=3
   タスク2: サイズ=1024, 周期=200, デッドライン=150, 優先度=2
   タスク3: サイズ=2048, 周期=500, デッドライン=400, 優先度=1
+スレッド数: 1 (CPUごとに1本)
+  CPU0   予約拒否 0 件, 割り当て失敗 0 回, デッドラインミス 0 回
+合計: 予約拒否 0 件, 割り当て失敗 0 回, デッドラインミス 0 回
 
 シミュレーション完了
 
 === リアルタイムストレステスト ===
-最大割り当て数: 768
-総実行時間: 45 ティック
+スレッド数: 1 (CPUごとに1本)
+最大割り当て数: 1000 (スレッドあたり最小 1000)
+  CPU0   予約拒否 0 件, 割り当て失敗 0 回, デッドラインミス 0 回
+合計: 予約拒否 0 件, 割り当て失敗 0 回, デッドラインミス 0 回
+総実行時間: 1 ティック
+
+=== 予約APIテスト ===
+予約受け付け (優先度3, 512x16): OK
+予約受け付け (優先度1, 512x16): OK
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+ヒープを使い切るまで割り当て: 1014 個
+満杯のヒープで予約から16個割り当て: OK
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 予約を受け付けられません
+優先度5の予約を拒否して取り上げを戻す: OK
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+[RT] 十分な大きさの空きブロックがありません
+優先度5の予約 (低優先度から取り上げ): OK
+[RT] 十分な大きさの空きブロックがありません
+[RT] 予約を受け付けられません
+優先度0の予約を起動時に拒否: OK
+割り当て・解放時間 (512バイト x 100000, TSC (rdtsc/rdtscp)):
+  予約から     : p50 63 ns, p99.9 175 ns, 最大 43416 ns
+  rt_malloc    : p50 415 ns, p99.9 767 ns, 最大 662242 ns
 
 === 決定性検証テスト ===
-実行時間統計 (512バイト割り当て・解放):
-  最小: 2 ティック
-  最大: 3 ティック
-  平均: 2.12 ティック
-  ジッター: 1 ティック
-  → 高い決定性
+実行時間統計 (512バイト割り当て・解放 x 100000):
+  CLOCK_MONOTONIC_RAW (読み出しコスト 34 ns):
+    p50 447 ns, p99 511 ns, p99.9 1663 ns, 最大 68019 ns
+    ジッター (p99.9 - p50): 1216 ns
+    見積もりに使う値 (p99.9 x 安全係数): 1995 ns
+    → 高い決定性
+  TSC (rdtsc/rdtscp) (読み出しコスト 26 ns):
+    p50 415 ns, p99 479 ns, p99.9 767 ns, 最大 47237 ns
+    ジッター (p99.9 - p50): 352 ns
+    見積もりに使う値 (p99.9 x 安全係数): 920 ns
+    → 高い決定性
 
 === リアルタイムアロケーター統計 ===
-ヒープサイズ: 4194304 バイト
+ヒープサイズ: 4194304 バイト (サブヒープ 1 個)
+ヒープの裏付け: mmap (THP), 事前フォールト済み, mlock済み
 現在使用量: 0 バイト (0.0%)
-ピーク使用量: 196608 バイト
-総割り当て: 318976 バイト
-総解放: 318976 バイト
+ピーク使用量: 4127296 バイト (サブヒープごとのピークの合計)
+総割り当て: 159403072 バイト
+総解放: 159403072 バイト
+空きブロック: 1 個, 最大 4194176 バイト (結合 312547 回)
 デッドラインミス: 0 回
-割り当て失敗: 232 回
-最大割り当て時間: 3 ティック
-最大解放時間: 2 ティック
-
-サイズクラス情報:
-サイズ  総数  空き  割当数  解放数  WCET割当  WCET解放  平均割当  平均解放
------  ----  ----  ------  ------  --------  --------  --------  --------
-   32  16384 16384       0       0         0         0      0.00      0.00
-   64  8192  8192       1       1         2         1      2.00      1.00
-  128  4096  4096    1000    1000         2         1      1.23      0.98
-  256  2048  2048     769     769         3         2      2.45      1.76
-  512  1024  1024     123     123         3         2      2.12      1.88
- 1024   512   512      31      31         2         2      1.84      1.65
- 2048   256   256      20      20         2         1      1.75      1.45
+割り当て失敗: 20 回
+最大割り当て時間: 45852 ns
+最大解放時間: 184283 ns
+計測タイマー: TSC (rdtsc/rdtscp)
+
+サイズクラス情報 (時間はナノ秒):
+サイズ  使用中  割当数  解放数  操作      p50      p99    p99.9     最大
+-----  ------  ------  ------  ----  -------  -------  -------  -------
+   64       0       1       1  割当      332      332      332      332
+                               解放      117      117      117      117
+  128       0   10000   10000  割当       71      103      143      671
+                               解放       59       87      223   184283
+  256       0    1510    1510  割当       71      111      175      779
+                               解放       63      175      287      420
+  512       0  300049  300049  割当       79      111      175    45852
+                               解放       71       87      127    48530
+ 1024       0       1       1  割当      437      437      437      437
+                               解放      495      495      495      495
+ 2048       0       1       1  割当      115      115      115      115
+                               解放      318      318      318      318
+ 4096       0    1003    1003  割当       71      111      119      284
+                               解放       63      175      239      322
 ====================================
 
 [RT] リアルタイムアロケーターをシャットダウンしました
 === デモ完了 ===
-*/
\ No newline at end of file
+*/